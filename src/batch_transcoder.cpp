@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "batch_transcoder.h"
+#include "thread_pool.h"
+
+#include <exception>
+
+namespace orthanc_jxl {
+
+BatchTranscoder::BatchTranscoder(ThreadPool& pool, std::vector<std::string> ids, Work work)
+    : pool_(pool), ids_(std::move(ids)), work_(std::move(work)), window_(PipelineWindow(pool)),
+      started_(ids_.size(), false), unstarted_(ids_.size()) {}
+
+BatchTranscoder::~BatchTranscoder() {
+    Pause();
+}
+
+void BatchTranscoder::Start() {
+    std::vector<size_t> pending;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (running_ || unstarted_ == 0) {
+            return;
+        }
+        for (size_t i = 0; i < ids_.size(); ++i) {
+            if (!started_[i]) {
+                pending.push_back(i);
+            }
+        }
+        running_ = true;
+    }
+    if (runner_.joinable()) {
+        runner_.join();   // the previous run, already finished
+    }
+    paused_ = false;
+    runner_ = std::thread([this, pending = std::move(pending)]() mutable {
+        Run(std::move(pending));
+    });
+}
+
+void BatchTranscoder::Pause() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);   // not between a wait's check and sleep
+        paused_ = true;
+    }
+    changed_.notify_all();
+    if (runner_.joinable()) {
+        runner_.join();
+    }
+}
+
+// Pipeline thread: starts an instance on the pool whenever the running ones
+// plus ready_ leave room in the window, and waits here - never on a pool
+// worker - while they do not. A slow instance holds up only its own slot.
+void BatchTranscoder::Run(std::vector<size_t> pending) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (size_t next = 0; next < pending.size();) {
+        changed_.wait(lock, [&] { return paused_ || ready_.size() + inFlight_ < window_; });
+        if (paused_) {
+            break;   // the rest are left for the next Start()
+        }
+        const size_t index = pending[next++];
+        started_[index] = true;
+        --unstarted_;
+        ++inFlight_;
+        lock.unlock();
+        try {
+            pool_.Enqueue([this, index] { Transcode(index); });
+        } catch (const std::exception& e) {
+            Finish(Item{ids_[index], Outcome::Failed, {}, {}, e.what()});
+        }
+        lock.lock();
+    }
+    changed_.wait(lock, [&] { return inFlight_ == 0; });
+    running_ = false;
+    changed_.notify_all();
+}
+
+// Pool worker: every started instance ends up in ready_, failed if anything
+// at all went wrong.
+void BatchTranscoder::Transcode(size_t index) {
+    Item item;
+    item.id = ids_[index];
+    try {
+        item.outcome = work_(item);
+    } catch (const std::exception& e) {
+        item = Item{item.id, Outcome::Failed, {}, {}, e.what()};
+    } catch (...) {
+        item = Item{item.id, Outcome::Failed, {}, {}, "Unknown error"};
+    }
+    Finish(std::move(item));
+}
+
+void BatchTranscoder::Finish(Item item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --inFlight_;
+    ready_.push_back(std::move(item));
+    changed_.notify_all();
+}
+
+bool BatchTranscoder::Take(std::vector<Item>& out, size_t max,
+                           std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    changed_.wait_for(lock, timeout, [&] { return !ready_.empty() || !running_; });
+    while (!ready_.empty() && out.size() < max) {
+        out.push_back(std::move(ready_.front()));
+        ready_.pop_front();
+    }
+    changed_.notify_all();
+    return running_ || !ready_.empty();
+}
+
+size_t BatchTranscoder::Unstarted() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return unstarted_;
+}
+
+bool BatchTranscoder::Running() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_;
+}
+
+}  // namespace orthanc_jxl
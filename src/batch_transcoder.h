@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace orthanc_jxl {
+
+class ThreadPool;
+
+/**
+ * Transcodes a batch of stored instances (a series or a study) through one
+ * shared pipeline, for POST /jxl/series/{id}/transcode.
+ *
+ * Converting instance by instance pays a parse, a frame fan-out and a
+ * serialize each, with cores idle in between. Here the instances flow through
+ * the pool together instead:
+ *
+ * - Parse ahead: up to PipelineWindow(pool) instances are fetched, parsed and
+ *   encoded at once, one per pool worker, so single-frame instances overlap.
+ *   A new one starts as soon as any finishes, so a slow instance holds up
+ *   nobody else.
+ * - Bulk write-back: finished instances queue up, in the order they finish,
+ *   until the owner Take()s them in batches to store. Queued and running
+ *   instances together stay within the window; while it is full, the
+ *   pipeline thread waits - never a pool worker.
+ * - Pausable: Pause() stops starting instances and waits for the running
+ *   ones; Start() later carries on with the instances never started.
+ *
+ * The `Work` runs on pool workers: it fetches item.id and fills the rest of
+ * the item. An exception marks that item failed; the batch carries on. Every
+ * started instance is handed back through Take(), failed if need be.
+ */
+class BatchTranscoder {
+public:
+    enum class Outcome { Converted, Skipped, Failed };
+
+    struct Item {
+        std::string id;
+        Outcome outcome = Outcome::Skipped;
+        std::vector<uint8_t> original;    // as stored, to restore on a failed write-back
+        std::vector<uint8_t> converted;   // JPEG XL replacement when Converted
+        std::string error;                // when Failed
+    };
+
+    using Work = std::function<Outcome(Item& item)>;
+
+    BatchTranscoder(ThreadPool& pool, std::vector<std::string> ids, Work work);
+    ~BatchTranscoder();  // Pause()
+
+    BatchTranscoder(const BatchTranscoder&) = delete;
+    BatchTranscoder& operator=(const BatchTranscoder&) = delete;
+
+    // Run the pipeline over the instances not started yet; no-op while it
+    // runs or once every instance has started.
+    void Start();
+    void Pause();
+
+    // Move up to `max` finished instances into `out`, waiting up to `timeout`
+    // for the first. Returns false once nothing more can come until the next
+    // Start(): the pipeline is stopped and every finished item was taken.
+    bool Take(std::vector<Item>& out, size_t max, std::chrono::milliseconds timeout);
+
+    size_t Total() const { return ids_.size(); }
+    size_t Unstarted() const;
+    bool Running() const;
+
+private:
+    void Run(std::vector<size_t> pending);
+    void Transcode(size_t index);
+    void Finish(Item item);
+
+    ThreadPool& pool_;
+    const std::vector<std::string> ids_;
+    const Work work_;
+    const size_t window_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable changed_;
+    std::vector<bool> started_;
+    size_t unstarted_;
+    std::deque<Item> ready_;
+    size_t inFlight_ = 0;   // started, not yet in ready_
+    bool running_ = false;
+    std::atomic<bool> paused_{false};
+    std::thread runner_;
+};
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "buffer_pool.h"
+
+#include <atomic>
+
+namespace orthanc_jxl {
+
+namespace {
+
+std::atomic<BufferPool*> g_sharedBufferPool{nullptr};
+
+// Bound on remembered output sizes; the map is cleared when it fills, which
+// only costs one doubling per geometry on the next encode.
+constexpr size_t kMaxPredictions = 4096;
+
+}  // namespace
+
+size_t BufferPool::ClassCeil(size_t size) {
+    if (size <= kMinPooledBytes) {
+        return kMinPooledBytes;
+    }
+    // Classes are {4,5,6,7} * 2^k: pick k with size >> k in [4, 7] and round
+    // up to a multiple of 2^k (8 * 2^k is the next octave's first class).
+    size_t k = 0;
+    while ((size >> k) > 7) {
+        ++k;
+    }
+    return ((size + (size_t{1} << k) - 1) >> k) << k;
+}
+
+size_t BufferPool::ClassFloor(size_t size) {
+    size_t k = 0;
+    while ((size >> k) > 7) {
+        ++k;
+    }
+    return (size >> k) << k;
+}
+
+std::vector<uint8_t> BufferPool::Acquire(size_t minCapacity) {
+    const size_t cls = ClassCeil(minCapacity);
+    std::vector<uint8_t> buffer;
+    if (capacity_ > 0) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = free_.find(cls);
+        if (it != free_.end() && !it->second.empty()) {
+            buffer = std::move(it->second.back());
+            it->second.pop_back();
+            bytes_ -= cls;
+            --buffers_;
+            ++hits_;
+            return buffer;
+        }
+        ++misses_;
+    }
+    buffer.reserve(cls);
+    return buffer;
+}
+
+void BufferPool::Release(std::vector<uint8_t>&& buffer) {
+    std::vector<uint8_t> victim = std::move(buffer);
+    if (capacity_ == 0 || victim.capacity() < kMinPooledBytes) {
+        return;
+    }
+    // Filed under the largest class it can serve; the surplus is not counted.
+    const size_t cls = ClassFloor(victim.capacity());
+    victim.clear();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (bytes_ + cls > capacity_) {
+        ++drops_;
+        return;  // freed on return, after the lock is released
+    }
+    free_[cls].push_back(std::move(victim));
+    bytes_ += cls;
+    ++buffers_;
+}
+
+size_t BufferPool::PredictSize(uint64_t key, size_t fallback) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = predictions_.find(key);
+    if (it == predictions_.end()) {
+        return fallback;
+    }
+    // Same geometry, different content: leave ~12% headroom.
+    return it->second + it->second / 8 + 4096;
+}
+
+void BufferPool::RecordSize(uint64_t key, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (predictions_.size() >= kMaxPredictions && predictions_.count(key) == 0) {
+        predictions_.clear();
+    }
+    predictions_[key] = size;
+}
+
+BufferPool::Stats BufferPool::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.drops = drops_;
+    stats.buffers = buffers_;
+    stats.bytes = bytes_;
+    return stats;
+}
+
+void BufferPool::SetShared(BufferPool* pool) {
+    g_sharedBufferPool.store(pool, std::memory_order_release);
+}
+
+BufferPool* BufferPool::Shared() {
+    return g_sharedBufferPool.load(std::memory_order_acquire);
+}
+
+std::vector<uint8_t> AcquireBuffer(size_t minCapacity) {
+    if (BufferPool* pool = BufferPool::Shared()) {
+        return pool->Acquire(minCapacity);
+    }
+    std::vector<uint8_t> buffer;
+    buffer.reserve(minCapacity);
+    return buffer;
+}
+
+void RecycleBuffer(std::vector<uint8_t>&& buffer) {
+    if (BufferPool* pool = BufferPool::Shared()) {
+        pool->Release(std::move(buffer));
+    } else {
+        std::vector<uint8_t>().swap(buffer);
+    }
+}
+
+}  // namespace orthanc_jxl
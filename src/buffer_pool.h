@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace orthanc_jxl {
+
+/**
+ * Size-classed, thread-safe pool of byte buffers.
+ *
+ * Bulk ingest allocates the same few buffer sizes over and over: one
+ * interleave buffer and one encoded bitstream per frame, sized by modality.
+ * Recycling the vectors keeps their pages mapped, so each frame no longer
+ * pays for a fresh mmap, page faults and a free.
+ *
+ * Buffers are plain std::vector<uint8_t>s grouped by capacity into classes a
+ * quarter-power of two apart. Idle capacity is bounded by `capacityBytes`;
+ * a buffer released into a full pool is simply freed.
+ *
+ * The pool also remembers the last encoded size per caller-chosen key (e.g.
+ * image geometry and encode settings), so an encoder can size its first
+ * output allocation instead of growing by doubling.
+ */
+class BufferPool {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t drops = 0;   // released buffers freed because the pool was full
+        size_t buffers = 0;
+        size_t bytes = 0;
+    };
+
+    // Buffers smaller than this are not worth pooling.
+    static constexpr size_t kMinPooledBytes = 64 * 1024;
+
+    // capacityBytes == 0 disables pooling (Acquire allocates, Release frees).
+    explicit BufferPool(size_t capacityBytes) : capacity_(capacityBytes) {}
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Empty vector with capacity() >= minCapacity; resize before writing.
+    std::vector<uint8_t> Acquire(size_t minCapacity);
+
+    // Hand a buffer back for reuse. Its contents are discarded.
+    void Release(std::vector<uint8_t>&& buffer);
+
+    // Expected size of the next output for `key`, or `fallback` when none has
+    // been recorded. Includes headroom over the last recorded size.
+    size_t PredictSize(uint64_t key, size_t fallback) const;
+    void RecordSize(uint64_t key, size_t size);
+
+    size_t Capacity() const { return capacity_; }
+    Stats GetStats() const;
+
+    // Process-wide pool used by JxlCodec and the transcode paths. nullptr (the
+    // default) means plain allocation. The pool must outlive every codec call
+    // started while it is installed.
+    static void SetShared(BufferPool* pool);
+    static BufferPool* Shared();
+
+private:
+    // Smallest class capacity >= size, and largest class capacity <= size.
+    static size_t ClassCeil(size_t size);
+    static size_t ClassFloor(size_t size);
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::unordered_map<size_t, std::vector<std::vector<uint8_t>>> free_;  // by class
+    std::unordered_map<uint64_t, size_t> predictions_;
+    size_t bytes_ = 0;
+    size_t buffers_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t drops_ = 0;
+};
+
+// Shared-pool helpers that fall back to plain allocation when none is set.
+std::vector<uint8_t> AcquireBuffer(size_t minCapacity);
+void RecycleBuffer(std::vector<uint8_t>&& buffer);
+
+}  // namespace orthanc_jxl
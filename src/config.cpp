@@ -19,10 +19,102 @@
 #include "config.h"
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <cstdio>
+
 namespace orthanc_jxl {
 
 using json = nlohmann::json;
 
+namespace {
+
+// One "Profiles" entry, on top of the already parsed top-level settings.
+EncodeProfile ParseProfile(const json& item, const PluginConfig& base) {
+    EncodeProfile profile;
+    profile.name = item.value("Name", std::string());
+    profile.encodeOptions = base.encodeOptions;
+    profile.centerFirstOrdering = base.centerFirstOrdering;
+    if (item.contains("Modalities")) {
+        profile.modalities = item["Modalities"].get<std::vector<std::string>>();
+    }
+    if (item.contains("SopClasses")) {
+        profile.sopClasses = item["SopClasses"].get<std::vector<std::string>>();
+    }
+    profile.minMegapixels = std::max(0.0, item.value("MinMegapixels", 0.0));
+    profile.maxMegapixels = std::max(0.0, item.value("MaxMegapixels", 0.0));
+
+    if (item.contains("Mode")) {
+        const std::string mode = item["Mode"].get<std::string>();
+        if (mode == "Lossless") {
+            profile.encodeOptions.mode = EncodeMode::Lossless;
+        } else if (mode == "ProgressiveLossless") {
+            profile.encodeOptions.mode = EncodeMode::ProgressiveLossless;
+        } else if (mode == "ProgressiveVarDCT") {
+            profile.encodeOptions.mode = EncodeMode::ProgressiveVarDCT;
+        }
+    }
+    const int effort = item.value("Effort", 0);
+    if (effort >= 1 && effort <= 10) {
+        profile.encodeOptions.effort = effort;
+    }
+    const float distance = item.value("Distance", -1.0f);
+    if (distance >= 0.0f) {
+        profile.encodeOptions.distance = distance;
+    }
+    const int dc = item.value("ProgressiveDC", -1);
+    if (dc >= 0 && dc <= 2) {
+        profile.encodeOptions.progressiveDC = dc;
+    }
+    profile.encodeOptions.progressiveAC =
+        item.value("ProgressiveAC", profile.encodeOptions.progressiveAC);
+    profile.centerFirstOrdering = item.value("CenterFirstOrdering", profile.centerFirstOrdering);
+    return profile;
+}
+
+}  // namespace
+
+bool EncodeProfile::Matches(const std::string& modality, const std::string& sopClass,
+                            uint32_t width, uint32_t height) const {
+    if (!modalities.empty() &&
+        std::find(modalities.begin(), modalities.end(), modality) == modalities.end()) {
+        return false;
+    }
+    if (!sopClasses.empty() &&
+        std::find(sopClasses.begin(), sopClasses.end(), sopClass) == sopClasses.end()) {
+        return false;
+    }
+    const double megapixels = static_cast<double>(width) * height / 1e6;
+    return megapixels >= minMegapixels && (maxMegapixels <= 0.0 || megapixels <= maxMegapixels);
+}
+
+const EncodeProfile* PluginConfig::MatchProfile(const std::string& modality,
+                                                const std::string& sopClass,
+                                                uint32_t width, uint32_t height) const {
+    for (const EncodeProfile& profile : profiles) {
+        if (profile.Matches(modality, sopClass, width, height)) {
+            return &profile;
+        }
+    }
+    return nullptr;
+}
+
+PluginConfig PluginConfig::ForTarget(const EncodeProfile* profile, bool lossyAccepted,
+                                     bool losslessAccepted) const {
+    PluginConfig target = *this;
+    target.profiles.clear();
+    if (profile) {
+        target.encodeOptions = profile->encodeOptions;
+        target.centerFirstOrdering = profile->centerFirstOrdering;
+    }
+    if (target.EncodesLossy() && !lossyAccepted) {
+        target.encodeOptions.mode = encodeOptions.mode == EncodeMode::ProgressiveVarDCT
+            ? EncodeMode::ProgressiveLossless : encodeOptions.mode;
+        target.encodeOptions.distance = 0.0f;
+    }
+    target.losslessTransferSyntax = losslessAccepted ? TS_JPEG_XL_LOSSLESS : TS_JPEG_XL;
+    return target;
+}
+
 EncodeOptions PluginConfig::GetEncodeOptions(uint32_t imageWidth, uint32_t imageHeight) const {
     EncodeOptions opts = encodeOptions;
 
@@ -35,10 +127,72 @@ EncodeOptions PluginConfig::GetEncodeOptions(uint32_t imageWidth, uint32_t image
     return opts;
 }
 
+bool PluginConfig::UseStreamingEncode(uint32_t imageWidth, uint32_t imageHeight) const {
+    return streamingEncodePixels > 0 &&
+           static_cast<uint64_t>(imageWidth) * imageHeight >= streamingEncodePixels;
+}
+
+std::string PluginConfig::OutputFingerprint() const {
+    char text[256];
+    snprintf(text, sizeof(text),
+             "mode=%d effort=%d distance=%.4f center=%d dc=%d ac=%d bits=%d stream=%llu "
+             "budget=%g/%g/%d",
+             static_cast<int>(encodeOptions.mode), encodeOptions.effort,
+             static_cast<double>(encodeOptions.distance), centerFirstOrdering ? 1 : 0,
+             encodeOptions.progressiveDC, encodeOptions.progressiveAC ? 1 : 0,
+             bitsStoredEncoding ? 1 : 0, static_cast<unsigned long long>(streamingEncodePixels),
+             effortLatencyMs, effortThroughputMBps, AdaptiveEffort() ? minimumEffort : 0);
+    std::string fingerprint = text;
+    for (const EncodeProfile& profile : profiles) {
+        std::string criteria;
+        for (const std::string& modality : profile.modalities) {
+            criteria += modality + ',';
+        }
+        criteria += '/';
+        for (const std::string& sopClass : profile.sopClasses) {
+            criteria += sopClass + ',';
+        }
+        snprintf(text, sizeof(text), ":%g-%g:%d/%d/%.4f/%d/%d/%d",
+                 profile.minMegapixels, profile.maxMegapixels,
+                 static_cast<int>(profile.encodeOptions.mode), profile.encodeOptions.effort,
+                 static_cast<double>(profile.encodeOptions.distance),
+                 profile.encodeOptions.progressiveDC, profile.encodeOptions.progressiveAC ? 1 : 0,
+                 profile.centerFirstOrdering ? 1 : 0);
+        fingerprint += " profile=" + criteria + text;
+    }
+    return fingerprint;
+}
+
+bool DailyWindow::Parse(const std::string& text, DailyWindow& window) {
+    int h1 = 0, m1 = 0, h2 = 0, m2 = 0;
+    char tail = 0;
+    if (std::sscanf(text.c_str(), "%d:%d-%d:%d%c", &h1, &m1, &h2, &m2, &tail) != 4 ||
+        h1 < 0 || h1 > 24 || h2 < 0 || h2 > 24 || m1 < 0 || m1 > 59 || m2 < 0 || m2 > 59) {
+        return false;
+    }
+    window.startMinute = std::min(h1 * 60 + m1, 24 * 60);
+    window.endMinute = std::min(h2 * 60 + m2, 24 * 60);
+    return true;
+}
+
+bool PluginConfig::InRecompressWindow(int minuteOfDay) const {
+    if (recompressWindows.empty()) {
+        return true;
+    }
+    for (const DailyWindow& window : recompressWindows) {
+        if (window.Contains(minuteOfDay)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 PluginConfig PluginConfig::Default() {
     PluginConfig config;
     config.encodeOptions = EncodeOptions::ProgressiveLossless(7);
     config.centerFirstOrdering = true;
+    config.backgroundDirectory = "OrthancStorage/jxl-ingest";
+    config.transcodedCacheDirectory = "OrthancStorage/jxl-cache";
     return config;
 }
 
@@ -51,6 +205,24 @@ PluginConfig PluginConfig::Parse(const char* jsonConfig) {
 
     try {
         json root = json::parse(jsonConfig);
+        if (root.contains("HttpDescribeErrors") && root["HttpDescribeErrors"].is_boolean()) {
+            config.httpDescribeErrors = root["HttpDescribeErrors"].get<bool>();
+        }
+        // Orthanc's own settings apply even without our section: replacements
+        // are staged under its storage and keep its declared instance extras.
+        const std::string storage = root.value("StorageDirectory", std::string("OrthancStorage"));
+        config.backgroundDirectory = storage + "/jxl-ingest";
+        config.transcodedCacheDirectory = storage + "/jxl-cache";
+        if (root.contains("UserMetadata") && root["UserMetadata"].is_object()) {
+            for (const auto& item : root["UserMetadata"].items()) {
+                config.userMetadata.push_back(item.key());
+            }
+        }
+        if (root.contains("UserContentType") && root["UserContentType"].is_object()) {
+            for (const auto& item : root["UserContentType"].items()) {
+                config.userAttachments.push_back(item.key());
+            }
+        }
 
         // Look for our plugin section
         if (!root.contains("OrthancJxl")) {
@@ -79,6 +251,26 @@ PluginConfig PluginConfig::Parse(const char* jsonConfig) {
             }
         }
 
+        // Parse per-instance effort targets (0 = off) and their effort floor
+        if (section.contains("EncodeLatencyBudget")) {
+            double ms = section["EncodeLatencyBudget"].get<double>();
+            if (ms >= 0.0) {
+                config.effortLatencyMs = ms;
+            }
+        }
+        if (section.contains("EncodeThroughputTarget")) {
+            double rate = section["EncodeThroughputTarget"].get<double>();
+            if (rate >= 0.0) {
+                config.effortThroughputMBps = rate;
+            }
+        }
+        if (section.contains("MinimumEffort")) {
+            int effort = section["MinimumEffort"].get<int>();
+            if (effort >= 1 && effort <= 10) {
+                config.minimumEffort = effort;
+            }
+        }
+
         // Parse distance (0.0 = lossless)
         if (section.contains("Distance")) {
             float distance = section["Distance"].get<float>();
@@ -93,10 +285,132 @@ PluginConfig PluginConfig::Parse(const char* jsonConfig) {
         }
 
         // Parse single-frame encode thread count (0 = auto, >=1 = fixed)
+        // ("Adaptive" = size each call from current load)
         if (section.contains("EncodeThreads")) {
-            int threads = section["EncodeThreads"].get<int>();
-            if (threads >= 0) {
-                config.encodeThreads = threads;
+            const json& value = section["EncodeThreads"];
+            if (value.is_string()) {
+                config.adaptiveThreads = (value.get<std::string>() == "Adaptive");
+            } else {
+                int threads = value.get<int>();
+                if (threads >= 0) {
+                    config.encodeThreads = threads;
+                }
+            }
+        }
+
+        // Parse fragment index cache size (MB, 0 = disabled)
+        if (section.contains("FragmentIndexCacheSize")) {
+            int mb = section["FragmentIndexCacheSize"].get<int>();
+            if (mb >= 0) {
+                config.fragmentCacheBytes = static_cast<size_t>(mb) * 1024 * 1024;
+            }
+        }
+
+        // Parse decoded frame cache size (MB, 0 = disabled)
+        if (section.contains("DecodedFrameCacheSize")) {
+            int mb = section["DecodedFrameCacheSize"].get<int>();
+            if (mb >= 0) {
+                config.decodedFrameCacheBytes = static_cast<size_t>(mb) * 1024 * 1024;
+            }
+        }
+
+        // Parse transcoded output cache (MB per tier, 0 = disabled)
+        if (section.contains("TranscodedCacheSize")) {
+            int mb = section["TranscodedCacheSize"].get<int>();
+            if (mb >= 0) {
+                config.transcodedCacheBytes = static_cast<size_t>(mb) * 1024 * 1024;
+            }
+        }
+        if (section.contains("TranscodedCacheDiskSize")) {
+            int mb = section["TranscodedCacheDiskSize"].get<int>();
+            if (mb >= 0) {
+                config.transcodedCacheDiskBytes = static_cast<size_t>(mb) * 1024 * 1024;
+            }
+        }
+        if (section.contains("TranscodedCacheDirectory") &&
+            !section["TranscodedCacheDirectory"].get<std::string>().empty()) {
+            config.transcodedCacheDirectory = section["TranscodedCacheDirectory"].get<std::string>();
+        }
+
+        // Parse viewer prefetch window (frames, 0 = disabled)
+        if (section.contains("PrefetchFrames")) {
+            int frames = section["PrefetchFrames"].get<int>();
+            if (frames >= 0) {
+                config.prefetchFrames = static_cast<uint32_t>(frames);
+            }
+        }
+
+        // Parse buffer pool ceiling (MB, 0 = disabled)
+        if (section.contains("BufferPoolSize")) {
+            int mb = section["BufferPoolSize"].get<int>();
+            if (mb >= 0) {
+                config.bufferPoolBytes = static_cast<size_t>(mb) * 1024 * 1024;
+            }
+        }
+
+        // Parse reduced-depth sample coding
+        if (section.contains("BitsStoredEncoding")) {
+            config.bitsStoredEncoding = section["BitsStoredEncoding"].get<bool>();
+        }
+
+        // Parse streaming encode threshold (megapixels per frame, 0 = never)
+        if (section.contains("StreamingEncodeThreshold")) {
+            double mp = section["StreamingEncodeThreshold"].get<double>();
+            if (mp >= 0.0) {
+                config.streamingEncodePixels = static_cast<uint64_t>(mp * 1000000.0);
+            }
+        }
+
+        // Parse background compress-on-ingest queue. Its journal and staged
+        // files default to a directory next to Orthanc's storage area.
+        if (section.contains("BackgroundCompression")) {
+            config.backgroundCompression = section["BackgroundCompression"].get<bool>();
+        }
+        if (section.contains("BackgroundCompressionQueueSize")) {
+            int entries = section["BackgroundCompressionQueueSize"].get<int>();
+            if (entries > 0) {
+                config.backgroundQueueSize = static_cast<size_t>(entries);
+            }
+        }
+        if (section.contains("BackgroundCompressionRate")) {
+            double rate = section["BackgroundCompressionRate"].get<double>();
+            if (rate >= 0.0) {
+                config.backgroundRate = rate;
+            }
+        }
+        if (section.contains("BackgroundCompressionDirectory") &&
+            !section["BackgroundCompressionDirectory"].get<std::string>().empty()) {
+            config.backgroundDirectory =
+                section["BackgroundCompressionDirectory"].get<std::string>();
+        }
+
+        // Parse deferred recompression target, schedule and CPU share
+        if (section.contains("RecompressEffort")) {
+            int effort = section["RecompressEffort"].get<int>();
+            if (effort >= 1 && effort <= 10) {
+                config.recompressEffort = effort;
+            }
+        }
+        if (section.contains("RecompressWindows")) {
+            for (const json& item : section["RecompressWindows"]) {
+                DailyWindow window;
+                if (DailyWindow::Parse(item.get<std::string>(), window)) {
+                    config.recompressWindows.push_back(window);
+                }
+            }
+        }
+        if (section.contains("RecompressCpuShare")) {
+            double share = section["RecompressCpuShare"].get<double>();
+            if (share > 0.0 && share <= 1.0) {
+                config.recompressCpuShare = share;
+            }
+        }
+
+        // Parse trace span buffer (spans kept, 0 = tracing off)
+        if (section.contains("TraceEvents")) {
+            int events = section["TraceEvents"].get<int>();
+            if (events >= 0) {
+                config.traceEvents = static_cast<size_t>(events);
             }
         }
 
@@ -112,6 +426,13 @@ PluginConfig PluginConfig::Parse(const char* jsonConfig) {
             config.encodeOptions.progressiveAC = section["ProgressiveAC"].get<bool>();
         }
 
+        // Parse encode profiles last: they default to the settings above
+        if (section.contains("Profiles")) {
+            for (const json& item : section["Profiles"]) {
+                config.profiles.push_back(ParseProfile(item, config));
+            }
+        }
+
     } catch (const json::exception&) {
         // Parse error - return default config
         return Default();
@@ -19,10 +19,46 @@
 #pragma once
 
 #include "jxl_codec.h"
+#include "transfer_syntax.h"
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace orthanc_jxl {
 
+// Daily time range in local time, start inclusive and end exclusive, in
+// minutes since midnight; a start after the end wraps past midnight.
+struct DailyWindow {
+    int startMinute = 0;
+    int endMinute = 24 * 60;
+
+    bool Contains(int minuteOfDay) const {
+        return startMinute <= endMinute
+            ? minuteOfDay >= startMinute && minuteOfDay < endMinute
+            : minuteOfDay >= startMinute || minuteOfDay < endMinute;
+    }
+
+    // "HH:MM-HH:MM" (e.g. "22:00-06:00"); false if malformed.
+    static bool Parse(const std::string& text, DailyWindow& window);
+};
+
+// Encode settings for the instances one "Profiles" entry matches. Criteria
+// left empty (or 0) match anything; settings left out keep the top-level ones.
+struct EncodeProfile {
+    std::string name;
+    std::vector<std::string> modalities;   // e.g. {"CR", "DX", "MG"}
+    std::vector<std::string> sopClasses;   // SOP Class UIDs
+    double minMegapixels = 0.0;            // per frame
+    double maxMegapixels = 0.0;            // per frame; 0 = no limit
+
+    EncodeOptions encodeOptions;
+    bool centerFirstOrdering = true;
+
+    bool Matches(const std::string& modality, const std::string& sopClass,
+                 uint32_t width, uint32_t height) const;
+};
+
 /**
  * Plugin configuration parsed from Orthanc config file.
  *
@@ -31,11 +67,36 @@ namespace orthanc_jxl {
  *   "OrthancJxl": {
  *     "Mode": "ProgressiveLossless",  // "Lossless", "ProgressiveLossless", "ProgressiveVarDCT"
  *     "Effort": 7,                     // 1-10
+ *     "EncodeLatencyBudget": 0,        // ms per frame; effort picked to fit, 0=off
+ *     "EncodeThroughputTarget": 0,     // MB/s of ingest; effort picked to fit, 0=off
+ *     "MinimumEffort": 1,              // Lowest effort either target may pick
  *     "Distance": 0.0,                 // 0.0 = lossless, >0 for lossy
  *     "CenterFirstOrdering": true,     // Enable center-first group ordering
  *     "ProgressiveDC": 0,              // VarDCT only: 0-2
  *     "ProgressiveAC": false,          // VarDCT only
- *     "EncodeThreads": 0               // Single-frame encode threads: 0=auto, 1=single
+ *     "EncodeThreads": 0,              // 0=auto, 1=single, N=cap, "Adaptive"=by load
+ *     "FragmentIndexCacheSize": 16,    // MB of per-instance frame offsets; 0=off
+ *     "DecodedFrameCacheSize": 256,    // MB of decoded frames for re-viewing; 0=off
+ *     "TranscodedCacheSize": 64,       // MB of TO-JXL results kept in memory; 0=off
+ *     "TranscodedCacheDiskSize": 0,    // MB of them kept on disk; 0=off
+ *     "TranscodedCacheDirectory": "",  // default StorageDirectory/jxl-cache
+ *     "PrefetchFrames": 0,             // Frames decoded ahead of a viewer; 0=off
+ *     "BufferPoolSize": 128,           // MB of idle frame buffers kept for reuse; 0=off
+ *     "StreamingEncodeThreshold": 64,  // Megapixels per frame to stream-encode
+ *                                      // (not progressive); 0=off
+ *     "BitsStoredEncoding": false,     // Code BitsStored, not BitsAllocated (see below)
+ *     "TraceEvents": 0,                // Trace spans kept for /jxl/trace; 0=off
+ *     "BackgroundCompression": false,  // Compress after storing, not during C-STORE
+ *     "BackgroundCompressionQueueSize": 100000,  // Pending instances; beyond = left as is
+ *     "BackgroundCompressionRate": 0,  // Instances started per second; 0=unlimited
+ *     "BackgroundCompressionDirectory": "",      // Journal; default StorageDirectory/jxl-ingest
+ *     "RecompressEffort": 9,           // Target effort of POST /jxl/recompress
+ *     "RecompressWindows": ["22:00-06:00"],      // Local hours it may run; []=any time
+ *     "RecompressCpuShare": 0.25,      // Busy fraction of its worker, (0, 1]
+ *     "Profiles": [                    // First match wins; see EncodeProfile
+ *       {"Name": "wan-cr", "Modalities": ["CR", "DX"], "MinMegapixels": 4,
+ *        "Mode": "ProgressiveVarDCT", "Distance": 1.0, "Effort": 5}
+ *     ]
  *   }
  * }
  */
@@ -43,20 +104,144 @@ struct PluginConfig {
     EncodeOptions encodeOptions;
     bool centerFirstOrdering = true;  // Use image center for group ordering
 
-    // libjxl worker threads per single-frame encode:
-    //   0 = auto (one per core) - best when instances are ingested sequentially
-    //   1 = single-threaded     - best when many instances transcode in parallel
-    //                             (concurrent DICOMweb pull / STOW), avoids
-    //                             oversubscribing cores
-    //   N = that many threads
+    // Per-instance effort (see EffortPolicy): the highest effort between
+    // minimumEffort and encodeOptions.effort whose predicted encode keeps
+    // each frame within effortLatencyMs and the plugin at effortThroughputMBps
+    // of native pixel data, given the work in flight. 0 disables a target.
+    double effortLatencyMs = 0.0;
+    double effortThroughputMBps = 0.0;
+    int minimumEffort = 1;
+
+    // True if either target is set.
+    bool AdaptiveEffort() const { return effortLatencyMs > 0.0 || effortThroughputMBps > 0.0; }
+
+    // Per-instance encode settings, matched on Modality, SOP Class and frame
+    // size in order. Lossy settings of a profile (or of the top level) are
+    // used only for requesters that accept JPEG XL (.112), so an instance
+    // requested as JPEG XL Lossless (.110) is always encoded losslessly.
+    std::vector<EncodeProfile> profiles;
+
+    // Transfer syntax of lossless TO-JXL output: .110, or .112 for a
+    // requester that accepts only that (see ForTarget).
+    std::string losslessTransferSyntax = TS_JPEG_XL_LOSSLESS;
+
+    // True if these settings encode lossy (VarDCT at a distance above 0).
+    bool EncodesLossy() const {
+        return encodeOptions.mode == EncodeMode::ProgressiveVarDCT && encodeOptions.distance > 0.0f;
+    }
+
+    // First profile matching the instance; nullptr keeps the top-level
+    // settings.
+    const EncodeProfile* MatchProfile(const std::string& modality, const std::string& sopClass,
+                                      uint32_t width, uint32_t height) const;
+
+    // These settings with `profile`'s applied (nullptr = none), for a
+    // requester that accepts lossy JPEG XL (.112) or not and JPEG XL
+    // Lossless (.110) or not. Lossy settings fall back to the lossless mode
+    // when .112 is not accepted; lossless output is labelled .112 when .110
+    // is not.
+    PluginConfig ForTarget(const EncodeProfile* profile, bool lossyAccepted,
+                           bool losslessAccepted) const;
+
+    // libjxl threads per single-frame encode. libjxl's jobs run on the shared
+    // plugin pool, so concurrent ingest no longer multiplies OS threads; this
+    // only caps how much of the pool one encode may occupy:
+    //   0 = auto (whole pool plus the calling thread)
+    //   1 = single-threaded
+    //   N = at most N threads
     // Multi-frame instances are unaffected (always one single-threaded frame per
     // pool worker).
     int encodeThreads = 0;
 
+    // "EncodeThreads": "Adaptive" - ignore encodeThreads and size every encode
+    // and decode (single- and multi-frame) from the work in flight, keeping
+    // total codec threads near the core count (see LoadTracker).
+    bool adaptiveThreads = false;
+
+    // Memory cap for the decode path's per-instance fragment index cache
+    // (frame -> byte range in Orthanc's buffer). 0 disables the cache.
+    size_t fragmentCacheBytes = 16u * 1024 * 1024;
+
+    // Memory budget for decoded frames kept to answer repeated views of the
+    // same frame (stack scrolling) without decoding again. 0 disables it.
+    size_t decodedFrameCacheBytes = 256u * 1024 * 1024;
+
+    // TO-JXL results kept to answer repeated retrievals of the same instance
+    // without encoding again, in memory and, when transcodedCacheDiskBytes is
+    // set, in transcodedCacheDirectory across restarts (see TranscodedCache).
+    // 0 disables a tier.
+    size_t transcodedCacheBytes = 64u * 1024 * 1024;
+    size_t transcodedCacheDiskBytes = 0;
+    std::string transcodedCacheDirectory;
+
+    // Frames to decode ahead, in the scroll direction, when a viewer opens a
+    // frame of a multi-frame instance (into the decoded frame cache, on the
+    // shared pool, throttled under load). 0 disables prefetching.
+    uint32_t prefetchFrames = 0;
+
+    // Ceiling on idle interleave / bitstream buffers kept by the shared
+    // BufferPool for reuse across frames and instances. 0 disables pooling.
+    size_t bufferPoolBytes = 128u * 1024 * 1024;
+
+    // Frames of at least this many pixels are encoded through libjxl's chunked
+    // input / output processor API, which bounds memory per worker
+    // independently of the frame size. 0 disables streaming.
+    uint64_t streamingEncodePixels = 64u * 1000 * 1000;
+
+    // Signal BitsStored (e.g. 12 of 16) as the codestream depth, signed
+    // samples as two's complement at that depth, so libjxl does not model
+    // unused high bits. Decoded exactly by this plugin, which sign-extends from
+    // HighBit; other JPEG XL decoders return the stored values without sign
+    // extension. Needs libjxl >= 0.8.
+    bool bitsStoredEncoding = false;
+
+    // Most recent transcode stage spans kept in memory for GET /jxl/trace
+    // (Chrome trace JSON). 0 leaves tracing off; per-stage times are still
+    // logged with every transcode.
+    size_t traceEvents = 0;
+
+    // Compress on ingest in the background: stored instances are queued in a
+    // persistent journal and replaced by their JPEG XL form by a few workers
+    // on the shared pool, so C-STORE / STOW latency does not include the
+    // encode (see IngestQueue). Use instead of Orthanc's IngestTranscoding.
+    bool backgroundCompression = false;
+    size_t backgroundQueueSize = 100000;    // pending instances
+    double backgroundRate = 0.0;            // instances started per second, 0 = unlimited
+    std::string backgroundDirectory;        // journal and staged replacements
+    // Orthanc's HttpDescribeErrors: plugins can only send a response body
+    // with a status other than 200 while it is on, so byte-range replies
+    // (206) depend on it.
+    bool httpDescribeErrors = true;
+    // User metadata and attachment types declared in Orthanc's own
+    // configuration (UserMetadata, UserContentType). Replacing a stored
+    // instance carries them over, with its labels.
+    std::vector<std::string> userMetadata;
+    std::vector<std::string> userAttachments;
+
+    // Deferred recompression (POST /jxl/recompress): stored JPEG XL Lossless
+    // instances are re-encoded at recompressEffort, verified bit-exact, and
+    // replaced when smaller. Runs only inside recompressWindows (any time when
+    // empty), busy at most recompressCpuShare of the time.
+    int recompressEffort = 9;
+    std::vector<DailyWindow> recompressWindows;
+    double recompressCpuShare = 0.25;
+
+    // True if recompression may start at this local minute of the day.
+    bool InRecompressWindow(int minuteOfDay) const;
+
+    // The settings that shape TO-JXL output (mode, effort and its targets,
+    // distance, center-first ordering, progressive passes, depth, streaming
+    // and profiles), as a one-line string: cached results made under other
+    // settings do not match.
+    std::string OutputFingerprint() const;
+
     // Resolve encodeThreads into the codec's worker-thread convention
     // (0 -> -1 = libjxl default).
     int SingleFrameThreads() const { return encodeThreads == 0 ? -1 : encodeThreads; }
 
+    // True if a frame of this size should use the streaming encoder.
+    bool UseStreamingEncode(uint32_t imageWidth, uint32_t imageHeight) const;
+
     // Get encode options with center coordinates applied
     EncodeOptions GetEncodeOptions(uint32_t imageWidth, uint32_t imageHeight) const;
 
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace orthanc_jxl {
+
+// Non-cryptographic hash of a whole buffer, eight bytes per step, for cache
+// keys and validators that must change whenever any byte does (unlike
+// FragmentIndexCache::MakeKey(), which samples only the tail).
+inline uint64_t HashBytes(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, p + i, sizeof(word));
+        h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+
+namespace orthanc_jxl {
+
+// Nanoseconds of CPU used by the calling thread.
+inline int64_t ThreadCpuNanos() {
+    timespec ts{};
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+        return 0;
+    }
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// Nanoseconds of CPU other threads have spent on work the calling thread
+// handed them and waited for (libjxl groups run on pool workers), since the
+// thread started. Added to by the codec runner.
+inline int64_t& DelegatedCpuNanos() {
+    thread_local int64_t nanos = 0;
+    return nanos;
+}
+
+// ThreadCpuNanos() plus DelegatedCpuNanos(): what the calling thread's work
+// has cost, wherever it ran.
+inline int64_t WorkCpuNanos() {
+    return ThreadCpuNanos() + DelegatedCpuNanos();
+}
+
+}  // namespace orthanc_jxl
@@ -17,6 +17,7 @@
  */
 
 #include "dicom_handler.h"
+#include "dicom_scan.h"
 #include "transfer_syntax.h"
 
 #include <dcmtk/dcmdata/dctk.h>
@@ -29,6 +30,7 @@
 #include <dcmtk/dcmdata/dcwcache.h>
 
 #include <cstring>
+#include <limits>
 
 namespace orthanc_jxl {
 
@@ -41,6 +43,7 @@ E_TransferSyntax MapTransferSyntax(const std::string& uid, E_EncodingType& encTy
     if (uid == TS_JPEG_XL_LOSSLESS)              return EXS_JPEGXLLossless;
     if (uid == TS_JPEG_XL_JPEG_RECOMPRESSION)    return EXS_JPEGXLJPEGRecompression;
     if (uid == TS_JPEG_XL)                       return EXS_JPEGXL;
+    if (uid == TS_JPEG_BASELINE)                 return EXS_JPEGProcess1;
     if (uid == TS_LITTLE_ENDIAN_EXPLICIT)        return EXS_LittleEndianExplicit;
     if (uid == TS_BIG_ENDIAN_EXPLICIT)           return EXS_BigEndianExplicit;
     if (uid == TS_LITTLE_ENDIAN_IMPLICIT) {
@@ -50,8 +53,32 @@ E_TransferSyntax MapTransferSyntax(const std::string& uid, E_EncodingType& encTy
     throw DicomHandlerError("Unsupported transfer syntax: " + uid);
 }
 
+// Trim trailing whitespace/padding that DICOM CS values may carry.
+std::string TrimPadding(std::string value) {
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\0')) {
+        value.pop_back();
+    }
+    return value;
+}
+
+// Remove the Extended Offset Table, which describes pixel data being replaced.
+void RemoveExtendedOffsetTable(DcmDataset* dataset) {
+    dataset->findAndDeleteElement(DCM_ExtendedOffsetTable);
+    dataset->findAndDeleteElement(DCM_ExtendedOffsetTableLengths);
+}
+
 }  // namespace
 
+// Pixel sequence under construction, with each frame's item offset (from the
+// first item after the Basic Offset Table) and length.
+struct DicomHandler::PendingFrames {
+    E_TransferSyntax xfer = EXS_Unknown;
+    std::unique_ptr<DcmPixelSequence> sequence;
+    std::vector<uint64_t> offsets;
+    std::vector<uint64_t> lengths;
+    uint64_t itemOffset = 0;
+};
+
 // ============================================================================
 // Constructor / Destructor
 // ============================================================================
@@ -91,12 +118,20 @@ DicomHandler::~DicomHandler() = default;
 
 DicomHandler::DicomHandler(DicomHandler&& other) noexcept
     : fileFormat_(std::move(other.fileFormat_))
+    , pendingPixelData_(std::move(other.pendingPixelData_))
+    , pendingFrames_(std::move(other.pendingFrames_))
+    , frameFragments_(std::move(other.frameFragments_))
+    , joinedFrames_(std::move(other.joinedFrames_))
     , parseWarning_(other.parseWarning_) {
 }
 
 DicomHandler& DicomHandler::operator=(DicomHandler&& other) noexcept {
     if (this != &other) {
         fileFormat_ = std::move(other.fileFormat_);
+        pendingPixelData_ = std::move(other.pendingPixelData_);
+        pendingFrames_ = std::move(other.pendingFrames_);
+        frameFragments_ = std::move(other.frameFragments_);
+        joinedFrames_ = std::move(other.joinedFrames_);
         parseWarning_ = other.parseWarning_;
     }
     return *this;
@@ -138,15 +173,32 @@ DicomImageInfo DicomHandler::GetImageInfo() const {
         info.numberOfFrames = static_cast<uint32_t>(frames);
     }
 
+    // Multi-valued DS attributes: the first value is the default one.
+    Float64 value = 0.0;
+    if (dataset->findAndGetFloat64(DCM_RescaleSlope, value).good() && value != 0.0) {
+        info.rescaleSlope = value;
+    }
+    if (dataset->findAndGetFloat64(DCM_RescaleIntercept, value).good()) {
+        info.rescaleIntercept = value;
+    }
+    if (dataset->findAndGetFloat64(DCM_WindowCenter, value).good()) {
+        info.windowCenter = value;
+    }
+    if (dataset->findAndGetFloat64(DCM_WindowWidth, value).good() && value > 0.0) {
+        info.windowWidth = value;
+    }
+
     OFString photometric;
     if (dataset->findAndGetOFString(DCM_PhotometricInterpretation, photometric).good()) {
-        info.photometricInterpretation = std::string(photometric.c_str());
-        // Trim trailing whitespace/padding that DICOM CS values may carry.
-        while (!info.photometricInterpretation.empty() &&
-               (info.photometricInterpretation.back() == ' ' ||
-                info.photometricInterpretation.back() == '\0')) {
-            info.photometricInterpretation.pop_back();
-        }
+        info.photometricInterpretation = TrimPadding(photometric.c_str());
+    }
+    OFString modality;
+    if (dataset->findAndGetOFString(DCM_Modality, modality).good()) {
+        info.modality = TrimPadding(modality.c_str());
+    }
+    OFString sopClass;
+    if (dataset->findAndGetOFString(DCM_SOPClassUID, sopClass).good()) {
+        info.sopClassUid = TrimPadding(sopClass.c_str());
     }
 
     return info;
@@ -172,6 +224,16 @@ std::string DicomHandler::GetTransferSyntax() const {
 // ============================================================================
 
 std::vector<uint8_t> DicomHandler::GetPixelData() const {
+    ByteView view = GetPixelDataView();
+    return std::vector<uint8_t>(view.data, view.data + view.size);
+}
+
+std::vector<uint8_t> DicomHandler::GetEncapsulatedData(uint32_t frameIndex) const {
+    ByteView view = GetEncapsulatedView(frameIndex);
+    return std::vector<uint8_t>(view.data, view.data + view.size);
+}
+
+ByteView DicomHandler::GetPixelDataView() const {
     DcmDataset* dataset = fileFormat_->getDataset();
 
     DcmElement* pixelElement = nullptr;
@@ -186,11 +248,10 @@ std::vector<uint8_t> DicomHandler::GetPixelData() const {
         throw DicomHandlerError("Failed to get pixel data array");
     }
 
-    size_t dataSize = pixelElement->getLength();
-    return std::vector<uint8_t>(rawData, rawData + dataSize);
+    return ByteView{rawData, static_cast<size_t>(pixelElement->getLength())};
 }
 
-std::vector<uint8_t> DicomHandler::GetEncapsulatedData(uint32_t frameIndex) const {
+DcmPixelSequence* DicomHandler::GetPixelSequence() const {
     DcmDataset* dataset = fileFormat_->getDataset();
 
     DcmElement* pixelElement = nullptr;
@@ -211,52 +272,118 @@ std::vector<uint8_t> DicomHandler::GetEncapsulatedData(uint32_t frameIndex) cons
     if (status.bad() || !pixelSequence) {
         throw DicomHandlerError("Failed to get encapsulated pixel data");
     }
+    return pixelSequence;
+}
+
+const std::vector<uint32_t>& DicomHandler::GetFrameFragments() const {
+    if (!frameFragments_.empty()) {
+        return frameFragments_;
+    }
 
-    // Get the frame data (skip offset table at index 0)
-    DcmPixelItem* pixelItem = nullptr;
-    status = pixelSequence->getItem(pixelItem, frameIndex + 1);  // +1 to skip offset table
-    if (status.bad() || !pixelItem) {
-        throw DicomHandlerError("Failed to get pixel item for frame");
+    DcmPixelSequence* pixelSequence = GetPixelSequence();
+    const unsigned long card = pixelSequence->card();
+    if (card < 2) {
+        return frameFragments_;  // no fragments, no frames
     }
 
-    Uint8* fragmentData = nullptr;
-    status = pixelItem->getUint8Array(fragmentData);
-    if (status.bad() || !fragmentData) {
-        throw DicomHandlerError("Failed to get fragment data");
+    // Fragments follow the Basic Offset Table (item 0).
+    std::vector<uint64_t> lengths(card - 1);
+    std::vector<bool> starts(card - 1);
+    std::vector<uint64_t> offsets;
+    for (unsigned long i = 0; i < card; ++i) {
+        DcmPixelItem* pixelItem = nullptr;
+        Uint8* itemData = nullptr;
+        if (pixelSequence->getItem(pixelItem, i).bad() || !pixelItem) {
+            throw DicomHandlerError("Failed to get pixel item");
+        }
+        const Uint32 length = pixelItem->getLength();
+        if (length > 0 && (pixelItem->getUint8Array(itemData).bad() || !itemData)) {
+            throw DicomHandlerError("Failed to get fragment data");
+        }
+        if (i == 0) {
+            for (Uint32 k = 0; k + 4 <= length; k += 4) {
+                offsets.push_back(static_cast<uint32_t>(itemData[k]) |
+                                  (static_cast<uint32_t>(itemData[k + 1]) << 8) |
+                                  (static_cast<uint32_t>(itemData[k + 2]) << 16) |
+                                  (static_cast<uint32_t>(itemData[k + 3]) << 24));
+            }
+        } else {
+            // Items are stored padded to even length.
+            lengths[i - 1] = (static_cast<uint64_t>(length) + 1) & ~uint64_t{1};
+            starts[i - 1] = StartsCompressedBitstream(itemData, length);
+        }
     }
 
-    Uint32 fragmentLength = pixelItem->getLength();
-    if (fragmentLength == 0) {
-        throw DicomHandlerError("Empty fragment data");
+    // An Extended Offset Table supersedes the (then empty) Basic one.
+    const Uint64* extended = nullptr;
+    unsigned long extendedCount = 0;
+    if (fileFormat_->getDataset()
+            ->findAndGetUint64Array(DCM_ExtendedOffsetTable, extended, &extendedCount)
+            .good() && extended) {
+        offsets.assign(extended, extended + extendedCount);
     }
 
-    return std::vector<uint8_t>(fragmentData, fragmentData + fragmentLength);
+    frameFragments_ = GroupFragmentsIntoFrames(lengths, offsets, starts,
+                                               GetImageInfo().numberOfFrames);
+    if (frameFragments_.empty()) {
+        throw DicomHandlerError("Encapsulated fragments do not match NumberOfFrames");
+    }
+    return frameFragments_;
 }
 
-uint32_t DicomHandler::GetEncapsulatedFrameCount() const {
-    DcmDataset* dataset = fileFormat_->getDataset();
+void DicomHandler::ResetEncapsulatedState() {
+    frameFragments_.clear();
+    joinedFrames_.clear();
+}
 
-    DcmElement* pixelElement = nullptr;
-    if (dataset->findAndGetElement(DCM_PixelData, pixelElement).bad() || !pixelElement) {
-        throw DicomHandlerError("No pixel data found in DICOM file");
+ByteView DicomHandler::GetEncapsulatedView(uint32_t frameIndex) const {
+    const std::vector<uint32_t>& first = GetFrameFragments();
+    if (static_cast<size_t>(frameIndex) + 1 >= first.size()) {
+        throw DicomHandlerError("Failed to get pixel item for frame");
     }
 
-    DcmPixelData* pixelData = OFstatic_cast(DcmPixelData*, pixelElement);
+    auto joined = joinedFrames_.find(frameIndex);
+    if (joined != joinedFrames_.end()) {
+        return ByteView{joined->second.data(), joined->second.size()};
+    }
 
-    E_TransferSyntax xferSyntax = EXS_Unknown;
-    const DcmRepresentationParameter* repParam = nullptr;
-    pixelData->getOriginalRepresentationKey(xferSyntax, repParam);
+    DcmPixelSequence* pixelSequence = GetPixelSequence();
+    std::vector<uint8_t> frame;
+    ByteView view;
+    for (uint32_t k = first[frameIndex]; k < first[frameIndex + 1]; ++k) {
+        // Get the fragment data (skip offset table at index 0)
+        DcmPixelItem* pixelItem = nullptr;
+        OFCondition status = pixelSequence->getItem(pixelItem, k + 1);
+        if (status.bad() || !pixelItem) {
+            throw DicomHandlerError("Failed to get pixel item for frame");
+        }
 
-    DcmPixelSequence* pixelSequence = nullptr;
-    if (pixelData->getEncapsulatedRepresentation(xferSyntax, repParam, pixelSequence).bad()
-        || !pixelSequence) {
-        throw DicomHandlerError("Failed to get encapsulated pixel data");
+        Uint8* fragmentData = nullptr;
+        status = pixelItem->getUint8Array(fragmentData);
+        if (status.bad() || !fragmentData) {
+            throw DicomHandlerError("Failed to get fragment data");
+        }
+
+        view = ByteView{fragmentData, static_cast<size_t>(pixelItem->getLength())};
+        if (first[frameIndex + 1] - first[frameIndex] > 1) {
+            frame.insert(frame.end(), view.data, view.data + view.size);
+        }
+    }
+
+    if (!frame.empty()) {
+        std::vector<uint8_t>& stored = joinedFrames_[frameIndex];
+        stored = std::move(frame);
+        view = ByteView{stored.data(), stored.size()};
+    }
+    if (view.empty()) {
+        throw DicomHandlerError("Empty fragment data");
     }
+    return view;
+}
 
-    // We always write exactly one fragment per frame, so the frame count is the
-    // number of items minus the Basic Offset Table (item 0).
-    unsigned long card = pixelSequence->card();
-    return card > 0 ? static_cast<uint32_t>(card - 1) : 0;
+uint32_t DicomHandler::GetEncapsulatedFrameCount() const {
+    const std::vector<uint32_t>& first = GetFrameFragments();
+    return first.empty() ? 0 : static_cast<uint32_t>(first.size() - 1);
 }
 
 // ============================================================================
@@ -268,40 +395,89 @@ void DicomHandler::SetEncapsulatedFrames(const std::vector<std::vector<uint8_t>>
     if (frames.empty()) {
         throw DicomHandlerError("No frames to store");
     }
+    BeginEncapsulatedFrames(transferSyntaxUid);
+    for (const auto& frame : frames) {
+        AppendEncapsulatedFrame(frame.data(), frame.size());
+    }
+    CommitEncapsulatedFrames();
+}
 
+void DicomHandler::BeginEncapsulatedFrames(const std::string& transferSyntaxUid) {
     E_EncodingType encType = EET_ExplicitLength;
     E_TransferSyntax xfer = MapTransferSyntax(transferSyntaxUid, encType);
-    if (!IsJxlTransferSyntax(transferSyntaxUid)) {
-        throw DicomHandlerError("SetEncapsulatedFrames requires a JXL transfer syntax");
+    if (!IsEncapsulatedTransferSyntax(transferSyntaxUid)) {
+        throw DicomHandlerError("SetEncapsulatedFrames requires an encapsulated transfer syntax");
     }
 
-    DcmDataset* dataset = fileFormat_->getDataset();
-
-    // Remove existing pixel data
-    delete dataset->remove(DCM_PixelData);
+    auto pending = std::make_unique<PendingFrames>();
+    pending->xfer = xfer;
+    pending->sequence = std::make_unique<DcmPixelSequence>(DCM_PixelSequenceTag);
+    // DICOM PS3.5 Annex A.4 requires a Basic Offset Table as the first item;
+    // it is filled in on commit, once every frame's offset is known.
+    pending->sequence->insert(new DcmPixelItem(DCM_PixelItemTag));
+    pendingFrames_ = std::move(pending);
+}
 
-    auto pixelData = std::make_unique<DcmPixelData>(DCM_PixelData);
-    auto pixelSequence = std::make_unique<DcmPixelSequence>(DCM_PixelSequenceTag);
+void DicomHandler::AppendEncapsulatedFrame(const uint8_t* data, size_t size) {
+    if (!pendingFrames_) {
+        throw DicomHandlerError("No encapsulated pixel data begun");
+    }
+    if (!data || size == 0) {
+        throw DicomHandlerError("Empty encoded frame");
+    }
+    if (size > std::numeric_limits<uint32_t>::max() - 1) {
+        throw DicomHandlerError("Encoded frame too large for one fragment");
+    }
+    auto fragment = std::make_unique<DcmPixelItem>(DCM_PixelItemTag);
+    OFCondition status = fragment->putUint8Array(data, static_cast<unsigned long>(size));
+    if (status.bad()) {
+        throw DicomHandlerError("Failed to store encoded data in fragment");
+    }
+    PendingFrames& pending = *pendingFrames_;
+    pending.sequence->insert(fragment.release());  // Sequence takes ownership
 
-    // DICOM PS3.5 Annex A.4 requires a Basic Offset Table as the first item.
-    // An empty BOT is valid; with one fragment per frame, frame i maps to item i+1.
-    pixelSequence->insert(new DcmPixelItem(DCM_PixelItemTag));
+    // An 8-byte item header plus the value, padded to even length.
+    pending.offsets.push_back(pending.itemOffset);
+    pending.lengths.push_back(size);
+    pending.itemOffset += 8 + ((static_cast<uint64_t>(size) + 1) & ~uint64_t{1});
+}
 
-    for (const auto& frame : frames) {
-        if (frame.empty()) {
-            throw DicomHandlerError("Empty encoded frame");
+void DicomHandler::CommitEncapsulatedFrames() {
+    if (!pendingFrames_ || pendingFrames_->offsets.empty()) {
+        throw DicomHandlerError("No frames to store");
+    }
+    std::unique_ptr<PendingFrames> pending = std::move(pendingFrames_);
+    const std::vector<uint64_t>& offsets = pending->offsets;
+
+    // The Basic Offset Table's 32-bit offsets let readers seek to frame i
+    // without walking the fragments; past 4 GiB it stays empty and the
+    // Extended Offset Table (7FE0,0001) carries 64-bit offsets instead.
+    const bool basicTableFits = offsets.back() <= std::numeric_limits<uint32_t>::max();
+    if (basicTableFits) {
+        DcmPixelItem* offsetTable = nullptr;
+        std::vector<Uint8> table(offsets.size() * 4);
+        for (size_t f = 0; f < offsets.size(); ++f) {
+            for (int b = 0; b < 4; ++b) {
+                table[f * 4 + b] = static_cast<Uint8>(offsets[f] >> (8 * b));
+            }
         }
-        auto fragment = std::make_unique<DcmPixelItem>(DCM_PixelItemTag);
-        OFCondition status = fragment->putUint8Array(
-            frame.data(), static_cast<unsigned long>(frame.size()));
-        if (status.bad()) {
-            throw DicomHandlerError("Failed to store encoded data in fragment");
+        if (pending->sequence->getItem(offsetTable, 0).bad() || !offsetTable ||
+            offsetTable->putUint8Array(table.data(),
+                                       static_cast<unsigned long>(table.size())).bad()) {
+            throw DicomHandlerError("Failed to store Basic Offset Table");
         }
-        pixelSequence->insert(fragment.release());  // Sequence takes ownership
     }
 
+    DcmDataset* dataset = fileFormat_->getDataset();
+
+    // Remove existing pixel data
+    delete dataset->remove(DCM_PixelData);
+    RemoveExtendedOffsetTable(dataset);
+    ResetEncapsulatedState();
+
     // Transfer ownership of the sequence to the pixel data element.
-    pixelData->putOriginalRepresentation(xfer, nullptr, pixelSequence.release());
+    auto pixelData = std::make_unique<DcmPixelData>(DCM_PixelData);
+    pixelData->putOriginalRepresentation(pending->xfer, nullptr, pending->sequence.release());
 
     DcmPixelData* rawPixelData = pixelData.release();
     OFCondition status = dataset->insert(rawPixelData, OFTrue /* replaceOld */);
@@ -309,6 +485,21 @@ void DicomHandler::SetEncapsulatedFrames(const std::vector<std::vector<uint8_t>>
         delete rawPixelData;
         throw DicomHandlerError("Failed to insert pixel data into dataset");
     }
+
+    const unsigned long count = static_cast<unsigned long>(offsets.size());
+    if (!basicTableFits) {
+        if (dataset->putAndInsertUint64Array(DCM_ExtendedOffsetTable, offsets.data(), count).bad() ||
+            dataset->putAndInsertUint64Array(DCM_ExtendedOffsetTableLengths,
+                                             pending->lengths.data(), count).bad()) {
+            throw DicomHandlerError("Failed to store Extended Offset Table");
+        }
+    }
+
+    // One fragment per frame.
+    frameFragments_.resize(count + 1);
+    for (size_t f = 0; f <= count; ++f) {
+        frameFragments_[f] = static_cast<uint32_t>(f);
+    }
 }
 
 void DicomHandler::SetUint16(uint16_t group, uint16_t element, uint16_t value) {
@@ -319,6 +510,14 @@ void DicomHandler::SetUint16(uint16_t group, uint16_t element, uint16_t value) {
     }
 }
 
+void DicomHandler::SetString(uint16_t group, uint16_t element, const std::string& value) {
+    DcmDataset* dataset = fileFormat_->getDataset();
+    OFCondition status = dataset->putAndInsertString(DcmTagKey(group, element), value.c_str());
+    if (status.bad()) {
+        throw DicomHandlerError("Failed to set DICOM tag");
+    }
+}
+
 void DicomHandler::SetNativePixelData(const std::vector<uint8_t>& pixelData) {
     SetNativePixelData(pixelData.data(), pixelData.size());
 }
@@ -332,6 +531,8 @@ void DicomHandler::SetNativePixelData(const uint8_t* data, size_t size) {
 
     // Remove existing pixel data
     delete dataset->remove(DCM_PixelData);
+    RemoveExtendedOffsetTable(dataset);
+    ResetEncapsulatedState();
 
     // Create new native (uncompressed) pixel data element
     DcmElement* pixelElement = new DcmOtherByteOtherWord(DCM_PixelData);
@@ -349,6 +550,41 @@ void DicomHandler::SetNativePixelData(const uint8_t* data, size_t size) {
     }
 }
 
+uint8_t* DicomHandler::PrepareNativePixelData(size_t size) {
+    if (size == 0 || size >= 0xFFFFFFFFu) {
+        throw DicomHandlerError("Invalid native pixel data size");
+    }
+
+    auto pixelElement = std::make_unique<DcmOtherByteOtherWord>(DCM_PixelData);
+    Uint8* storage = nullptr;
+    OFCondition status = pixelElement->createUint8Array(static_cast<Uint32>(size), storage);
+    if (status.bad() || !storage) {
+        throw DicomHandlerError("Failed to allocate pixel data");
+    }
+    pendingPixelData_ = std::move(pixelElement);
+    return storage;
+}
+
+void DicomHandler::CommitNativePixelData() {
+    if (!pendingPixelData_) {
+        throw DicomHandlerError("No prepared pixel data to commit");
+    }
+
+    DcmDataset* dataset = fileFormat_->getDataset();
+
+    // Remove existing pixel data
+    delete dataset->remove(DCM_PixelData);
+    RemoveExtendedOffsetTable(dataset);
+    ResetEncapsulatedState();
+
+    DcmElement* pixelElement = pendingPixelData_.release();
+    OFCondition status = dataset->insert(pixelElement);
+    if (status.bad()) {
+        delete pixelElement;
+        throw DicomHandlerError("Failed to insert pixel data into dataset");
+    }
+}
+
 void DicomHandler::SetTransferSyntax(const std::string& transferSyntaxUid) {
     DcmMetaInfo* metaInfo = fileFormat_->getMetaInfo();
     if (metaInfo) {
@@ -365,6 +601,13 @@ void DicomHandler::SetTransferSyntax(const std::string& transferSyntaxUid) {
 // ============================================================================
 
 std::vector<uint8_t> DicomHandler::WriteToBuffer(const std::string& transferSyntaxUid) const {
+    std::vector<uint8_t> buffer;
+    VectorSink sink(buffer);
+    WriteTo(transferSyntaxUid, sink);
+    return buffer;
+}
+
+size_t DicomHandler::WriteTo(const std::string& transferSyntaxUid, OutputSink& sink) const {
     // Determine transfer syntax
     E_EncodingType encType = EET_ExplicitLength;
     E_TransferSyntax xfer = MapTransferSyntax(transferSyntaxUid, encType);
@@ -372,7 +615,7 @@ std::vector<uint8_t> DicomHandler::WriteToBuffer(const std::string& transferSynt
     DcmDataset* dataset = fileFormat_->getDataset();
 
     // For compressed syntaxes, choose the correct pixel data representation
-    if (IsJxlTransferSyntax(transferSyntaxUid)) {
+    if (IsEncapsulatedTransferSyntax(transferSyntaxUid)) {
         DcmElement* pixelElement = nullptr;
         OFCondition status = dataset->findAndGetElement(DCM_PixelData, pixelElement);
         if (status.good() && pixelElement) {
@@ -383,11 +626,11 @@ std::vector<uint8_t> DicomHandler::WriteToBuffer(const std::string& transferSynt
         }
     }
 
-    // Calculate buffer size
+    // Upper bound on the serialized size (dataset plus preamble and meta header)
     size_t bufferSize = dataset->calcElementLength(xfer, encType) + 4096;
 
-    std::vector<uint8_t> buffer(bufferSize);
-    DcmOutputBufferStream outputStream(buffer.data(), bufferSize);
+    uint8_t* buffer = sink.Reserve(bufferSize);
+    DcmOutputBufferStream outputStream(buffer, bufferSize);
 
     fileFormat_->transferInit();
     OFCondition status = fileFormat_->write(outputStream, xfer, encType, nullptr);
@@ -397,11 +640,10 @@ std::vector<uint8_t> DicomHandler::WriteToBuffer(const std::string& transferSynt
         throw DicomHandlerError(std::string("Failed to write DICOM: ") + status.text());
     }
 
-    // Resize to actual written size
-    offile_off_t writtenSize = outputStream.tell();
-    buffer.resize(static_cast<size_t>(writtenSize));
-
-    return buffer;
+    // Report the actual written size
+    const size_t writtenSize = static_cast<size_t>(outputStream.tell());
+    sink.Commit(writtenSize);
+    return writtenSize;
 }
 
 } // namespace orthanc_jxl
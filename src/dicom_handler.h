@@ -19,13 +19,18 @@
 #pragma once
 
 #include <cstdint>
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
 #include <stdexcept>
 
+#include "output_sink.h"
+
 // Forward declarations for DCMTK
+class DcmElement;
 class DcmFileFormat;
+class DcmPixelSequence;
 
 namespace orthanc_jxl {
 
@@ -34,6 +39,14 @@ public:
     explicit DicomHandlerError(const std::string& msg) : std::runtime_error(msg) {}
 };
 
+// Non-owning view of bytes held elsewhere (DCMTK's dataset or Orthanc's buffer).
+struct ByteView {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    bool empty() const { return size == 0; }
+};
+
 struct DicomImageInfo {
     uint32_t width = 0;
     uint32_t height = 0;
@@ -45,6 +58,14 @@ struct DicomImageInfo {
     uint16_t planarConfiguration = 0;   // 0 = interleaved (R1G1B1...), 1 = planar (R..G..B..)
     bool isSigned = false;
     std::string photometricInterpretation;  // e.g. MONOCHROME2, RGB, YBR_FULL
+    std::string modality;                   // e.g. CT, MR; empty if absent
+    std::string sopClassUid;                // empty if absent
+
+    // Display attributes (first value of each), for rendering previews.
+    double rescaleSlope = 1.0;
+    double rescaleIntercept = 0.0;
+    double windowCenter = 0.0;
+    double windowWidth = 0.0;           // 0 = no window in the instance
 
     // Bytes of a single uncompressed frame.
     size_t FrameSizeBytes() const {
@@ -75,20 +96,63 @@ public:
     std::vector<uint8_t> GetEncapsulatedData(uint32_t frameIndex = 0) const;  // For compressed
     uint32_t GetEncapsulatedFrameCount() const;          // Number of encapsulated frames
 
+    // Zero-copy variants of the above. The views point into the parsed dataset
+    // and stay valid until the pixel data is replaced or the handler destroyed.
+    // Frames are located through the Extended or Basic Offset Table when
+    // present; a frame split over several fragments is joined once into a
+    // buffer the handler keeps for as long as the view would be valid.
+    ByteView GetPixelDataView() const;
+    ByteView GetEncapsulatedView(uint32_t frameIndex = 0) const;
+
     // Modification
-    // Store one encapsulated fragment per frame under the given JXL transfer syntax.
+    // Store one encapsulated fragment per frame under the given JXL (or JPEG
+    // Baseline) transfer syntax, with a Basic Offset Table (or, past 4 GiB of
+    // fragments, an Extended Offset Table) so readers can seek to any frame.
     void SetEncapsulatedFrames(const std::vector<std::vector<uint8_t>>& frames,
                                const std::string& transferSyntaxUid);
+
+    // The same, one frame at a time, so a pipelined transcode need not hold
+    // every encoded frame: BeginEncapsulatedFrames starts a detached pixel
+    // sequence, AppendEncapsulatedFrame copies the next frame into it, and
+    // CommitEncapsulatedFrames swaps it in with its offset tables. The current
+    // pixel data (and any views into it) stays valid until the commit.
+    void BeginEncapsulatedFrames(const std::string& transferSyntaxUid);
+    void AppendEncapsulatedFrame(const uint8_t* data, size_t size);
+    void CommitEncapsulatedFrames();
     void SetNativePixelData(const std::vector<uint8_t>& pixelData);
     void SetNativePixelData(const uint8_t* data, size_t size);
+
+    // Two-phase native pixel replacement without an intermediate copy:
+    // PrepareNativePixelData allocates a detached Pixel Data element of `size`
+    // bytes and returns its storage for the caller to fill in place. The current
+    // pixel data (and any views into it) stays valid until CommitNativePixelData
+    // swaps the prepared element in.
+    uint8_t* PrepareNativePixelData(size_t size);
+    void CommitNativePixelData();
     void SetTransferSyntax(const std::string& transferSyntaxUid);
     void SetUint16(uint16_t group, uint16_t element, uint16_t value);  // e.g. PlanarConfiguration
+    void SetString(uint16_t group, uint16_t element, const std::string& value);  // e.g. PhotometricInterpretation
 
     // Serialization
     std::vector<uint8_t> WriteToBuffer(const std::string& transferSyntaxUid) const;
+    // Serialize straight into the sink's memory; returns the bytes written.
+    size_t WriteTo(const std::string& transferSyntaxUid, OutputSink& sink) const;
 
 private:
+    DcmPixelSequence* GetPixelSequence() const;
+
+    // First fragment of each frame plus an end marker, resolved on first use.
+    const std::vector<uint32_t>& GetFrameFragments() const;
+
+    // Drop state derived from the current pixel data and offset tables.
+    void ResetEncapsulatedState();
+
     std::unique_ptr<DcmFileFormat> fileFormat_;
+    std::unique_ptr<DcmElement> pendingPixelData_;
+    struct PendingFrames;
+    std::unique_ptr<PendingFrames> pendingFrames_;
+    mutable std::vector<uint32_t> frameFragments_;
+    mutable std::map<uint32_t, std::vector<uint8_t>> joinedFrames_;
     bool parseWarning_ = false;
 };
 
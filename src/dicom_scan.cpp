@@ -0,0 +1,469 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "dicom_scan.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace orthanc_jxl {
+
+namespace {
+
+constexpr size_t kPreambleSize = 128;
+constexpr size_t kPrefixSize = kPreambleSize + 4;  // preamble + "DICM"
+
+inline uint16_t ReadU16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t ReadU32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Explicit VR encodings that carry a 2-byte reserved field and a 4-byte length
+// (PS3.5 Table 7.1-1); every other VR has a 2-byte length.
+bool HasLongLength(const uint8_t* vr) {
+    static const char* const kLongVrs[] = {
+        "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV",
+    };
+    for (const char* v : kLongVrs) {
+        if (vr[0] == v[0] && vr[1] == v[1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+constexpr uint32_t kUndefinedLength = 0xFFFFFFFFu;
+constexpr uint16_t kItemGroup = 0xFFFE;
+constexpr uint16_t kItem = 0xE000;
+constexpr uint16_t kItemDelimitation = 0xE00D;
+constexpr uint16_t kSequenceDelimitation = 0xE0DD;
+
+// Nested sequences deeper than this are treated as malformed rather than
+// risking unbounded recursion on hostile input.
+constexpr int kMaxSequenceDepth = 32;
+
+// One Explicit VR Little Endian element header (or item/delimiter, which carry
+// no VR).
+struct ElementHeader {
+    uint16_t group = 0;
+    uint16_t element = 0;
+    char vr[2] = {0, 0};
+    uint32_t length = 0;
+    size_t headerLen = 0;
+};
+
+bool ReadHeader(const uint8_t* buf, size_t size, size_t pos, ElementHeader& h) {
+    if (pos + 8 > size) {
+        return false;
+    }
+    const uint8_t* p = buf + pos;
+    h.group = ReadU16(p);
+    h.element = ReadU16(p + 2);
+    if (h.group == kItemGroup) {
+        h.vr[0] = h.vr[1] = 0;
+        h.length = ReadU32(p + 4);
+        h.headerLen = 8;
+        return true;
+    }
+    h.vr[0] = static_cast<char>(p[4]);
+    h.vr[1] = static_cast<char>(p[5]);
+    if (HasLongLength(p + 4)) {
+        if (pos + 12 > size) {
+            return false;
+        }
+        h.length = ReadU32(p + 8);
+        h.headerLen = 12;
+    } else {
+        h.length = ReadU16(p + 6);
+        h.headerLen = 8;
+    }
+    return true;
+}
+
+bool IsSequence(const ElementHeader& h) {
+    return h.vr[0] == 'S' && h.vr[1] == 'Q';
+}
+
+// Skip the body of an undefined-length sequence; pos starts just past the SQ
+// header and ends just past its Sequence Delimitation Item.
+bool SkipUndefinedSequence(const uint8_t* buf, size_t size, size_t& pos, int depth) {
+    if (depth > kMaxSequenceDepth) {
+        return false;
+    }
+    for (;;) {
+        ElementHeader item;
+        if (!ReadHeader(buf, size, pos, item) || item.group != kItemGroup) {
+            return false;
+        }
+        pos += item.headerLen;
+        if (item.element == kSequenceDelimitation) {
+            return true;
+        }
+        if (item.element != kItem) {
+            return false;
+        }
+        if (item.length != kUndefinedLength) {
+            if (item.length > size - pos) {
+                return false;
+            }
+            pos += item.length;
+            continue;
+        }
+        // Undefined-length item: elements until the Item Delimitation Item.
+        for (;;) {
+            ElementHeader e;
+            if (!ReadHeader(buf, size, pos, e)) {
+                return false;
+            }
+            pos += e.headerLen;
+            if (e.group == kItemGroup && e.element == kItemDelimitation) {
+                break;
+            }
+            if (e.length == kUndefinedLength) {
+                // Only SQ may be undefined length here; UN would switch to
+                // implicit VR (CP-246), which this walker does not decode.
+                if (!IsSequence(e) || !SkipUndefinedSequence(buf, size, pos, depth + 1)) {
+                    return false;
+                }
+                continue;
+            }
+            if (e.length > size - pos) {
+                return false;
+            }
+            pos += e.length;
+        }
+    }
+}
+
+uint16_t ValueU16(const uint8_t* value, uint32_t len) {
+    return len >= 2 ? ReadU16(value) : 0;
+}
+
+std::string ValueString(const uint8_t* value, uint32_t len) {
+    while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\0')) {
+        --len;
+    }
+    size_t start = 0;
+    while (start < len && value[start] == ' ') {
+        ++start;
+    }
+    return std::string(reinterpret_cast<const char*>(value) + start, len - start);
+}
+
+// First value of a (possibly multi-valued) DS; `fallback` when absent or
+// unparseable.
+double ValueDecimal(const uint8_t* value, uint32_t len, double fallback) {
+    const std::string text = ValueString(value, len);
+    char* end = nullptr;
+    const double parsed = std::strtod(text.c_str(), &end);
+    return end != text.c_str() ? parsed : fallback;
+}
+
+// Record the Image Pixel module attributes FragmentIndex carries.
+void ReadImageAttribute(const ElementHeader& h, const uint8_t* value, DicomImageInfo& info) {
+    switch (h.element) {
+        case 0x0002: info.samplesPerPixel = ValueU16(value, h.length); break;
+        case 0x0004: info.photometricInterpretation = ValueString(value, h.length); break;
+        case 0x0006: info.planarConfiguration = ValueU16(value, h.length); break;
+        case 0x0008: {
+            // NumberOfFrames is IS; default to 1 when absent or non-positive.
+            long frames = std::strtol(ValueString(value, h.length).c_str(), nullptr, 10);
+            info.numberOfFrames = frames > 0 ? static_cast<uint32_t>(frames) : 1;
+            break;
+        }
+        case 0x0010: info.height = ValueU16(value, h.length); break;
+        case 0x0011: info.width = ValueU16(value, h.length); break;
+        case 0x0100: info.bitsAllocated = ValueU16(value, h.length); break;
+        case 0x0101: info.bitsStored = ValueU16(value, h.length); break;
+        case 0x0102: info.highBit = ValueU16(value, h.length); break;
+        case 0x0103: info.isSigned = ValueU16(value, h.length) != 0; break;
+        case 0x1050: info.windowCenter = ValueDecimal(value, h.length, 0.0); break;
+        case 0x1051: info.windowWidth = std::max(ValueDecimal(value, h.length, 0.0), 0.0); break;
+        case 0x1052: info.rescaleIntercept = ValueDecimal(value, h.length, 0.0); break;
+        case 0x1053: {
+            const double slope = ValueDecimal(value, h.length, 1.0);
+            info.rescaleSlope = slope != 0.0 ? slope : 1.0;
+            break;
+        }
+        default: break;
+    }
+}
+
+inline uint64_t ReadU64(const uint8_t* p) {
+    return static_cast<uint64_t>(ReadU32(p)) | (static_cast<uint64_t>(ReadU32(p + 4)) << 32);
+}
+
+// Collect the fragments of an encapsulated Pixel Data element, and the Basic
+// Offset Table item's value; pos starts just past the (7FE0,0010) header.
+bool ReadFragments(const uint8_t* buf, size_t size, size_t pos,
+                   std::vector<ByteRange>& fragments, ByteRange& offsetTable) {
+    bool first = true;
+    for (;;) {
+        ElementHeader item;
+        if (!ReadHeader(buf, size, pos, item) || item.group != kItemGroup) {
+            return false;
+        }
+        pos += item.headerLen;
+        if (item.element == kSequenceDelimitation) {
+            return true;
+        }
+        if (item.element != kItem || item.length == kUndefinedLength ||
+            item.length > size - pos) {
+            return false;
+        }
+        if (first) {  // item 0 is the Basic Offset Table
+            offsetTable = {pos, item.length};
+        } else {
+            fragments.push_back({pos, item.length});
+        }
+        first = false;
+        pos += item.length;
+    }
+}
+
+// Fill index.frames from the fragments of the Pixel Data element, through the
+// Extended or Basic Offset Table when one is populated. Each frame must be a
+// single fragment to be used in place.
+bool MapFrames(const uint8_t* buf, const std::vector<ByteRange>& fragments,
+               const ByteRange& offsetTable, const std::vector<uint64_t>& extendedOffsets,
+               FragmentIndex& index) {
+    const uint32_t frameCount = index.info.numberOfFrames;
+    if (fragments.size() == frameCount) {
+        index.frames = fragments;  // what this plugin writes: no grouping needed
+        return true;
+    }
+
+    std::vector<uint64_t> lengths(fragments.size());
+    std::vector<bool> starts(fragments.size());
+    for (size_t k = 0; k < fragments.size(); ++k) {
+        lengths[k] = fragments[k].length;
+        starts[k] = StartsCompressedBitstream(buf + fragments[k].offset, fragments[k].length);
+    }
+    std::vector<uint64_t> offsets = extendedOffsets;
+    if (offsets.empty()) {
+        offsets.resize(offsetTable.length / 4);
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            offsets[i] = ReadU32(buf + offsetTable.offset + i * 4);
+        }
+    }
+
+    const std::vector<uint32_t> first =
+        GroupFragmentsIntoFrames(lengths, offsets, starts, frameCount);
+    if (first.empty()) {
+        return false;
+    }
+    index.frames.resize(frameCount);
+    for (uint32_t f = 0; f < frameCount; ++f) {
+        if (first[f + 1] - first[f] != 1) {
+            return false;  // split frame: DCMTK joins it
+        }
+        index.frames[f] = fragments[first[f]];
+    }
+    return true;
+}
+
+// UI values are padded to even length with a trailing NUL (and sometimes a
+// space from non-conformant writers).
+std::string TrimUid(const uint8_t* p, size_t len) {
+    while (len > 0 && (p[len - 1] == '\0' || p[len - 1] == ' ')) {
+        --len;
+    }
+    return std::string(reinterpret_cast<const char*>(p), len);
+}
+
+}  // namespace
+
+bool StartsCompressedBitstream(const uint8_t* data, size_t size) {
+    static const uint8_t kJxlContainer[12] = {0x00, 0x00, 0x00, 0x0C, 'J', 'X', 'L', ' ',
+                                              0x0D, 0x0A, 0x87, 0x0A};
+    if (!data || size < 2) {
+        return false;
+    }
+    if (data[0] == 0xFF && (data[1] == 0xD8 || data[1] == 0x0A)) {
+        return true;  // JPEG SOI or JXL codestream
+    }
+    return size >= sizeof(kJxlContainer) &&
+           std::memcmp(data, kJxlContainer, sizeof(kJxlContainer)) == 0;
+}
+
+std::vector<uint32_t> GroupFragmentsIntoFrames(const std::vector<uint64_t>& fragmentLengths,
+                                               const std::vector<uint64_t>& frameOffsets,
+                                               const std::vector<bool>& startsBitstream,
+                                               uint32_t frameCount) {
+    const size_t fragmentCount = fragmentLengths.size();
+    if (frameCount == 0 || fragmentCount < frameCount) {
+        return {};
+    }
+    std::vector<uint32_t> first;
+    first.reserve(frameCount + 1);
+
+    // Offset table: every entry must land on an item boundary, in order.
+    if (frameOffsets.size() == frameCount) {
+        uint64_t itemOffset = 0;
+        size_t k = 0;
+        for (uint64_t offset : frameOffsets) {
+            while (k < fragmentCount && itemOffset < offset) {
+                itemOffset += 8 + fragmentLengths[k++];
+            }
+            if (k == fragmentCount || itemOffset != offset ||
+                (!first.empty() && first.back() == k)) {
+                break;
+            }
+            first.push_back(static_cast<uint32_t>(k));
+        }
+        if (first.size() == frameCount && first.front() == 0) {
+            first.push_back(static_cast<uint32_t>(fragmentCount));
+            return first;
+        }
+        first.clear();
+    }
+
+    if (fragmentCount == frameCount || frameCount == 1) {
+        // One fragment per frame, or one frame in however many fragments.
+        for (uint32_t f = 0; f < frameCount; ++f) {
+            first.push_back(f);
+        }
+        first.push_back(static_cast<uint32_t>(fragmentCount));
+        return first;
+    }
+
+    // No usable table: frames begin where a bitstream does.
+    if (startsBitstream.size() == fragmentCount) {
+        for (size_t k = 0; k < fragmentCount; ++k) {
+            if (startsBitstream[k]) {
+                first.push_back(static_cast<uint32_t>(k));
+            }
+        }
+        if (first.size() == frameCount && first.front() == 0) {
+            first.push_back(static_cast<uint32_t>(fragmentCount));
+            return first;
+        }
+    }
+    return {};
+}
+
+bool SniffFileMeta(const void* data, size_t size, FileMetaInfo& meta) {
+    const uint8_t* buf = static_cast<const uint8_t*>(data);
+    if (!buf || size < kPrefixSize ||
+        std::memcmp(buf + kPreambleSize, "DICM", 4) != 0) {
+        return false;
+    }
+
+    // The File Meta group is always Explicit VR Little Endian (PS3.10 7.1).
+    size_t pos = kPrefixSize;
+    bool haveTs = false;
+    while (pos + 8 <= size) {
+        const uint8_t* p = buf + pos;
+        const uint16_t group = ReadU16(p);
+        if (group != 0x0002) {
+            break;
+        }
+        const uint16_t element = ReadU16(p + 2);
+
+        size_t headerLen = 8;
+        uint32_t valueLen = 0;
+        if (HasLongLength(p + 4)) {
+            if (pos + 12 > size) {
+                return false;
+            }
+            headerLen = 12;
+            valueLen = ReadU32(p + 8);
+        } else {
+            valueLen = ReadU16(p + 6);
+        }
+        if (valueLen == 0xFFFFFFFFu || valueLen > size - pos - headerLen) {
+            return false;  // undefined length or truncated: not for us to handle
+        }
+
+        const uint8_t* value = p + headerLen;
+        if (element == 0x0010) {
+            meta.transferSyntaxUid = TrimUid(value, valueLen);
+            haveTs = true;
+        } else if (element == 0x0003) {
+            meta.sopInstanceUid = TrimUid(value, valueLen);
+        }
+        pos += headerLen + valueLen;
+    }
+
+    meta.datasetOffset = pos;
+    return haveTs && !meta.transferSyntaxUid.empty();
+}
+
+std::string SniffTransferSyntax(const void* data, size_t size) {
+    FileMetaInfo meta;
+    return SniffFileMeta(data, size, meta) ? meta.transferSyntaxUid : std::string();
+}
+
+bool IndexEncapsulatedFrames(const void* data, size_t size, const FileMetaInfo& meta,
+                             FragmentIndex& index) {
+    const uint8_t* buf = static_cast<const uint8_t*>(data);
+    if (!buf || meta.datasetOffset == 0 || meta.datasetOffset > size) {
+        return false;
+    }
+
+    index = FragmentIndex();
+    std::vector<uint64_t> extendedOffsets;
+    size_t pos = meta.datasetOffset;
+    while (pos < size) {
+        ElementHeader h;
+        if (!ReadHeader(buf, size, pos, h)) {
+            return false;
+        }
+        pos += h.headerLen;
+
+        if (h.group == 0x7FE0 && h.element == 0x0010) {
+            // Native (defined-length) pixel data is not encapsulated.
+            std::vector<ByteRange> fragments;
+            ByteRange offsetTable;
+            if (h.length != kUndefinedLength ||
+                !ReadFragments(buf, size, pos, fragments, offsetTable) ||
+                index.info.width == 0 || index.info.height == 0) {
+                return false;
+            }
+            return MapFrames(buf, fragments, offsetTable, extendedOffsets, index);
+        }
+
+        if (h.length == kUndefinedLength) {
+            if (!IsSequence(h) || !SkipUndefinedSequence(buf, size, pos, 0)) {
+                return false;
+            }
+            continue;
+        }
+        if (h.length > size - pos) {
+            return false;
+        }
+        if (h.group == 0x0028) {
+            ReadImageAttribute(h, buf + pos, index.info);
+        } else if (h.group == 0x7FE0 && h.element == 0x0001) {
+            // Extended Offset Table (OV): one 64-bit offset per frame.
+            extendedOffsets.resize(h.length / 8);
+            for (size_t i = 0; i < extendedOffsets.size(); ++i) {
+                extendedOffsets[i] = ReadU64(buf + pos + i * 8);
+            }
+        }
+        pos += h.length;
+    }
+    return false;  // no Pixel Data
+}
+
+}  // namespace orthanc_jxl
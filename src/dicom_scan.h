@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "dicom_handler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace orthanc_jxl {
+
+/**
+ * Fields of the File Meta Information group (0002,xxxx), read straight from a
+ * raw Part 10 buffer without involving DCMTK.
+ *
+ * Orthanc offers every instance to the decode and transcoder callbacks,
+ * whatever its transfer syntax. Reading just the meta group lets the plugin
+ * decline instances that are not ours before paying for a full parse.
+ */
+struct FileMetaInfo {
+    std::string transferSyntaxUid;   // (0002,0010)
+    std::string sopInstanceUid;      // (0002,0003) Media Storage SOP Instance UID
+    size_t datasetOffset = 0;        // first byte after the meta group
+};
+
+// Parse the File Meta group of a Part 10 buffer (128-byte preamble + "DICM").
+// Returns false if the buffer is not Part 10 or the group is malformed; the
+// caller should then fall back to a full DCMTK parse.
+bool SniffFileMeta(const void* data, size_t size, FileMetaInfo& meta);
+
+// Transfer Syntax UID of a Part 10 buffer, or an empty string if it cannot be
+// determined without a full parse.
+std::string SniffTransferSyntax(const void* data, size_t size);
+
+// Location of one value inside the raw instance buffer.
+struct ByteRange {
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+/**
+ * Where each frame's encapsulated bitstream lives in a raw instance buffer,
+ * plus the image attributes needed to decode it.
+ *
+ * Built by walking the dataset directly, so a frame can be handed to the codec
+ * as a pointer into Orthanc's buffer without DCMTK parsing or copying the
+ * instance.
+ */
+struct FragmentIndex {
+    DicomImageInfo info;
+    std::vector<ByteRange> frames;   // one entry per frame
+
+    // Approximate heap footprint, for cache accounting.
+    size_t MemoryBytes() const {
+        return sizeof(*this) + info.photometricInterpretation.capacity()
+               + frames.capacity() * sizeof(ByteRange);
+    }
+};
+
+// True if `data` begins a JPEG (SOI marker) or JPEG XL (codestream or
+// container signature) bitstream, i.e. could be the first fragment of a frame.
+bool StartsCompressedBitstream(const uint8_t* data, size_t size);
+
+/**
+ * Group the fragments of an encapsulated Pixel Data element into frames
+ * (PS3.5 A.4).
+ *
+ * fragmentLengths are the value lengths of the items after the Basic Offset
+ * Table. frameOffsets are the Extended or Basic Offset Table entries (offset
+ * of each frame's first item, counted from the first item after the BOT), or
+ * empty when neither table is populated. startsBitstream[k] tells whether
+ * fragment k passes StartsCompressedBitstream, for tables that are absent or
+ * do not fit.
+ *
+ * Returns frameCount + 1 boundaries, frame f being fragments
+ * [first[f], first[f + 1]), or an empty vector when no mapping fits.
+ */
+std::vector<uint32_t> GroupFragmentsIntoFrames(const std::vector<uint64_t>& fragmentLengths,
+                                               const std::vector<uint64_t>& frameOffsets,
+                                               const std::vector<bool>& startsBitstream,
+                                               uint32_t frameCount);
+
+// Index the encapsulated Pixel Data of an Explicit VR Little Endian instance
+// (all JXL transfer syntaxes are), using the Basic or Extended Offset Table
+// when present. Returns false for anything the walker does not understand
+// (implicit-VR UN values, frames split over several fragments, truncation, no
+// encapsulated pixel data); the caller should fall back to DCMTK.
+bool IndexEncapsulatedFrames(const void* data, size_t size, const FileMetaInfo& meta,
+                             FragmentIndex& index);
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "effort_policy.h"
+#include "load_tracker.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Single-threaded lossless cost per sample, in ns, by effort (index 0
+// unused): typical of libjxl 0.8-0.11 on 16-bit greyscale. Only the ratios
+// matter once anything has been measured.
+constexpr std::array<double, EffortPolicy::kMaxEffort + 1> kPriorNsPerSample = {
+    0.0, 8.0, 25.0, 40.0, 90.0, 140.0, 200.0, 300.0, 700.0, 2000.0, 20000.0};
+
+// Weight of the newest frame in the running estimates.
+constexpr double kAlpha = 0.2;
+
+std::atomic<EffortPolicy*> g_sharedEffortPolicy{nullptr};
+
+}  // namespace
+
+EffortPolicy::EffortPolicy(const Options& options) : options_([&] {
+        Options o = options;
+        o.minEffort = std::clamp(o.minEffort, 1, kMaxEffort);
+        o.threadBudget = std::max<size_t>(1, o.threadBudget);
+        return o;
+    }()) {}
+
+double EffortPolicy::Threads(int threads) const {
+    return threads < 0 ? static_cast<double>(options_.threadBudget)
+                       : static_cast<double>(std::max(1, threads));
+}
+
+double EffortPolicy::CostLocked(int effort, Clock::time_point now) const {
+    const double prior = kPriorNsPerSample[effort] * scale_;
+    if (measured_[effort] <= 0.0) {
+        return prior;
+    }
+    // The measurement is trusted less the older it is, so a cost learnt under
+    // load (or on a bad run) does not pin an effort that is no longer chosen.
+    const double halfLife = static_cast<double>(options_.halfLife.count());
+    if (halfLife <= 0.0) {
+        return measured_[effort];
+    }
+    const double ageMs =
+        std::chrono::duration<double, std::milli>(now - recorded_[effort]).count();
+    const double weight = std::exp2(-std::max(0.0, ageMs) / halfLife);
+    return weight * measured_[effort] + (1.0 - weight) * prior;
+}
+
+double EffortPolicy::CostPerSample(int effort) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return CostLocked(std::clamp(effort, 1, kMaxEffort), Clock::now());
+}
+
+int EffortPolicy::Choose(size_t samples, size_t bytesPerSample, uint32_t frames,
+                         int threads, int maxEffort) const {
+    maxEffort = std::clamp(maxEffort, 1, kMaxEffort);
+    const int minEffort = std::min(options_.minEffort, maxEffort);
+    if (!Enabled()) {
+        return maxEffort;
+    }
+    // Threads each of this call's frames can count on: the budget split over
+    // every frame in flight, its own included (at most a budget of them run
+    // at once), and no more than each asks for.
+    const double budget = static_cast<double>(options_.threadBudget);
+    const size_t own = std::min<size_t>(std::max<uint32_t>(1, frames), options_.threadBudget);
+    const size_t tracked = options_.load ? options_.load->InFlightFrames() : 0;
+    const double inFlight = static_cast<double>(std::max(own, tracked));
+    const double share = std::min(Threads(threads), budget / inFlight);
+    const double backlog = std::max(1.0, inFlight / budget);
+
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int e = maxEffort; e > minEffort; --e) {
+        const double cost = CostLocked(e, now);
+        const double latencyMs = cost * static_cast<double>(samples) / share / 1e6;
+        const double rateMBps = budget * static_cast<double>(bytesPerSample) / cost * 1e3;
+        if ((options_.latencyMs <= 0.0 || latencyMs <= options_.latencyMs) &&
+            (options_.throughputMBps <= 0.0 || rateMBps >= options_.throughputMBps * backlog)) {
+            return e;
+        }
+    }
+    return minEffort;
+}
+
+void EffortPolicy::Record(int effort, size_t samples, double cpuMs) {
+    if (effort < 1 || effort > kMaxEffort || samples == 0 || cpuMs <= 0.0) {
+        return;
+    }
+    const double cost = cpuMs * 1e6 / static_cast<double>(samples);
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Continue from the decayed estimate, not the stale measurement.
+    measured_[effort] = measured_[effort] > 0.0
+        ? (1.0 - kAlpha) * CostLocked(effort, now) + kAlpha * cost : cost;
+    recorded_[effort] = now;
+    ++frames_[effort];
+    const double ratio = cost / kPriorNsPerSample[effort];
+    scale_ = scaled_ ? (1.0 - kAlpha) * scale_ + kAlpha * ratio : ratio;
+    scaled_ = true;
+}
+
+EffortPolicy::Stats EffortPolicy::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Clock::time_point now = Clock::now();
+    Stats stats;
+    stats.measured = frames_;
+    for (int e = 1; e <= kMaxEffort; ++e) {
+        stats.nsPerSample[e] = CostLocked(e, now);
+    }
+    return stats;
+}
+
+void EffortPolicy::SetShared(EffortPolicy* policy) {
+    g_sharedEffortPolicy.store(policy, std::memory_order_release);
+}
+
+EffortPolicy* EffortPolicy::Shared() {
+    return g_sharedEffortPolicy.load(std::memory_order_acquire);
+}
+
+}  // namespace orthanc_jxl
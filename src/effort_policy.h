@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace orthanc_jxl {
+
+class LoadTracker;
+
+/**
+ * Picks the libjxl effort of each TO-JXL encode from a latency or throughput
+ * target, instead of using the configured Effort for every instance.
+ *
+ * Cost is modelled as CPU nanoseconds per sample (pixel x channel) at each
+ * effort, learnt from the CPU time of the encodes the plugin runs (libjxl's
+ * pool workers included), so waiting for a busy pool does not count as cost.
+ * Efforts not measured yet are extrapolated from a table of typical relative
+ * costs, scaled by how the measured efforts compare with it; an effort not
+ * measured for a while decays back towards that extrapolation with halfLife,
+ * so one that stopped being chosen under load can be chosen again. For an
+ * instance the policy predicts each frame's encode time at every effort - from
+ * its size and the share of the thread budget it can expect with the frames
+ * already in flight - and takes the highest effort between minEffort and the
+ * instance's configured effort that meets:
+ *
+ * - latencyMs: each frame encodes within this wall time, and
+ * - throughputMBps: the whole budget keeps up this rate of native bytes,
+ *   raised by the backlog when more frames are in flight than threads.
+ *
+ * When work backs up every frame's share shrinks, so effort drops; it comes
+ * back up once the load clears. With no target set it leaves effort alone.
+ */
+class EffortPolicy {
+public:
+    static constexpr int kMaxEffort = 10;
+
+    struct Options {
+        int minEffort = 1;
+        double latencyMs = 0.0;        // per frame; 0 = no latency target
+        double throughputMBps = 0.0;   // native MB/s; 0 = no throughput target
+        size_t threadBudget = 1;       // threads codec work may occupy in total
+        const LoadTracker* load = nullptr;   // frames in flight; none = only the caller's
+        std::chrono::milliseconds halfLife{300000};   // of an effort's last measurement
+    };
+
+    struct Stats {
+        std::array<uint64_t, kMaxEffort + 1> measured{};    // frames timed, by effort
+        std::array<double, kMaxEffort + 1> nsPerSample{};   // current estimate, by effort
+    };
+
+    explicit EffortPolicy(const Options& options);
+
+    EffortPolicy(const EffortPolicy&) = delete;
+    EffortPolicy& operator=(const EffortPolicy&) = delete;
+
+    bool Enabled() const { return options_.latencyMs > 0.0 || options_.throughputMBps > 0.0; }
+
+    // Effort, at most maxEffort (its configured one), for an instance of
+    // `frames` frames of `samples` samples of `bytesPerSample` each, encoded
+    // with `threads` libjxl threads per frame (JxlCodec's convention; < 0 =
+    // the whole budget). maxEffort when no target is set.
+    int Choose(size_t samples, size_t bytesPerSample, uint32_t frames, int threads,
+               int maxEffort) const;
+
+    // A frame of `samples` encoded at `effort` took `cpuMs` of CPU, over
+    // every thread that worked on it.
+    void Record(int effort, size_t samples, double cpuMs);
+
+    // Predicted CPU nanoseconds per sample at `effort`.
+    double CostPerSample(int effort) const;
+
+    Stats GetStats() const;
+
+    // Policy consulted by TranscodeToJxl; nullptr uses the configured effort.
+    static void SetShared(EffortPolicy* policy);
+    static EffortPolicy* Shared();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    double CostLocked(int effort, Clock::time_point now) const;
+    double Threads(int threads) const;
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::array<double, kMaxEffort + 1> measured_{};   // 0 = not measured yet
+    std::array<uint64_t, kMaxEffort + 1> frames_{};
+    std::array<Clock::time_point, kMaxEffort + 1> recorded_{};   // last measurement
+    double scale_ = 1.0;    // measured / prior, over all recorded frames
+    bool scaled_ = false;
+};
+
+}  // namespace orthanc_jxl
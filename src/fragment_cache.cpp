@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "fragment_cache.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Bytes at the end of the buffer folded into the key. The last fragment sits
+// there, so a re-encoded instance that kept its UID and size still misses.
+constexpr size_t kTailHashBytes = 4096;
+
+uint64_t Fnv1a(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+}  // namespace
+
+std::string FragmentIndexCache::MakeKey(const FileMetaInfo& meta, const void* data,
+                                        size_t size) {
+    if (meta.sopInstanceUid.empty() || !data) {
+        return std::string();
+    }
+    const size_t tail = std::min(size, kTailHashBytes);
+    const uint64_t hash = Fnv1a(static_cast<const uint8_t*>(data) + (size - tail), tail);
+
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), "|%zu|%016llx", size,
+             static_cast<unsigned long long>(hash));
+    return meta.sopInstanceUid + suffix;
+}
+
+std::shared_ptr<const FragmentIndex> FragmentIndexCache::Find(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->index;
+}
+
+void FragmentIndexCache::Insert(const std::string& key,
+                                std::shared_ptr<const FragmentIndex> index) {
+    if (capacity_ == 0 || key.empty() || !index) {
+        return;
+    }
+    const size_t bytes = index->MemoryBytes() + key.size() + sizeof(Entry);
+    if (bytes > capacity_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+        // Lost a race with another thread indexing the same instance.
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    lru_.push_front(Entry{key, std::move(index), bytes});
+    map_.emplace(key, lru_.begin());
+    bytes_ += bytes;
+    EvictLocked();
+}
+
+void FragmentIndexCache::EvictLocked() {
+    while (bytes_ > capacity_ && !lru_.empty()) {
+        const Entry& victim = lru_.back();
+        bytes_ -= victim.bytes;
+        map_.erase(victim.key);
+        lru_.pop_back();
+        ++evictions_;
+    }
+}
+
+FragmentIndexCache::Stats FragmentIndexCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s;
+    s.hits = hits_;
+    s.misses = misses_;
+    s.evictions = evictions_;
+    s.entries = map_.size();
+    s.bytes = bytes_;
+    return s;
+}
+
+}  // namespace orthanc_jxl
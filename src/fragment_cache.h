@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "dicom_scan.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace orthanc_jxl {
+
+/**
+ * Bounded LRU cache of per-instance fragment indexes.
+ *
+ * Orthanc calls the decode callback once per frame with the full instance
+ * buffer. Caching where each frame lives means that scrolling a multi-frame
+ * instance indexes it once, and every later frame goes straight from Orthanc's
+ * buffer to the codec.
+ *
+ * Entries are keyed by MakeKey() (SOP Instance UID, buffer size and a hash of
+ * the buffer tail), so a modified instance with the same UID maps to a new
+ * entry. Offsets are still bounds-checked by the caller before use.
+ */
+class FragmentIndexCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    // capacityBytes == 0 disables the cache (every lookup misses, inserts are
+    // dropped).
+    explicit FragmentIndexCache(size_t capacityBytes) : capacity_(capacityBytes) {}
+
+    FragmentIndexCache(const FragmentIndexCache&) = delete;
+    FragmentIndexCache& operator=(const FragmentIndexCache&) = delete;
+
+    // Cache key for a raw instance; empty when the instance has no Media
+    // Storage SOP Instance UID to key on.
+    static std::string MakeKey(const FileMetaInfo& meta, const void* data, size_t size);
+
+    std::shared_ptr<const FragmentIndex> Find(const std::string& key);
+    void Insert(const std::string& key, std::shared_ptr<const FragmentIndex> index);
+
+    size_t Capacity() const { return capacity_; }
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const FragmentIndex> index;
+        size_t bytes;
+    };
+    using EntryList = std::list<Entry>;
+
+    void EvictLocked();
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    EntryList lru_;  // front = most recently used
+    std::unordered_map<std::string, EntryList::iterator> map_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "frame_cache.h"
+#include "content_hash.h"
+#include "pixel_layout.h"
+#include "trace.h"
+
+#include <cstdio>
+
+namespace orthanc_jxl {
+
+std::shared_ptr<DecodedFrame> DecodeFrame(const uint8_t* data, size_t size, bool isSigned,
+                                          uint32_t highBit, int numWorkerThreads) {
+    auto frame = std::make_shared<DecodedFrame>();
+    frame->isSigned = isSigned;
+    StageSpan decode(Stage::Decode);
+    frame->info = JxlCodec::DecodeInto(data, size,
+        [&](const ImageInfo& info, PixelFormat format) {
+            frame->info = info;
+            frame->format = format;
+            frame->pixels.resize(frame->RowBytes() * info.height);
+            return DecodeTarget{frame->pixels.data(), frame->RowBytes()};
+        },
+        numWorkerThreads);
+    SignExtendFrame(frame->pixels.data(), frame->RowBytes(), frame->info.height,
+                    static_cast<size_t>(frame->info.width) * JxlCodec::NumChannels(frame->format),
+                    JxlCodec::BitsPerSample(frame->format) / 8, frame->info.bitsPerSample,
+                    highBit, isSigned);
+    return frame;
+}
+
+std::string DecodedFrameCache::MakeKey(const std::string& instanceKey, uint32_t frameIndex,
+                                       const uint8_t* bitstream, size_t size) {
+    if (instanceKey.empty()) {
+        return std::string();
+    }
+    char suffix[40];
+    snprintf(suffix, sizeof(suffix), "#%u|%016llx", frameIndex,
+             static_cast<unsigned long long>(HashBytes(bitstream, size)));
+    return instanceKey + suffix;
+}
+
+std::shared_ptr<const DecodedFrame> DecodedFrameCache::Find(const std::string& key) {
+    if (capacity_ == 0 || key.empty()) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it == map_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->frame;
+}
+
+bool DecodedFrameCache::Contains(const std::string& key) const {
+    if (capacity_ == 0 || key.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return map_.count(key) != 0;
+}
+
+void DecodedFrameCache::Insert(const std::string& key,
+                               std::shared_ptr<const DecodedFrame> frame) {
+    if (capacity_ == 0 || key.empty() || !frame) {
+        return;
+    }
+    const size_t bytes = frame->MemoryBytes() + key.size() + sizeof(Entry);
+    if (bytes > capacity_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it != map_.end()) {
+        // Another thread decoded the same frame concurrently.
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return;
+    }
+    lru_.push_front(Entry{key, std::move(frame), bytes});
+    map_.emplace(key, lru_.begin());
+    bytes_ += bytes;
+    EvictLocked();
+}
+
+void DecodedFrameCache::EvictLocked() {
+    while (bytes_ > capacity_ && !lru_.empty()) {
+        const Entry& victim = lru_.back();
+        bytes_ -= victim.bytes;
+        map_.erase(victim.key);
+        lru_.pop_back();
+        ++evictions_;
+    }
+}
+
+DecodedFrameCache::Stats DecodedFrameCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s;
+    s.hits = hits_;
+    s.misses = misses_;
+    s.evictions = evictions_;
+    s.entries = map_.size();
+    s.bytes = bytes_;
+    return s;
+}
+
+}  // namespace orthanc_jxl
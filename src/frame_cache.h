@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "jxl_codec.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace orthanc_jxl {
+
+// One decoded frame exactly as the decode callback hands it to Orthanc:
+// tightly packed rows, signed reduced-depth samples already sign-extended.
+struct DecodedFrame {
+    ImageInfo info;
+    PixelFormat format = PixelFormat::Gray8;
+    bool isSigned = false;   // Pixel Representation, picks the Orthanc format
+    std::vector<uint8_t> pixels;
+
+    size_t RowBytes() const {
+        return static_cast<size_t>(info.width) * JxlCodec::BytesPerPixel(format);
+    }
+
+    // Approximate heap footprint, for cache accounting.
+    size_t MemoryBytes() const { return sizeof(*this) + pixels.capacity(); }
+};
+
+// Decode one frame into a cacheable DecodedFrame, sign-extending signed
+// reduced-depth frames from `highBit` (see SignExtensionBits).
+std::shared_ptr<DecodedFrame> DecodeFrame(const uint8_t* data, size_t size, bool isSigned,
+                                          uint32_t highBit, int numWorkerThreads);
+
+/**
+ * Bounded LRU cache of decoded frames, shared by Orthanc's HTTP threads.
+ *
+ * Scrolling back and forth through a stack asks for the same frames over and
+ * over; a hit costs one copy into the Orthanc image instead of a JXL decode.
+ * Keys combine FragmentIndexCache::MakeKey() with the frame index and a hash
+ * of the frame's own bitstream: the instance key only samples the tail of the
+ * buffer, and serving stale pixels for a modified frame is not an option.
+ * Frames are shared immutable, so a hit stays valid while another thread
+ * evicts it.
+ */
+class DecodedFrameCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0;
+    };
+
+    // capacityBytes == 0 disables the cache (every lookup misses, inserts are
+    // dropped).
+    explicit DecodedFrameCache(size_t capacityBytes) : capacity_(capacityBytes) {}
+
+    DecodedFrameCache(const DecodedFrameCache&) = delete;
+    DecodedFrameCache& operator=(const DecodedFrameCache&) = delete;
+
+    // Key for frame `frameIndex`, whose JXL bitstream is `bitstream`, of the
+    // instance with the given FragmentIndexCache key; empty if the instance
+    // key is.
+    static std::string MakeKey(const std::string& instanceKey, uint32_t frameIndex,
+                               const uint8_t* bitstream, size_t size);
+
+    std::shared_ptr<const DecodedFrame> Find(const std::string& key);
+    // Whether `key` is cached, without touching LRU order or the counters.
+    bool Contains(const std::string& key) const;
+    void Insert(const std::string& key, std::shared_ptr<const DecodedFrame> frame);
+
+    bool Enabled() const { return capacity_ > 0; }
+    size_t Capacity() const { return capacity_; }
+    Stats GetStats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::shared_ptr<const DecodedFrame> frame;
+        size_t bytes;
+    };
+    using EntryList = std::list<Entry>;
+
+    void EvictLocked();
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    EntryList lru_;  // front = most recently used
+    std::unordered_map<std::string, EntryList::iterator> map_;
+    size_t bytes_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+};
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "frame_prefetch.h"
+#include "load_tracker.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Scroll positions remembered at once; the map is simply cleared when full.
+constexpr size_t kMaxTrackedInstances = 256;
+
+}  // namespace
+
+struct FramePrefetcher::Job {
+    std::string key;
+    std::vector<uint8_t> bitstream;
+    bool isSigned = false;
+    uint32_t highBit = 0;
+};
+
+FramePrefetcher::FramePrefetcher(ThreadPool& pool, DecodedFrameCache& cache,
+                                 const LoadTracker& load, uint32_t window, size_t maxInFlight)
+    : pool_(pool), cache_(cache), load_(load),
+      window_(cache.Enabled() ? window : 0),
+      maxInFlight_(std::max<size_t>(1, maxInFlight)) {}
+
+FramePrefetcher::~FramePrefetcher() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopping_ = true;
+    idle_.wait(lock, [this] { return pending_.empty(); });
+}
+
+bool FramePrefetcher::Throttled() const {
+    // Foreground transcodes and decodes already occupy half the thread budget.
+    return load_.InFlightFrames() * 2 > load_.Budget();
+}
+
+void FramePrefetcher::OnFrameViewed(const std::string& instanceKey, uint32_t frameIndex,
+                                    uint32_t frameCount, bool isSigned, uint32_t highBit,
+                                    const FrameSource& frames) {
+    if (!Enabled() || frameCount < 2 || instanceKey.empty()) {
+        return;
+    }
+
+    bool backward = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = lastFrame_.find(instanceKey);
+        if (it != lastFrame_.end()) {
+            backward = frameIndex < it->second;
+            it->second = frameIndex;
+        } else {
+            if (lastFrame_.size() >= kMaxTrackedInstances) {
+                lastFrame_.clear();
+            }
+            lastFrame_.emplace(instanceKey, frameIndex);
+        }
+    }
+
+    for (uint32_t step = 1; step <= window_; ++step) {
+        if (backward ? step > frameIndex
+                     : static_cast<uint64_t>(frameIndex) + step >= frameCount) {
+            break;
+        }
+        const uint32_t n = backward ? frameIndex - step : frameIndex + step;
+        const ByteView bits = frames(n);
+        if (bits.empty()) {
+            continue;
+        }
+        std::string key = DecodedFrameCache::MakeKey(instanceKey, n, bits.data, bits.size);
+        if (cache_.Contains(key)) {
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (stopping_ || pending_.size() >= maxInFlight_ || Throttled()) {
+                break;
+            }
+            if (!pending_.insert(key).second) {
+                continue;
+            }
+        }
+
+        // The key is reserved: hand it back if the decode cannot be queued,
+        // or the destructor would wait for it forever.
+        try {
+            auto job = std::make_shared<Job>();
+            job->key = key;
+            job->bitstream.assign(bits.data, bits.data + bits.size);
+            job->isSigned = isSigned;
+            job->highBit = highBit;
+            pool_.Enqueue([this, job] { Run(*job); });
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ReleaseLocked(key);
+            throw;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++stats_.queued;
+    }
+}
+
+void FramePrefetcher::ReleaseLocked(const std::string& key) {
+    pending_.erase(key);
+    if (pending_.empty()) {
+        idle_.notify_all();
+    }
+}
+
+void FramePrefetcher::Run(Job& job) {
+    bool start = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        start = !stopping_;
+    }
+    bool decoded = false;
+    if (start && !Throttled()) {
+        try {
+            cache_.Insert(job.key, DecodeFrame(job.bitstream.data(), job.bitstream.size(),
+                                               job.isSigned, job.highBit,
+                                               JxlCodec::kSingleThreaded));
+            decoded = true;
+        } catch (const std::exception&) {
+            // The viewer's own request will surface the error.
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (decoded) {
+        ++stats_.completed;
+    } else {
+        ++stats_.dropped;
+    }
+    ReleaseLocked(job.key);
+}
+
+FramePrefetcher::Stats FramePrefetcher::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "dicom_handler.h"
+#include "frame_cache.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace orthanc_jxl {
+
+class LoadTracker;
+class ThreadPool;
+
+/**
+ * Speculative decode of the frames a viewer is about to ask for.
+ *
+ * When frame N of a multi-frame instance is viewed, the next `window` frames
+ * in the scroll direction (N+1.. after moving forward, N-1.. after moving
+ * back) are decoded single-threaded on the shared pool into the
+ * DecodedFrameCache, so the following requests are cache hits. Their
+ * bitstreams are copied out of Orthanc's buffer when queued, since that
+ * buffer only lives for the callback.
+ *
+ * The pool has no priorities, so prefetch throttles itself instead: at most
+ * `maxInFlight` decodes are queued at a time, nothing is queued while
+ * foreground codec work fills half the LoadTracker budget, and a queued
+ * decode that starts under such load is dropped.
+ */
+class FramePrefetcher {
+public:
+    struct Stats {
+        uint64_t queued = 0;      // decodes handed to the pool
+        uint64_t completed = 0;   // decoded into the cache
+        uint64_t dropped = 0;     // throttled at start, or failed to decode
+    };
+
+    // Returns the bitstream of frame n of the instance being viewed, or an
+    // empty view; only called during OnFrameViewed.
+    using FrameSource = std::function<ByteView(uint32_t n)>;
+
+    // window == 0 disables prefetching. pool, cache and load must outlive the
+    // prefetcher.
+    FramePrefetcher(ThreadPool& pool, DecodedFrameCache& cache, const LoadTracker& load,
+                    uint32_t window, size_t maxInFlight);
+
+    // Drops queued decodes that have not started and waits for running ones.
+    ~FramePrefetcher();
+
+    FramePrefetcher(const FramePrefetcher&) = delete;
+    FramePrefetcher& operator=(const FramePrefetcher&) = delete;
+
+    // Frame `frameIndex` of `frameCount` was just requested; queue the
+    // neighbours not already cached or queued.
+    void OnFrameViewed(const std::string& instanceKey, uint32_t frameIndex,
+                       uint32_t frameCount, bool isSigned, uint32_t highBit,
+                       const FrameSource& frames);
+
+    bool Enabled() const { return window_ > 0; }
+    Stats GetStats() const;
+
+private:
+    struct Job;
+
+    bool Throttled() const;
+    void Run(Job& job);
+    // Forget a queued or finished frame key; wakes the destructor when none
+    // are left. Caller holds mutex_.
+    void ReleaseLocked(const std::string& key);
+
+    ThreadPool& pool_;
+    DecodedFrameCache& cache_;
+    const LoadTracker& load_;
+    const uint32_t window_;
+    const size_t maxInFlight_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable idle_;
+    std::unordered_set<std::string> pending_;             // frame keys queued or running
+    std::unordered_map<std::string, uint32_t> lastFrame_;  // scroll direction per instance
+    bool stopping_ = false;
+    Stats stats_;
+};
+
+}  // namespace orthanc_jxl
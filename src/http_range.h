@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "dicom_scan.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+
+namespace orthanc_jxl {
+
+enum class RangeRequest {
+    Full,           // no usable Range header: answer 200 with everything
+    Partial,        // answer 206 with the bytes in `range`
+    Unsatisfiable,  // answer 416
+};
+
+// Interpret an HTTP Range header (RFC 9110 14.2) against a body of `total`
+// bytes: "bytes=first-last", "bytes=first-" or "bytes=-suffixLength". Other
+// units, malformed values and multi-range requests fall back to Full, which
+// a server is always allowed to answer with.
+inline RangeRequest ParseRangeHeader(const std::string& header, size_t total, ByteRange& range) {
+    const std::string prefix = "bytes=";
+    if (header.compare(0, prefix.size(), prefix) != 0 ||
+        header.find(',') != std::string::npos) {
+        return RangeRequest::Full;
+    }
+    const std::string spec = header.substr(prefix.size());
+    const size_t dash = spec.find('-');
+    if (dash == std::string::npos) {
+        return RangeRequest::Full;
+    }
+    auto parse = [](const std::string& text, unsigned long long& value) {
+        if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        value = std::strtoull(text.c_str(), nullptr, 10);
+        return true;
+    };
+    const std::string firstText = spec.substr(0, dash), lastText = spec.substr(dash + 1);
+    unsigned long long first = 0, last = 0;
+
+    if (firstText.empty()) {
+        // Suffix range: the final `last` bytes.
+        if (!parse(lastText, last)) {
+            return RangeRequest::Full;
+        }
+        if (last == 0 || total == 0) {
+            return RangeRequest::Unsatisfiable;
+        }
+        const size_t length = last < total ? static_cast<size_t>(last) : total;
+        range = ByteRange{total - length, length};
+        return RangeRequest::Partial;
+    }
+    if (!parse(firstText, first) || (!lastText.empty() && (!parse(lastText, last) || last < first))) {
+        return RangeRequest::Full;
+    }
+    if (first >= total) {
+        return RangeRequest::Unsatisfiable;
+    }
+    const size_t end = lastText.empty() || last >= total ? total : static_cast<size_t>(last) + 1;
+    range = ByteRange{static_cast<size_t>(first), end - static_cast<size_t>(first)};
+    return RangeRequest::Partial;
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "ingest_queue.h"
+#include "load_tracker.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Studies remembered as viewed at once; expired ones are pruned past this.
+constexpr size_t kMaxViewedStudies = 1024;
+
+// How long a throttled worker waits before looking at the load again.
+constexpr std::chrono::milliseconds kThrottlePoll(100);
+
+// How often a worker outside its schedule checks it again.
+constexpr std::chrono::seconds kSchedulePoll(30);
+
+// Completions appended before the journal is rewritten with just the pending
+// entries (once they also outnumber them).
+constexpr size_t kRewriteAfterRemovals = 65536;
+
+}  // namespace
+
+IngestQueue::IngestQueue(const LoadTracker& load, Options options, Worker worker)
+    : load_(load), options_(std::move(options)), worker_(std::move(worker)) {
+    if (!options_.journalPath.empty()) {
+        Replay();
+    }
+}
+
+IngestQueue::~IngestQueue() {
+    Stop();
+}
+
+void IngestQueue::Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopping_ || !threads_.empty()) {
+        return;
+    }
+    for (size_t i = 0; i < std::max<size_t>(1, options_.workers); ++i) {
+        threads_.emplace_back([this] { WorkerLoop(); });
+    }
+}
+
+// Journal lines are "+ <instance> [<studyUid>]" and "- <instance>". Replaying
+// keeps the entries still pending, in their original order.
+void IngestQueue::Replay() {
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, size_t> index;
+    {
+        std::ifstream in(options_.journalPath);
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string op;
+            Entry entry;
+            if (!(fields >> op >> entry.instanceId)) {
+                continue;   // torn final line after a crash
+            }
+            fields >> entry.studyUid;
+            auto it = index.find(entry.instanceId);
+            if (op == "+" && it == index.end()) {
+                index.emplace(entry.instanceId, entries.size());
+                entries.push_back(std::move(entry));
+            } else if (op == "-" && it != index.end()) {
+                entries[it->second].instanceId.clear();
+                index.erase(it);
+            }
+        }
+    }
+
+    for (Entry& entry : entries) {
+        if (!entry.instanceId.empty()) {
+            ids_.insert(entry.instanceId);
+            waiting_.push_back(std::move(entry));
+        }
+    }
+    if (!RewriteJournal()) {
+        throw std::runtime_error("Cannot write ingest journal: " + options_.journalPath);
+    }
+    stats_.restored = waiting_.size();
+}
+
+// Replace the journal with one "+" line per pending entry, via a temporary
+// file so a crash leaves either the old or the new journal.
+bool IngestQueue::RewriteJournal() {
+    const std::string rewritten = options_.journalPath + ".tmp";
+    {
+        std::ofstream out(rewritten, std::ios::trunc);
+        for (const auto& running : running_) {
+            out << "+ " << running.first << ' ' << running.second << '\n';
+        }
+        for (const std::deque<Entry>* queue : {&hot_, &waiting_}) {
+            for (const Entry& entry : *queue) {
+                out << "+ " << entry.instanceId << ' ' << entry.studyUid << '\n';
+            }
+        }
+        for (const auto& retry : retrying_) {
+            out << "+ " << retry.second.instanceId << ' ' << retry.second.studyUid << '\n';
+        }
+        if (!out.flush()) {
+            return false;
+        }
+    }
+    journal_.close();
+    const bool replaced = std::rename(rewritten.c_str(), options_.journalPath.c_str()) == 0;
+    journal_.clear();
+    journal_.open(options_.journalPath, std::ios::app);
+    journalRemovals_ = 0;
+    return replaced && journal_.is_open();
+}
+
+void IngestQueue::AppendJournal(char op, const Entry& entry) {
+    if (!journal_.is_open()) {
+        return;
+    }
+    journal_ << op << ' ' << entry.instanceId;
+    if (op == '+') {
+        journal_ << ' ' << entry.studyUid;
+    }
+    journal_ << '\n';
+    journal_.flush();
+    if (op == '-' && ++journalRemovals_ >= kRewriteAfterRemovals &&
+        journalRemovals_ > ids_.size()) {
+        RewriteJournal();   // on failure the appended journal is still valid
+    }
+}
+
+void IngestQueue::Stop() {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        threads.swap(threads_);
+    }
+    wake_.notify_all();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+bool IngestQueue::Push(const Entry& entry) {
+    if (entry.instanceId.empty()) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ids_.count(entry.instanceId)) {
+            return false;
+        }
+        if (waiting_.size() + hot_.size() + retrying_.size() >= options_.capacity) {
+            ++stats_.rejected;
+            return false;
+        }
+        ids_.insert(entry.instanceId);
+        AppendJournal('+', entry);
+        if (IsHot(entry.studyUid, Clock::now())) {
+            hot_.push_back(entry);
+        } else {
+            waiting_.push_back(entry);
+        }
+        ++stats_.queued;
+    }
+    wake_.notify_one();
+    return true;
+}
+
+bool IngestQueue::IsHot(const std::string& studyUid, Clock::time_point now) const {
+    if (studyUid.empty()) {
+        return false;
+    }
+    auto it = viewed_.find(studyUid);
+    return it != viewed_.end() && now - it->second < std::chrono::seconds(options_.hotSeconds);
+}
+
+void IngestQueue::MarkStudyViewed(const std::string& studyUid) {
+    if (studyUid.empty()) {
+        return;
+    }
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    const bool wasHot = IsHot(studyUid, now);
+    if (!wasHot && viewed_.size() >= kMaxViewedStudies) {
+        for (auto it = viewed_.begin(); it != viewed_.end();) {
+            it = IsHot(it->first, now) ? std::next(it) : viewed_.erase(it);
+        }
+        if (viewed_.size() >= kMaxViewedStudies) {
+            viewed_.clear();
+        }
+    }
+    viewed_[studyUid] = now;
+    if (wasHot) {
+        return;   // its entries were moved when it became hot
+    }
+    auto moved = std::stable_partition(waiting_.begin(), waiting_.end(),
+        [&](const Entry& e) { return e.studyUid != studyUid; });
+    std::move(moved, waiting_.end(), std::back_inserter(hot_));
+    waiting_.erase(moved, waiting_.end());
+}
+
+bool IngestQueue::Throttled() const {
+    // Foreground transcodes and decodes already occupy half the thread budget.
+    return load_.InFlightFrames() * 2 > load_.Budget();
+}
+
+// Count a failure of `entry`; unless that was its last attempt, park it
+// until its retry delay has passed and return true.
+bool IngestQueue::ScheduleRetry(Entry& entry) {
+    const uint32_t failures = ++failures_[entry.instanceId];
+    if (failures >= options_.maxAttempts) {
+        return false;
+    }
+    const auto delay = options_.retryDelay * (int64_t{1} << std::min<uint32_t>(failures - 1, 16));
+    retrying_.emplace(Clock::now() + delay, std::move(entry));
+    return true;
+}
+
+// Retries whose delay has passed go back to the end of their queue.
+void IngestQueue::PromoteRetries(Clock::time_point now) {
+    while (!retrying_.empty() && retrying_.begin()->first <= now) {
+        Entry entry = std::move(retrying_.begin()->second);
+        retrying_.erase(retrying_.begin());
+        (IsHot(entry.studyUid, now) ? hot_ : waiting_).push_back(std::move(entry));
+    }
+}
+
+void IngestQueue::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        PromoteRetries(Clock::now());
+        if (stopping_) {
+            return;
+        }
+        if (waiting_.empty() && hot_.empty()) {
+            if (retrying_.empty()) {
+                wake_.wait(lock);
+            } else {
+                wake_.wait_until(lock, retrying_.begin()->first);
+            }
+            continue;
+        }
+        if (Throttled()) {
+            wake_.wait_for(lock, kThrottlePoll);
+            continue;
+        }
+        if (options_.mayStart && !options_.mayStart()) {
+            wake_.wait_for(lock, kSchedulePoll);
+            continue;
+        }
+        const Clock::time_point now = Clock::now();
+        if (options_.ratePerSecond > 0.0) {
+            if (now < nextStart_) {
+                wake_.wait_until(lock, nextStart_);
+                continue;
+            }
+            nextStart_ = std::max(nextStart_, now) +
+                std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(1.0 / options_.ratePerSecond));
+        }
+
+        std::deque<Entry>& from = hot_.empty() ? waiting_ : hot_;
+        Entry entry = std::move(from.front());
+        from.pop_front();
+        running_.emplace(entry.instanceId, entry.studyUid);
+        lock.unlock();
+
+        const Clock::time_point started = Clock::now();
+        Outcome outcome = Outcome::Skipped;
+        bool failed = false;
+        try {
+            outcome = worker_(entry);
+        } catch (const std::exception&) {
+            // The worker has logged it; the instance stays as stored for now.
+            failed = true;
+        }
+        const Clock::duration busy = Clock::now() - started;
+
+        lock.lock();
+        running_.erase(entry.instanceId);
+        if (failed && stopping_) {
+            // Most likely Orthanc shutting down under it: retry next start.
+            waiting_.push_front(std::move(entry));
+            continue;
+        }
+        if (failed && ScheduleRetry(entry)) {
+            ++stats_.retried;
+        } else {
+            ids_.erase(entry.instanceId);
+            failures_.erase(entry.instanceId);
+            AppendJournal('-', entry);
+            if (failed) {
+                ++stats_.failed;
+            } else if (outcome == Outcome::Converted) {
+                ++stats_.converted;
+            } else {
+                ++stats_.skipped;
+            }
+        }
+        if (options_.cpuShare > 0.0 && options_.cpuShare < 1.0) {
+            // Idle long enough that busy / (busy + idle) == cpuShare.
+            const auto idle = std::chrono::duration_cast<Clock::duration>(
+                busy * (1.0 / options_.cpuShare - 1.0));
+            wake_.wait_for(lock, idle, [this] { return stopping_; });
+        }
+    }
+}
+
+IngestQueue::Stats IngestQueue::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats stats = stats_;
+    stats.pending = waiting_.size() + hot_.size() + retrying_.size();
+    stats.prioritised = hot_.size();
+    stats.retrying = retrying_.size();
+    stats.running = running_.size();
+    return stats;
+}
+
+}  // namespace orthanc_jxl
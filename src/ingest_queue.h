@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace orthanc_jxl {
+
+class LoadTracker;
+
+/**
+ * Persistent work queue for compressing instances after they are stored.
+ *
+ * Ingest accepts instances as sent and only records them here; a few
+ * background workers later hand each one to the `Worker` (fetch, transcode,
+ * replace), so C-STORE / STOW latency no longer includes the encode.
+ *
+ * - Bounded: Push() refuses new entries once `capacity` are pending, leaving
+ *   those instances as stored rather than stalling ingest.
+ * - Backpressure: no entry starts while foreground codec work fills half the
+ *   LoadTracker budget, and at most `workers` run at once.
+ * - Rate limit: at most `ratePerSecond` entries start per second (0 = no limit).
+ * - Priority: entries of a study marked viewed within the last `hotSeconds`
+ *   run before the rest, oldest first within each group.
+ * - Resumable: every push and completion is appended to a journal, replayed
+ *   (and compacted) by the constructor, so pending work survives a restart.
+ *   Entries that were running at shutdown run again.
+ * - Retries: an entry whose worker throws runs again after `retryDelay`,
+ *   doubling per failure, and is only dropped (left as stored) after
+ *   `maxAttempts` failures. Failure counts are not journaled: after a
+ *   restart an entry gets its full set of attempts again.
+ * - Schedule: optionally, entries only start while `mayStart` returns true
+ *   (e.g. inside configured hours), and each worker idles after an entry so
+ *   that it is busy at most `cpuShare` of the time.
+ *
+ * The same queue drives deferred high-effort recompression of stored JPEG XL
+ * instances, with its own journal and worker.
+ */
+class IngestQueue {
+public:
+    struct Entry {
+        std::string instanceId;   // Orthanc ID
+        std::string studyUid;     // StudyInstanceUID, for priority; may be empty
+    };
+
+    enum class Outcome {
+        Converted,   // replaced by its compressed form
+        Skipped,     // nothing to do (already compressed, deleted, ...)
+    };
+
+    // Runs on a queue worker thread; throws on failure. The entry is removed
+    // from the queue once it returns, or once it has failed maxAttempts
+    // times - the instance then stays as stored.
+    using Worker = std::function<Outcome(const Entry& entry)>;
+
+    struct Options {
+        std::string journalPath;       // empty = not persisted
+        size_t capacity = 100000;      // pending entries
+        double ratePerSecond = 0.0;    // 0 = unlimited
+        size_t workers = 1;
+        uint32_t hotSeconds = 600;
+        double cpuShare = 1.0;             // (0, 1]: busy fraction per worker
+        std::function<bool()> mayStart;    // empty = any time
+        uint32_t maxAttempts = 3;          // failures before an entry is dropped
+        std::chrono::milliseconds retryDelay{30000};   // first retry; doubles after
+    };
+
+    struct Stats {
+        uint64_t restored = 0;    // pending entries replayed from the journal
+        uint64_t queued = 0;      // accepted by Push()
+        uint64_t rejected = 0;    // refused by Push() because the queue was full
+        uint64_t converted = 0;
+        uint64_t skipped = 0;
+        uint64_t failed = 0;      // dropped after maxAttempts failures
+        uint64_t retried = 0;     // failures queued to run again
+        size_t pending = 0;       // waiting, including prioritised and retrying
+        size_t prioritised = 0;   // waiting, of a recently viewed study
+        size_t retrying = 0;      // waiting out a retry delay
+        size_t running = 0;
+    };
+
+    // Replays the journal; throws std::runtime_error if it cannot be opened.
+    // load must outlive the queue. Workers start with Start().
+    IngestQueue(const LoadTracker& load, Options options, Worker worker);
+
+    // Calls Stop().
+    ~IngestQueue();
+
+    IngestQueue(const IngestQueue&) = delete;
+    IngestQueue& operator=(const IngestQueue&) = delete;
+
+    void Start();
+
+    // Stops the workers after their current entry. Pending entries, and any
+    // that fail while stopping, stay in the journal for the next start; Push()
+    // still journals new ones.
+    void Stop();
+
+    // Queue an instance; false if it is already queued or the queue is full.
+    bool Push(const Entry& entry);
+
+    // A viewer opened this study: its pending instances move to the front.
+    void MarkStudyViewed(const std::string& studyUid);
+
+    Stats GetStats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void Replay();
+    bool RewriteJournal();
+    void AppendJournal(char op, const Entry& entry);
+    bool IsHot(const std::string& studyUid, Clock::time_point now) const;
+    bool Throttled() const;
+    bool ScheduleRetry(Entry& entry);
+    void PromoteRetries(Clock::time_point now);
+    void WorkerLoop();
+
+    const LoadTracker& load_;
+    const Options options_;
+    const Worker worker_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Entry> waiting_;
+    std::deque<Entry> hot_;                           // of recently viewed studies
+    std::multimap<Clock::time_point, Entry> retrying_;  // by when they run again
+    std::unordered_map<std::string, uint32_t> failures_;  // instanceId -> failures so far
+    std::unordered_set<std::string> ids_;             // waiting or running
+    std::unordered_map<std::string, std::string> running_;  // instanceId -> studyUid
+    std::unordered_map<std::string, Clock::time_point> viewed_;  // studyUid -> last view
+    Clock::time_point nextStart_{};                   // rate limit
+    std::ofstream journal_;
+    size_t journalRemovals_ = 0;                      // "-" lines since the last rewrite
+    std::vector<std::thread> threads_;
+    bool stopping_ = false;
+    Stats stats_;
+};
+
+}  // namespace orthanc_jxl
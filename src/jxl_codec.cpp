@@ -17,6 +17,9 @@
  */
 
 #include "jxl_codec.h"
+#include "buffer_pool.h"
+#include "cpu_time.h"
+#include "thread_pool.h"
 
 #include <jxl/encode.h>
 #include <jxl/encode_cxx.h>
@@ -24,6 +27,42 @@
 #include <jxl/decode_cxx.h>
 #include <jxl/thread_parallel_runner.h>
 #include <jxl/thread_parallel_runner_cxx.h>
+#include <jxl/version.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+// Chunked frame input and output processors arrived in libjxl 0.10.
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 10, 0)
+#define ORTHANC_JXL_HAVE_CHUNKED_ENCODE 1
+#else
+#define ORTHANC_JXL_HAVE_CHUNKED_ENCODE 0
+#endif
+
+// Input/output bit depth control (JXL_BIT_DEPTH_FROM_CODESTREAM) arrived in
+// libjxl 0.8.
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 8, 0)
+#define ORTHANC_JXL_HAVE_BIT_DEPTH 1
+#else
+#define ORTHANC_JXL_HAVE_BIT_DEPTH 0
+#endif
+
+// Progressive decode events (JXL_DEC_FRAME_PROGRESSION with a chosen detail
+// level) arrived in libjxl 0.7.
+#if JPEGXL_NUMERIC_VERSION >= JPEGXL_COMPUTE_NUMERIC_VERSION(0, 7, 0)
+#define ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL 1
+#else
+#define ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL 0
+#endif
 
 namespace orthanc_jxl {
 
@@ -97,6 +136,357 @@ void* GetThreadLocalRunner(size_t numThreads) {
     }
     return runner.get();
 }
+// The plugin-wide pool libjxl's jobs run on, when one is installed.
+std::atomic<ThreadPool*> g_sharedPool{nullptr};
+
+// JxlParallelRunner over the shared ThreadPool. Each call fans the job range
+// out to at most `participants` threads (pool workers plus the calling
+// thread), which pull job indices from a shared cursor. thread_id is the
+// participant slot, so per-thread scratch that libjxl sizes in init() stays
+// in range. CPU the pool workers spend is added to the caller's
+// DelegatedCpuNanos(), so stage spans see the whole cost of a codec call.
+struct PoolRunner {
+    ThreadPool* pool = nullptr;
+    size_t participants = 0;
+
+    static JxlParallelRetCode Run(void* runnerOpaque, void* jpegxlOpaque,
+                                  JxlParallelRunInit init, JxlParallelRunFunction func,
+                                  uint32_t startRange, uint32_t endRange) {
+        auto* self = static_cast<PoolRunner*>(runnerOpaque);
+        if (startRange > endRange) {
+            return JXL_PARALLEL_RET_RUNNER_ERROR;
+        }
+        if (startRange == endRange) {
+            return 0;
+        }
+        const size_t threads = std::min<size_t>(self->participants, endRange - startRange);
+        if (init(jpegxlOpaque, threads) != 0) {
+            return JXL_PARALLEL_RET_RUNNER_ERROR;
+        }
+        std::atomic<uint32_t> next{startRange};
+        std::atomic<int64_t> delegated{0};
+        const std::thread::id caller = std::this_thread::get_id();
+        ParallelFor(*self->pool, threads, [&](size_t threadId) {
+            const bool helper = std::this_thread::get_id() != caller;
+            const int64_t startCpu = helper ? ThreadCpuNanos() : 0;
+            for (;;) {
+                const uint32_t value = next.fetch_add(1, std::memory_order_relaxed);
+                if (value >= endRange) {
+                    break;
+                }
+                func(jpegxlOpaque, value, threadId);
+            }
+            if (helper) {
+                delegated.fetch_add(ThreadCpuNanos() - startCpu, std::memory_order_relaxed);
+            }
+        }, 1);
+        DelegatedCpuNanos() += delegated.load(std::memory_order_relaxed);
+        return 0;
+    }
+};
+
+// Parallel runner for one encode/decode call. With a shared pool installed,
+// libjxl's jobs run on it; otherwise on a thread-local JxlThreadParallelRunner.
+// Must outlive the encoder/decoder it is attached to, so declare it first.
+class CodecRunner {
+public:
+    explicit CodecRunner(int numWorkerThreads) {
+        if (numWorkerThreads >= 0 && numWorkerThreads <= 1) {
+            return;  // No runner; libjxl runs on the calling thread.
+        }
+        if (ThreadPool* pool = g_sharedPool.load(std::memory_order_acquire)) {
+            const size_t all = pool->Size() + 1;  // workers + this thread
+            pool_.pool = pool;
+            pool_.participants = (numWorkerThreads < 0)
+                ? all : std::min(all, static_cast<size_t>(numWorkerThreads));
+            fn_ = &PoolRunner::Run;
+            opaque_ = &pool_;
+            return;
+        }
+        // Reuse a thread-local parallel runner (avoids per-call pool churn)
+        opaque_ = GetThreadLocalRunner(ResolveThreadCount(numWorkerThreads));
+        fn_ = opaque_ ? JxlThreadParallelRunner : nullptr;
+    }
+
+    CodecRunner(const CodecRunner&) = delete;
+    CodecRunner& operator=(const CodecRunner&) = delete;
+
+    void Attach(JxlEncoder* encoder) {
+        if (fn_ && JxlEncoderSetParallelRunner(encoder, fn_, opaque_) != JXL_ENC_SUCCESS) {
+            throw JxlCodecError("Failed to set parallel runner");
+        }
+    }
+
+    void Attach(JxlDecoder* decoder) {
+        if (fn_ && JxlDecoderSetParallelRunner(decoder, fn_, opaque_) != JXL_DEC_SUCCESS) {
+            throw JxlCodecError("Failed to set parallel runner");
+        }
+    }
+
+private:
+    PoolRunner pool_;
+    JxlParallelRunner fn_ = nullptr;
+    void* opaque_ = nullptr;
+};
+
+// ----------------------------------------------------------------------------
+// Encoder / decoder reuse
+// ----------------------------------------------------------------------------
+
+struct GlobalCodecStats {
+    std::atomic<uint64_t> encodersCreated{0};
+    std::atomic<uint64_t> decodersCreated{0};
+    std::atomic<uint64_t> codecsReused{0};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> systemAllocations{0};
+    std::atomic<size_t> idleArenaBytes{0};  // cached by parked (idle) codecs
+};
+GlobalCodecStats g_stats;
+
+// Blocks idle codecs may keep cached across all threads. Orthanc runs many
+// HTTP threads and each keeps its own idle codecs, so without a process-wide
+// cap quiet threads would hold up to kMaxCachedBytes per codec indefinitely.
+constexpr size_t kMaxIdleArenaBytes = 32u << 20;
+
+// JxlMemoryManager over power-of-two size-class free lists. Each pooled
+// encoder/decoder owns one, so the blocks libjxl releases on Reset are handed
+// back on the next call instead of going through malloc again. libjxl also
+// allocates from runner threads, so the lists are locked; outside parallel
+// sections the lock is uncontended. Freed blocks are linked through their own
+// payload, so the callbacks never allocate or throw.
+class CodecArena {
+public:
+    CodecArena() = default;
+    CodecArena(const CodecArena&) = delete;
+    CodecArena& operator=(const CodecArena&) = delete;
+
+    ~CodecArena() {
+        Unpark();
+        Trim();
+    }
+
+    const JxlMemoryManager* Manager() const { return &manager_; }
+
+    // Account the cached blocks of an arena whose codec goes idle against
+    // kMaxIdleArenaBytes; an arena that would exceed it is emptied instead.
+    void Park() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (g_stats.idleArenaBytes.fetch_add(cachedBytes_, std::memory_order_relaxed) +
+                cachedBytes_ > kMaxIdleArenaBytes) {
+            g_stats.idleArenaBytes.fetch_sub(cachedBytes_, std::memory_order_relaxed);
+            TrimLocked();
+        }
+        parkedBytes_ = cachedBytes_;
+    }
+
+    // The codec is in use again (or destroyed): stop counting it as idle.
+    void Unpark() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        g_stats.idleArenaBytes.fetch_sub(parkedBytes_, std::memory_order_relaxed);
+        parkedBytes_ = 0;
+    }
+
+    // Fold this arena's counters into the process-wide stats.
+    void FlushStats() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        g_stats.allocations.fetch_add(allocations_, std::memory_order_relaxed);
+        g_stats.systemAllocations.fetch_add(systemAllocations_, std::memory_order_relaxed);
+        allocations_ = 0;
+        systemAllocations_ = 0;
+    }
+
+private:
+    static constexpr size_t kMinShift = 6;   // 64 B, room for the free-list link
+    static constexpr size_t kMaxShift = 20;  // 1 MiB; larger blocks bypass the arena
+    static constexpr size_t kClasses = kMaxShift - kMinShift + 1;
+    static constexpr size_t kLarge = kClasses;
+    // Cap on idle bytes per arena; beyond it frees go straight to the system.
+    static constexpr size_t kMaxCachedBytes = 4u << 20;
+
+    // Precedes every block; keeps the payload aligned as malloc would.
+    struct alignas(alignof(std::max_align_t)) Header {
+        size_t sizeClass;
+    };
+
+    static size_t ClassOf(size_t size) {
+        if (size > (size_t{1} << kMaxShift)) {
+            return kLarge;
+        }
+        size_t sizeClass = 0;
+        while ((size_t{1} << (kMinShift + sizeClass)) < size) {
+            ++sizeClass;
+        }
+        return sizeClass;
+    }
+
+    static size_t ClassBytes(size_t sizeClass) { return size_t{1} << (kMinShift + sizeClass); }
+
+    void Trim() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        TrimLocked();
+    }
+
+    void TrimLocked() {
+        for (void*& head : free_) {
+            while (head) {
+                void* next = *static_cast<void**>(head);
+                std::free(static_cast<Header*>(head) - 1);
+                head = next;
+            }
+        }
+        cachedBytes_ = 0;
+    }
+
+    static void* Alloc(void* opaque, size_t size) {
+        auto* self = static_cast<CodecArena*>(opaque);
+        const size_t sizeClass = ClassOf(size);
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            ++self->allocations_;
+            if (sizeClass != kLarge && self->free_[sizeClass]) {
+                void* block = self->free_[sizeClass];
+                self->free_[sizeClass] = *static_cast<void**>(block);
+                self->cachedBytes_ -= ClassBytes(sizeClass);
+                return block;
+            }
+            ++self->systemAllocations_;
+        }
+        const size_t bytes = (sizeClass == kLarge) ? size : ClassBytes(sizeClass);
+        if (bytes > SIZE_MAX - sizeof(Header)) {
+            return nullptr;
+        }
+        auto* header = static_cast<Header*>(std::malloc(sizeof(Header) + bytes));
+        if (!header) {
+            return nullptr;
+        }
+        header->sizeClass = sizeClass;
+        return header + 1;
+    }
+
+    static void Free(void* opaque, void* address) {
+        if (!address) {
+            return;
+        }
+        auto* self = static_cast<CodecArena*>(opaque);
+        Header* header = static_cast<Header*>(address) - 1;
+        const size_t sizeClass = header->sizeClass;
+        if (sizeClass != kLarge) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (self->cachedBytes_ + ClassBytes(sizeClass) <= kMaxCachedBytes) {
+                *static_cast<void**>(address) = self->free_[sizeClass];
+                self->free_[sizeClass] = address;
+                self->cachedBytes_ += ClassBytes(sizeClass);
+                return;
+            }
+        }
+        std::free(header);
+    }
+
+    JxlMemoryManager manager_{this, &CodecArena::Alloc, &CodecArena::Free};
+    std::mutex mutex_;
+    void* free_[kClasses] = {};
+    size_t cachedBytes_ = 0;
+    size_t parkedBytes_ = 0;   // cachedBytes_ counted in idleArenaBytes
+    uint64_t allocations_ = 0;
+    uint64_t systemAllocations_ = 0;
+};
+
+// An encoder/decoder together with the arena it allocates from. The arena is
+// declared first so it outlives the handle's final frees.
+struct PooledEncoder {
+    CodecArena arena;
+    JxlEncoderPtr handle{JxlEncoderMake(arena.Manager())};
+
+    static constexpr const char* kCreateError = "Failed to create JXL encoder";
+    static void CountCreated() { g_stats.encodersCreated.fetch_add(1, std::memory_order_relaxed); }
+    static void Reset(JxlEncoder* encoder) { JxlEncoderReset(encoder); }
+};
+
+struct PooledDecoder {
+    CodecArena arena;
+    JxlDecoderPtr handle{JxlDecoderMake(arena.Manager())};
+
+    static constexpr const char* kCreateError = "Failed to create JXL decoder";
+    static void CountCreated() { g_stats.decodersCreated.fetch_add(1, std::memory_order_relaxed); }
+    static void Reset(JxlDecoder* decoder) { JxlDecoderReset(decoder); }
+};
+
+// Borrows an encoder/decoder from the calling thread's idle list for one call
+// and resets it on the way back, which also drops the parallel runner and any
+// caller buffers. A thread can hold several at once: a pool worker waiting in
+// ParallelFor may pick up another frame's codec task, so a miss just creates
+// another object. Idle objects unused for kIdleTimeout are destroyed on the
+// thread's next call, and their cached blocks count against
+// kMaxIdleArenaBytes meanwhile. Declare after the CodecRunner it is attached to.
+template <typename Pooled>
+class CodecLease {
+public:
+    CodecLease() {
+        auto& idle = IdleList();
+        ExpireIdle(idle);
+        if (!idle.empty()) {
+            pooled_ = std::move(idle.back().pooled);
+            idle.pop_back();
+            pooled_->arena.Unpark();
+            g_stats.codecsReused.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        pooled_ = std::make_unique<Pooled>();
+        if (!pooled_->handle) {
+            throw JxlCodecError(Pooled::kCreateError);
+        }
+        Pooled::CountCreated();
+    }
+
+    ~CodecLease() {
+        Pooled::Reset(pooled_->handle.get());
+        pooled_->arena.FlushStats();
+        auto& idle = IdleList();
+        if (idle.size() < kMaxIdle) {
+            pooled_->arena.Park();
+            // Within reserved capacity, so this cannot throw.
+            idle.push_back({std::move(pooled_), std::chrono::steady_clock::now()});
+        }
+    }
+
+    CodecLease(const CodecLease&) = delete;
+    CodecLease& operator=(const CodecLease&) = delete;
+
+    auto* get() const { return pooled_->handle.get(); }
+
+private:
+    static constexpr size_t kMaxIdle = 2;
+    static constexpr std::chrono::seconds kIdleTimeout{60};
+
+    struct Idle {
+        std::unique_ptr<Pooled> pooled;
+        std::chrono::steady_clock::time_point since;
+    };
+
+    static std::vector<Idle>& IdleList() {
+        thread_local std::vector<Idle> idle = [] {
+            std::vector<Idle> list;
+            list.reserve(kMaxIdle);
+            return list;
+        }();
+        return idle;
+    }
+
+    // Entries are pushed in release order, so the stale ones are at the front.
+    static void ExpireIdle(std::vector<Idle>& idle) {
+        const auto cutoff = std::chrono::steady_clock::now() - kIdleTimeout;
+        size_t stale = 0;
+        while (stale < idle.size() && idle[stale].since < cutoff) {
+            ++stale;
+        }
+        idle.erase(idle.begin(), idle.begin() + stale);
+    }
+
+    std::unique_ptr<Pooled> pooled_;
+};
+
+using EncoderLease = CodecLease<PooledEncoder>;
+using DecoderLease = CodecLease<PooledDecoder>;
 } // anonymous namespace
 
 int JxlCodec::BytesPerPixel(PixelFormat format) { return GetFormatInfo(format).bytesPerPixel; }
@@ -111,52 +501,125 @@ PixelFormat JxlCodec::FormatFromImageInfo(const ImageInfo& info) {
     return (info.bitsPerSample <= 8) ? PixelFormat::RGB24 : PixelFormat::RGB48;
 }
 
+void JxlCodec::SetSharedPool(ThreadPool* pool) {
+    g_sharedPool.store(pool, std::memory_order_release);
+}
+
+CodecStats JxlCodec::Stats() {
+    CodecStats stats;
+    stats.encodersCreated = g_stats.encodersCreated.load(std::memory_order_relaxed);
+    stats.decodersCreated = g_stats.decodersCreated.load(std::memory_order_relaxed);
+    stats.codecsReused = g_stats.codecsReused.load(std::memory_order_relaxed);
+    stats.allocations = g_stats.allocations.load(std::memory_order_relaxed);
+    stats.systemAllocations = g_stats.systemAllocations.load(std::memory_order_relaxed);
+    stats.idleArenaBytes = g_stats.idleArenaBytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+bool JxlCodec::HasSignature(const uint8_t* data, size_t size) {
+    const JxlSignature sig = JxlSignatureCheck(data, size);
+    return sig == JXL_SIG_CODESTREAM || sig == JXL_SIG_CONTAINER;
+}
+
 static JxlDataType ToJxlDataType(PixelFormat format) {
     return GetFormatInfo(format).jxlType;
 }
 
+// Smallest first output allocation.
+constexpr size_t kMinEncodeOutput = 64 * 1024;
+
+// Key for the shared buffer pool's size predictions: frames with the same
+// geometry and settings (one modality, one config) compress to similar sizes.
+static uint64_t EncodedSizeKey(uint32_t width, uint32_t height, PixelFormat format,
+                               const EncodeOptions& options) {
+    uint32_t distanceBits;
+    std::memcpy(&distanceBits, &options.distance, sizeof(distanceBits));
+    const uint64_t fields[] = {
+        width, height, static_cast<uint64_t>(format), static_cast<uint64_t>(options.mode),
+        static_cast<uint64_t>(options.effort), static_cast<uint64_t>(options.progressiveDC),
+        static_cast<uint64_t>(options.progressiveAC), distanceBits, options.bitsStored,
+    };
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint64_t field : fields) {
+        h ^= field;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// First output allocation for an encode: the last size seen for this key plus
+// headroom when a buffer pool is installed, otherwise the historical 64 KB.
+static size_t PredictEncodedSize(uint64_t key, size_t inputSize) {
+    BufferPool* buffers = BufferPool::Shared();
+    if (!buffers) {
+        return kMinEncodeOutput;
+    }
+    return buffers->PredictSize(key, std::max(kMinEncodeOutput, inputSize / 4));
+}
+
+static void RecordEncodedSize(uint64_t key, size_t size) {
+    if (BufferPool* buffers = BufferPool::Shared()) {
+        buffers->RecordSize(key, size);
+    }
+}
+
+// Run a closed-input encoder to completion and return the bitstream.
+static std::vector<uint8_t> DrainEncoderOutput(JxlEncoder* encoder, size_t initialSize) {
+    std::vector<uint8_t> result = AcquireBuffer(initialSize);
+    result.resize(initialSize);
+    uint8_t* nextOut = result.data();
+    size_t availOut = result.size();
+
+    while (true) {
+        JxlEncoderStatus status = JxlEncoderProcessOutput(encoder, &nextOut, &availOut);
+
+        if (status == JXL_ENC_SUCCESS) {
+            size_t actualSize = result.size() - availOut;
+            result.resize(actualSize);
+            break;
+        } else if (status == JXL_ENC_NEED_MORE_OUTPUT) {
+            size_t bytesWritten = result.size() - availOut;
+            result.resize(result.size() * 2);
+            nextOut = result.data() + bytesWritten;
+            availOut = result.size() - bytesWritten;
+        } else {
+            throw JxlCodecError("Encoding failed with error: " + std::to_string(static_cast<int>(status)));
+        }
+    }
+
+    return result;
+}
+
 // ============================================================================
 // Encoding
 // ============================================================================
 
-std::vector<uint8_t> JxlCodec::Encode(
-    const void* pixelData,
+// Set basic info, colour encoding and per-mode frame settings shared by the
+// buffered and streaming encoders.
+static JxlEncoderFrameSettings* ConfigureEncoder(
+    JxlEncoder* encoder,
     uint32_t width,
     uint32_t height,
     PixelFormat format,
-    const EncodeOptions& options,
-    int numWorkerThreads)
+    const EncodeOptions& options)
 {
-    // Create encoder with RAII wrapper
-    auto encoder = JxlEncoderMake(nullptr);
-    if (!encoder) {
-        throw JxlCodecError("Failed to create JXL encoder");
-    }
-
-    // Reuse a thread-local parallel runner (avoids per-call pool churn)
-    void* runner = GetThreadLocalRunner(ResolveThreadCount(numWorkerThreads));
-    if (runner) {
-        if (JxlEncoderSetParallelRunner(encoder.get(),
-                                        JxlThreadParallelRunner,
-                                        runner) != JXL_ENC_SUCCESS) {
-            throw JxlCodecError("Failed to set parallel runner");
-        }
-    }
-
     // Set up basic info
     JxlBasicInfo basicInfo;
     JxlEncoderInitBasicInfo(&basicInfo);
 
     basicInfo.xsize = width;
     basicInfo.ysize = height;
-    basicInfo.bits_per_sample = BitsPerSample(format);
+    const uint32_t formatBits = JxlCodec::BitsPerSample(format);
+    const bool reducedDepth = ORTHANC_JXL_HAVE_BIT_DEPTH &&
+        options.bitsStored > 0 && options.bitsStored < formatBits;
+    basicInfo.bits_per_sample = reducedDepth ? options.bitsStored : formatBits;
     basicInfo.exponent_bits_per_sample = 0;  // Integer samples
     basicInfo.uses_original_profile = JXL_TRUE;  // Preserve values for medical imaging
-    basicInfo.num_color_channels = IsGrayscale(format) ? 1 : 3;
+    basicInfo.num_color_channels = JxlCodec::IsGrayscale(format) ? 1 : 3;
     basicInfo.num_extra_channels = 0;
     basicInfo.alpha_bits = 0;
 
-    if (JxlEncoderSetBasicInfo(encoder.get(), &basicInfo) != JXL_ENC_SUCCESS) {
+    if (JxlEncoderSetBasicInfo(encoder, &basicInfo) != JXL_ENC_SUCCESS) {
         throw JxlCodecError("Failed to set basic info");
     }
 
@@ -172,7 +635,7 @@ std::vector<uint8_t> JxlCodec::Encode(
     // libjxl requires a known transfer function here (UNKNOWN is rejected when
     // uses_original_profile is set). Use RELATIVE (colorimetric) intent, which
     // suits measured data better than PERCEPTUAL.
-    const bool gray = IsGrayscale(format);
+    const bool gray = JxlCodec::IsGrayscale(format);
     JxlColorEncoding colorEncoding = {};
     colorEncoding.color_space = gray ? JXL_COLOR_SPACE_GRAY : JXL_COLOR_SPACE_RGB;
     colorEncoding.white_point = JXL_WHITE_POINT_D65;
@@ -181,16 +644,27 @@ std::vector<uint8_t> JxlCodec::Encode(
         gray ? JXL_TRANSFER_FUNCTION_LINEAR : JXL_TRANSFER_FUNCTION_SRGB;
     colorEncoding.rendering_intent = JXL_RENDERING_INTENT_RELATIVE;
 
-    if (JxlEncoderSetColorEncoding(encoder.get(), &colorEncoding) != JXL_ENC_SUCCESS) {
+    if (JxlEncoderSetColorEncoding(encoder, &colorEncoding) != JXL_ENC_SUCCESS) {
         throw JxlCodecError("Failed to set color encoding");
     }
 
     // Create frame settings
-    JxlEncoderFrameSettings* frameSettings = JxlEncoderFrameSettingsCreate(encoder.get(), nullptr);
+    JxlEncoderFrameSettings* frameSettings = JxlEncoderFrameSettingsCreate(encoder, nullptr);
     if (!frameSettings) {
         throw JxlCodecError("Failed to create frame settings");
     }
 
+#if ORTHANC_JXL_HAVE_BIT_DEPTH
+    // By default libjxl rescales 16-bit input to the codestream depth; take
+    // the samples as already being in [0, 2^bits_per_sample) instead.
+    if (reducedDepth) {
+        JxlBitDepth bitDepth = {JXL_BIT_DEPTH_FROM_CODESTREAM, 0, 0};
+        if (JxlEncoderSetFrameBitDepth(frameSettings, &bitDepth) != JXL_ENC_SUCCESS) {
+            throw JxlCodecError("Failed to set input bit depth");
+        }
+    }
+#endif
+
     // Configure based on encoding mode
     switch (options.mode) {
         case EncodeMode::Lossless:
@@ -243,6 +717,26 @@ std::vector<uint8_t> JxlCodec::Encode(
     // Set effort level
     JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_EFFORT, options.effort);
 
+    return frameSettings;
+}
+
+std::vector<uint8_t> JxlCodec::Encode(
+    const void* pixelData,
+    uint32_t width,
+    uint32_t height,
+    PixelFormat format,
+    const EncodeOptions& options,
+    int numWorkerThreads)
+{
+    CodecRunner runner(numWorkerThreads);
+
+    // Recycled encoder, reset when the call returns
+    EncoderLease encoder;
+    runner.Attach(encoder.get());
+
+    JxlEncoderFrameSettings* frameSettings =
+        ConfigureEncoder(encoder.get(), width, height, format, options);
+
     // Set up pixel format
     JxlPixelFormat pixelFormat = {};
     pixelFormat.num_channels = NumChannels(format);
@@ -261,29 +755,228 @@ std::vector<uint8_t> JxlCodec::Encode(
     // Close input
     JxlEncoderCloseInput(encoder.get());
 
-    // Process output
-    std::vector<uint8_t> result(64 * 1024);  // Start with 64KB
-    uint8_t* nextOut = result.data();
-    size_t availOut = result.size();
+    const uint64_t sizeKey = EncodedSizeKey(width, height, format, options);
+    std::vector<uint8_t> encoded =
+        DrainEncoderOutput(encoder.get(), PredictEncodedSize(sizeKey, inputSize));
+    RecordEncodedSize(sizeKey, encoded.size());
+    return encoded;
+}
 
-    while (true) {
-        JxlEncoderStatus status = JxlEncoderProcessOutput(encoder.get(), &nextOut, &availOut);
+// ============================================================================
+// Streaming encoding
+// ============================================================================
 
-        if (status == JXL_ENC_SUCCESS) {
-            size_t actualSize = result.size() - availOut;
-            result.resize(actualSize);
-            break;
-        } else if (status == JXL_ENC_NEED_MORE_OUTPUT) {
-            size_t bytesWritten = result.size() - availOut;
-            result.resize(result.size() * 2);
-            nextOut = result.data() + bytesWritten;
-            availOut = result.size() - bytesWritten;
-        } else {
-            throw JxlCodecError("Encoding failed with error: " + std::to_string(static_cast<int>(status)));
+#if ORTHANC_JXL_HAVE_CHUNKED_ENCODE
+namespace {
+
+// JxlChunkedFrameInputSource over a StreamingSource. libjxl may request
+// regions from several runner threads at once, so scratch buffers are
+// tracked under a lock. Callbacks must not throw into libjxl: failures are
+// recorded and reported as a null buffer.
+class ChunkedInput {
+public:
+    ChunkedInput(const StreamingSource& source, PixelFormat format)
+        : source_(source), bytesPerPixel_(JxlCodec::BytesPerPixel(format)) {
+        pixelFormat_.num_channels = JxlCodec::NumChannels(format);
+        pixelFormat_.data_type = ToJxlDataType(format);
+        pixelFormat_.endianness = JXL_NATIVE_ENDIAN;
+        pixelFormat_.align = 0;
+    }
+
+    JxlChunkedFrameInputSource Source() {
+        JxlChunkedFrameInputSource src = {};
+        src.opaque = this;
+        src.get_color_channels_pixel_format = &GetPixelFormat;
+        src.get_color_channel_data_at = &GetDataAt;
+        src.get_extra_channel_pixel_format = &GetExtraPixelFormat;
+        src.get_extra_channel_data_at = &GetExtraDataAt;
+        src.release_buffer = &Release;
+        return src;
+    }
+
+    bool Failed() const { return failed_.load(std::memory_order_relaxed); }
+
+private:
+    static void GetPixelFormat(void* opaque, JxlPixelFormat* format) {
+        *format = static_cast<ChunkedInput*>(opaque)->pixelFormat_;
+    }
+
+    static const void* GetDataAt(void* opaque, size_t x, size_t y,
+                                 size_t xsize, size_t ysize, size_t* rowOffset) {
+        auto* self = static_cast<ChunkedInput*>(opaque);
+        const size_t pixelBytes = static_cast<size_t>(self->bytesPerPixel_);
+        if (!self->source_.read) {
+            *rowOffset = self->source_.stride;
+            return self->source_.data + y * self->source_.stride + x * pixelBytes;
+        }
+        try {
+            auto scratch = std::make_unique<uint8_t[]>(xsize * ysize * pixelBytes);
+            self->source_.read(x, y, xsize, ysize, scratch.get());
+            *rowOffset = xsize * pixelBytes;
+            const void* region = scratch.get();
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            self->scratch_.emplace(region, std::move(scratch));
+            return region;
+        } catch (...) {
+            self->failed_.store(true, std::memory_order_relaxed);
+            return nullptr;
         }
     }
 
-    return result;
+    static void GetExtraPixelFormat(void*, size_t, JxlPixelFormat*) {}
+
+    static const void* GetExtraDataAt(void*, size_t, size_t, size_t, size_t, size_t,
+                                      size_t*) {
+        return nullptr;  // no extra channels are declared
+    }
+
+    static void Release(void* opaque, const void* buf) {
+        auto* self = static_cast<ChunkedInput*>(opaque);
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        self->scratch_.erase(buf);  // no-op for in-place regions
+    }
+
+    const StreamingSource& source_;
+    const int bytesPerPixel_;
+    JxlPixelFormat pixelFormat_ = {};
+    std::mutex mutex_;
+    std::unordered_map<const void*, std::unique_ptr<uint8_t[]>> scratch_;
+    std::atomic<bool> failed_{false};  // set from runner threads
+};
+
+// JxlEncoderOutputProcessor writing into a growable vector. libjxl seeks back
+// to patch section sizes, so the high-water mark, not the cursor, is the end.
+class ChunkedOutput {
+public:
+    explicit ChunkedOutput(size_t initialCapacity) : data_(AcquireBuffer(initialCapacity)) {}
+
+    JxlEncoderOutputProcessor Processor() {
+        JxlEncoderOutputProcessor proc = {};
+        proc.opaque = this;
+        proc.get_buffer = &GetBuffer;
+        proc.release_buffer = &ReleaseBuffer;
+        proc.seek = &Seek;
+        proc.set_finalized_position = &SetFinalizedPosition;
+        return proc;
+    }
+
+    std::vector<uint8_t> Take() {
+        data_.resize(end_);
+        return std::move(data_);
+    }
+
+    bool Failed() const { return failed_; }
+
+private:
+    static void* GetBuffer(void* opaque, size_t* size) {
+        auto* self = static_cast<ChunkedOutput*>(opaque);
+        const size_t need = self->position_ + *size;
+        try {
+            if (need > self->data_.size()) {
+                self->data_.resize(std::max(need, self->data_.size() + self->data_.size() / 2));
+            }
+        } catch (...) {
+            self->failed_ = true;
+            return nullptr;
+        }
+        return self->data_.data() + self->position_;
+    }
+
+    static void ReleaseBuffer(void* opaque, size_t written) {
+        auto* self = static_cast<ChunkedOutput*>(opaque);
+        self->position_ += written;
+        self->end_ = std::max(self->end_, self->position_);
+    }
+
+    static void Seek(void* opaque, uint64_t position) {
+        static_cast<ChunkedOutput*>(opaque)->position_ = static_cast<size_t>(position);
+    }
+
+    static void SetFinalizedPosition(void*, uint64_t) {}
+
+    std::vector<uint8_t> data_;
+    size_t position_ = 0;
+    size_t end_ = 0;
+    bool failed_ = false;
+};
+
+}  // namespace
+#endif  // ORTHANC_JXL_HAVE_CHUNKED_ENCODE
+
+bool JxlCodec::SupportsStreamingEncode() {
+    return ORTHANC_JXL_HAVE_CHUNKED_ENCODE != 0;
+}
+
+bool JxlCodec::SupportsReducedBitDepth() {
+    return ORTHANC_JXL_HAVE_BIT_DEPTH != 0;
+}
+
+std::vector<uint8_t> JxlCodec::EncodeStreaming(
+    const StreamingSource& source,
+    uint32_t width,
+    uint32_t height,
+    PixelFormat format,
+    const EncodeOptions& options,
+    int numWorkerThreads)
+{
+    const size_t rowBytes = static_cast<size_t>(width) * BytesPerPixel(format);
+    if (!source.read && (!source.data || source.stride < rowBytes)) {
+        throw JxlCodecError("Invalid streaming encode source");
+    }
+
+#if ORTHANC_JXL_HAVE_CHUNKED_ENCODE
+    CodecRunner runner(numWorkerThreads);
+    EncoderLease encoder;
+    runner.Attach(encoder.get());
+
+    JxlEncoderFrameSettings* frameSettings =
+        ConfigureEncoder(encoder.get(), width, height, format, options);
+
+    // Stream input and output for anything larger than one group. libjxl
+    // silently falls back to buffering the whole frame for settings it cannot
+    // stream, which include responsive (progressive) modular, progressive
+    // DC/AC and custom group order, so those are turned off here: streamed
+    // frames are stored as plain (non-progressive) lossless or VarDCT.
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_BUFFERING, 2);
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_RESPONSIVE, 0);
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_PROGRESSIVE_DC, 0);
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_PROGRESSIVE_AC, 0);
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_QPROGRESSIVE_AC, 0);
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_GROUP_ORDER, 0);
+
+    const uint64_t sizeKey = EncodedSizeKey(width, height, format, options);
+    ChunkedOutput output(PredictEncodedSize(sizeKey, rowBytes * height));
+    if (JxlEncoderSetOutputProcessor(encoder.get(), output.Processor()) != JXL_ENC_SUCCESS) {
+        throw JxlCodecError("Failed to set output processor");
+    }
+
+    ChunkedInput input(source, format);
+    if (JxlEncoderAddChunkedFrame(frameSettings, JXL_TRUE, input.Source()) != JXL_ENC_SUCCESS) {
+        throw JxlCodecError(input.Failed() ? "Failed to read pixel region"
+                                           : "Failed to add chunked frame");
+    }
+    JxlEncoderCloseInput(encoder.get());
+    if (JxlEncoderFlushInput(encoder.get()) != JXL_ENC_SUCCESS || output.Failed()) {
+        throw JxlCodecError("Streaming encode failed");
+    }
+    std::vector<uint8_t> encoded = output.Take();
+    RecordEncodedSize(sizeKey, encoded.size());
+    return encoded;
+#else
+    // No chunked API: materialize one interleaved, tightly packed frame.
+    if (!source.read && source.stride == rowBytes) {
+        return Encode(source.data, width, height, format, options, numWorkerThreads);
+    }
+    std::vector<uint8_t> frame(rowBytes * height);
+    if (source.read) {
+        source.read(0, 0, width, height, frame.data());
+    } else {
+        for (uint32_t y = 0; y < height; ++y) {
+            std::memcpy(frame.data() + y * rowBytes, source.data + y * source.stride, rowBytes);
+        }
+    }
+    return Encode(frame.data(), width, height, format, options, numWorkerThreads);
+#endif
 }
 
 std::vector<uint8_t> JxlCodec::EncodeLossless(
@@ -301,15 +994,132 @@ std::vector<uint8_t> JxlCodec::EncodeProgressiveLossless(
                   EncodeOptions::ProgressiveLossless(effort, centerX, centerY));
 }
 
+// ============================================================================
+// JPEG recompression
+// ============================================================================
+
+std::vector<uint8_t> JxlCodec::RecompressJpeg(
+    const uint8_t* jpegData, size_t size,
+    int effort,
+    int numWorkerThreads)
+{
+    CodecRunner runner(numWorkerThreads);
+    EncoderLease encoder;
+    runner.Attach(encoder.get());
+
+    // The reconstruction data lives in a 'jbrd' box, so the container format
+    // is required. Basic info and colour encoding come from the JPEG itself.
+    if (JxlEncoderUseContainer(encoder.get(), JXL_TRUE) != JXL_ENC_SUCCESS ||
+        JxlEncoderStoreJPEGMetadata(encoder.get(), JXL_TRUE) != JXL_ENC_SUCCESS) {
+        throw JxlCodecError("Failed to enable JPEG reconstruction");
+    }
+
+    JxlEncoderFrameSettings* frameSettings = JxlEncoderFrameSettingsCreate(encoder.get(), nullptr);
+    if (!frameSettings) {
+        throw JxlCodecError("Failed to create frame settings");
+    }
+    JxlEncoderFrameSettingsSetOption(frameSettings, JXL_ENC_FRAME_SETTING_EFFORT, effort);
+
+    // The DCT coefficients are carried over unchanged; this fails for JPEG
+    // features libjxl cannot represent (arithmetic coding, 12-bit, lossless).
+    if (JxlEncoderAddJPEGFrame(frameSettings, jpegData, size) != JXL_ENC_SUCCESS) {
+        throw JxlCodecError("JPEG bitstream cannot be recompressed losslessly");
+    }
+
+    JxlEncoderCloseInput(encoder.get());
+    // Recompressed JPEGs are ~20% smaller, so the input size rarely grows.
+    return DrainEncoderOutput(encoder.get(), std::max(kMinEncodeOutput, size));
+}
+
+std::vector<uint8_t> JxlCodec::ReconstructJpeg(const uint8_t* data, size_t size)
+{
+    DecoderLease decoder;
+
+    // Subscribing to FULL_IMAGE without ever setting a pixel buffer means the
+    // image is only ever emitted as JPEG; no pixels are decoded.
+    if (JxlDecoderSubscribeEvents(decoder.get(),
+            JXL_DEC_JPEG_RECONSTRUCTION | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to subscribe to decoder events");
+    }
+
+    if (JxlDecoderSetInput(decoder.get(), data, size) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to set decoder input");
+    }
+
+    // Recompressed JPEGs are ~20% smaller than the original, so start a bit
+    // above the input size and grow on demand.
+    std::vector<uint8_t> jpeg = AcquireBuffer(size + size / 4 + 4096);
+    jpeg.resize(size + size / 4 + 4096);
+    bool haveReconstruction = false;
+
+    while (true) {
+        JxlDecoderStatus status = JxlDecoderProcessInput(decoder.get());
+
+        switch (status) {
+            case JXL_DEC_JPEG_RECONSTRUCTION:
+                if (JxlDecoderSetJPEGBuffer(decoder.get(), jpeg.data(), jpeg.size())
+                    != JXL_DEC_SUCCESS) {
+                    throw JxlCodecError("Failed to set JPEG output buffer");
+                }
+                haveReconstruction = true;
+                break;
+
+            case JXL_DEC_JPEG_NEED_MORE_OUTPUT: {
+                const size_t written = jpeg.size() - JxlDecoderReleaseJPEGBuffer(decoder.get());
+                jpeg.resize(jpeg.size() * 2);
+                if (JxlDecoderSetJPEGBuffer(decoder.get(), jpeg.data() + written,
+                                            jpeg.size() - written) != JXL_DEC_SUCCESS) {
+                    throw JxlCodecError("Failed to set JPEG output buffer");
+                }
+                break;
+            }
+
+            case JXL_DEC_NEED_IMAGE_OUT_BUFFER:
+                // Only reached when there is no reconstruction data to emit.
+                throw JxlCodecError("JXL bitstream has no JPEG reconstruction data");
+
+            case JXL_DEC_FULL_IMAGE:
+            case JXL_DEC_SUCCESS: {
+                if (!haveReconstruction) {
+                    throw JxlCodecError("JXL bitstream has no JPEG reconstruction data");
+                }
+                jpeg.resize(jpeg.size() - JxlDecoderReleaseJPEGBuffer(decoder.get()));
+                return jpeg;
+            }
+
+            case JXL_DEC_ERROR:
+                throw JxlCodecError("Decoder error");
+
+            case JXL_DEC_NEED_MORE_INPUT:
+                throw JxlCodecError("Incomplete JXL data");
+
+            default:
+                break;
+        }
+    }
+}
+
+// Return integer samples at the codestream's stored depth rather than
+// rescaled to the output type, so reduced-depth frames decode to their
+// original values. Identical to the default for full-depth codestreams.
+// Must follow JxlDecoderSetImageOutBuffer.
+static void UseCodestreamBitDepth(JxlDecoder* decoder) {
+#if ORTHANC_JXL_HAVE_BIT_DEPTH
+    JxlBitDepth bitDepth = {JXL_BIT_DEPTH_FROM_CODESTREAM, 0, 0};
+    if (JxlDecoderSetImageOutBitDepth(decoder, &bitDepth) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to set output bit depth");
+    }
+#else
+    (void)decoder;
+#endif
+}
+
 // ============================================================================
 // Decoding - Info only
 // ============================================================================
 
 ImageInfo JxlCodec::DecodeInfo(const uint8_t* data, size_t size) {
-    auto decoder = JxlDecoderMake(nullptr);
-    if (!decoder) {
-        throw JxlCodecError("Failed to create JXL decoder");
-    }
+    DecoderLease decoder;
 
     if (JxlDecoderSubscribeEvents(decoder.get(), JXL_DEC_BASIC_INFO) != JXL_DEC_SUCCESS) {
         throw JxlCodecError("Failed to subscribe to decoder events");
@@ -356,16 +1166,9 @@ std::vector<uint8_t> JxlCodec::Decode(
     PixelFormat outputFormat,
     int numWorkerThreads)
 {
-    auto decoder = JxlDecoderMake(nullptr);
-    if (!decoder) {
-        throw JxlCodecError("Failed to create JXL decoder");
-    }
-
-    // Reuse a thread-local parallel runner (avoids per-call pool churn)
-    void* runner = GetThreadLocalRunner(ResolveThreadCount(numWorkerThreads));
-    if (runner) {
-        JxlDecoderSetParallelRunner(decoder.get(), JxlThreadParallelRunner, runner);
-    }
+    CodecRunner runner(numWorkerThreads);
+    DecoderLease decoder;
+    runner.Attach(decoder.get());
 
     if (JxlDecoderSubscribeEvents(decoder.get(),
             JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
@@ -415,6 +1218,7 @@ std::vector<uint8_t> JxlCodec::Decode(
                                                     result.data(), result.size()) != JXL_DEC_SUCCESS) {
                         throw JxlCodecError("Failed to set output buffer");
                     }
+                    UseCodestreamBitDepth(decoder.get());
                     outputBufferSet = true;
                 }
                 break;
@@ -447,12 +1251,112 @@ std::vector<uint8_t> JxlCodec::Decode(
     return Decode(jxlData.data(), jxlData.size(), outputFormat, numWorkerThreads);
 }
 
+ImageInfo JxlCodec::DecodeInto(
+    const uint8_t* data, size_t size,
+    const DecodeAllocator& allocate,
+    int numWorkerThreads)
+{
+    CodecRunner runner(numWorkerThreads);
+    DecoderLease decoder;
+    runner.Attach(decoder.get());
+
+    if (JxlDecoderSubscribeEvents(decoder.get(),
+            JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to subscribe to decoder events");
+    }
+
+    if (JxlDecoderSetInput(decoder.get(), data, size) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to set decoder input");
+    }
+
+    ImageInfo info;
+    DecodeTarget target;
+    bool haveInfo = false;
+    bool outputBufferSet = false;
+    JxlPixelFormat pixelFormat = {};
+
+    while (true) {
+        JxlDecoderStatus status = JxlDecoderProcessInput(decoder.get());
+
+        switch (status) {
+            case JXL_DEC_BASIC_INFO: {
+                JxlBasicInfo basicInfo;
+                if (JxlDecoderGetBasicInfo(decoder.get(), &basicInfo) != JXL_DEC_SUCCESS) {
+                    throw JxlCodecError("Failed to get basic info");
+                }
+                info.width = basicInfo.xsize;
+                info.height = basicInfo.ysize;
+                info.bitsPerSample = basicInfo.bits_per_sample;
+                info.numChannels = basicInfo.num_color_channels;
+                info.isGrayscale = (basicInfo.num_color_channels == 1);
+
+                const PixelFormat format = FormatFromImageInfo(info);
+                target = allocate(info, format);
+                const size_t rowBytes = static_cast<size_t>(info.width) * BytesPerPixel(format);
+                if (!target.data || target.stride < rowBytes) {
+                    throw JxlCodecError("Invalid decode target");
+                }
+
+                // align == stride makes libjxl place row y at y * stride.
+                pixelFormat.num_channels = NumChannels(format);
+                pixelFormat.data_type = ToJxlDataType(format);
+                pixelFormat.endianness = JXL_NATIVE_ENDIAN;
+                pixelFormat.align = target.stride;
+                haveInfo = true;
+                break;
+            }
+
+            case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
+                if (!haveInfo) {
+                    throw JxlCodecError("Image data before basic info");
+                }
+                if (!outputBufferSet) {
+                    size_t requiredSize;
+                    if (JxlDecoderImageOutBufferSize(decoder.get(), &pixelFormat, &requiredSize) != JXL_DEC_SUCCESS) {
+                        throw JxlCodecError("Failed to get output buffer size");
+                    }
+                    if (JxlDecoderSetImageOutBuffer(decoder.get(), &pixelFormat,
+                                                    target.data, requiredSize) != JXL_DEC_SUCCESS) {
+                        throw JxlCodecError("Failed to set output buffer");
+                    }
+                    UseCodestreamBitDepth(decoder.get());
+                    outputBufferSet = true;
+                }
+                break;
+            }
+
+            case JXL_DEC_FULL_IMAGE:
+            case JXL_DEC_SUCCESS:
+                if (!outputBufferSet) {
+                    throw JxlCodecError("No image decoded");
+                }
+                return info;
+
+            case JXL_DEC_ERROR:
+                throw JxlCodecError("Decoder error");
+
+            case JXL_DEC_NEED_MORE_INPUT:
+                throw JxlCodecError("Incomplete JXL data");
+
+            default:
+                // Continue processing other events
+                break;
+        }
+    }
+}
+
 std::pair<std::vector<uint8_t>, ImageInfo> JxlCodec::Decode(
     const uint8_t* data, size_t size,
     int numWorkerThreads)
 {
-    ImageInfo info = DecodeInfo(data, size);
-    std::vector<uint8_t> pixels = Decode(data, size, FormatFromImageInfo(info), numWorkerThreads);
+    std::vector<uint8_t> pixels;
+    ImageInfo info = DecodeInto(data, size,
+        [&pixels](const ImageInfo& i, PixelFormat format) {
+            const size_t rowBytes = static_cast<size_t>(i.width) * BytesPerPixel(format);
+            pixels.resize(rowBytes * i.height);
+            return DecodeTarget{pixels.data(), rowBytes};
+        },
+        numWorkerThreads);
     return {std::move(pixels), info};
 }
 
@@ -463,4 +1367,152 @@ std::pair<std::vector<uint8_t>, ImageInfo> JxlCodec::Decode(
     return Decode(jxlData.data(), jxlData.size(), numWorkerThreads);
 }
 
+// ============================================================================
+// Decoding - Progressive (previews)
+// ============================================================================
+
+// First codestream prefix handed to a progressive decode. Small frames are
+// read whole; larger ones start at 1/16 of the stream and double, which for
+// typical encodes reaches the DC (1:8) pass on the first or second step.
+static constexpr size_t kMinProgressiveInput = 64 * 1024;
+
+ProgressiveImage JxlCodec::DecodeProgressive(
+    const uint8_t* data, size_t size,
+    uint32_t maxDownsampling,
+    int numWorkerThreads)
+{
+    CodecRunner runner(numWorkerThreads);
+    DecoderLease decoder;
+    runner.Attach(decoder.get());
+
+#if ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL
+    const bool progressive = maxDownsampling > 1;
+#else
+    const bool progressive = false;
+#endif
+    int events = JXL_DEC_BASIC_INFO | JXL_DEC_FULL_IMAGE;
+#if ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL
+    if (progressive) {
+        events |= JXL_DEC_FRAME_PROGRESSION;
+    }
+#endif
+    if (JxlDecoderSubscribeEvents(decoder.get(), events) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to subscribe to decoder events");
+    }
+#if ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL
+    // kPasses reports every pass, including the DC one.
+    if (progressive && JxlDecoderSetProgressiveDetail(decoder.get(), kPasses) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to set progressive detail");
+    }
+#endif
+
+    // Only the first `fed` bytes are visible to the decoder; a pass boundary
+    // it reaches inside them ends the decode without touching the rest.
+    size_t fed = progressive ? std::min(size, std::max(kMinProgressiveInput, size / 16)) : size;
+    if (JxlDecoderSetInput(decoder.get(), data, fed) != JXL_DEC_SUCCESS) {
+        throw JxlCodecError("Failed to set decoder input");
+    }
+
+    ProgressiveImage result;
+    bool haveInfo = false;
+    bool outputBufferSet = false;
+    JxlPixelFormat pixelFormat = {};
+
+    while (true) {
+        JxlDecoderStatus status = JxlDecoderProcessInput(decoder.get());
+
+        switch (status) {
+            case JXL_DEC_BASIC_INFO: {
+                JxlBasicInfo basicInfo;
+                if (JxlDecoderGetBasicInfo(decoder.get(), &basicInfo) != JXL_DEC_SUCCESS) {
+                    throw JxlCodecError("Failed to get basic info");
+                }
+                ImageInfo& info = result.info;
+                info.width = basicInfo.xsize;
+                info.height = basicInfo.ysize;
+                info.bitsPerSample = basicInfo.bits_per_sample;
+                info.numChannels = basicInfo.num_color_channels;
+                info.isGrayscale = (basicInfo.num_color_channels == 1);
+
+                const PixelFormat format = FormatFromImageInfo(info);
+                pixelFormat.num_channels = NumChannels(format);
+                pixelFormat.data_type = ToJxlDataType(format);
+                pixelFormat.endianness = JXL_NATIVE_ENDIAN;
+                pixelFormat.align = 0;
+                result.pixels.resize(static_cast<size_t>(info.width) * info.height *
+                                     BytesPerPixel(format));
+                haveInfo = true;
+                break;
+            }
+
+            case JXL_DEC_NEED_IMAGE_OUT_BUFFER: {
+                if (!haveInfo) {
+                    throw JxlCodecError("Image data before basic info");
+                }
+                if (!outputBufferSet) {
+                    size_t requiredSize;
+                    if (JxlDecoderImageOutBufferSize(decoder.get(), &pixelFormat, &requiredSize) != JXL_DEC_SUCCESS) {
+                        throw JxlCodecError("Failed to get output buffer size");
+                    }
+                    if (result.pixels.size() < requiredSize) {
+                        result.pixels.resize(requiredSize);
+                    }
+                    if (JxlDecoderSetImageOutBuffer(decoder.get(), &pixelFormat,
+                                                    result.pixels.data(),
+                                                    result.pixels.size()) != JXL_DEC_SUCCESS) {
+                        throw JxlCodecError("Failed to set output buffer");
+                    }
+                    UseCodestreamBitDepth(decoder.get());
+                    outputBufferSet = true;
+                }
+                break;
+            }
+
+#if ORTHANC_JXL_HAVE_PROGRESSIVE_DETAIL
+            case JXL_DEC_FRAME_PROGRESSION: {
+                const size_t ratio = JxlDecoderGetIntendedDownsamplingRatio(decoder.get());
+                if (outputBufferSet && ratio <= maxDownsampling) {
+                    if (JxlDecoderFlushImage(decoder.get()) != JXL_DEC_SUCCESS) {
+                        throw JxlCodecError("Failed to flush progressive image");
+                    }
+                    result.downsampling = static_cast<uint32_t>(ratio);
+                    result.bytesRead = fed;
+                    return result;
+                }
+                break;
+            }
+#endif
+
+            case JXL_DEC_FULL_IMAGE:
+            case JXL_DEC_SUCCESS:
+                if (!outputBufferSet) {
+                    throw JxlCodecError("No image decoded");
+                }
+                result.downsampling = 1;
+                result.bytesRead = fed;
+                return result;
+
+            case JXL_DEC_ERROR:
+                throw JxlCodecError("Decoder error");
+
+            case JXL_DEC_NEED_MORE_INPUT: {
+                if (fed == size) {
+                    throw JxlCodecError("Incomplete JXL data");
+                }
+                // Re-offer the unconsumed tail together with the next step.
+                const size_t start = fed - JxlDecoderReleaseInput(decoder.get());
+                fed = size - fed <= fed ? size : fed * 2;
+                if (JxlDecoderSetInput(decoder.get(), data + start, fed - start) != JXL_DEC_SUCCESS) {
+                    throw JxlCodecError("Failed to set decoder input");
+                }
+                break;
+            }
+
+            default:
+                // Continue processing other events
+                break;
+        }
+    }
+}
+
 } // namespace orthanc_jxl
@@ -19,6 +19,7 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <vector>
 #include <stdexcept>
 #include <string>
@@ -26,6 +27,8 @@
 
 namespace orthanc_jxl {
 
+class ThreadPool;
+
 class JxlCodecError : public std::runtime_error {
 public:
     explicit JxlCodecError(const std::string& msg) : std::runtime_error(msg) {}
@@ -52,6 +55,10 @@ struct EncodeOptions {
     int progressiveDC = 0;   // VarDCT only (0-2)
     bool progressiveAC = false;
     float distance = 0.0f;   // 0.0 = mathematically lossless
+    // Stored bit depth to signal in the codestream; 0 = the format's full
+    // depth. Must be below it, with every sample already in [0, 2^bits).
+    // Ignored when SupportsReducedBitDepth() is false.
+    uint32_t bitsStored = 0;
 
     static EncodeOptions Lossless(int effort = 7);
     static EncodeOptions ProgressiveLossless(int effort = 7, int centerX = -1, int centerY = -1);
@@ -68,16 +75,70 @@ struct ImageInfo {
     bool isGrayscale = false;
 };
 
+// Caller-owned destination for an in-place decode: row y of the image starts
+// at data + y * stride, and stride is at least width * BytesPerPixel(format).
+struct DecodeTarget {
+    uint8_t* data = nullptr;
+    size_t stride = 0;
+};
+
+// Invoked by DecodeInto once the basic info is known, with the pixel format
+// the frame will be decoded as. Returns where to write the pixels (or throws).
+using DecodeAllocator = std::function<DecodeTarget(const ImageInfo& info, PixelFormat format)>;
+
+// Fills `out` with the interleaved pixels of the xsize x ysize region at
+// (x, y), row-major and tightly packed.
+using RegionReader = std::function<void(size_t x, size_t y, size_t xsize, size_t ysize,
+                                        uint8_t* out)>;
+
+// Pixel source for EncodeStreaming. Interleaved input is described by
+// data/stride and handed to libjxl in place; when `read` is set, regions are
+// produced on demand into scratch buffers instead (e.g. from planar input).
+struct StreamingSource {
+    const uint8_t* data = nullptr;
+    size_t stride = 0;
+    RegionReader read;
+};
+
+// Result of DecodeProgressive. The pixels always cover the full frame, in the
+// layout Decode() would return, but may only carry the detail of an early
+// progressive pass, upsampled by libjxl.
+struct ProgressiveImage {
+    std::vector<uint8_t> pixels;
+    ImageInfo info;
+    uint32_t downsampling = 1;   // detail the pixels carry: 1 = full, 8 = DC only
+    size_t bytesRead = 0;        // codestream prefix handed to the decoder
+};
+
+// Process-wide counters for libjxl object reuse and the allocations libjxl
+// makes through the plugin's memory manager. Monotonic except idleArenaBytes;
+// take two snapshots and subtract to measure a steady-state window.
+struct CodecStats {
+    uint64_t encodersCreated = 0;    // JxlEncoderCreate calls
+    uint64_t decodersCreated = 0;    // JxlDecoderCreate calls
+    uint64_t codecsReused = 0;       // calls served by a recycled encoder/decoder
+    uint64_t allocations = 0;        // allocation requests from libjxl
+    uint64_t systemAllocations = 0;  // of which reached malloc (arena miss)
+    uint64_t idleArenaBytes = 0;     // currently cached by idle codecs (capped)
+};
+
 class JxlCodec {
 public:
     // Worker-thread count semantics shared by Encode/Decode:
-    //   < 0  -> libjxl default (one worker per hardware thread)
-    //   0/1  -> single-threaded, no parallel runner allocated
-    //   > 1  -> that many libjxl worker threads
-    // Runners are cached thread-locally and reused across calls.
+    //   < 0  -> all available threads
+    //   0/1  -> single-threaded, no parallel runner
+    //   > 1  -> at most that many threads (including the calling one)
+    // With a shared pool installed (SetSharedPool) libjxl's jobs run on that
+    // pool; otherwise on a JxlThreadParallelRunner cached per calling thread.
     static constexpr int kDefaultThreads = -1;
     static constexpr int kSingleThreaded = 1;
 
+    // Run libjxl's internal parallelism on `pool` instead of per-thread
+    // runners, so codec work shares one bounded set of threads however many
+    // callers encode at once. Pass nullptr to detach; the pool must outlive
+    // every encode/decode started while it is installed.
+    static void SetSharedPool(ThreadPool* pool);
+
     // Encoding
     static std::vector<uint8_t> Encode(
         const void* pixelData,
@@ -88,6 +149,31 @@ public:
         int numWorkerThreads = kDefaultThreads
     );
 
+    // Streaming encode for very large frames (WSI, mammography, long-length
+    // imaging). libjxl pulls pixel regions from `source` while encoding and
+    // writes compressed bytes through an output processor, so neither a
+    // contiguous interleaved copy of the frame nor libjxl's own copy of the
+    // codestream is held. Progressive options in `options` are dropped,
+    // because libjxl would otherwise buffer the frame anyway: the output is
+    // plain lossless (or VarDCT) with scanline group order. Needs libjxl >=
+    // 0.10 (see SupportsStreamingEncode); older versions fall back to a
+    // buffered Encode() that keeps the options as given.
+    static std::vector<uint8_t> EncodeStreaming(
+        const StreamingSource& source,
+        uint32_t width,
+        uint32_t height,
+        PixelFormat format,
+        const EncodeOptions& options = EncodeOptions::ProgressiveLossless(),
+        int numWorkerThreads = kDefaultThreads
+    );
+    static bool SupportsStreamingEncode();
+
+    // True when libjxl can take and return samples at the codestream's own
+    // bit depth (libjxl >= 0.8), which EncodeOptions::bitsStored needs.
+    // Decoders always return samples unscaled at the codestream depth, so a
+    // 12-bit codestream decodes to 0..4095 in a 16-bit buffer.
+    static bool SupportsReducedBitDepth();
+
     // Convenience encoders
     static std::vector<uint8_t> EncodeLossless(
         const void* pixelData, uint32_t width, uint32_t height,
@@ -99,6 +185,17 @@ public:
         PixelFormat format, int effort = 7, int centerX = -1, int centerY = -1
     );
 
+    // Lossless JPEG recompression (transfer syntax .111). RecompressJpeg
+    // re-packs a baseline JPEG's DCT coefficients into a JXL container together
+    // with the data needed to rebuild the original file; ReconstructJpeg
+    // returns that original JPEG byte for byte, without decoding to pixels.
+    static std::vector<uint8_t> RecompressJpeg(
+        const uint8_t* jpegData, size_t size,
+        int effort = 7,
+        int numWorkerThreads = kDefaultThreads
+    );
+    static std::vector<uint8_t> ReconstructJpeg(const uint8_t* data, size_t size);
+
     // Decoding - info only (fast)
     static ImageInfo DecodeInfo(const uint8_t* data, size_t size);
     static ImageInfo DecodeInfo(const std::vector<uint8_t>& jxlData);
@@ -115,6 +212,27 @@ public:
         int numWorkerThreads = kDefaultThreads
     );
 
+    // Decoding - auto-detect format straight into caller memory. Basic info and
+    // pixels are read in one decoder session; allocate() is called once between
+    // the two, so the caller can size its buffer (e.g. an OrthancPluginImage
+    // with its own pitch) and no staging copy is needed.
+    static ImageInfo DecodeInto(
+        const uint8_t* data, size_t size,
+        const DecodeAllocator& allocate,
+        int numWorkerThreads = kDefaultThreads
+    );
+
+    // Decoding - stop at the first progressive pass with at most
+    // maxDownsampling:1 detail (1, 2, 4 or 8). The codestream is fed in growing
+    // prefixes, so for progressive encodes (squeeze, progressive DC) a preview
+    // reads and reconstructs only the start of the bitstream. Non-progressive
+    // codestreams, or libjxl < 0.7, decode in full (downsampling = 1).
+    static ProgressiveImage DecodeProgressive(
+        const uint8_t* data, size_t size,
+        uint32_t maxDownsampling,
+        int numWorkerThreads = kDefaultThreads
+    );
+
     // Decoding - auto-detect format
     static std::pair<std::vector<uint8_t>, ImageInfo> Decode(
         const uint8_t* data, size_t size,
@@ -131,6 +249,16 @@ public:
     static int BitsPerSample(PixelFormat format);
     static bool IsGrayscale(PixelFormat format);
     static PixelFormat FormatFromImageInfo(const ImageInfo& info);
+
+    // True if data starts with a JXL codestream or container signature.
+    static bool HasSignature(const uint8_t* data, size_t size);
+
+    // Encoders and decoders are recycled per calling thread (JxlEncoderReset /
+    // JxlDecoderReset) and allocate from a per-object arena of cached blocks,
+    // so small frames do not pay for libjxl setup and malloc on every call.
+    // Idle objects expire after a minute without use, and their cached blocks
+    // are capped process-wide (32 MiB) however many threads hold them.
+    static CodecStats Stats();
 };
 
 } // namespace orthanc_jxl
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "layout_kernels.h"
+
+#include "pixel_layout.h"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ORTHANC_JXL_X86_KERNELS 1
+#include <immintrin.h>
+#else
+#define ORTHANC_JXL_X86_KERNELS 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#define ORTHANC_JXL_NEON_KERNELS 1
+#include <arm_neon.h>
+#else
+#define ORTHANC_JXL_NEON_KERNELS 0
+#endif
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Planar input with more channels than this uses the reference loops.
+constexpr int kMaxPlanes = 4;
+
+// ----------------------------------------------------------------------------
+// Scalar kernels, specialised on channel count and sample width
+// ----------------------------------------------------------------------------
+
+template <int C, int B>
+void InterleaveFixed(const uint8_t* const* planes, size_t pixels, uint8_t* out) {
+    for (size_t p = 0; p < pixels; ++p) {
+        for (int c = 0; c < C; ++c) {
+            for (int b = 0; b < B; ++b) {
+                out[(p * C + c) * B + b] = planes[c][p * B + b];
+            }
+        }
+    }
+}
+
+void InterleaveScalar(const uint8_t* const* planes, size_t pixels,
+                      int numChannels, int bytesPerSample, uint8_t* out) {
+    if (pixels == 0) {
+        return;
+    }
+    switch (numChannels * 8 + bytesPerSample) {
+        case 1 * 8 + 1:
+        case 1 * 8 + 2:
+            std::memcpy(out, planes[0], pixels * bytesPerSample);
+            return;
+        case 3 * 8 + 1: InterleaveFixed<3, 1>(planes, pixels, out); return;
+        case 3 * 8 + 2: InterleaveFixed<3, 2>(planes, pixels, out); return;
+        case 4 * 8 + 1: InterleaveFixed<4, 1>(planes, pixels, out); return;
+        case 4 * 8 + 2: InterleaveFixed<4, 2>(planes, pixels, out); return;
+        default:
+            break;
+    }
+    for (size_t p = 0; p < pixels; ++p) {
+        for (int c = 0; c < numChannels; ++c) {
+            std::memcpy(out + (p * numChannels + c) * bytesPerSample,
+                        planes[c] + p * bytesPerSample, bytesPerSample);
+        }
+    }
+}
+
+// Finish the pixels a vector loop left over with the scalar kernel. The
+// offset plane pointers only fit kMaxPlanes channels; wider pixels (which the
+// vector loops never take, so `done` is 0) use the reference loop in place.
+void InterleaveTail(const uint8_t* const* planes, size_t done, size_t pixels,
+                    int numChannels, int bytesPerSample, uint8_t* out) {
+    if (numChannels > kMaxPlanes) {
+        for (size_t p = done; p < pixels; ++p) {
+            for (int c = 0; c < numChannels; ++c) {
+                std::memcpy(out + (p * numChannels + c) * bytesPerSample,
+                            planes[c] + p * bytesPerSample, bytesPerSample);
+            }
+        }
+        return;
+    }
+    const uint8_t* rest[kMaxPlanes];
+    for (int c = 0; c < numChannels; ++c) {
+        rest[c] = planes[c] + done * bytesPerSample;
+    }
+    InterleaveScalar(rest, pixels - done, numChannels, bytesPerSample,
+                     out + done * numChannels * bytesPerSample);
+}
+
+constexpr LayoutKernels kScalarKernels = {
+    KernelIsa::Scalar, "scalar",
+    InterleaveScalar,
+};
+
+// ----------------------------------------------------------------------------
+// x86: byte shuffles over 16-byte lanes
+// ----------------------------------------------------------------------------
+
+#if ORTHANC_JXL_X86_KERNELS
+
+// pshufb masks for 3-channel data with B-byte samples. One 16-byte lane of
+// each plane holds 16 / B pixels, which interleave into three 16-byte lanes
+// of output: out[k] = OR over c of shuffle(plane[c], inter[k][c]). -128
+// zeroes a byte.
+template <int B>
+struct ShuffleMasks {
+    int8_t inter[3][3][16];
+};
+
+template <int B>
+constexpr ShuffleMasks<B> MakeShuffleMasks() {
+    ShuffleMasks<B> m{};
+    for (int k = 0; k < 3; ++k) {
+        for (int i = 0; i < 16; ++i) {
+            const int j = 16 * k + i;  // output byte within the 48-byte block
+            const int pixel = j / (3 * B);
+            const int channel = (j / B) % 3;
+            const int byte = j % B;
+            for (int c = 0; c < 3; ++c) {
+                m.inter[k][c][i] = static_cast<int8_t>(c == channel ? pixel * B + byte : -128);
+            }
+        }
+    }
+    return m;
+}
+
+template <int B>
+struct Masks {
+    static constexpr ShuffleMasks<B> value = MakeShuffleMasks<B>();
+};
+template <int B>
+constexpr ShuffleMasks<B> Masks<B>::value;
+
+template <int B>
+__attribute__((target("sse4.1")))
+size_t Interleave3Sse41(const uint8_t* const* planes, size_t pixels, uint8_t* out) {
+    const auto& m = Masks<B>::value;
+    __m128i mask[3][3];
+    for (int k = 0; k < 3; ++k) {
+        for (int c = 0; c < 3; ++c) {
+            mask[k][c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(m.inter[k][c]));
+        }
+    }
+    constexpr size_t kStep = 16 / B;
+    size_t p = 0;
+    for (; p + kStep <= pixels; p += kStep) {
+        __m128i v[3];
+        for (int c = 0; c < 3; ++c) {
+            v[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(planes[c] + p * B));
+        }
+        for (int k = 0; k < 3; ++k) {
+            const __m128i o = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(v[0], mask[k][0]), _mm_shuffle_epi8(v[1], mask[k][1])),
+                _mm_shuffle_epi8(v[2], mask[k][2]));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + p * 3 * B + 16 * k), o);
+        }
+    }
+    return p;
+}
+
+__attribute__((target("sse4.1")))
+void InterleaveSse41(const uint8_t* const* planes, size_t pixels,
+                     int numChannels, int bytesPerSample, uint8_t* out) {
+    size_t done = 0;
+    if (numChannels == 3 && bytesPerSample == 1) {
+        done = Interleave3Sse41<1>(planes, pixels, out);
+    } else if (numChannels == 3 && bytesPerSample == 2) {
+        done = Interleave3Sse41<2>(planes, pixels, out);
+    }
+    InterleaveTail(planes, done, pixels, numChannels, bytesPerSample, out);
+}
+
+// AVX2 shuffles stay within 128-bit lanes, so each 32-byte register carries
+// two SSE-sized blocks (low lane = block A, high lane = block B) through the
+// same masks, and lane permutes restore the output's memory order.
+template <int B>
+__attribute__((target("avx2")))
+size_t Interleave3Avx2(const uint8_t* const* planes, size_t pixels, uint8_t* out) {
+    const auto& m = Masks<B>::value;
+    __m256i mask[3][3];
+    for (int k = 0; k < 3; ++k) {
+        for (int c = 0; c < 3; ++c) {
+            mask[k][c] = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(m.inter[k][c])));
+        }
+    }
+    constexpr size_t kStep = 32 / B;
+    size_t p = 0;
+    for (; p + kStep <= pixels; p += kStep) {
+        __m256i v[3];
+        for (int c = 0; c < 3; ++c) {
+            v[c] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(planes[c] + p * B));
+        }
+        __m256i o[3];  // lanes: [block A chunk k, block B chunk k]
+        for (int k = 0; k < 3; ++k) {
+            o[k] = _mm256_or_si256(
+                _mm256_or_si256(_mm256_shuffle_epi8(v[0], mask[k][0]),
+                                _mm256_shuffle_epi8(v[1], mask[k][1])),
+                _mm256_shuffle_epi8(v[2], mask[k][2]));
+        }
+        uint8_t* dst = out + p * 3 * B;
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                            _mm256_permute2x128_si256(o[0], o[1], 0x20));  // A0 A1
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 32),
+                            _mm256_permute2x128_si256(o[2], o[0], 0x30));  // A2 B0
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + 64),
+                            _mm256_permute2x128_si256(o[1], o[2], 0x31));  // B1 B2
+    }
+    return p;
+}
+
+__attribute__((target("avx2")))
+void InterleaveAvx2(const uint8_t* const* planes, size_t pixels,
+                    int numChannels, int bytesPerSample, uint8_t* out) {
+    size_t done = 0;
+    if (numChannels == 3 && bytesPerSample == 1) {
+        done = Interleave3Avx2<1>(planes, pixels, out);
+    } else if (numChannels == 3 && bytesPerSample == 2) {
+        done = Interleave3Avx2<2>(planes, pixels, out);
+    }
+    InterleaveTail(planes, done, pixels, numChannels, bytesPerSample, out);
+}
+
+constexpr LayoutKernels kSse41Kernels = {
+    KernelIsa::Sse41, "sse4.1",
+    InterleaveSse41,
+};
+
+constexpr LayoutKernels kAvx2Kernels = {
+    KernelIsa::Avx2, "avx2",
+    InterleaveAvx2,
+};
+
+#endif  // ORTHANC_JXL_X86_KERNELS
+
+// ----------------------------------------------------------------------------
+// NEON: structure loads/stores interleave natively
+// ----------------------------------------------------------------------------
+
+#if ORTHANC_JXL_NEON_KERNELS
+
+void InterleaveNeon(const uint8_t* const* planes, size_t pixels,
+                    int numChannels, int bytesPerSample, uint8_t* out) {
+    size_t p = 0;
+    if (numChannels == 3 && bytesPerSample == 1) {
+        for (; p + 16 <= pixels; p += 16) {
+            uint8x16x3_t v;
+            v.val[0] = vld1q_u8(planes[0] + p);
+            v.val[1] = vld1q_u8(planes[1] + p);
+            v.val[2] = vld1q_u8(planes[2] + p);
+            vst3q_u8(out + p * 3, v);
+        }
+    } else if (numChannels == 3 && bytesPerSample == 2) {
+        for (; p + 8 <= pixels; p += 8) {
+            uint16x8x3_t v;
+            v.val[0] = vreinterpretq_u16_u8(vld1q_u8(planes[0] + p * 2));
+            v.val[1] = vreinterpretq_u16_u8(vld1q_u8(planes[1] + p * 2));
+            v.val[2] = vreinterpretq_u16_u8(vld1q_u8(planes[2] + p * 2));
+            vst3q_u16(reinterpret_cast<uint16_t*>(out + p * 6), v);
+        }
+    }
+    InterleaveTail(planes, p, pixels, numChannels, bytesPerSample, out);
+}
+
+constexpr LayoutKernels kNeonKernels = {
+    KernelIsa::Neon, "neon",
+    InterleaveNeon,
+};
+
+#endif  // ORTHANC_JXL_NEON_KERNELS
+
+const LayoutKernels& SelectKernels() {
+#if ORTHANC_JXL_X86_KERNELS
+    if (__builtin_cpu_supports("avx2")) {
+        return kAvx2Kernels;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        return kSse41Kernels;
+    }
+#endif
+#if ORTHANC_JXL_NEON_KERNELS
+    return kNeonKernels;
+#else
+    return kScalarKernels;
+#endif
+}
+
+}  // namespace
+
+const LayoutKernels& Kernels() {
+    static const LayoutKernels& kernels = SelectKernels();
+    return kernels;
+}
+
+const LayoutKernels* KernelsFor(KernelIsa isa) {
+    switch (isa) {
+        case KernelIsa::Scalar:
+            return &kScalarKernels;
+#if ORTHANC_JXL_X86_KERNELS
+        case KernelIsa::Sse41:
+            return __builtin_cpu_supports("sse4.1") ? &kSse41Kernels : nullptr;
+        case KernelIsa::Avx2:
+            return __builtin_cpu_supports("avx2") ? &kAvx2Kernels : nullptr;
+#endif
+#if ORTHANC_JXL_NEON_KERNELS
+        case KernelIsa::Neon:
+            return &kNeonKernels;
+#endif
+        default:
+            return nullptr;
+    }
+}
+
+void InterleaveFrame(const uint8_t* src, size_t pixelsPerFrame,
+                     int numChannels, int bytesPerSample, uint8_t* out) {
+    if (numChannels > kMaxPlanes) {
+        PlanarToInterleaved(src, pixelsPerFrame, numChannels, bytesPerSample, out);
+        return;
+    }
+    const size_t plane = pixelsPerFrame * bytesPerSample;
+    const uint8_t* planes[kMaxPlanes];
+    for (int c = 0; c < numChannels; ++c) {
+        planes[c] = src + c * plane;
+    }
+    Kernels().interleave(planes, pixelsPerFrame, numChannels, bytesPerSample, out);
+}
+
+void InterleaveRegion(const uint8_t* src, size_t width, size_t height,
+                      size_t x, size_t y, size_t xsize, size_t ysize,
+                      int numChannels, int bytesPerSample, uint8_t* out) {
+    if (numChannels > kMaxPlanes) {
+        PlanarRegionToInterleaved(src, width, height, x, y, xsize, ysize,
+                                  numChannels, bytesPerSample, out);
+        return;
+    }
+    const LayoutKernels& kernels = Kernels();
+    const size_t plane = width * height * bytesPerSample;
+    const size_t outRow = xsize * numChannels * bytesPerSample;
+    const uint8_t* planes[kMaxPlanes];
+    for (size_t row = 0; row < ysize; ++row) {
+        const size_t first = ((y + row) * width + x) * bytesPerSample;
+        for (int c = 0; c < numChannels; ++c) {
+            planes[c] = src + c * plane + first;
+        }
+        kernels.interleave(planes, xsize, numChannels, bytesPerSample, out + row * outRow);
+    }
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace orthanc_jxl {
+
+/**
+ * Vectorised pixel layout kernels.
+ *
+ * The reference loops in pixel_layout.h copy one sample at a time; on 16-bit
+ * RGB multi-frame input that pass costs more than a fast-effort encode. These
+ * kernels do the same work 16-32 bytes at a time. The common 3-channel
+ * 8/16-bit shapes get shuffle-based SSE4.1 / AVX2 paths (picked at runtime)
+ * or NEON structure loads/stores; every other shape runs a scalar loop
+ * specialised on channel count and sample width.
+ *
+ * All kernels are byte-exact: results match the scalar reference for every
+ * input, including lengths that are not a multiple of the vector width.
+ */
+enum class KernelIsa {
+    Scalar,
+    Sse41,
+    Avx2,
+    Neon,
+};
+
+struct LayoutKernels {
+    KernelIsa isa;
+    const char* name;
+
+    // planes[c] points at channel c's samples for `pixels` consecutive
+    // pixels; out receives them colour-by-pixel. Any channel count works;
+    // the vector paths cover 3 channels; 4 uses a specialised scalar loop;
+    // the rest run the reference loop.
+    void (*interleave)(const uint8_t* const* planes, size_t pixels,
+                       int numChannels, int bytesPerSample, uint8_t* out);
+};
+
+// Best kernels for the running CPU; resolved once.
+const LayoutKernels& Kernels();
+
+// Kernels for a specific instruction set, or nullptr when it was not compiled
+// in or the CPU lacks it (used by tests and benchmarks).
+const LayoutKernels* KernelsFor(KernelIsa isa);
+
+// Convert one planar frame (R..R G..G B..B) to interleaved, like
+// PlanarToInterleaved() in pixel_layout.h.
+void InterleaveFrame(const uint8_t* src, size_t pixelsPerFrame,
+                     int numChannels, int bytesPerSample, uint8_t* out);
+
+// Interleave one rectangle of a planar frame, row-major with
+// xsize * numChannels * bytesPerSample bytes per row, like
+// PlanarRegionToInterleaved().
+void InterleaveRegion(const uint8_t* src, size_t width, size_t height,
+                      size_t x, size_t y, size_t xsize, size_t ysize,
+                      int numChannels, int bytesPerSample, uint8_t* out);
+
+}  // namespace orthanc_jxl
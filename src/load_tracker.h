@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace orthanc_jxl {
+
+/**
+ * Tracks codec work in flight across the plugin and sizes each call's libjxl
+ * worker count from it.
+ *
+ * Every transcode (and viewer decode) registers a Scope for its duration. In
+ * adaptive mode a new call splits the thread budget (pool workers plus the
+ * calling thread) evenly over the frames that can run right now, its own
+ * included: a lone single-frame request gets the whole pool, a 4-frame
+ * instance on an idle 16-core box gets ~4 threads per frame, and under heavy
+ * concurrent ingest every frame encodes single-threaded. The decision is made
+ * once per call, so a long encode keeps its share while load changes around it.
+ */
+class LoadTracker {
+public:
+    // threadBudget: threads codec work may occupy in total (>= 1).
+    // adaptive: false keeps the caller's fixed thread counts and only counts.
+    LoadTracker(size_t threadBudget, bool adaptive)
+        : budget_(std::max<size_t>(1, threadBudget)), adaptive_(adaptive) {}
+
+    LoadTracker(const LoadTracker&) = delete;
+    LoadTracker& operator=(const LoadTracker&) = delete;
+
+    // Registration of one call for its lifetime.
+    class Scope {
+    public:
+        // frames: frames the call will process concurrently at most.
+        Scope(LoadTracker& tracker, uint32_t frames)
+            : tracker_(tracker), weight_(tracker.Weight(frames)), frames_(frames) {
+            tracker_.transcodes_.fetch_add(1, std::memory_order_relaxed);
+            activeAfter_ = tracker_.frames_.fetch_add(weight_, std::memory_order_relaxed) + weight_;
+        }
+
+        ~Scope() {
+            tracker_.frames_.fetch_sub(weight_, std::memory_order_relaxed);
+            tracker_.transcodes_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        // libjxl worker threads for each of this call's frames, in JxlCodec's
+        // convention. fixedThreads is used when the tracker is not adaptive
+        // (typically kSingleThreaded for multi-frame, the configured count for
+        // a single frame).
+        int FrameThreads(int fixedThreads) const {
+            if (!tracker_.adaptive_) {
+                return fixedThreads;
+            }
+            const size_t perFrame = tracker_.budget_ / std::max<size_t>(1, activeAfter_);
+            return perFrame <= 1 ? 1 : static_cast<int>(perFrame);
+        }
+
+        uint32_t Frames() const { return frames_; }
+
+    private:
+        LoadTracker& tracker_;
+        const size_t weight_;
+        const uint32_t frames_;
+        size_t activeAfter_ = 0;
+    };
+
+    bool Adaptive() const { return adaptive_; }
+    size_t Budget() const { return budget_; }
+    size_t InFlightTranscodes() const { return transcodes_.load(std::memory_order_relaxed); }
+    size_t InFlightFrames() const { return frames_.load(std::memory_order_relaxed); }
+
+private:
+    // A call never has more frames running at once than there are threads.
+    size_t Weight(uint32_t frames) const {
+        return std::min<size_t>(std::max<uint32_t>(1, frames), budget_);
+    }
+
+    const size_t budget_;
+    const bool adaptive_;
+    std::atomic<size_t> transcodes_{0};
+    std::atomic<size_t> frames_{0};
+};
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "metrics.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// Values below this get a bucket each; above it, four per power of two.
+constexpr uint64_t kLinearLimit = 4;
+
+// Largest power of two with its own buckets (2^26 us ~ 67 s).
+constexpr unsigned kMaxExponent = 26;
+
+unsigned Log2(uint64_t v) {
+    unsigned e = 0;
+    while (v >>= 1) {
+        ++e;
+    }
+    return e;
+}
+
+std::string Prefixed(const char* group, const char* name, const char* suffix) {
+    std::string s = "orthanc_jxl_";
+    s += group;
+    s += '_';
+    s += name;
+    s += '_';
+    s += suffix;
+    return s;
+}
+
+double Ratio(uint64_t nativeBytes, uint64_t encodedBytes) {
+    return encodedBytes ? static_cast<double>(nativeBytes) / encodedBytes : 0.0;
+}
+
+void AppendLatency(std::vector<MetricValue>& out, const char* group, const char* name,
+                   const HistogramSnapshot& h) {
+    out.push_back({Prefixed(group, name, "count"), static_cast<double>(h.count)});
+    out.push_back({Prefixed(group, name, "mean_ms"), h.MeanMicros() / 1000.0});
+    out.push_back({Prefixed(group, name, "p50_ms"), h.Percentile(0.50) / 1000.0});
+    out.push_back({Prefixed(group, name, "p95_ms"), h.Percentile(0.95) / 1000.0});
+    out.push_back({Prefixed(group, name, "p99_ms"), h.Percentile(0.99) / 1000.0});
+}
+
+nlohmann::json LatencyJson(const HistogramSnapshot& h) {
+    nlohmann::json buckets = nlohmann::json::array();
+    for (size_t b = 0; b < HistogramSnapshot::kBuckets; ++b) {
+        if (h.buckets[b]) {
+            // [lower bound in us, count]; sparse, most buckets stay empty.
+            buckets.push_back({HistogramSnapshot::BucketLow(b), h.buckets[b]});
+        }
+    }
+    return {
+        {"count", h.count},
+        {"mean_ms", h.MeanMicros() / 1000.0},
+        {"p50_ms", h.Percentile(0.50) / 1000.0},
+        {"p95_ms", h.Percentile(0.95) / 1000.0},
+        {"p99_ms", h.Percentile(0.99) / 1000.0},
+        {"buckets_us", buckets},
+    };
+}
+
+}  // namespace
+
+// ============================================================================
+// Histograms
+// ============================================================================
+
+size_t HistogramSnapshot::BucketOf(uint64_t micros) {
+    if (micros < kLinearLimit) {
+        return static_cast<size_t>(micros);
+    }
+    const unsigned e = Log2(micros);
+    if (e > kMaxExponent) {
+        return kBuckets - 1;
+    }
+    return (e - 1) * 4 + static_cast<size_t>((micros >> (e - 2)) & 3);
+}
+
+uint64_t HistogramSnapshot::BucketLow(size_t b) {
+    if (b < kLinearLimit) {
+        return b;
+    }
+    const unsigned e = static_cast<unsigned>(b / 4 + 1);
+    return (4 + (b % 4)) << (e - 2);
+}
+
+double HistogramSnapshot::Percentile(double q) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    const double rank = q * static_cast<double>(count);
+    uint64_t seen = 0;
+    for (size_t b = 0; b < kBuckets; ++b) {
+        if (buckets[b] == 0) {
+            continue;
+        }
+        if (static_cast<double>(seen + buckets[b]) >= rank) {
+            const double low = static_cast<double>(BucketLow(b));
+            const double high = b + 1 < kBuckets ? static_cast<double>(BucketLow(b + 1))
+                                                 : low * 1.25;
+            const double within = (rank - static_cast<double>(seen)) / buckets[b];
+            return low + (high - low) * within;
+        }
+        seen += buckets[b];
+    }
+    return static_cast<double>(BucketLow(kBuckets - 1));
+}
+
+size_t LatencyHistogram::ShardIndex() {
+    static std::atomic<size_t> next{0};
+    thread_local const size_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return index;
+}
+
+HistogramSnapshot LatencyHistogram::Snapshot() const {
+    HistogramSnapshot snapshot;
+    for (const Shard& shard : shards_) {
+        snapshot.count += shard.count.load(std::memory_order_relaxed);
+        snapshot.sumMicros += shard.sum.load(std::memory_order_relaxed);
+        for (size_t b = 0; b < HistogramSnapshot::kBuckets; ++b) {
+            snapshot.buckets[b] += shard.buckets[b].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+// ============================================================================
+// Plugin Metrics
+// ============================================================================
+
+const char* StageName(Stage stage) {
+    switch (stage) {
+        case Stage::Parse:     return "parse";
+        case Stage::Extract:   return "extract";
+        case Stage::Layout:    return "layout";
+        case Stage::QueueWait: return "queue";
+        case Stage::Encode:    return "encode";
+        case Stage::Decode:    return "decode";
+        case Stage::Serialize: return "serialize";
+        case Stage::Count:     break;
+    }
+    return "unknown";
+}
+
+const char* OperationName(Operation operation) {
+    switch (operation) {
+        case Operation::ToJxl:           return "to_jxl";
+        case Operation::FromJxl:         return "from_jxl";
+        case Operation::RecompressJpeg:  return "recompress_jpeg";
+        case Operation::ReconstructJpeg: return "reconstruct_jpeg";
+        case Operation::FrameDecode:     return "frame_decode";
+        case Operation::Preview:         return "preview";
+        case Operation::RawFrame:        return "raw_frame";
+        case Operation::Count:           break;
+    }
+    return "unknown";
+}
+
+void PluginMetrics::RecordOperation(Operation operation, uint64_t micros,
+                                    uint64_t nativeBytes, uint64_t encodedBytes) {
+    const size_t i = static_cast<size_t>(operation);
+    operations_[i].Record(micros);
+    counters_[i].nativeBytes.fetch_add(nativeBytes, std::memory_order_relaxed);
+    counters_[i].encodedBytes.fetch_add(encodedBytes, std::memory_order_relaxed);
+}
+
+void PluginMetrics::RecordError(Operation operation) {
+    counters_[static_cast<size_t>(operation)].errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+PluginMetrics::ModalitySlot& PluginMetrics::SlotFor(const std::string& modality) {
+    ModalitySlot& other = modalities_[kMaxModalities];
+    // The name becomes part of a metric name, so keep to [A-Za-z0-9_].
+    if (modality.empty() || modality.size() >= sizeof(other.name) ||
+        !std::all_of(modality.begin(), modality.end(), [](char c) {
+            return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+        })) {
+        return other;
+    }
+    for (size_t i = 0; i < kMaxModalities; ++i) {
+        ModalitySlot& slot = modalities_[i];
+        if (!slot.used.load(std::memory_order_acquire)) {
+            break;  // slots are claimed in order
+        }
+        if (modality == slot.name) {
+            return slot;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(modalityMutex_);
+    for (size_t i = 0; i < kMaxModalities; ++i) {
+        ModalitySlot& slot = modalities_[i];
+        if (!slot.used.load(std::memory_order_relaxed)) {
+            std::memcpy(slot.name, modality.c_str(), modality.size() + 1);
+            slot.used.store(true, std::memory_order_release);
+            return slot;
+        }
+        if (modality == slot.name) {
+            return slot;
+        }
+    }
+    return other;
+}
+
+void PluginMetrics::RecordModality(const std::string& modality, uint64_t nativeBytes,
+                                   uint64_t encodedBytes) {
+    ModalitySlot& slot = SlotFor(modality);
+    slot.instances.fetch_add(1, std::memory_order_relaxed);
+    slot.nativeBytes.fetch_add(nativeBytes, std::memory_order_relaxed);
+    slot.encodedBytes.fetch_add(encodedBytes, std::memory_order_relaxed);
+}
+
+void PluginMetrics::RecordEffort(int effort, uint64_t nativeBytes, uint64_t encodedBytes) {
+    if (effort < 1 || static_cast<size_t>(effort) >= efforts_.size()) {
+        return;
+    }
+    EffortCounters& counters = efforts_[static_cast<size_t>(effort)];
+    counters.instances.fetch_add(1, std::memory_order_relaxed);
+    counters.nativeBytes.fetch_add(nativeBytes, std::memory_order_relaxed);
+    counters.encodedBytes.fetch_add(encodedBytes, std::memory_order_relaxed);
+}
+
+HistogramSnapshot PluginMetrics::StageSnapshot(Stage stage) const {
+    return stages_[static_cast<size_t>(stage)].Snapshot();
+}
+
+HistogramSnapshot PluginMetrics::OperationSnapshot(Operation operation) const {
+    return operations_[static_cast<size_t>(operation)].Snapshot();
+}
+
+void PluginMetrics::Collect(std::vector<MetricValue>& out) const {
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        AppendLatency(out, "stage", StageName(static_cast<Stage>(i)), stages_[i].Snapshot());
+    }
+    for (size_t i = 0; i < operations_.size(); ++i) {
+        const char* name = OperationName(static_cast<Operation>(i));
+        const OperationCounters& c = counters_[i];
+        AppendLatency(out, "op", name, operations_[i].Snapshot());
+        out.push_back({Prefixed("op", name, "errors"),
+                       static_cast<double>(c.errors.load(std::memory_order_relaxed))});
+        out.push_back({Prefixed("op", name, "native_bytes"),
+                       static_cast<double>(c.nativeBytes.load(std::memory_order_relaxed))});
+        out.push_back({Prefixed("op", name, "encoded_bytes"),
+                       static_cast<double>(c.encodedBytes.load(std::memory_order_relaxed))});
+    }
+    for (const ModalitySlot& slot : modalities_) {
+        const uint64_t instances = slot.instances.load(std::memory_order_relaxed);
+        if (instances == 0) {
+            continue;
+        }
+        const char* name = slot.used.load(std::memory_order_acquire) ? slot.name : "OTHER";
+        out.push_back({Prefixed("modality", name, "instances"), static_cast<double>(instances)});
+        out.push_back({Prefixed("modality", name, "ratio"),
+                       Ratio(slot.nativeBytes.load(std::memory_order_relaxed),
+                             slot.encodedBytes.load(std::memory_order_relaxed))});
+    }
+    for (size_t e = 1; e < efforts_.size(); ++e) {
+        const EffortCounters& c = efforts_[e];
+        const uint64_t instances = c.instances.load(std::memory_order_relaxed);
+        if (instances == 0) {
+            continue;
+        }
+        const std::string name = std::to_string(e);
+        out.push_back({Prefixed("effort", name.c_str(), "instances"),
+                       static_cast<double>(instances)});
+        out.push_back({Prefixed("effort", name.c_str(), "native_bytes"),
+                       static_cast<double>(c.nativeBytes.load(std::memory_order_relaxed))});
+        out.push_back({Prefixed("effort", name.c_str(), "ratio"),
+                       Ratio(c.nativeBytes.load(std::memory_order_relaxed),
+                             c.encodedBytes.load(std::memory_order_relaxed))});
+    }
+}
+
+std::string PluginMetrics::ToJson(const std::vector<MetricValue>& gauges) const {
+    nlohmann::json doc;
+    for (size_t i = 0; i < stages_.size(); ++i) {
+        doc["stages"][StageName(static_cast<Stage>(i))] = LatencyJson(stages_[i].Snapshot());
+    }
+    for (size_t i = 0; i < operations_.size(); ++i) {
+        const OperationCounters& c = counters_[i];
+        const uint64_t nativeBytes = c.nativeBytes.load(std::memory_order_relaxed);
+        const uint64_t encodedBytes = c.encodedBytes.load(std::memory_order_relaxed);
+        nlohmann::json op = LatencyJson(operations_[i].Snapshot());
+        op["errors"] = c.errors.load(std::memory_order_relaxed);
+        op["native_bytes"] = nativeBytes;
+        op["encoded_bytes"] = encodedBytes;
+        op["ratio"] = Ratio(nativeBytes, encodedBytes);
+        doc["operations"][OperationName(static_cast<Operation>(i))] = op;
+    }
+    doc["modalities"] = nlohmann::json::object();
+    for (const ModalitySlot& slot : modalities_) {
+        const uint64_t instances = slot.instances.load(std::memory_order_relaxed);
+        if (instances == 0) {
+            continue;
+        }
+        const uint64_t nativeBytes = slot.nativeBytes.load(std::memory_order_relaxed);
+        const uint64_t encodedBytes = slot.encodedBytes.load(std::memory_order_relaxed);
+        const char* name = slot.used.load(std::memory_order_acquire) ? slot.name : "OTHER";
+        doc["modalities"][name] = {
+            {"instances", instances},
+            {"native_bytes", nativeBytes},
+            {"encoded_bytes", encodedBytes},
+            {"ratio", Ratio(nativeBytes, encodedBytes)},
+        };
+    }
+    doc["efforts"] = nlohmann::json::object();
+    for (size_t e = 1; e < efforts_.size(); ++e) {
+        const EffortCounters& c = efforts_[e];
+        const uint64_t instances = c.instances.load(std::memory_order_relaxed);
+        if (instances == 0) {
+            continue;
+        }
+        const uint64_t nativeBytes = c.nativeBytes.load(std::memory_order_relaxed);
+        const uint64_t encodedBytes = c.encodedBytes.load(std::memory_order_relaxed);
+        doc["efforts"][std::to_string(e)] = {
+            {"instances", instances},
+            {"native_bytes", nativeBytes},
+            {"encoded_bytes", encodedBytes},
+            {"ratio", Ratio(nativeBytes, encodedBytes)},
+        };
+    }
+    doc["plugin"] = nlohmann::json::object();
+    for (const MetricValue& gauge : gauges) {
+        doc["plugin"][gauge.name] = gauge.value;
+    }
+    return doc.dump(2);
+}
+
+PluginMetrics& Metrics() {
+    static PluginMetrics metrics;
+    return metrics;
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace orthanc_jxl {
+
+// Point-in-time copy of a LatencyHistogram.
+struct HistogramSnapshot {
+    static constexpr size_t kBuckets = 104;
+
+    uint64_t count = 0;
+    uint64_t sumMicros = 0;
+    std::array<uint64_t, kBuckets> buckets{};
+
+    double MeanMicros() const { return count ? static_cast<double>(sumMicros) / count : 0.0; }
+
+    // Estimated q-quantile (0..1) in microseconds, interpolated within the
+    // bucket it falls in; 0 when empty.
+    double Percentile(double q) const;
+
+    // Smallest value counted in bucket b (the next bucket's is its bound).
+    static uint64_t BucketLow(size_t b);
+    static size_t BucketOf(uint64_t micros);
+};
+
+/**
+ * Wait-free latency histogram for hot paths.
+ *
+ * Buckets are log-linear - four per power of two of microseconds, so any
+ * estimate is within 25% - from 1 us up to ~67 s (longer lands in the last
+ * bucket). Counters are sharded by recording thread and only summed when a
+ * snapshot is read, so concurrent frames rarely touch the same cache line and
+ * Record() is a few relaxed atomic adds.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(uint64_t micros) {
+        Shard& shard = shards_[ShardIndex()];
+        shard.count.fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(micros, std::memory_order_relaxed);
+        shard.buckets[HistogramSnapshot::BucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    HistogramSnapshot Snapshot() const;
+
+private:
+    static constexpr size_t kShards = 8;
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+        std::array<std::atomic<uint64_t>, HistogramSnapshot::kBuckets> buckets{};
+    };
+
+    static size_t ShardIndex();
+
+    std::array<Shard, kShards> shards_;
+};
+
+// Instrumented stages, each timed by a StageSpan (trace.h) wherever it runs
+// (transcode, viewer decode, prefetch, preview).
+enum class Stage : size_t {
+    Parse,      // DCMTK parse of an instance
+    Extract,    // locating pixel data / fragments, allocating the output
+    Layout,     // planar interleave, signed-sample mapping (per frame)
+    QueueWait,  // from the frame pipeline until a worker starts the frame (per frame)
+    Encode,     // one frame through libjxl (pixel encode or JPEG recompression)
+    Decode,     // one frame out of libjxl (pixels or reconstructed JPEG)
+    Serialize,  // appending frames and writing the transcoded instance
+    Count
+};
+
+// Plugin entry points, timed end to end.
+enum class Operation : size_t {
+    ToJxl,            // native -> JXL
+    FromJxl,          // JXL -> native
+    RecompressJpeg,   // .50 -> .111
+    ReconstructJpeg,  // .111 -> .50
+    FrameDecode,      // DecodeImageCallback (viewer), cache hits included
+    Preview,          // /jxl/.../preview
+    RawFrame,         // /jxl/instances/{id}/frames/{n}
+    Count
+};
+
+const char* StageName(Stage stage);
+const char* OperationName(Operation operation);
+
+// One named value, as published to Orthanc's metrics.
+struct MetricValue {
+    std::string name;
+    double value = 0.0;
+};
+
+/**
+ * Process-wide plugin metrics: latency histograms per stage and operation,
+ * byte counters per operation and compression ratio per modality.
+ *
+ * Recording is lock-free apart from the first instance of each modality.
+ * Everything is monotonic since plugin start; Prometheus derives rates.
+ */
+class PluginMetrics {
+public:
+    // Modalities tracked separately; the rest are counted as "OTHER".
+    static constexpr size_t kMaxModalities = 16;
+
+    void RecordStage(Stage stage, uint64_t micros) {
+        stages_[static_cast<size_t>(stage)].Record(micros);
+    }
+
+    void RecordOperation(Operation operation, uint64_t micros,
+                         uint64_t nativeBytes = 0, uint64_t encodedBytes = 0);
+    void RecordError(Operation operation);
+
+    // Bytes in and out of one compressing transcode of an instance of
+    // `modality` (e.g. "CT"; empty is counted as "OTHER").
+    void RecordModality(const std::string& modality, uint64_t nativeBytes, uint64_t encodedBytes);
+
+    // The same by the libjxl effort the instance was encoded at (1-10;
+    // anything else is ignored), to audit what each effort costs and saves.
+    void RecordEffort(int effort, uint64_t nativeBytes, uint64_t encodedBytes);
+
+    HistogramSnapshot StageSnapshot(Stage stage) const;
+    HistogramSnapshot OperationSnapshot(Operation operation) const;
+
+    // Flat "orthanc_jxl_*" values for Orthanc's metrics (Prometheus).
+    void Collect(std::vector<MetricValue>& out) const;
+
+    // The same as a JSON document, with `gauges` (pool, caches, ...) added
+    // under "plugin".
+    std::string ToJson(const std::vector<MetricValue>& gauges) const;
+
+private:
+    struct OperationCounters {
+        std::atomic<uint64_t> errors{0};
+        std::atomic<uint64_t> nativeBytes{0};
+        std::atomic<uint64_t> encodedBytes{0};
+    };
+
+    struct ModalitySlot {
+        std::atomic<bool> used{false};
+        char name[17] = {};
+        std::atomic<uint64_t> instances{0};
+        std::atomic<uint64_t> nativeBytes{0};
+        std::atomic<uint64_t> encodedBytes{0};
+    };
+
+    struct EffortCounters {
+        std::atomic<uint64_t> instances{0};
+        std::atomic<uint64_t> nativeBytes{0};
+        std::atomic<uint64_t> encodedBytes{0};
+    };
+
+    ModalitySlot& SlotFor(const std::string& modality);
+
+    std::array<LatencyHistogram, static_cast<size_t>(Stage::Count)> stages_;
+    std::array<LatencyHistogram, static_cast<size_t>(Operation::Count)> operations_;
+    std::array<OperationCounters, static_cast<size_t>(Operation::Count)> counters_;
+
+    // The last slot is "OTHER"; slots are claimed under the mutex and then
+    // found without it.
+    std::array<ModalitySlot, kMaxModalities + 1> modalities_;
+    std::mutex modalityMutex_;
+
+    // Index = effort; 0 unused.
+    std::array<EffortCounters, 11> efforts_;
+};
+
+// The plugin-wide metrics instance.
+PluginMetrics& Metrics();
+
+// Times one plugin operation. Done() records it as completed; a scope left
+// without Done() (an exception) counts as an error.
+class ScopedOperation {
+public:
+    explicit ScopedOperation(Operation operation)
+        : operation_(operation), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedOperation() {
+        if (!done_) {
+            Metrics().RecordError(operation_);
+        }
+    }
+
+    ScopedOperation(const ScopedOperation&) = delete;
+    ScopedOperation& operator=(const ScopedOperation&) = delete;
+
+    void Done(uint64_t nativeBytes = 0, uint64_t encodedBytes = 0) {
+        done_ = true;
+        const auto micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start_).count();
+        Metrics().RecordOperation(operation_, static_cast<uint64_t>(micros),
+                                  nativeBytes, encodedBytes);
+    }
+
+private:
+    const Operation operation_;
+    const std::chrono::steady_clock::time_point start_;
+    bool done_ = false;
+};
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace orthanc_jxl {
+
+/**
+ * Destination for a serialized DICOM instance.
+ *
+ * The writer asks for a buffer of at least an upper-bound size, serializes into
+ * it and then reports how much it used. Implementations can hand out memory
+ * owned by someone else (e.g. an OrthancPluginMemoryBuffer), so the output is
+ * written exactly once, in its final location.
+ */
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    // Return a writable buffer of at least `capacity` bytes. Called once per
+    // write; may throw if the memory cannot be obtained.
+    virtual uint8_t* Reserve(size_t capacity) = 0;
+
+    // The first `size` bytes of the reserved buffer hold the output.
+    virtual void Commit(size_t size) = 0;
+};
+
+// Sink backed by a caller-owned vector.
+class VectorSink : public OutputSink {
+public:
+    explicit VectorSink(std::vector<uint8_t>& out) : out_(out) {}
+
+    uint8_t* Reserve(size_t capacity) override {
+        out_.resize(capacity);
+        return out_.data();
+    }
+
+    void Commit(size_t size) override { out_.resize(size); }
+
+private:
+    std::vector<uint8_t>& out_;
+};
+
+}  // namespace orthanc_jxl
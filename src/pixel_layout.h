@@ -31,21 +31,166 @@ namespace orthanc_jxl {
  * (PlanarConfiguration 0), so planar uncompressed input is converted before
  * encoding. The transform is byte-exact and reversible.
  */
-inline std::vector<uint8_t> PlanarToInterleaved(const uint8_t* src,
-                                                size_t pixelsPerFrame,
-                                                int numChannels,
-                                                int bytesPerSample) {
-    std::vector<uint8_t> out(pixelsPerFrame * numChannels * bytesPerSample);
+inline void PlanarToInterleaved(const uint8_t* src,
+                                size_t pixelsPerFrame,
+                                int numChannels,
+                                int bytesPerSample,
+                                uint8_t* out) {
     const size_t plane = pixelsPerFrame * bytesPerSample;
     for (int c = 0; c < numChannels; ++c) {
         const uint8_t* planeSrc = src + static_cast<size_t>(c) * plane;
         for (size_t p = 0; p < pixelsPerFrame; ++p) {
-            std::memcpy(out.data() + (p * numChannels + c) * bytesPerSample,
+            std::memcpy(out + (p * numChannels + c) * bytesPerSample,
                         planeSrc + p * bytesPerSample,
                         bytesPerSample);
         }
     }
+}
+
+// As above, into a newly allocated frame.
+inline std::vector<uint8_t> PlanarToInterleaved(const uint8_t* src,
+                                                size_t pixelsPerFrame,
+                                                int numChannels,
+                                                int bytesPerSample) {
+    std::vector<uint8_t> out(pixelsPerFrame * numChannels * bytesPerSample);
+    PlanarToInterleaved(src, pixelsPerFrame, numChannels, bytesPerSample, out.data());
     return out;
 }
 
+/**
+ * Interleave one rectangle of a planar frame into `out`, row-major with
+ * xsize * numChannels * bytesPerSample bytes per row.
+ *
+ * Lets a streaming encoder pull planar input a region at a time instead of
+ * converting the whole frame up front.
+ */
+inline void PlanarRegionToInterleaved(const uint8_t* src,
+                                      size_t width, size_t height,
+                                      size_t x, size_t y, size_t xsize, size_t ysize,
+                                      int numChannels, int bytesPerSample,
+                                      uint8_t* out) {
+    const size_t plane = width * height * bytesPerSample;
+    const size_t pixelBytes = static_cast<size_t>(numChannels) * bytesPerSample;
+    for (size_t row = 0; row < ysize; ++row) {
+        uint8_t* dst = out + row * xsize * pixelBytes;
+        const size_t first = (y + row) * width + x;
+        for (int c = 0; c < numChannels; ++c) {
+            const uint8_t* planeSrc = src + static_cast<size_t>(c) * plane + first * bytesPerSample;
+            for (size_t p = 0; p < xsize; ++p) {
+                std::memcpy(dst + p * pixelBytes + c * bytesPerSample,
+                            planeSrc + p * bytesPerSample,
+                            bytesPerSample);
+            }
+        }
+    }
+}
+
+/**
+ * Reduced-depth sample coding (OrthancJxl.BitsStoredEncoding).
+ *
+ * CT is typically 12 bits stored in 16 and signed. Signalling the stored depth
+ * to libjxl keeps the encoder from modelling unused high bits. Signed samples
+ * follow the DICOM convention (PS3.5 8.1.1): the codestream holds them as
+ * BitsStored-bit two's complement, and decoders sign-extend from HighBit. Any
+ * JPEG XL decoder therefore returns the stored values as DICOM defines them,
+ * and a signed frame from another encoder at reduced depth decodes the same
+ * way. Frames at full depth are stored verbatim.
+ */
+// Depth to signal for a container of `containerBits` (8 or 16), or 0 to keep
+// the container depth. Only depths that still select the same decode buffer
+// type qualify (9-15 in 16 bits, 1-7 in 8), and HighBit must be BitsStored - 1.
+inline uint32_t ReducedSampleDepth(uint32_t containerBits, uint32_t bitsStored,
+                                   uint32_t highBit) {
+    if (bitsStored == 0 || highBit + 1 != bitsStored) {
+        return 0;
+    }
+    const uint32_t floor = (containerBits == 16) ? 9 : 1;
+    return (bitsStored >= floor && bitsStored < containerBits) ? bitsStored : 0;
+}
+
+// True if every sample survives reduced-depth coding exactly: unsigned
+// samples must be below 2^bits, signed ones sign-extended from bit bits - 1.
+// Overlay or garbage bits above BitsStored fail this check, and those frames
+// are encoded at full depth instead.
+inline bool SamplesFitDepth(const uint8_t* samples, size_t count, int bytesPerSample,
+                            uint32_t bits, bool isSigned) {
+    const int32_t half = 1 << (bits - 1);
+    bool fits = true;
+    if (bytesPerSample == 2) {
+        const uint16_t* s = reinterpret_cast<const uint16_t*>(samples);
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t v = isSigned ? static_cast<int16_t>(s[i]) + half : s[i];
+            fits &= (v >= 0 && v < 2 * half);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            const int32_t v = isSigned ? static_cast<int8_t>(samples[i]) + half : samples[i];
+            fits &= (v >= 0 && v < 2 * half);
+        }
+    }
+    return fits;
+}
+
+// Signed samples to `bits`-bit two's complement: drop the sign extension.
+// `out` may equal `samples`.
+inline void TruncateSignedSamples(const uint8_t* samples, size_t count, int bytesPerSample,
+                                  uint32_t bits, uint8_t* out) {
+    const uint32_t mask = (1u << bits) - 1;
+    if (bytesPerSample == 2) {
+        const uint16_t* s = reinterpret_cast<const uint16_t*>(samples);
+        uint16_t* d = reinterpret_cast<uint16_t*>(out);
+        for (size_t i = 0; i < count; ++i) {
+            d[i] = static_cast<uint16_t>(s[i] & mask);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = static_cast<uint8_t>(samples[i] & mask);
+        }
+    }
+}
+
+// In place: sign-extend `bits`-bit two's complement samples to the container
+// width, ignoring anything above bit bits - 1.
+inline void SignExtendSamples(uint8_t* samples, size_t count, int bytesPerSample,
+                              uint32_t bits) {
+    const int32_t half = 1 << (bits - 1);
+    const int32_t mask = (1 << bits) - 1;
+    if (bytesPerSample == 2) {
+        uint16_t* s = reinterpret_cast<uint16_t*>(samples);
+        for (size_t i = 0; i < count; ++i) {
+            s[i] = static_cast<uint16_t>(((s[i] & mask) ^ half) - half);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            samples[i] = static_cast<uint8_t>(((samples[i] & mask) ^ half) - half);
+        }
+    }
+}
+
+// Bits to sign-extend a decoded frame from, or 0 to keep it as decoded: only
+// signed frames that decode below their container depth, from HighBit.
+inline uint32_t SignExtensionBits(bool isSigned, uint32_t codestreamBits,
+                                  uint32_t containerBits, uint32_t highBit) {
+    if (!isSigned || codestreamBits >= containerBits || highBit == 0 ||
+        highBit + 1 >= containerBits) {
+        return 0;
+    }
+    return highBit + 1;
+}
+
+// Sign-extend a decoded frame in place (see SignExtensionBits): `rows` rows,
+// each `rowSamples` samples long and `stride` bytes apart.
+inline void SignExtendFrame(uint8_t* frame, size_t stride, size_t rows, size_t rowSamples,
+                            int bytesPerSample, uint32_t codestreamBits, uint32_t highBit,
+                            bool isSigned) {
+    const uint32_t bits = SignExtensionBits(isSigned, codestreamBits,
+                                            8u * static_cast<uint32_t>(bytesPerSample), highBit);
+    if (bits == 0) {
+        return;
+    }
+    for (size_t y = 0; y < rows; ++y) {
+        SignExtendSamples(frame + y * stride, rowSamples, bytesPerSample, bits);
+    }
+}
+
 }  // namespace orthanc_jxl
@@ -20,17 +20,54 @@
 
 #include "jxl_codec.h"
 #include "dicom_handler.h"
+#include "dicom_scan.h"
+#include "effort_policy.h"
 #include "transfer_syntax.h"
 #include "config.h"
+#include "batch_transcoder.h"
+#include "buffer_pool.h"
+#include "content_hash.h"
+#include "fragment_cache.h"
+#include "frame_cache.h"
+#include "frame_prefetch.h"
+#include "http_range.h"
+#include "ingest_queue.h"
+#include "load_tracker.h"
+#include "metrics.h"
+#include "output_sink.h"
+#include "pixel_layout.h"
+#include "preview.h"
+#include "staged_replacement.h"
 #include "thread_pool.h"
+#include "trace.h"
 #include "transcode.h"
+#include "transcoded_cache.h"
 #include "version.h"
 
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <set>
+#include <strings.h>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <unistd.h>
 #include <vector>
 
 using namespace orthanc_jxl;
@@ -42,10 +79,249 @@ static PluginConfig pluginConfig_;
 // lifetime so study imports don't pay per-instance thread-pool setup costs.
 static std::unique_ptr<ThreadPool> threadPool_;
 
+// Frame offsets of recently decoded JXL instances, so viewing frame N of a
+// multi-frame instance does not re-walk (or DCMTK-parse) the whole buffer.
+static std::unique_ptr<FragmentIndexCache> fragmentCache_;
+
+// Recently decoded frames, for scrolling back and forth through a stack.
+static std::unique_ptr<DecodedFrameCache> frameCache_;
+
+// TO-JXL results, so re-fetching an uncompressed instance skips the encode.
+static std::unique_ptr<TranscodedCache> transcodedCache_;
+
+// Speculative decodes of neighbouring frames into frameCache_.
+static std::unique_ptr<FramePrefetcher> prefetcher_;
+
+// Recycled interleave / bitstream buffers, installed as BufferPool::Shared().
+static std::unique_ptr<BufferPool> bufferPool_;
+
+// Codec work in flight; sizes libjxl threads per call in adaptive mode.
+static std::unique_ptr<LoadTracker> loadTracker_;
+
+// Per-instance effort from EncodeLatencyBudget / EncodeThroughputTarget;
+// only created when one is set, installed as EffortPolicy::Shared().
+static std::unique_ptr<EffortPolicy> effortPolicy_;
+
+// Recent transcode stage spans for /jxl/trace; only created when TraceEvents
+// is set, installed as TraceRecorder::Shared().
+static std::unique_ptr<TraceRecorder> traceRecorder_;
+
+// Stored instances waiting to be replaced by their JPEG XL form, when
+// BackgroundCompression is on.
+static std::unique_ptr<IngestQueue> ingestQueue_;
+
+// Stored JPEG XL instances waiting to be re-encoded at RecompressEffort, and
+// the JXL bytes before / after for those done since start. Both byte counts
+// change together, so `before - after` is always the bytes saved.
+static std::mutex recompressMutex_;
+static std::unique_ptr<IngestQueue> recompressQueue_;
+struct RecompressBytes {
+    uint64_t before = 0;
+    uint64_t after = 0;
+};
+static std::mutex recompressBytesMutex_;
+static RecompressBytes recompressBytes_;
+
+static void AddRecompressBytes(uint64_t before, uint64_t after)
+{
+    std::lock_guard<std::mutex> lock(recompressBytesMutex_);
+    recompressBytes_.before += before;
+    recompressBytes_.after += after;
+}
+
+static RecompressBytes GetRecompressBytes()
+{
+    std::lock_guard<std::mutex> lock(recompressBytesMutex_);
+    return recompressBytes_;
+}
+
+// Set on OrthancStarted, once background workers may use the REST API.
+static bool orthancStarted_ = false;
+
+// The recompression queue, created on first use (or at start when a journal
+// is left to resume) and started as soon as Orthanc is up.
+static IngestQueue* RecompressQueue(bool create);
+
+static OrthancPluginPixelFormat ToOrthancPixelFormat(PixelFormat format, bool isSigned)
+{
+    switch (format) {
+        case PixelFormat::Gray8:
+            return OrthancPluginPixelFormat_Grayscale8;
+        case PixelFormat::Gray16:
+            return isSigned ? OrthancPluginPixelFormat_SignedGrayscale16
+                            : OrthancPluginPixelFormat_Grayscale16;
+        case PixelFormat::RGB24:
+            return OrthancPluginPixelFormat_RGB24;
+        default:  // RGB48
+            return OrthancPluginPixelFormat_RGB48;
+    }
+}
+
+// Fragment index of a raw JXL instance: cached from an earlier call when
+// possible, otherwise built by walking the buffer once. Returns null when the
+// buffer needs DCMTK to locate its frames.
+static std::shared_ptr<const FragmentIndex> LookupFragmentIndex(
+    const std::string& key, const FileMetaInfo& meta, const void* dicom, size_t size)
+{
+    if (!key.empty()) {
+        if (auto cached = fragmentCache_->Find(key)) {
+            return cached;
+        }
+    }
+    auto index = std::make_shared<FragmentIndex>();
+    if (!IndexEncapsulatedFrames(dicom, size, meta, *index)) {
+        return nullptr;
+    }
+    fragmentCache_->Insert(key, index);
+    return index;
+}
+
+// A frame's JXL bitstream plus the attributes of the instance holding it.
+// The bitstream lives in the caller's buffer, or in the DCMTK parse `handler`
+// keeps alive when the fragment index could not vouch for it.
+struct JxlFrameRef {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    DicomImageInfo info;
+    std::string instanceKey;   // FragmentIndexCache::MakeKey(); may be empty
+    std::unique_ptr<DicomHandler> handler;
+
+    // Where the instance's other frames are, for prefetching: the fragment
+    // index over the caller's buffer, or else `handler`.
+    std::shared_ptr<const FragmentIndex> index;
+    const uint8_t* buffer = nullptr;
+    size_t bufferSize = 0;
+
+    // Bitstream of frame n of the same instance, or empty.
+    ByteView Frame(uint32_t n) const {
+        if (handler) {
+            return n < info.numberOfFrames ? handler->GetEncapsulatedView(n) : ByteView{};
+        }
+        if (!index || n >= index->frames.size()) {
+            return ByteView{};
+        }
+        const ByteRange& range = index->frames[n];
+        if (range.offset > bufferSize || range.length > bufferSize - range.offset) {
+            return ByteView{};
+        }
+        return ByteView{buffer + range.offset, range.length};
+    }
+};
+
+enum class FrameLookup { NotJxl, NoSuchFrame, Found };
+
+// Locate frame `frameIndex` of a JXL instance. NotJxl if the instance is not
+// JPEG XL, NoSuchFrame if it has no such frame; throws if the frame should be
+// there but cannot be found.
+static FrameLookup LocateJxlFrame(const void* dicom, size_t size, uint32_t frameIndex,
+                                  JxlFrameRef& frame)
+{
+    FileMetaInfo meta;
+    const bool sniffed = SniffFileMeta(dicom, size, meta);
+    if (sniffed && !IsJxlTransferSyntax(meta.transferSyntaxUid)) {
+        return FrameLookup::NotJxl;
+    }
+
+    // Locate the frame's JXL bitstream straight in Orthanc's buffer.
+    if (sniffed) {
+        frame.instanceKey = FragmentIndexCache::MakeKey(meta, dicom, size);
+    }
+    if (auto index = sniffed ? LookupFragmentIndex(frame.instanceKey, meta, dicom, size)
+                             : nullptr) {
+        if (frameIndex >= index->frames.size()) {
+            return FrameLookup::NoSuchFrame;
+        }
+        const ByteRange& range = index->frames[frameIndex];
+        if (range.offset <= size && range.length <= size - range.offset) {
+            frame.data = static_cast<const uint8_t*>(dicom) + range.offset;
+            frame.size = range.length;
+            frame.info = index->info;
+            frame.index = std::move(index);
+            frame.buffer = static_cast<const uint8_t*>(dicom);
+            frame.bufferSize = size;
+        }
+    }
+
+    // Anything the index cannot vouch for goes through DCMTK; the handler
+    // outlives the decode so the fragment can be read in place.
+    if (!frame.data || !JxlCodec::HasSignature(frame.data, frame.size)) {
+        {
+            StageSpan parse(Stage::Parse);
+            frame.handler = std::make_unique<DicomHandler>(dicom, size);
+        }
+        if (!sniffed && !IsJxlTransferSyntax(frame.handler->GetTransferSyntax())) {
+            return FrameLookup::NotJxl;
+        }
+        frame.info = frame.handler->GetImageInfo();
+        if (frameIndex >= frame.info.numberOfFrames) {
+            return FrameLookup::NoSuchFrame;
+        }
+        const ByteView fragment = frame.handler->GetEncapsulatedView(frameIndex);
+        frame.data = fragment.data;
+        frame.size = fragment.size;
+    }
+    return FrameLookup::Found;
+}
+
 // ============================================================================
 // Decode Image Callback
 // ============================================================================
 
+// New Orthanc image of `info`'s size and `format`, or throws.
+static OrthancPluginImage* CreateImage(const ImageInfo& info, PixelFormat format, bool isSigned)
+{
+    OrthancPluginImage* image = OrthancPluginCreateImage(
+        context_, ToOrthancPixelFormat(format, isSigned), info.width, info.height);
+    if (!image) {
+        throw std::runtime_error("Failed to create output image");
+    }
+    return image;
+}
+
+// Where to write an Orthanc image's pixels, or throws.
+static DecodeTarget ImageTarget(OrthancPluginImage* image)
+{
+    uint32_t pitch = OrthancPluginGetImagePitch(context_, image);
+    uint8_t* buffer = reinterpret_cast<uint8_t*>(OrthancPluginGetImageBuffer(context_, image));
+    if (!buffer || pitch == 0) {
+        throw std::runtime_error("Failed to get image buffer");
+    }
+    return DecodeTarget{buffer, pitch};
+}
+
+// Queue speculative decodes of the frames after (or before) the one viewed.
+// Errors only cost the prefetch, never the request that triggered it.
+static void PrefetchNeighbours(const JxlFrameRef& frame, uint32_t frameIndex)
+{
+    if (!prefetcher_->Enabled()) {
+        return;
+    }
+    try {
+        prefetcher_->OnFrameViewed(frame.instanceKey, frameIndex, frame.info.numberOfFrames,
+                                   frame.info.isSigned, frame.info.highBit,
+                                   [&frame](uint32_t n) { return frame.Frame(n); });
+    } catch (const std::exception&) {
+    }
+}
+
+// Answer a decode from the frame cache: one row-by-row copy.
+static OrthancPluginImage* ImageFromCachedFrame(const DecodedFrame& frame)
+{
+    OrthancPluginImage* image = CreateImage(frame.info, frame.format, frame.isSigned);
+    try {
+        const DecodeTarget target = ImageTarget(image);
+        const size_t rowBytes = frame.RowBytes();
+        for (uint32_t y = 0; y < frame.info.height; ++y) {
+            std::memcpy(target.data + y * target.stride, frame.pixels.data() + y * rowBytes,
+                        rowBytes);
+        }
+    } catch (...) {
+        OrthancPluginFreeImage(context_, image);
+        throw;
+    }
+    return image;
+}
+
 static OrthancPluginErrorCode DecodeImageCallback(
     OrthancPluginImage** target,
     const void* dicom,
@@ -53,78 +329,504 @@ static OrthancPluginErrorCode DecodeImageCallback(
     uint32_t frameIndex)
 {
     try {
-        DicomHandler handler(dicom, size);
+        JxlFrameRef frame;
+        switch (LocateJxlFrame(dicom, size, frameIndex, frame)) {
+            case FrameLookup::NotJxl:
+                // Not our transfer syntax, let another decoder handle it
+                return OrthancPluginErrorCode_NotImplemented;
+            case FrameLookup::NoSuchFrame:
+                return OrthancPluginErrorCode_ParameterOutOfRange;
+            case FrameLookup::Found:
+                break;
+        }
+        const bool isSigned = frame.info.isSigned;
+        ScopedOperation operation(Operation::FrameDecode);
 
-        std::string transferSyntax = handler.GetTransferSyntax();
-        if (!IsJxlTransferSyntax(transferSyntax)) {
-            // Not our transfer syntax, let another decoder handle it
-            return OrthancPluginErrorCode_NotImplemented;
+        // Frames scrolled past a moment ago are answered from memory.
+        const std::string frameKey = frameCache_->Enabled()
+            ? DecodedFrameCache::MakeKey(frame.instanceKey, frameIndex, frame.data, frame.size)
+            : std::string();
+        if (auto cached = frameCache_->Find(frameKey)) {
+            *target = ImageFromCachedFrame(*cached);
+            PrefetchNeighbours(frame, frameIndex);
+            operation.Done(0, frame.size);
+            return OrthancPluginErrorCode_Success;
         }
 
-        // Get image info
-        DicomImageInfo dicomInfo = handler.GetImageInfo();
+        // Decode straight into the Orthanc image: its buffer is created (with
+        // Orthanc's pitch) once the codestream header has been read, in the same
+        // decoder session that then fills it.
+        LoadTracker::Scope load(*loadTracker_, 1);
+        OrthancPluginImage* image = nullptr;
+        try {
+            DecodeTarget target;
+            PixelFormat format{};
+            StageSpan decode(Stage::Decode, frameIndex);
+            const ImageInfo decoded = JxlCodec::DecodeInto(frame.data, frame.size,
+                [&](const ImageInfo& info, PixelFormat decodedFormat) {
+                    format = decodedFormat;
+                    image = CreateImage(info, format, isSigned);
+                    target = ImageTarget(image);
+                    return target;
+                },
+                load.FrameThreads(JxlCodec::kDefaultThreads));
 
-        // Extract encapsulated JXL data
-        std::vector<uint8_t> jxlData = handler.GetEncapsulatedData(frameIndex);
+            // Reduced-depth frames of signed instances hold BitsStored-bit
+            // two's complement.
+            SignExtendFrame(target.data, target.stride, decoded.height,
+                            static_cast<size_t>(decoded.width) * JxlCodec::NumChannels(format),
+                            JxlCodec::BitsPerSample(format) / 8, decoded.bitsPerSample,
+                            frame.info.highBit, isSigned);
 
-        // Decode JXL
-        auto [pixels, jxlInfo] = JxlCodec::Decode(jxlData);
-        PixelFormat format = JxlCodec::FormatFromImageInfo(jxlInfo);
+            if (!frameKey.empty()) {
+                auto entry = std::make_shared<DecodedFrame>();
+                entry->info = decoded;
+                entry->format = format;
+                entry->isSigned = isSigned;
+                const size_t rowBytes = entry->RowBytes();
+                entry->pixels.resize(rowBytes * decoded.height);
+                for (uint32_t y = 0; y < decoded.height; ++y) {
+                    std::memcpy(entry->pixels.data() + y * rowBytes,
+                                target.data + y * target.stride, rowBytes);
+                }
+                frameCache_->Insert(frameKey, std::move(entry));
+            }
+        } catch (...) {
+            if (image) {
+                OrthancPluginFreeImage(context_, image);
+            }
+            throw;
+        }
 
-        // Map to Orthanc pixel format
-        OrthancPluginPixelFormat pixelFormat;
-        switch (format) {
-            case PixelFormat::Gray8:
-                pixelFormat = OrthancPluginPixelFormat_Grayscale8;
-                break;
-            case PixelFormat::Gray16:
-                pixelFormat = dicomInfo.isSigned
-                    ? OrthancPluginPixelFormat_SignedGrayscale16
-                    : OrthancPluginPixelFormat_Grayscale16;
-                break;
-            case PixelFormat::RGB24:
-                pixelFormat = OrthancPluginPixelFormat_RGB24;
-                break;
-            default:  // RGB48
-                pixelFormat = OrthancPluginPixelFormat_RGB48;
+        *target = image;
+        PrefetchNeighbours(frame, frameIndex);
+        operation.Done(0, frame.size);
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_, (std::string("orthanc-jxl decode error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// ============================================================================
+// Preview REST Route
+// ============================================================================
+
+// Value of GET argument `key`, or null when absent.
+static const char* GetArgument(const OrthancPluginHttpRequest* request, const char* key)
+{
+    for (uint32_t i = 0; i < request->getCount; ++i) {
+        if (std::strcmp(request->getKeys[i], key) == 0) {
+            return request->getValues[i];
+        }
+    }
+    return nullptr;
+}
+
+// Read an optional numeric GET argument into `value`; false if it is present
+// but not a number.
+static bool ParseNumberArgument(const OrthancPluginHttpRequest* request, const char* key,
+                                double& value)
+{
+    const char* text = GetArgument(request, key);
+    if (!text) {
+        return true;
+    }
+    char* end = nullptr;
+    const double parsed = std::strtod(text, &end);
+    if (end == text || *end != '\0' || !std::isfinite(parsed)) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Frees an SDK memory buffer on scope exit.
+struct ScopedMemoryBuffer {
+    OrthancPluginMemoryBuffer buffer{nullptr, 0};
+
+    ScopedMemoryBuffer() = default;
+    ScopedMemoryBuffer(const ScopedMemoryBuffer&) = delete;
+    ScopedMemoryBuffer& operator=(const ScopedMemoryBuffer&) = delete;
+    ~ScopedMemoryBuffer() {
+        if (buffer.data) {
+            OrthancPluginFreeMemoryBuffer(context_, &buffer);
+        }
+    }
+};
+
+// GET /jxl/instances/{id}/frames/{n}/preview
+//     [?scale=8][&windowCenter=C&windowWidth=W]
+//
+// PNG thumbnail of one frame at 1/scale size (a power of two up to 32,
+// default 8). Only the progressive passes that scale needs are decoded, and
+// the instance's window (or the one given) is applied while downscaling.
+static OrthancPluginErrorCode PreviewCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    try {
+        const char* instanceId = request->groups[0];
+        const unsigned long frameIndex = std::strtoul(request->groups[1], nullptr, 10);
+
+        double scale = 8;
+        double center = std::numeric_limits<double>::quiet_NaN();
+        double width = std::numeric_limits<double>::quiet_NaN();
+        if (!ParseNumberArgument(request, "scale", scale) ||
+            !ParseNumberArgument(request, "windowCenter", center) ||
+            !ParseNumberArgument(request, "windowWidth", width)) {
+            return OrthancPluginErrorCode_BadRequest;
+        }
+        const uint32_t previewScale = static_cast<uint32_t>(scale);
+        if (scale != previewScale || previewScale == 0 || previewScale > kMaxPreviewScale ||
+            (previewScale & (previewScale - 1)) != 0 ||
+            frameIndex > std::numeric_limits<uint32_t>::max()) {
+            return OrthancPluginErrorCode_ParameterOutOfRange;
+        }
+
+        ScopedMemoryBuffer dicom;
+        if (OrthancPluginGetDicomForInstance(context_, &dicom.buffer, instanceId)
+            != OrthancPluginErrorCode_Success) {
+            return OrthancPluginErrorCode_UnknownResource;
+        }
+
+        JxlFrameRef frame;
+        switch (LocateJxlFrame(dicom.buffer.data, dicom.buffer.size,
+                               static_cast<uint32_t>(frameIndex), frame)) {
+            case FrameLookup::NotJxl:
+                // Other transfer syntaxes are served by Orthanc's own /preview.
+                return OrthancPluginErrorCode_IncompatibleImageFormat;
+            case FrameLookup::NoSuchFrame:
+                OrthancPluginSendHttpStatusCode(context_, output, 404);
+                return OrthancPluginErrorCode_Success;
+            case FrameLookup::Found:
                 break;
         }
 
-        // Create Orthanc image
-        OrthancPluginImage* image = OrthancPluginCreateImage(
-            context_, pixelFormat, jxlInfo.width, jxlInfo.height);
+        ScopedOperation operation(Operation::Preview);
 
-        if (!image) {
-            OrthancPluginLogError(context_, "orthanc-jxl: Failed to create output image");
-            return OrthancPluginErrorCode_Plugin;
+        // Arguments override the instance's default window one by one.
+        PreviewWindow window;
+        window.center = std::isnan(center) ? frame.info.windowCenter : center;
+        window.width = std::isnan(width) ? frame.info.windowWidth : width;
+
+        LoadTracker::Scope load(*loadTracker_, 1);
+        const PreviewImage preview = DecodePreview(frame.data, frame.size, frame.info,
+                                                   previewScale, window,
+                                                   load.FrameThreads(JxlCodec::kDefaultThreads));
+        OrthancPluginCompressAndAnswerPngImage(
+            context_, output,
+            preview.channels == 3 ? OrthancPluginPixelFormat_RGB24
+                                  : OrthancPluginPixelFormat_Grayscale8,
+            preview.width, preview.height, static_cast<uint32_t>(preview.Stride()),
+            preview.pixels.data());
+        operation.Done(0, preview.bytesRead);
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_, (std::string("orthanc-jxl preview error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// ============================================================================
+// Raw Frame REST Route
+// ============================================================================
+
+// Value of HTTP request header `key` (any case), or null when absent.
+static const char* GetHeader(const OrthancPluginHttpRequest* request, const char* key)
+{
+    for (uint32_t i = 0; i < request->headersCount; ++i) {
+        if (strcasecmp(request->headersKeys[i], key) == 0) {
+            return request->headersValues[i];
+        }
+    }
+    return nullptr;
+}
+
+// GET /jxl/instances/{id}/frames/{n}
+//
+// The stored JPEG XL bitstream of one frame as image/jxl, straight from the
+// fragment index over Orthanc's copy of the instance: no decode, no
+// re-encode and no DCMTK serialization. A single "Range: bytes=..." is
+// answered with 206, so a progressive client can fetch the first passes and
+// stop; the ETag (and If-Range) keep later ranges on the same bitstream.
+static OrthancPluginErrorCode RawFrameCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    try {
+        const char* instanceId = request->groups[0];
+        const unsigned long frameIndex = std::strtoul(request->groups[1], nullptr, 10);
+        if (frameIndex > std::numeric_limits<uint32_t>::max()) {
+            return OrthancPluginErrorCode_ParameterOutOfRange;
         }
 
-        // Copy pixel data respecting pitch
-        uint32_t pitch = OrthancPluginGetImagePitch(context_, image);
-        uint8_t* buffer = reinterpret_cast<uint8_t*>(
-            OrthancPluginGetImageBuffer(context_, image));
+        ScopedMemoryBuffer dicom;
+        if (OrthancPluginGetDicomForInstance(context_, &dicom.buffer, instanceId)
+            != OrthancPluginErrorCode_Success) {
+            return OrthancPluginErrorCode_UnknownResource;
+        }
 
-        if (!buffer || pitch == 0) {
-            OrthancPluginFreeImage(context_, image);
-            OrthancPluginLogError(context_, "orthanc-jxl: Failed to get image buffer");
-            return OrthancPluginErrorCode_Plugin;
+        JxlFrameRef frame;
+        switch (LocateJxlFrame(dicom.buffer.data, dicom.buffer.size,
+                               static_cast<uint32_t>(frameIndex), frame)) {
+            case FrameLookup::NotJxl:
+                // Other transfer syntaxes are served by Orthanc's own /frames.
+                return OrthancPluginErrorCode_IncompatibleImageFormat;
+            case FrameLookup::NoSuchFrame:
+                OrthancPluginSendHttpStatusCode(context_, output, 404);
+                return OrthancPluginErrorCode_Success;
+            case FrameLookup::Found:
+                break;
+        }
+        if (!frame.data || frame.size == 0 || frame.size > std::numeric_limits<uint32_t>::max()) {
+            return OrthancPluginErrorCode_ParameterOutOfRange;
         }
 
-        int bytesPerPixel = JxlCodec::BytesPerPixel(format);
+        ScopedOperation operation(Operation::RawFrame);
 
-        uint32_t rowSize = jxlInfo.width * bytesPerPixel;
+        // A strong validator of the bitstream itself: any change to the frame's
+        // bytes changes it, whatever else happens to the instance.
+        char etag[24];
+        snprintf(etag, sizeof(etag), "\"%016llx\"",
+                 static_cast<unsigned long long>(HashBytes(frame.data, frame.size)));
+        OrthancPluginSetHttpHeader(context_, output, "ETag", etag);
 
-        for (uint32_t y = 0; y < jxlInfo.height; ++y) {
-            memcpy(buffer + y * pitch,
-                   pixels.data() + y * rowSize,
-                   rowSize);
+        // Orthanc sends the body of a non-200 status only with
+        // HttpDescribeErrors on; without it, ranges are ignored and the whole
+        // frame is answered, as HTTP allows.
+        ByteRange range{0, frame.size};
+        RangeRequest kind = RangeRequest::Full;
+        if (pluginConfig_.httpDescribeErrors) {
+            OrthancPluginSetHttpHeader(context_, output, "Accept-Ranges", "bytes");
+            const char* rangeHeader = GetHeader(request, "range");
+            const char* ifRange = GetHeader(request, "if-range");
+            if (rangeHeader && (!ifRange || std::strcmp(etag, ifRange) == 0)) {
+                kind = ParseRangeHeader(rangeHeader, frame.size, range);
+            }
         }
 
-        *target = image;
+        if (kind == RangeRequest::Unsatisfiable) {
+            const std::string contentRange = "bytes */" + std::to_string(frame.size);
+            OrthancPluginSetHttpHeader(context_, output, "Content-Range", contentRange.c_str());
+            OrthancPluginSendHttpStatus(context_, output, 416, nullptr, 0);
+            return OrthancPluginErrorCode_Success;
+        }
+        if (kind == RangeRequest::Partial) {
+            const std::string contentRange = "bytes " + std::to_string(range.offset) + '-' +
+                std::to_string(range.offset + range.length - 1) + '/' +
+                std::to_string(frame.size);
+            OrthancPluginSetHttpHeader(context_, output, "Content-Range", contentRange.c_str());
+            OrthancPluginSetHttpHeader(context_, output, "Content-Type", "image/jxl");
+            OrthancPluginSendHttpStatus(context_, output, 206, frame.data + range.offset,
+                                        static_cast<uint32_t>(range.length));
+        } else {
+            OrthancPluginAnswerBuffer(context_, output, frame.data,
+                                      static_cast<uint32_t>(frame.size), "image/jxl");
+        }
+        operation.Done(0, range.length);
         return OrthancPluginErrorCode_Success;
 
     } catch (const std::exception& e) {
-        OrthancPluginLogError(context_, (std::string("orthanc-jxl decode error: ") + e.what()).c_str());
+        OrthancPluginLogError(context_, (std::string("orthanc-jxl raw frame error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// ============================================================================
+// Metrics
+// ============================================================================
+
+static double HitRatio(uint64_t hits, uint64_t misses)
+{
+    return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0;
+}
+
+// Point-in-time figures of the pool, load tracker, codec and caches, alongside
+// the latency and byte counters kept by Metrics().
+static void CollectPluginGauges(std::vector<MetricValue>& out)
+{
+    auto add = [&out](const char* name, double value) {
+        out.push_back({std::string("orthanc_jxl_") + name, value});
+    };
+    if (threadPool_) {
+        add("pool_workers", static_cast<double>(threadPool_->Size()));
+        add("pool_queued_tasks", static_cast<double>(threadPool_->QueuedTasks()));
+        add("pool_active_workers", static_cast<double>(threadPool_->ActiveWorkers()));
+        add("pool_busy_seconds", threadPool_->BusyMicros() / 1e6);
+    }
+    if (loadTracker_) {
+        add("inflight_transcodes", static_cast<double>(loadTracker_->InFlightTranscodes()));
+        add("inflight_frames", static_cast<double>(loadTracker_->InFlightFrames()));
+    }
+    if (effortPolicy_) {
+        // Cost estimates behind the effort choices, for efforts measured so far.
+        const EffortPolicy::Stats stats = effortPolicy_->GetStats();
+        for (int e = 1; e <= EffortPolicy::kMaxEffort; ++e) {
+            if (stats.measured[e] > 0) {
+                const std::string name = "effort_" + std::to_string(e) + "_ns_per_sample";
+                add(name.c_str(), stats.nsPerSample[e]);
+            }
+        }
+    }
+    const CodecStats codec = JxlCodec::Stats();
+    add("codec_encoders_created", static_cast<double>(codec.encodersCreated));
+    add("codec_decoders_created", static_cast<double>(codec.decodersCreated));
+    add("codec_reused", static_cast<double>(codec.codecsReused));
+    add("codec_allocations", static_cast<double>(codec.allocations));
+    add("codec_system_allocations", static_cast<double>(codec.systemAllocations));
+    add("codec_idle_arena_bytes", static_cast<double>(codec.idleArenaBytes));
+    if (bufferPool_) {
+        const BufferPool::Stats stats = bufferPool_->GetStats();
+        add("buffer_pool_hit_ratio", HitRatio(stats.hits, stats.misses));
+        add("buffer_pool_drops", static_cast<double>(stats.drops));
+        add("buffer_pool_bytes", static_cast<double>(stats.bytes));
+    }
+    if (fragmentCache_) {
+        const FragmentIndexCache::Stats stats = fragmentCache_->GetStats();
+        add("fragment_cache_hit_ratio", HitRatio(stats.hits, stats.misses));
+        add("fragment_cache_evictions", static_cast<double>(stats.evictions));
+        add("fragment_cache_bytes", static_cast<double>(stats.bytes));
+    }
+    if (frameCache_) {
+        const DecodedFrameCache::Stats stats = frameCache_->GetStats();
+        add("frame_cache_hits", static_cast<double>(stats.hits));
+        add("frame_cache_misses", static_cast<double>(stats.misses));
+        add("frame_cache_hit_ratio", HitRatio(stats.hits, stats.misses));
+        add("frame_cache_evictions", static_cast<double>(stats.evictions));
+        add("frame_cache_bytes", static_cast<double>(stats.bytes));
+    }
+    if (transcodedCache_) {
+        const TranscodedCache::Stats stats = transcodedCache_->GetStats();
+        add("transcoded_cache_hits", static_cast<double>(stats.hits));
+        add("transcoded_cache_misses", static_cast<double>(stats.misses));
+        add("transcoded_cache_hit_ratio", HitRatio(stats.hits, stats.misses));
+        add("transcoded_cache_evictions", static_cast<double>(stats.evictions));
+        add("transcoded_cache_bytes", static_cast<double>(stats.bytes));
+        add("transcoded_cache_disk_bytes", static_cast<double>(stats.diskBytes));
+    }
+    if (prefetcher_) {
+        const FramePrefetcher::Stats stats = prefetcher_->GetStats();
+        add("prefetch_queued", static_cast<double>(stats.queued));
+        add("prefetch_completed", static_cast<double>(stats.completed));
+        add("prefetch_dropped", static_cast<double>(stats.dropped));
+    }
+    if (ingestQueue_) {
+        const IngestQueue::Stats stats = ingestQueue_->GetStats();
+        add("ingest_pending", static_cast<double>(stats.pending));
+        add("ingest_running", static_cast<double>(stats.running));
+        add("ingest_converted", static_cast<double>(stats.converted));
+        add("ingest_rejected", static_cast<double>(stats.rejected));
+        add("ingest_failed", static_cast<double>(stats.failed));
+        add("ingest_retried", static_cast<double>(stats.retried));
+    }
+    if (IngestQueue* queue = RecompressQueue(false)) {
+        const IngestQueue::Stats stats = queue->GetStats();
+        add("recompress_pending", static_cast<double>(stats.pending));
+        add("recompress_converted", static_cast<double>(stats.converted));
+        add("recompress_failed", static_cast<double>(stats.failed));
+        add("recompress_retried", static_cast<double>(stats.retried));
+        const RecompressBytes bytes = GetRecompressBytes();
+        add("recompress_saved_bytes", static_cast<double>(bytes.before - bytes.after));
+    }
+}
+
+// Called by Orthanc before it renders /tools/metrics-prometheus.
+// Orthanc takes metric values as float, which is exact only to 2^24: a byte
+// counter would start losing whole kilobytes after 16 MiB of traffic. Byte
+// values are therefore published in MiB ("..._bytes" as "..._mebibytes"),
+// exact to the MiB up to 16 TiB; /jxl/stats keeps them in bytes.
+static void RefreshMetrics()
+{
+    static const std::string kBytes = "_bytes";
+    std::vector<MetricValue> values;
+    Metrics().Collect(values);
+    CollectPluginGauges(values);
+    for (MetricValue& value : values) {
+        const size_t suffix = value.name.size() - std::min(value.name.size(), kBytes.size());
+        if (value.name.compare(suffix, std::string::npos, kBytes) == 0) {
+            value.name.replace(suffix, std::string::npos, "_mebibytes");
+            value.value /= 1024.0 * 1024.0;
+        }
+        OrthancPluginSetMetricsValue(context_, value.name.c_str(),
+                                     static_cast<float>(value.value),
+                                     OrthancPluginMetricsType_Default);
+    }
+}
+
+// GET /jxl/stats
+//
+// The same metrics as JSON, with the full latency histograms.
+static OrthancPluginErrorCode StatsCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    try {
+        std::vector<MetricValue> gauges;
+        CollectPluginGauges(gauges);
+        const std::string json = Metrics().ToJson(gauges);
+        OrthancPluginAnswerBuffer(context_, output, json.data(),
+                                  static_cast<uint32_t>(json.size()), "application/json");
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_, (std::string("orthanc-jxl stats error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// GET /jxl/trace, DELETE /jxl/trace
+//
+// The recorded stage spans as Chrome trace JSON (load in ui.perfetto.dev or
+// chrome://tracing); DELETE empties the buffer, e.g. before a test import.
+static OrthancPluginErrorCode TraceCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Delete) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET,DELETE");
+        return OrthancPluginErrorCode_Success;
+    }
+    if (!traceRecorder_) {
+        OrthancPluginSendHttpStatusCode(context_, output, 404);
+        return OrthancPluginErrorCode_Success;
+    }
+
+    try {
+        std::string json = "{}";
+        if (request->method == OrthancPluginHttpMethod_Delete) {
+            traceRecorder_->Clear();
+        } else {
+            json = traceRecorder_->ToJson();
+        }
+        OrthancPluginAnswerBuffer(context_, output, json.data(),
+                                  static_cast<uint32_t>(json.size()), "application/json");
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_, (std::string("orthanc-jxl trace error: ") + e.what()).c_str());
         return OrthancPluginErrorCode_Plugin;
     }
 }
@@ -133,6 +835,45 @@ static OrthancPluginErrorCode DecodeImageCallback(
 // Transcoder Callback
 // ============================================================================
 
+// Serializes the transcoded instance straight into the Orthanc-owned output
+// buffer. The buffer is allocated at an upper bound and its size trimmed on
+// commit; if the transcode throws before Release() the buffer is freed again.
+class OrthancBufferSink : public OutputSink {
+public:
+    explicit OrthancBufferSink(OrthancPluginMemoryBuffer* target) : target_(target) {}
+
+    ~OrthancBufferSink() override {
+        if (reserved_) {
+            OrthancPluginFreeMemoryBuffer(context_, target_);
+        }
+    }
+
+    uint8_t* Reserve(size_t capacity) override {
+        if (reserved_ || capacity > std::numeric_limits<uint32_t>::max()) {
+            throw std::runtime_error("Transcoded instance too large for output buffer");
+        }
+        if (OrthancPluginCreateMemoryBuffer(context_, target_, static_cast<uint32_t>(capacity))
+            != OrthancPluginErrorCode_Success) {
+            throw std::runtime_error("Failed to allocate output buffer");
+        }
+        reserved_ = true;
+        return static_cast<uint8_t*>(target_->data);
+    }
+
+    void Commit(size_t size) override {
+        // Orthanc releases the block with free(), so trimming the reported
+        // size is enough.
+        target_->size = static_cast<uint32_t>(size);
+    }
+
+    // Hand the buffer over to Orthanc.
+    void Release() { reserved_ = false; }
+
+private:
+    OrthancPluginMemoryBuffer* target_;
+    bool reserved_ = false;
+};
+
 static OrthancPluginErrorCode TranscoderCallback(
     OrthancPluginMemoryBuffer* transcoded,
     const void* buffer,
@@ -144,12 +885,21 @@ static OrthancPluginErrorCode TranscoderCallback(
     (void)allowNewSopInstanceUid;  // Not used for JXL transcoding
 
     // Check what transfer syntaxes are requested
-    bool jxlRequested = false;
+    bool jxlLosslessRequested = false;
+    bool jxlLossyRequested = false;
+    bool jpegRecompressionRequested = false;
+    bool jpegBaselineRequested = false;
     const char* uncompressedSyntax = nullptr;
 
     for (uint32_t i = 0; i < countSyntaxes; ++i) {
         if (strcmp(allowedSyntaxes[i], TS_JPEG_XL_LOSSLESS) == 0) {
-            jxlRequested = true;
+            jxlLosslessRequested = true;
+        } else if (strcmp(allowedSyntaxes[i], TS_JPEG_XL) == 0) {
+            jxlLossyRequested = true;
+        } else if (strcmp(allowedSyntaxes[i], TS_JPEG_XL_JPEG_RECOMPRESSION) == 0) {
+            jpegRecompressionRequested = true;
+        } else if (strcmp(allowedSyntaxes[i], TS_JPEG_BASELINE) == 0) {
+            jpegBaselineRequested = true;
         }
         // Track first uncompressed syntax for FROM-JXL transcoding
         if (!uncompressedSyntax && IsUncompressedTransferSyntax(allowedSyntaxes[i])) {
@@ -158,51 +908,156 @@ static OrthancPluginErrorCode TranscoderCallback(
     }
 
     try {
-        DicomHandler handler(buffer, static_cast<size_t>(size));
-        std::string currentTs = handler.GetTransferSyntax();
+        // Decide from the meta group alone so foreign instances are declined
+        // without a DCMTK parse. When the sniffer cannot read the meta group the
+        // instance is parsed here, and that parse is reused for the transcode:
+        // every instance is parsed at most once per request.
+        std::unique_ptr<DicomHandler> handler;
+        StageBreakdown parseStages;
+        auto parsed = [&]() -> DicomHandler& {
+            if (!handler) {
+                StageSpan span(parseStages, Stage::Parse);
+                handler = std::make_unique<DicomHandler>(buffer, static_cast<size_t>(size));
+            }
+            return *handler;
+        };
+        std::string currentTs = SniffTransferSyntax(buffer, static_cast<size_t>(size));
+        if (currentTs.empty()) {
+            currentTs = parsed().GetTransferSyntax();
+        }
+
+        // Case 1a: Source is a recompressed JPEG and JPEG Baseline is accepted:
+        // hand back the original JPEG bitstream, byte for byte, without
+        // decoding to pixels.
+        if (currentTs == TS_JPEG_XL_JPEG_RECOMPRESSION && jpegBaselineRequested) {
+            ScopedOperation operation(Operation::ReconstructJpeg);
+            OrthancBufferSink sink(transcoded);
+            TranscodeResult result = ReconstructJpegFromJxl(parsed(), *threadPool_, &sink);
+            sink.Release();
+            operation.Done(result.nativeBytes, result.encodedBytes);
+            result.stages.Add(parseStages);
+
+            char logMsg[512];
+            snprintf(logMsg, sizeof(logMsg),
+                "orthanc-jxl: Reconstructed JPEG (%u frame%s) %zu KB -> %zu KB - %s",
+                result.frameCount, result.frameCount == 1 ? "" : "s",
+                result.encodedBytes / 1024, result.nativeBytes / 1024,
+                result.stages.ToString().c_str());
+            OrthancPluginLogInfo(context_, logMsg);
+
+            return OrthancPluginErrorCode_Success;
+        }
 
-        // Case 1: Source is JXL and uncompressed output is requested (FROM-JXL)
+        // Case 1b: Source is JXL and uncompressed output is requested (FROM-JXL)
         if (IsJxlTransferSyntax(currentTs) && uncompressedSyntax) {
+            ScopedOperation operation(Operation::FromJxl);
+            OrthancBufferSink sink(transcoded);
             TranscodeResult result = TranscodeFromJxl(
-                buffer, static_cast<size_t>(size), uncompressedSyntax, *threadPool_);
+                parsed(), uncompressedSyntax, *threadPool_, &sink, loadTracker_.get());
+            sink.Release();
+            operation.Done(result.nativeBytes, result.encodedBytes);
+            result.stages.Add(parseStages);
 
-            if (OrthancPluginCreateMemoryBuffer(context_, transcoded, result.dicom.size())
-                != OrthancPluginErrorCode_Success) {
-                OrthancPluginLogError(context_, "orthanc-jxl: Failed to allocate output buffer");
-                return OrthancPluginErrorCode_Plugin;
-            }
-            memcpy(transcoded->data, result.dicom.data(), result.dicom.size());
+            char logMsg[512];
+            snprintf(logMsg, sizeof(logMsg),
+                "orthanc-jxl: Transcoded FROM JXL (%u frame%s) -> %zu KB - %s",
+                result.frameCount, result.frameCount == 1 ? "" : "s",
+                result.nativeBytes / 1024, result.stages.ToString().c_str());
+            OrthancPluginLogInfo(context_, logMsg);
+
+            return OrthancPluginErrorCode_Success;
+        }
+
+        // Case 2a: JPEG Baseline source and JPEG Recompression is accepted:
+        // losslessly repack the DCT coefficients, far cheaper than a pixel
+        // transcode and reversible to the exact original JPEG.
+        if (currentTs == TS_JPEG_BASELINE && jpegRecompressionRequested) {
+            ScopedOperation operation(Operation::RecompressJpeg);
+            OrthancBufferSink sink(transcoded);
+            TranscodeResult result = RecompressJpegToJxl(
+                parsed(), pluginConfig_, *threadPool_, &sink, loadTracker_.get());
+            sink.Release();
+            operation.Done(result.nativeBytes, result.encodedBytes);
+            result.stages.Add(parseStages);
 
-            char logMsg[256];
+            double ratio = result.encodedBytes
+                ? static_cast<double>(result.nativeBytes) / result.encodedBytes : 0.0;
+            char logMsg[512];
             snprintf(logMsg, sizeof(logMsg),
-                "orthanc-jxl: Transcoded FROM JXL (%u frame%s) -> %zu KB",
+                "orthanc-jxl: Recompressed JPEG (%u frame%s) %zu KB -> %zu KB (%.2fx) - %s",
                 result.frameCount, result.frameCount == 1 ? "" : "s",
-                result.nativeBytes / 1024);
+                result.nativeBytes / 1024, result.encodedBytes / 1024, ratio,
+                result.stages.ToString().c_str());
             OrthancPluginLogInfo(context_, logMsg);
 
             return OrthancPluginErrorCode_Success;
         }
 
-        // Case 2: JXL is requested and source is not JXL (TO-JXL)
-        if (jxlRequested && !IsJxlTransferSyntax(currentTs)) {
-            TranscodeResult result = TranscodeToJxl(
-                buffer, static_cast<size_t>(size), pluginConfig_, *threadPool_,
-                pluginConfig_.SingleFrameThreads());
+        // Case 2b: JXL is requested and source is not JXL (TO-JXL). The
+        // instance's profile is encoded for the cheapest syntax accepted:
+        // lossy settings only when JPEG XL (.112) is, losslessly otherwise.
+        // A result cached from an earlier retrieval of the same content, for
+        // the same accepted syntaxes, is copied out without parsing or encoding.
+        if ((jxlLosslessRequested || jxlLossyRequested) && !IsJxlTransferSyntax(currentTs)) {
+            std::string cacheKey;
+            FileMetaInfo meta;
+            if (transcodedCache_ && transcodedCache_->Enabled() &&
+                SniffFileMeta(buffer, static_cast<size_t>(size), meta)) {
+                const char* variant = !jxlLossyRequested ? ""
+                                    : jxlLosslessRequested ? "110,112" : "112";
+                cacheKey = TranscodedCache::MakeKey(meta, buffer, static_cast<size_t>(size),
+                                                    variant);
+            }
+            if (TranscodedCache::Result cached = transcodedCache_
+                    ? transcodedCache_->Find(cacheKey) : nullptr) {
+                if (cached->size() > std::numeric_limits<uint32_t>::max() ||
+                    OrthancPluginCreateMemoryBuffer(context_, transcoded,
+                        static_cast<uint32_t>(cached->size())) != OrthancPluginErrorCode_Success) {
+                    OrthancPluginLogError(context_, "orthanc-jxl: cached result buffer alloc failed");
+                    return OrthancPluginErrorCode_Plugin;
+                }
+                memcpy(transcoded->data, cached->data(), cached->size());
 
-            if (OrthancPluginCreateMemoryBuffer(context_, transcoded, result.dicom.size())
-                != OrthancPluginErrorCode_Success) {
-                OrthancPluginLogError(context_, "orthanc-jxl: Failed to allocate output buffer");
-                return OrthancPluginErrorCode_Plugin;
+                char logMsg[256];
+                snprintf(logMsg, sizeof(logMsg),
+                    "orthanc-jxl: Served TO JXL from cache %zu KB -> %zu KB",
+                    static_cast<size_t>(size) / 1024, cached->size() / 1024);
+                OrthancPluginLogInfo(context_, logMsg);
+                return OrthancPluginErrorCode_Success;
             }
-            memcpy(transcoded->data, result.dicom.data(), result.dicom.size());
+
+            const DicomImageInfo info = parsed().GetImageInfo();
+            const EncodeProfile* profile = pluginConfig_.MatchProfile(
+                info.modality, info.sopClassUid, info.width, info.height);
+            const PluginConfig target =
+                pluginConfig_.ForTarget(profile, jxlLossyRequested, jxlLosslessRequested);
+
+            ScopedOperation operation(Operation::ToJxl);
+            OrthancBufferSink sink(transcoded);
+            TranscodeResult result = TranscodeToJxl(
+                parsed(), target, *threadPool_,
+                target.SingleFrameThreads(), &sink, loadTracker_.get());
+            sink.Release();
+            if (!cacheKey.empty()) {
+                transcodedCache_->Insert(cacheKey, transcoded->data, transcoded->size);
+            }
+            operation.Done(result.nativeBytes, result.encodedBytes);
+            result.stages.Add(parseStages);
+            Metrics().RecordModality(info.modality, result.nativeBytes, result.encodedBytes);
+            Metrics().RecordEffort(result.effort, result.nativeBytes, result.encodedBytes);
 
             double ratio = result.encodedBytes
                 ? static_cast<double>(result.nativeBytes) / result.encodedBytes : 0.0;
-            char logMsg[256];
+            char logMsg[512];
             snprintf(logMsg, sizeof(logMsg),
-                "orthanc-jxl: Transcoded TO JXL (%u frame%s) %zu KB -> %zu KB (%.2fx)",
+                "orthanc-jxl: Transcoded TO JXL (%u frame%s, %s, profile %s, effort %d) "
+                "%zu KB -> %zu KB (%.2fx) - %s",
                 result.frameCount, result.frameCount == 1 ? "" : "s",
-                result.nativeBytes / 1024, result.encodedBytes / 1024, ratio);
+                target.EncodesLossy() ? "lossy" : "lossless",
+                profile && !profile->name.empty() ? profile->name.c_str() : "default",
+                result.effort,
+                result.nativeBytes / 1024, result.encodedBytes / 1024, ratio,
+                result.stages.ToString().c_str());
             OrthancPluginLogInfo(context_, logMsg);
 
             return OrthancPluginErrorCode_Success;
@@ -238,21 +1093,948 @@ static OrthancPluginErrorCode TranscoderCallback(
 }
 
 // ============================================================================
-// Plugin Entry Points
+// Background Compression
 // ============================================================================
 
-extern "C" {
-
-ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+// Where a converted instance is kept while it replaces the original, so a
+// crash between deleting the original and storing it loses nothing.
+static std::string StagedInstancePath(const std::string& instanceId)
 {
-    context_ = context;
+    return pluginConfig_.backgroundDirectory + "/staged/" + instanceId + ".dcm";
+}
 
-    // Check Orthanc version
-    if (OrthancPluginCheckVersion(context) == 0) {
-        std::string msg = "orthanc-jxl: This plugin requires Orthanc >= " +
-            std::to_string(ORTHANC_PLUGINS_MINIMAL_MAJOR_NUMBER) + "." +
-            std::to_string(ORTHANC_PLUGINS_MINIMAL_MINOR_NUMBER) + "." +
-            std::to_string(ORTHANC_PLUGINS_MINIMAL_REVISION_NUMBER);
+// Write a file and fsync it and its directory, so that it survives a crash
+// once this returns.
+static void WriteFileDurably(const std::string& path, const void* data, size_t size)
+{
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    const char* p = static_cast<const char*>(data);
+    size_t left = size;
+    while (left > 0) {
+        const ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot write " + path);
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    const bool synced = ::fsync(fd) == 0;
+    if (::close(fd) != 0 || !synced) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    const std::string dir = std::filesystem::path(path).parent_path().string();
+    const int dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dirFd < 0 || ::fsync(dirFd) != 0) {
+        if (dirFd >= 0) {
+            ::close(dirFd);
+        }
+        throw std::runtime_error("Cannot sync " + dir);
+    }
+    ::close(dirFd);
+}
+
+// GET on an internal REST route into a string; empty on failure.
+static std::string RestGetString(const std::string& uri)
+{
+    ScopedMemoryBuffer answer;
+    if (OrthancPluginRestApiGet(context_, &answer.buffer, uri.c_str())
+        != OrthancPluginErrorCode_Success) {
+        return std::string();
+    }
+    return std::string(static_cast<const char*>(answer.buffer.data), answer.buffer.size);
+}
+
+// Store an instance through the REST API; returns Orthanc's "Status"
+// ("Success", or "AlreadyStored" when OverwriteInstances is off).
+static std::string StoreInstance(const void* dicom, size_t size)
+{
+    if (size > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Instance too large to store");
+    }
+    ScopedMemoryBuffer answer;
+    if (OrthancPluginRestApiPost(context_, &answer.buffer, "/instances", dicom,
+                                 static_cast<uint32_t>(size)) != OrthancPluginErrorCode_Success) {
+        throw std::runtime_error("Failed to store the converted instance");
+    }
+    const char* text = static_cast<const char*>(answer.buffer.data);
+    const nlohmann::json reply = nlohmann::json::parse(text, text + answer.buffer.size);
+    return reply.value("Status", std::string());
+}
+
+// `base` is the resource's REST path, e.g. "/series/<id>".
+static void ReadResourceExtras(const std::string& base, ResourceExtras& extras)
+{
+    if (!pluginConfig_.userMetadata.empty()) {
+        const std::string text = RestGetString(base + "/metadata?expand");
+        const nlohmann::json all = text.empty() ? nlohmann::json::object()
+                                                : nlohmann::json::parse(text);
+        for (const std::string& name : pluginConfig_.userMetadata) {
+            if (all.contains(name) && all[name].is_string()) {
+                extras.metadata[name] = all[name].get<std::string>();
+            }
+        }
+    }
+    const std::string labels = RestGetString(base + "/labels");   // Orthanc 1.12+
+    if (!labels.empty()) {
+        extras.labels = nlohmann::json::parse(labels).get<std::vector<std::string>>();
+    }
+}
+
+static InstanceExtras ReadInstanceExtras(const std::string& instanceId)
+{
+    const std::string base = "/instances/" + instanceId;
+    InstanceExtras extras;
+    ReadResourceExtras(base, extras);
+    if (!pluginConfig_.userAttachments.empty()) {
+        const std::string text = RestGetString(base + "/attachments");
+        const nlohmann::json present = text.empty() ? nlohmann::json::array()
+                                                    : nlohmann::json::parse(text);
+        for (const std::string& name : pluginConfig_.userAttachments) {
+            if (std::find(present.begin(), present.end(), name) != present.end()) {
+                ScopedMemoryBuffer content;
+                const std::string uri = base + "/attachments/" + name + "/data";
+                if (OrthancPluginRestApiGet(context_, &content.buffer, uri.c_str())
+                    != OrthancPluginErrorCode_Success) {
+                    throw std::runtime_error("Cannot read attachment " + name);
+                }
+                extras.attachments[name].assign(static_cast<const char*>(content.buffer.data),
+                                                content.buffer.size);
+            }
+        }
+    }
+    const std::string series = RestGetString(base + "/series");
+    const std::string patient = RestGetString(base + "/patient");
+    if (series.empty() || patient.empty()) {
+        throw std::runtime_error("Cannot read the parents of instance " + instanceId);
+    }
+    const nlohmann::json seriesDoc = nlohmann::json::parse(series);
+    for (const std::string& path : {
+             "/series/" + seriesDoc.at("ID").get<std::string>(),
+             "/studies/" + seriesDoc.at("ParentStudy").get<std::string>(),
+             "/patients/" + nlohmann::json::parse(patient).at("ID").get<std::string>()}) {
+        ReadResourceExtras(path, extras.parents[path]);
+    }
+    return extras;
+}
+
+static void PutResource(const std::string& uri, const std::string& body)
+{
+    ScopedMemoryBuffer answer;
+    if (OrthancPluginRestApiPut(context_, &answer.buffer, uri.c_str(), body.data(),
+                                static_cast<uint32_t>(body.size()))
+        != OrthancPluginErrorCode_Success) {
+        throw std::runtime_error("Failed to restore " + uri);
+    }
+}
+
+static void RestoreResourceExtras(const std::string& base, const ResourceExtras& extras)
+{
+    for (const auto& [name, value] : extras.metadata) {
+        PutResource(base + "/metadata/" + name, value);
+    }
+    for (const std::string& label : extras.labels) {
+        PutResource(base + "/labels/" + label, std::string());
+    }
+}
+
+// Put the extras back on the replacement instance and, when the original was
+// deleted rather than overwritten, on its parents too: if it was the last
+// instance below them, they were deleted and recreated bare with it.
+static void RestoreInstanceExtras(const std::string& instanceId, const InstanceExtras& extras,
+                                  bool withParents)
+{
+    const std::string base = "/instances/" + instanceId;
+    RestoreResourceExtras(base, extras);
+    for (const auto& [name, content] : extras.attachments) {
+        PutResource(base + "/attachments/" + name, content);
+    }
+    if (withParents) {
+        for (const auto& [path, parent] : extras.parents) {
+            RestoreResourceExtras(path, parent);
+        }
+    }
+}
+
+// Put `dicom` (same UIDs, hence the same Orthanc ID) in place of the stored
+// instance. With OverwriteInstances the store replaces it directly; otherwise
+// the original is deleted first, with the staged copy (synced to disk before
+// anything is deleted) covering the gap. Either way Orthanc drops what it
+// kept beside the original, so its InstanceExtras are staged too and put
+// back on the replacement (and, after a delete, on the series, study and
+// patient it may have taken with it). If the replacement is refused after
+// the delete, `original` is stored back.
+static void ReplaceStoredInstance(const std::string& instanceId, const std::vector<uint8_t>& dicom,
+                                  const void* original, size_t originalSize)
+{
+    const std::string staged = StagedInstancePath(instanceId);
+    const std::string stagedExtras = StagedExtrasPath(staged);
+    const InstanceExtras extras = ReadInstanceExtras(instanceId);
+    const std::vector<uint8_t> extrasCbor = extras.ToCbor();
+    WriteFileDurably(stagedExtras, extrasCbor.data(), extrasCbor.size());
+    WriteFileDurably(staged, dicom.data(), dicom.size());
+    auto unstage = [&]() {
+        std::remove(staged.c_str());
+        std::remove(stagedExtras.c_str());
+    };
+
+    bool deleted = false;
+    if (StoreInstance(dicom.data(), dicom.size()) == "AlreadyStored") {
+        const std::string uri = "/instances/" + instanceId;
+        if (OrthancPluginRestApiDelete(context_, uri.c_str()) != OrthancPluginErrorCode_Success) {
+            unstage();
+            throw std::runtime_error("Failed to delete the original instance");
+        }
+        deleted = true;
+        try {
+            StoreInstance(dicom.data(), dicom.size());
+        } catch (const std::exception&) {
+            StoreInstance(original, originalSize);   // else the staged copy is recovered
+            RestoreInstanceExtras(instanceId, extras, true);
+            unstage();
+            throw;
+        }
+    }
+    RestoreInstanceExtras(instanceId, extras, deleted);
+    unstage();
+}
+
+// Convert an instance to JPEG XL for background and batch compression:
+// uncompressed instances are encoded with the configured options and JPEG
+// Baseline is recompressed losslessly. False for anything else.
+static bool ConvertToJxl(const void* dicom, size_t size, TranscodeResult& result)
+{
+    std::string ts = SniffTransferSyntax(dicom, size);
+    if (!ts.empty() && ts != TS_JPEG_BASELINE && !IsUncompressedTransferSyntax(ts)) {
+        return false;
+    }
+
+    StageBreakdown parse;
+    DicomHandler handler = [&] {
+        StageSpan span(parse, Stage::Parse);
+        return DicomHandler(dicom, size);
+    }();
+    ts = handler.GetTransferSyntax();
+    // Each frame is encoded single-threaded, with no libjxl workers of its
+    // own, and outside the load tracker. The frames still run on the shared
+    // pool. The ingest queue holds them back under foreground load, but a
+    // batch job competes with foreground requests for pool workers.
+    if (ts == TS_JPEG_BASELINE) {
+        ScopedOperation operation(Operation::RecompressJpeg);
+        result = RecompressJpegToJxl(handler, pluginConfig_, *threadPool_);
+        operation.Done(result.nativeBytes, result.encodedBytes);
+    } else if (IsUncompressedTransferSyntax(ts)) {
+        // Profiles apply to stored conversions too, lossy only when the
+        // top-level settings are: archive copies of WAN profiles stay lossless.
+        const DicomImageInfo info = handler.GetImageInfo();
+        const PluginConfig target = pluginConfig_.ForTarget(
+            pluginConfig_.MatchProfile(info.modality, info.sopClassUid, info.width, info.height),
+            pluginConfig_.EncodesLossy(), true);
+        ScopedOperation operation(Operation::ToJxl);
+        result = TranscodeToJxl(handler, target, *threadPool_, JxlCodec::kSingleThreaded);
+        operation.Done(result.nativeBytes, result.encodedBytes);
+        Metrics().RecordModality(handler.GetImageInfo().modality,
+                                 result.nativeBytes, result.encodedBytes);
+        Metrics().RecordEffort(result.effort, result.nativeBytes, result.encodedBytes);
+    } else {
+        return false;
+    }
+    result.stages.Add(parse);
+    return true;
+}
+
+// IngestQueue worker: replace one stored instance by its JPEG XL form, or
+// leave it alone when ConvertToJxl does not apply.
+static IngestQueue::Outcome CompressStoredInstance(const IngestQueue::Entry& entry)
+{
+    try {
+        ScopedMemoryBuffer dicom;
+        if (OrthancPluginGetDicomForInstance(context_, &dicom.buffer, entry.instanceId.c_str())
+            != OrthancPluginErrorCode_Success) {
+            return IngestQueue::Outcome::Skipped;   // deleted since it was queued
+        }
+        const size_t size = dicom.buffer.size;
+        TranscodeResult result;
+        if (!ConvertToJxl(dicom.buffer.data, size, result)) {
+            return IngestQueue::Outcome::Skipped;
+        }
+        ReplaceStoredInstance(entry.instanceId, result.dicom, dicom.buffer.data, size);
+
+        char logMsg[512];
+        snprintf(logMsg, sizeof(logMsg),
+            "orthanc-jxl: Background compressed %s (%u frame%s) %zu KB -> %zu KB - %s",
+            entry.instanceId.c_str(), result.frameCount, result.frameCount == 1 ? "" : "s",
+            size / 1024, result.dicomBytes / 1024, result.stages.ToString().c_str());
+        OrthancPluginLogInfo(context_, logMsg);
+        return IngestQueue::Outcome::Converted;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogWarning(context_, ("orthanc-jxl: Background compression of " +
+            entry.instanceId + " failed, left as stored: " + e.what()).c_str());
+        throw;
+    }
+}
+
+// Store replacements left staged by a crash mid-replacement, with what the
+// original carried (see RecoverStagedReplacements). When the original is
+// still there its journal entry simply runs again.
+static void RecoverStagedInstances()
+{
+    RecoverStagedReplacements(pluginConfig_.backgroundDirectory + "/staged",
+        [](const std::vector<uint8_t>& dicom) { StoreInstance(dicom.data(), dicom.size()); },
+        [](const std::string& instanceId, const InstanceExtras& extras) {
+            RestoreInstanceExtras(instanceId, extras, true);
+        },
+        [](const std::string& path, const std::string& error) {
+            OrthancPluginLogWarning(context_, ("orthanc-jxl: Cannot restore staged instance " +
+                path + ": " + error).c_str());
+        });
+}
+
+// Start and stop the background queues with Orthanc, and queue new instances
+// that background compression can convert. Replacements stored by
+// CompressStoredInstance are JPEG XL and therefore not re-queued.
+static OrthancPluginErrorCode OnChangeCallback(
+    OrthancPluginChangeType changeType,
+    OrthancPluginResourceType resourceType,
+    const char* resourceId)
+{
+    try {
+        if (changeType == OrthancPluginChangeType_OrthancStarted) {
+            RecoverStagedInstances();
+            std::lock_guard<std::mutex> lock(recompressMutex_);
+            orthancStarted_ = true;
+            for (IngestQueue* queue : {ingestQueue_.get(), recompressQueue_.get()}) {
+                if (queue) {
+                    queue->Start();
+                }
+            }
+        } else if (changeType == OrthancPluginChangeType_OrthancStopped) {
+            std::lock_guard<std::mutex> lock(recompressMutex_);
+            for (IngestQueue* queue : {ingestQueue_.get(), recompressQueue_.get()}) {
+                if (queue) {
+                    queue->Stop();
+                }
+            }
+        } else if (ingestQueue_ && changeType == OrthancPluginChangeType_NewInstance &&
+                   resourceType == OrthancPluginResourceType_Instance) {
+            const std::string id = resourceId;
+            const std::string ts = RestGetString("/instances/" + id + "/metadata/TransferSyntax");
+            if (ts != TS_JPEG_BASELINE && !IsUncompressedTransferSyntax(ts)) {
+                return OrthancPluginErrorCode_Success;
+            }
+            std::string studyUid;
+            const std::string study = RestGetString("/instances/" + id + "/study");
+            if (!study.empty()) {
+                studyUid = nlohmann::json::parse(study)["MainDicomTags"]
+                    .value("StudyInstanceUID", std::string());
+            }
+            const IngestQueue::Stats before = ingestQueue_->GetStats();
+            if (!ingestQueue_->Push({id, studyUid}) &&
+                ingestQueue_->GetStats().rejected > before.rejected && before.rejected == 0) {
+                OrthancPluginLogWarning(context_,
+                    "orthanc-jxl: Background compression queue full; new instances are "
+                    "left as stored (see BackgroundCompressionQueueSize)");
+            }
+        }
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_,
+            (std::string("orthanc-jxl background compression error: ") + e.what()).c_str());
+    }
+    return OrthancPluginErrorCode_Success;
+}
+
+// True if `segment` is a DICOM UID (digits and dots), not an Orthanc ID.
+static bool IsDicomUid(const std::string& segment)
+{
+    return !segment.empty() &&
+           segment.find_first_not_of("0123456789.") == std::string::npos;
+}
+
+// Sees every HTTP request, and lets all of them through: reads of a study
+// (DICOMweb .../studies/{StudyInstanceUID}..., WADO-URI ?studyUID=) move its
+// pending instances to the front of the background compression queue.
+static int32_t IncomingRequestFilter(
+    OrthancPluginHttpMethod method,
+    const char* uri,
+    const char* /* ip */,
+    uint32_t /* headersCount */,
+    const char* const* /* headersKeys */,
+    const char* const* /* headersValues */,
+    uint32_t getArgumentsCount,
+    const char* const* getArgumentsKeys,
+    const char* const* getArgumentsValues)
+{
+    if (!ingestQueue_ || method != OrthancPluginHttpMethod_Get) {
+        return 1;
+    }
+    const char* studies = std::strstr(uri, "/studies/");
+    if (studies) {
+        const std::string rest = studies + std::strlen("/studies/");
+        const std::string uid = rest.substr(0, rest.find('/'));
+        if (IsDicomUid(uid)) {
+            ingestQueue_->MarkStudyViewed(uid);
+        }
+    }
+    for (uint32_t i = 0; i < getArgumentsCount; ++i) {
+        if (std::strcmp(getArgumentsKeys[i], "studyUID") == 0 &&
+            IsDicomUid(getArgumentsValues[i])) {
+            ingestQueue_->MarkStudyViewed(getArgumentsValues[i]);
+        }
+    }
+    return 1;
+}
+
+// GET /jxl/ingest
+//
+// Background compression progress as JSON.
+static OrthancPluginErrorCode IngestStatusCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    nlohmann::json status = {{"Enabled", ingestQueue_ != nullptr}};
+    if (ingestQueue_) {
+        const IngestQueue::Stats stats = ingestQueue_->GetStats();
+        status["Pending"] = stats.pending;
+        status["Prioritised"] = stats.prioritised;
+        status["Retrying"] = stats.retrying;
+        status["Running"] = stats.running;
+        status["Restored"] = stats.restored;
+        status["Queued"] = stats.queued;
+        status["Rejected"] = stats.rejected;
+        status["Converted"] = stats.converted;
+        status["Skipped"] = stats.skipped;
+        status["Failed"] = stats.failed;
+        status["Retried"] = stats.retried;
+    }
+    const std::string json = status.dump();
+    OrthancPluginAnswerBuffer(context_, output, json.data(),
+                              static_cast<uint32_t>(json.size()), "application/json");
+    return OrthancPluginErrorCode_Success;
+}
+
+// ============================================================================
+// Deferred Recompression
+// ============================================================================
+
+// Pending entries a recompression request may add; beyond, it is refused.
+static constexpr size_t kRecompressQueueCapacity = 1000000;
+
+// IngestQueue worker: re-encode one stored JPEG XL Lossless instance at
+// RecompressEffort and keep the result if it is smaller.
+static IngestQueue::Outcome RecompressStoredInstance(const IngestQueue::Entry& entry)
+{
+    try {
+        const std::string ts =
+            RestGetString("/instances/" + entry.instanceId + "/metadata/TransferSyntax");
+        if (ts != TS_JPEG_XL_LOSSLESS) {
+            return IngestQueue::Outcome::Skipped;
+        }
+        ScopedMemoryBuffer dicom;
+        if (OrthancPluginGetDicomForInstance(context_, &dicom.buffer, entry.instanceId.c_str())
+            != OrthancPluginErrorCode_Success) {
+            return IngestQueue::Outcome::Skipped;
+        }
+        const size_t size = dicom.buffer.size;
+        StageBreakdown parse;
+        DicomHandler handler = [&] {
+            StageSpan span(parse, Stage::Parse);
+            return DicomHandler(dicom.buffer.data, size);
+        }();
+        TranscodeResult result = RecompressJxl(handler, pluginConfig_,
+                                               pluginConfig_.recompressEffort, *threadPool_);
+        result.stages.Add(parse);
+        if (result.encodedBytes >= result.nativeBytes) {
+            AddRecompressBytes(result.nativeBytes, result.nativeBytes);
+            return IngestQueue::Outcome::Skipped;   // already as small: keep it
+        }
+        ReplaceStoredInstance(entry.instanceId, result.dicom, dicom.buffer.data, size);
+        AddRecompressBytes(result.nativeBytes, result.encodedBytes);
+
+        char logMsg[512];
+        snprintf(logMsg, sizeof(logMsg),
+            "orthanc-jxl: Recompressed %s at effort %d (%u frame%s) %zu KB -> %zu KB - %s",
+            entry.instanceId.c_str(), pluginConfig_.recompressEffort,
+            result.frameCount, result.frameCount == 1 ? "" : "s",
+            result.nativeBytes / 1024, result.encodedBytes / 1024,
+            result.stages.ToString().c_str());
+        OrthancPluginLogInfo(context_, logMsg);
+        return IngestQueue::Outcome::Converted;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogWarning(context_, ("orthanc-jxl: Recompression of " + entry.instanceId +
+            " failed, original kept: " + e.what()).c_str());
+        throw;
+    }
+}
+
+// True if the local time is inside one of the RecompressWindows.
+static bool InRecompressWindow()
+{
+    const std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    return pluginConfig_.InRecompressWindow(local.tm_hour * 60 + local.tm_min);
+}
+
+static IngestQueue* RecompressQueue(bool create)
+{
+    std::lock_guard<std::mutex> lock(recompressMutex_);
+    if (!recompressQueue_ && create) {
+        std::filesystem::create_directories(pluginConfig_.backgroundDirectory + "/staged");
+        IngestQueue::Options options;
+        options.journalPath = pluginConfig_.backgroundDirectory + "/recompress.journal";
+        options.capacity = kRecompressQueueCapacity;
+        options.workers = 1;
+        options.cpuShare = pluginConfig_.recompressCpuShare;
+        options.mayStart = InRecompressWindow;
+        recompressQueue_ = std::make_unique<IngestQueue>(*loadTracker_, options,
+                                                         RecompressStoredInstance);
+        if (orthancStarted_) {
+            recompressQueue_->Start();
+        }
+    }
+    return recompressQueue_.get();
+}
+
+// IDs of the instances of a study, series or instance, or every instance of
+// the archive; empty when `id` names nothing.
+static std::vector<std::string> InstancesOf(const std::string& id, bool archive)
+{
+    std::vector<std::string> ids;
+    if (archive) {
+        for (size_t since = 0;; since += 1000) {
+            const std::string page =
+                RestGetString("/instances?since=" + std::to_string(since) + "&limit=1000");
+            const nlohmann::json list = page.empty() ? nlohmann::json::array()
+                                                     : nlohmann::json::parse(page);
+            for (const auto& instance : list) {
+                ids.push_back(instance.get<std::string>());
+            }
+            if (list.size() < 1000) {
+                return ids;
+            }
+        }
+    }
+    for (const char* level : {"/studies/", "/series/"}) {
+        const std::string children = RestGetString(level + id + "/instances");
+        if (!children.empty()) {
+            for (const auto& instance : nlohmann::json::parse(children)) {
+                ids.push_back(instance["ID"].get<std::string>());
+            }
+            return ids;
+        }
+    }
+    if (!RestGetString("/instances/" + id).empty()) {
+        ids.push_back(id);
+    }
+    return ids;
+}
+
+// POST /jxl/recompress  {"Resources": [<study, series or instance ID>...]}
+//                       {"Archive": true}
+// GET  /jxl/recompress
+//
+// Queue stored JPEG XL Lossless instances for re-encoding at
+// RecompressEffort, or report progress and the bytes saved so far.
+static OrthancPluginErrorCode RecompressCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "GET,POST");
+        return OrthancPluginErrorCode_Success;
+    }
+
+    try {
+        nlohmann::json answer;
+        if (request->method == OrthancPluginHttpMethod_Post) {
+            const char* text = static_cast<const char*>(request->body);
+            const nlohmann::json body = request->bodySize
+                ? nlohmann::json::parse(text, text + request->bodySize) : nlohmann::json::object();
+            const bool archive = body.value("Archive", false);
+            std::vector<std::string> resources;
+            if (body.contains("Resources")) {
+                resources = body["Resources"].get<std::vector<std::string>>();
+            }
+            if (!archive && resources.empty()) {
+                return OrthancPluginErrorCode_BadRequest;
+            }
+            if (archive) {
+                resources.assign(1, std::string());
+            }
+
+            IngestQueue* queue = RecompressQueue(true);
+            size_t queued = 0, unknown = 0;
+            const uint64_t rejectedBefore = queue->GetStats().rejected;
+            for (const std::string& resource : resources) {
+                const std::vector<std::string> instances = InstancesOf(resource, archive);
+                unknown += instances.empty() ? 1 : 0;
+                for (const std::string& instance : instances) {
+                    queued += queue->Push({instance, std::string()}) ? 1 : 0;
+                }
+            }
+            answer["Queued"] = queued;
+            answer["Rejected"] = queue->GetStats().rejected - rejectedBefore;
+            answer["UnknownResources"] = unknown;
+        }
+
+        IngestQueue* queue = RecompressQueue(false);
+        const IngestQueue::Stats stats = queue ? queue->GetStats() : IngestQueue::Stats();
+        const RecompressBytes bytes = GetRecompressBytes();
+        const uint64_t before = bytes.before;
+        const uint64_t after = bytes.after;
+        answer["Effort"] = pluginConfig_.recompressEffort;
+        answer["InWindow"] = InRecompressWindow();
+        answer["Pending"] = stats.pending;
+        answer["Running"] = stats.running;
+        answer["Converted"] = stats.converted;
+        answer["Skipped"] = stats.skipped;
+        answer["Failed"] = stats.failed;
+        answer["Retried"] = stats.retried;
+        answer["BytesBefore"] = before;
+        answer["BytesAfter"] = after;
+        answer["BytesSaved"] = before - after;
+        answer["Savings"] = before ? 1.0 - static_cast<double>(after) / before : 0.0;
+
+        const std::string json = answer.dump();
+        OrthancPluginAnswerBuffer(context_, output, json.data(),
+                                  static_cast<uint32_t>(json.size()), "application/json");
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_,
+            (std::string("orthanc-jxl recompress error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// ============================================================================
+// Batch Transcoding
+// ============================================================================
+
+// Finished instances stored per job step, and how long a step waits for them.
+static constexpr size_t kBatchStoreChunk = 32;
+static constexpr std::chrono::milliseconds kBatchStepWait{500};
+static constexpr size_t kBatchMaxErrors = 20;
+
+// One POST /jxl/{series|studies}/{id}/transcode, run by Orthanc's job engine:
+// the pipeline converts in the background, each step stores what it
+// finished. `step` serialises steps with shutdown; `counters` guards the
+// figures that /jobs/{id} reads from REST threads.
+struct BatchJob {
+    std::string level;
+    std::string resourceId;
+    std::vector<std::string> instances;
+    std::unique_ptr<BatchTranscoder> transcoder;
+
+    std::mutex step;
+    std::mutex counters;
+    size_t converted = 0;
+    size_t skipped = 0;
+    size_t failed = 0;
+    uint64_t bytesBefore = 0;
+    uint64_t bytesAfter = 0;
+    std::vector<std::string> errors;
+    std::chrono::steady_clock::time_point started;
+    double seconds = 0.0;
+};
+
+// Jobs Orthanc has not finalized yet, paused on plugin shutdown.
+static std::mutex batchJobsMutex_;
+static std::set<BatchJob*> batchJobs_;
+static std::atomic<bool> batchJobsStopped_{false};
+
+// BatchTranscoder work, on a pool worker: fetch and convert one instance.
+static BatchTranscoder::Outcome ConvertBatchInstance(BatchTranscoder::Item& item)
+{
+    ScopedMemoryBuffer dicom;
+    if (OrthancPluginGetDicomForInstance(context_, &dicom.buffer, item.id.c_str())
+        != OrthancPluginErrorCode_Success) {
+        throw std::runtime_error("Instance not found");
+    }
+    TranscodeResult result;
+    if (!ConvertToJxl(dicom.buffer.data, dicom.buffer.size, result)) {
+        return BatchTranscoder::Outcome::Skipped;
+    }
+    const uint8_t* data = static_cast<const uint8_t*>(dicom.buffer.data);
+    item.original.assign(data, data + dicom.buffer.size);
+    item.converted = std::move(result.dicom);
+    return BatchTranscoder::Outcome::Converted;
+}
+
+static void RecordBatchError(BatchJob& job, const std::string& id, const std::string& error)
+{
+    ++job.failed;
+    if (job.errors.size() < kBatchMaxErrors) {
+        job.errors.push_back(id + ": " + error);
+    }
+}
+
+static OrthancPluginJobStepStatus BatchJobStep(void* raw)
+{
+    BatchJob& job = *static_cast<BatchJob*>(raw);
+    std::lock_guard<std::mutex> stepLock(job.step);
+    if (batchJobsStopped_) {
+        return OrthancPluginJobStepStatus_Failure;
+    }
+
+    try {
+        if (!job.transcoder) {
+            job.transcoder = std::make_unique<BatchTranscoder>(
+                *threadPool_, job.instances, ConvertBatchInstance);
+            job.started = std::chrono::steady_clock::now();
+        }
+        job.transcoder->Start();
+
+        // Bulk write-back: store this step's share of finished instances.
+        std::vector<BatchTranscoder::Item> items;
+        const bool more = job.transcoder->Take(items, kBatchStoreChunk, kBatchStepWait);
+        for (BatchTranscoder::Item& item : items) {
+            std::string error = item.error;
+            if (item.outcome == BatchTranscoder::Outcome::Converted) {
+                try {
+                    ReplaceStoredInstance(item.id, item.converted,
+                                          item.original.data(), item.original.size());
+                } catch (const std::exception& e) {
+                    error = e.what();
+                    item.outcome = BatchTranscoder::Outcome::Failed;
+                }
+            }
+            std::lock_guard<std::mutex> lock(job.counters);
+            switch (item.outcome) {
+                case BatchTranscoder::Outcome::Converted:
+                    ++job.converted;
+                    job.bytesBefore += item.original.size();
+                    job.bytesAfter += item.converted.size();
+                    break;
+                case BatchTranscoder::Outcome::Skipped:
+                    ++job.skipped;
+                    break;
+                case BatchTranscoder::Outcome::Failed:
+                    RecordBatchError(job, item.id, error);
+                    break;
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(job.counters);
+            job.seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - job.started).count();
+        }
+
+        if (more || job.transcoder->Unstarted() > 0) {
+            return OrthancPluginJobStepStatus_Continue;
+        }
+
+        char logMsg[512];
+        snprintf(logMsg, sizeof(logMsg),
+            "orthanc-jxl: Batch transcoded %s %s - %zu converted, %zu skipped, %zu failed, "
+            "%llu KB -> %llu KB in %.1f s",
+            job.level.c_str(), job.resourceId.c_str(), job.converted, job.skipped, job.failed,
+            static_cast<unsigned long long>(job.bytesBefore / 1024),
+            static_cast<unsigned long long>(job.bytesAfter / 1024), job.seconds);
+        OrthancPluginLogInfo(context_, logMsg);
+        return OrthancPluginJobStepStatus_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_,
+            (std::string("orthanc-jxl batch transcode error: ") + e.what()).c_str());
+        return OrthancPluginJobStepStatus_Failure;
+    }
+}
+
+// Paused or canceled: stop starting instances, and let the running ones
+// finish; a resumed job carries on with the rest.
+static OrthancPluginErrorCode BatchJobStop(void* raw, OrthancPluginJobStopReason reason)
+{
+    BatchJob& job = *static_cast<BatchJob*>(raw);
+    std::lock_guard<std::mutex> stepLock(job.step);
+    if (reason != OrthancPluginJobStopReason_Success && job.transcoder) {
+        job.transcoder->Pause();
+    }
+    return OrthancPluginErrorCode_Success;
+}
+
+// Resubmitted after failing or being canceled: start over. Instances
+// converted the first time are JPEG XL now and come out skipped.
+static OrthancPluginErrorCode BatchJobReset(void* raw)
+{
+    BatchJob& job = *static_cast<BatchJob*>(raw);
+    std::lock_guard<std::mutex> stepLock(job.step);
+    job.transcoder.reset();
+    std::lock_guard<std::mutex> lock(job.counters);
+    job.converted = job.skipped = job.failed = 0;
+    job.bytesBefore = job.bytesAfter = 0;
+    job.errors.clear();
+    job.seconds = 0.0;
+    return OrthancPluginErrorCode_Success;
+}
+
+static float BatchJobProgress(void* raw)
+{
+    BatchJob& job = *static_cast<BatchJob*>(raw);
+    std::lock_guard<std::mutex> lock(job.counters);
+    const size_t done = job.converted + job.skipped + job.failed;
+    return job.instances.empty() ? 1.0f
+                                 : static_cast<float>(done) / job.instances.size();
+}
+
+static OrthancPluginErrorCode BatchJobContent(OrthancPluginMemoryBuffer* target, void* raw)
+{
+    BatchJob& job = *static_cast<BatchJob*>(raw);
+    nlohmann::json content;
+    {
+        std::lock_guard<std::mutex> lock(job.counters);
+        const size_t done = job.converted + job.skipped + job.failed;
+        content["Level"] = job.level;
+        content["Resource"] = job.resourceId;
+        content["Instances"] = job.instances.size();
+        content["Done"] = done;
+        content["Converted"] = job.converted;
+        content["Skipped"] = job.skipped;
+        content["Failed"] = job.failed;
+        content["BytesBefore"] = job.bytesBefore;
+        content["BytesAfter"] = job.bytesAfter;
+        content["Savings"] = job.bytesBefore
+            ? 1.0 - static_cast<double>(job.bytesAfter) / job.bytesBefore : 0.0;
+        content["InstancesPerSecond"] = job.seconds > 0.0 ? done / job.seconds : 0.0;
+        content["MegabytesPerSecond"] = job.seconds > 0.0
+            ? job.bytesBefore / (1024.0 * 1024.0) / job.seconds : 0.0;
+        content["Errors"] = job.errors;
+    }
+    const std::string json = content.dump();
+    if (OrthancPluginCreateMemoryBuffer(context_, target, static_cast<uint32_t>(json.size()))
+        != OrthancPluginErrorCode_Success) {
+        return OrthancPluginErrorCode_NotEnoughMemory;
+    }
+    memcpy(target->data, json.data(), json.size());
+    return OrthancPluginErrorCode_Success;
+}
+
+// Not serialized: a job interrupted by a restart is simply submitted again.
+static int32_t BatchJobSerialized(OrthancPluginMemoryBuffer* /* target */, void* /* job */)
+{
+    return 0;
+}
+
+static void BatchJobFinalize(void* raw)
+{
+    BatchJob* job = static_cast<BatchJob*>(raw);
+    {
+        std::lock_guard<std::mutex> lock(batchJobsMutex_);
+        batchJobs_.erase(job);
+    }
+    delete job;
+}
+
+// POST /jxl/series/{id}/transcode   {"Priority": 0}
+// POST /jxl/studies/{id}/transcode
+//
+// Submit an Orthanc job converting every instance of the series or study to
+// JPEG XL through one shared pipeline (see BatchTranscoder). Answers the job
+// ID; /jobs/{ID} reports progress, throughput and the bytes saved.
+static OrthancPluginErrorCode BatchTranscodeCallback(
+    OrthancPluginRestOutput* output,
+    const char* /* url */,
+    const OrthancPluginHttpRequest* request)
+{
+    if (request->method != OrthancPluginHttpMethod_Post) {
+        OrthancPluginSendMethodNotAllowed(context_, output, "POST");
+        return OrthancPluginErrorCode_Success;
+    }
+    if (request->groupsCount != 2) {
+        return OrthancPluginErrorCode_BadRequest;
+    }
+
+    try {
+        const char* text = static_cast<const char*>(request->body);
+        const nlohmann::json body = request->bodySize
+            ? nlohmann::json::parse(text, text + request->bodySize) : nlohmann::json::object();
+        const int priority = body.value("Priority", 0);
+
+        auto job = std::make_unique<BatchJob>();
+        job->level = request->groups[0];
+        job->resourceId = request->groups[1];
+        const std::string children =
+            RestGetString("/" + job->level + "/" + job->resourceId + "/instances");
+        if (children.empty()) {
+            return OrthancPluginErrorCode_UnknownResource;
+        }
+        for (const auto& instance : nlohmann::json::parse(children)) {
+            job->instances.push_back(instance["ID"].get<std::string>());
+        }
+        std::error_code error;
+        std::filesystem::create_directories(pluginConfig_.backgroundDirectory + "/staged", error);
+
+        {
+            std::lock_guard<std::mutex> lock(batchJobsMutex_);
+            if (batchJobsStopped_) {
+                return OrthancPluginErrorCode_Plugin;
+            }
+            batchJobs_.insert(job.get());
+        }
+        const size_t count = job->instances.size();
+        BatchJob* owned = job.release();
+        OrthancPluginJob* orthancJob = OrthancPluginCreateJob2(
+            context_, owned, BatchJobFinalize, "JxlBatchTranscode", BatchJobProgress,
+            BatchJobContent, BatchJobSerialized, BatchJobStep, BatchJobStop, BatchJobReset);
+        if (!orthancJob) {
+            BatchJobFinalize(owned);
+            return OrthancPluginErrorCode_Plugin;
+        }
+        char* jobId = OrthancPluginSubmitJob(context_, orthancJob, priority);
+        if (!jobId) {
+            OrthancPluginFreeJob(context_, orthancJob);   // finalizes it
+            return OrthancPluginErrorCode_Plugin;
+        }
+
+        nlohmann::json answer;
+        answer["ID"] = jobId;
+        answer["Path"] = std::string("/jobs/") + jobId;
+        answer["Instances"] = count;
+        OrthancPluginFreeString(context_, jobId);
+        const std::string json = answer.dump();
+        OrthancPluginAnswerBuffer(context_, output, json.data(),
+                                  static_cast<uint32_t>(json.size()), "application/json");
+        return OrthancPluginErrorCode_Success;
+
+    } catch (const std::exception& e) {
+        OrthancPluginLogError(context_,
+            (std::string("orthanc-jxl batch transcode error: ") + e.what()).c_str());
+        return OrthancPluginErrorCode_Plugin;
+    }
+}
+
+// ============================================================================
+// Plugin Entry Points
+// ============================================================================
+
+extern "C" {
+
+ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* context)
+{
+    context_ = context;
+
+    // Check Orthanc version
+    if (OrthancPluginCheckVersion(context) == 0) {
+        std::string msg = "orthanc-jxl: This plugin requires Orthanc >= " +
+            std::to_string(ORTHANC_PLUGINS_MINIMAL_MAJOR_NUMBER) + "." +
+            std::to_string(ORTHANC_PLUGINS_MINIMAL_MINOR_NUMBER) + "." +
+            std::to_string(ORTHANC_PLUGINS_MINIMAL_REVISION_NUMBER);
         OrthancPluginLogError(context, msg.c_str());
         return -1;
     }
@@ -262,6 +2044,9 @@ ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* contex
     // Create the shared worker pool for frame-level parallelism.
     unsigned int hw = std::thread::hardware_concurrency();
     threadPool_ = std::make_unique<ThreadPool>(hw == 0 ? 1u : hw);
+    // libjxl's own parallelism runs on the same pool, so concurrent requests
+    // share one bounded set of codec threads.
+    JxlCodec::SetSharedPool(threadPool_.get());
 
     // Parse plugin configuration
     char* configJson = OrthancPluginGetConfiguration(context);
@@ -272,6 +2057,78 @@ ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* contex
         pluginConfig_ = PluginConfig::Default();
     }
 
+    fragmentCache_ = std::make_unique<FragmentIndexCache>(pluginConfig_.fragmentCacheBytes);
+    frameCache_ = std::make_unique<DecodedFrameCache>(pluginConfig_.decodedFrameCacheBytes);
+    {
+        TranscodedCache::Options options;
+        options.memoryBytes = pluginConfig_.transcodedCacheBytes;
+        options.diskBytes = pluginConfig_.transcodedCacheDiskBytes;
+        options.directory = pluginConfig_.transcodedCacheDirectory;
+        options.fingerprint = pluginConfig_.OutputFingerprint();
+        try {
+            transcodedCache_ = std::make_unique<TranscodedCache>(options);
+        } catch (const std::exception& e) {
+            // Keep the memory tier without the unusable directory.
+            OrthancPluginLogError(context, (std::string("orthanc-jxl: Transcoded cache "
+                "disk tier disabled: ") + e.what()).c_str());
+            options.diskBytes = 0;
+            transcodedCache_ = std::make_unique<TranscodedCache>(options);
+        }
+    }
+    bufferPool_ = std::make_unique<BufferPool>(pluginConfig_.bufferPoolBytes);
+    BufferPool::SetShared(bufferPool_.get());
+    loadTracker_ = std::make_unique<LoadTracker>(threadPool_->Size() + 1,
+                                                 pluginConfig_.adaptiveThreads);
+    // Prefetch may occupy at most half the pool; the rest stays free for
+    // the requests themselves.
+    prefetcher_ = std::make_unique<FramePrefetcher>(
+        *threadPool_, *frameCache_, *loadTracker_, pluginConfig_.prefetchFrames,
+        std::max<size_t>(1, threadPool_->Size() / 2));
+    if (pluginConfig_.AdaptiveEffort()) {
+        EffortPolicy::Options options;
+        options.minEffort = pluginConfig_.minimumEffort;
+        options.latencyMs = pluginConfig_.effortLatencyMs;
+        options.throughputMBps = pluginConfig_.effortThroughputMBps;
+        options.threadBudget = loadTracker_->Budget();
+        options.load = loadTracker_.get();
+        effortPolicy_ = std::make_unique<EffortPolicy>(options);
+        EffortPolicy::SetShared(effortPolicy_.get());
+    }
+    if (pluginConfig_.traceEvents > 0) {
+        traceRecorder_ = std::make_unique<TraceRecorder>(pluginConfig_.traceEvents);
+        TraceRecorder::SetShared(traceRecorder_.get());
+    }
+    if (pluginConfig_.backgroundCompression) {
+        // Workers start once Orthanc is up (OrthancStarted), as they use the
+        // REST API. A journal that cannot be opened disables the queue.
+        try {
+            std::filesystem::create_directories(pluginConfig_.backgroundDirectory + "/staged");
+            IngestQueue::Options options;
+            options.journalPath = pluginConfig_.backgroundDirectory + "/queue.journal";
+            options.capacity = pluginConfig_.backgroundQueueSize;
+            options.ratePerSecond = pluginConfig_.backgroundRate;
+            options.workers = std::max<size_t>(1, threadPool_->Size() / 2);
+            ingestQueue_ = std::make_unique<IngestQueue>(*loadTracker_, options,
+                                                         CompressStoredInstance);
+            const IngestQueue::Stats stats = ingestQueue_->GetStats();
+            OrthancPluginLogInfo(context, ("orthanc-jxl: Background compression enabled, " +
+                std::to_string(stats.restored) + " instance(s) resumed from " +
+                options.journalPath).c_str());
+        } catch (const std::exception& e) {
+            OrthancPluginLogError(context,
+                (std::string("orthanc-jxl: Background compression disabled: ") + e.what()).c_str());
+        }
+    }
+    // Resume a recompression left pending by the previous run.
+    if (std::filesystem::exists(pluginConfig_.backgroundDirectory + "/recompress.journal")) {
+        try {
+            RecompressQueue(true);
+        } catch (const std::exception& e) {
+            OrthancPluginLogError(context,
+                (std::string("orthanc-jxl: Cannot resume recompression: ") + e.what()).c_str());
+        }
+    }
+
     // Log configuration
     const char* modeName = "Unknown";
     switch (pluginConfig_.encodeOptions.mode) {
@@ -281,10 +2138,24 @@ ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* contex
     }
     char configMsg[256];
     snprintf(configMsg, sizeof(configMsg),
-        "orthanc-jxl: Config - Mode=%s, Effort=%d, Distance=%.2f, EncodeThreads=%d, Pool=%u",
+        "orthanc-jxl: Config - Mode=%s, Effort=%d, Distance=%.2f, EncodeThreads=%s, Pool=%u",
         modeName, pluginConfig_.encodeOptions.effort, pluginConfig_.encodeOptions.distance,
-        pluginConfig_.encodeThreads, threadPool_ ? (unsigned)threadPool_->Size() : 0u);
+        pluginConfig_.adaptiveThreads ? "Adaptive"
+                                      : std::to_string(pluginConfig_.encodeThreads).c_str(),
+        threadPool_ ? (unsigned)threadPool_->Size() : 0u);
     OrthancPluginLogInfo(context, configMsg);
+    if (effortPolicy_) {
+        snprintf(configMsg, sizeof(configMsg),
+            "orthanc-jxl: Effort %d-%d by EncodeLatencyBudget=%.0f ms, "
+            "EncodeThroughputTarget=%.1f MB/s",
+            pluginConfig_.minimumEffort, pluginConfig_.encodeOptions.effort,
+            pluginConfig_.effortLatencyMs, pluginConfig_.effortThroughputMBps);
+        OrthancPluginLogInfo(context, configMsg);
+    }
+    if (pluginConfig_.bitsStoredEncoding && !JxlCodec::SupportsReducedBitDepth()) {
+        OrthancPluginLogWarning(context,
+            "orthanc-jxl: BitsStoredEncoding needs libjxl >= 0.8; encoding at full depth");
+    }
 
     // Register decode callback for viewing JXL images
     OrthancPluginRegisterDecodeImageCallback(context, DecodeImageCallback);
@@ -292,6 +2163,35 @@ ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* contex
     // Register transcoder callback for encoding to JXL
     OrthancPluginRegisterTranscoderCallback(context, TranscoderCallback);
 
+    // Fast thumbnails from the progressive passes of a frame
+    OrthancPluginRegisterRestCallbackNoLock(
+        context, "/jxl/instances/([^/]+)/frames/([0-9]+)/preview", PreviewCallback);
+
+    // Stored frame bitstreams as image/jxl, with byte ranges
+    OrthancPluginRegisterRestCallbackNoLock(
+        context, "/jxl/instances/([^/]+)/frames/([0-9]+)", RawFrameCallback);
+
+    // Latency, throughput and cache figures for /tools/metrics-prometheus,
+    // and as JSON
+    OrthancPluginRegisterRefreshMetricsCallback(context, RefreshMetrics);
+    OrthancPluginRegisterRestCallbackNoLock(context, "/jxl/stats", StatsCallback);
+
+    // Per-stage transcode spans, when TraceEvents is set
+    OrthancPluginRegisterRestCallbackNoLock(context, "/jxl/trace", TraceCallback);
+
+    // Compress-on-ingest after storage, prioritised by what viewers open,
+    // and deferred high-effort recompression
+    OrthancPluginRegisterRestCallbackNoLock(context, "/jxl/ingest", IngestStatusCallback);
+    OrthancPluginRegisterRestCallbackNoLock(context, "/jxl/recompress", RecompressCallback);
+
+    // Whole series / studies converted as Orthanc jobs
+    OrthancPluginRegisterRestCallbackNoLock(
+        context, "/jxl/(series|studies)/([^/]+)/transcode", BatchTranscodeCallback);
+    OrthancPluginRegisterOnChangeCallback(context, OnChangeCallback);
+    if (ingestQueue_) {
+        OrthancPluginRegisterIncomingHttpRequestFilter2(context, IncomingRequestFilter);
+    }
+
     OrthancPluginLogInfo(context,
         "orthanc-jxl: Plugin initialized - JPEG-XL transfer syntaxes enabled");
     OrthancPluginLogInfo(context,
@@ -304,6 +2204,97 @@ ORTHANC_PLUGINS_API int32_t OrthancPluginInitialize(OrthancPluginContext* contex
 
 ORTHANC_PLUGINS_API void OrthancPluginFinalize()
 {
+    // Let running background conversions finish; pending ones stay journaled.
+    ingestQueue_.reset();
+    {
+        std::lock_guard<std::mutex> lock(recompressMutex_);
+        recompressQueue_.reset();
+        orthancStarted_ = false;
+    }
+    // Batch jobs stop starting instances; Orthanc finalizes them later.
+    {
+        std::lock_guard<std::mutex> lock(batchJobsMutex_);
+        batchJobsStopped_ = true;
+        for (BatchJob* job : batchJobs_) {
+            std::lock_guard<std::mutex> stepLock(job->step);
+            if (job->transcoder) {
+                job->transcoder->Pause();
+            }
+        }
+    }
+    if (fragmentCache_) {
+        FragmentIndexCache::Stats stats = fragmentCache_->GetStats();
+        char statsMsg[256];
+        snprintf(statsMsg, sizeof(statsMsg),
+            "orthanc-jxl: Fragment index cache - hits=%llu misses=%llu evictions=%llu "
+            "entries=%zu bytes=%zu",
+            static_cast<unsigned long long>(stats.hits),
+            static_cast<unsigned long long>(stats.misses),
+            static_cast<unsigned long long>(stats.evictions),
+            stats.entries, stats.bytes);
+        OrthancPluginLogInfo(context_, statsMsg);
+    }
+    // Let running prefetches finish before the caches and pool go away.
+    if (prefetcher_) {
+        FramePrefetcher::Stats stats = prefetcher_->GetStats();
+        prefetcher_.reset();
+        char statsMsg[256];
+        snprintf(statsMsg, sizeof(statsMsg),
+            "orthanc-jxl: Frame prefetch - queued=%llu completed=%llu dropped=%llu",
+            static_cast<unsigned long long>(stats.queued),
+            static_cast<unsigned long long>(stats.completed),
+            static_cast<unsigned long long>(stats.dropped));
+        OrthancPluginLogInfo(context_, statsMsg);
+    }
+    if (frameCache_) {
+        DecodedFrameCache::Stats stats = frameCache_->GetStats();
+        char statsMsg[256];
+        snprintf(statsMsg, sizeof(statsMsg),
+            "orthanc-jxl: Decoded frame cache - hits=%llu misses=%llu evictions=%llu "
+            "entries=%zu bytes=%zu",
+            static_cast<unsigned long long>(stats.hits),
+            static_cast<unsigned long long>(stats.misses),
+            static_cast<unsigned long long>(stats.evictions),
+            stats.entries, stats.bytes);
+        OrthancPluginLogInfo(context_, statsMsg);
+    }
+    if (transcodedCache_) {
+        TranscodedCache::Stats stats = transcodedCache_->GetStats();
+        char statsMsg[320];
+        snprintf(statsMsg, sizeof(statsMsg),
+            "orthanc-jxl: Transcoded cache - hits=%llu (disk %llu) misses=%llu evictions=%llu "
+            "invalidations=%llu entries=%zu bytes=%zu disk_entries=%zu disk_bytes=%zu",
+            static_cast<unsigned long long>(stats.hits),
+            static_cast<unsigned long long>(stats.diskHits),
+            static_cast<unsigned long long>(stats.misses),
+            static_cast<unsigned long long>(stats.evictions),
+            static_cast<unsigned long long>(stats.invalidations),
+            stats.entries, stats.bytes, stats.diskEntries, stats.diskBytes);
+        OrthancPluginLogInfo(context_, statsMsg);
+    }
+    if (bufferPool_) {
+        BufferPool::Stats stats = bufferPool_->GetStats();
+        char statsMsg[256];
+        snprintf(statsMsg, sizeof(statsMsg),
+            "orthanc-jxl: Buffer pool - hits=%llu misses=%llu drops=%llu "
+            "buffers=%zu bytes=%zu",
+            static_cast<unsigned long long>(stats.hits),
+            static_cast<unsigned long long>(stats.misses),
+            static_cast<unsigned long long>(stats.drops),
+            stats.buffers, stats.bytes);
+        OrthancPluginLogInfo(context_, statsMsg);
+    }
+    fragmentCache_.reset();
+    frameCache_.reset();
+    transcodedCache_.reset();
+    EffortPolicy::SetShared(nullptr);
+    effortPolicy_.reset();
+    TraceRecorder::SetShared(nullptr);
+    traceRecorder_.reset();
+    BufferPool::SetShared(nullptr);
+    bufferPool_.reset();
+    loadTracker_.reset();
+    JxlCodec::SetSharedPool(nullptr);
     threadPool_.reset();
     OrthancPluginLogInfo(context_, "orthanc-jxl: Plugin finalized");
     context_ = nullptr;
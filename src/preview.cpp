@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "preview.h"
+#include "pixel_layout.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+namespace orthanc_jxl {
+
+namespace {
+
+// How stored samples map back to DICOM values: plain unsigned, or two's
+// complement sign-extended from bit signBits - 1 (the container width, or
+// HighBit + 1 for reduced-depth signed frames, see SignExtensionBits).
+struct SampleDecoding {
+    uint32_t signBits = 0;   // 0 = unsigned
+};
+
+template <typename Sample>
+inline int32_t DecodeSample(Sample s, const SampleDecoding& d) {
+    if (d.signBits == 0) {
+        return s;
+    }
+    const int32_t half = 1 << (d.signBits - 1);
+    return ((static_cast<int32_t>(s) & (2 * half - 1)) ^ half) - half;
+}
+
+// DICOM linear VOI function (PS3.3 C.11.2.1.2.1) onto 0..255.
+class LinearWindow {
+public:
+    LinearWindow(double center, double width, bool invert)
+        : center_(center - 0.5), span_(std::max(width - 1.0, 1e-6)), invert_(invert) {}
+
+    uint8_t operator()(double x) const {
+        double y = ((x - center_) / span_ + 0.5) * 255.0;
+        y = std::min(std::max(y, 0.0), 255.0);
+        const auto v = static_cast<uint8_t>(y + 0.5);
+        return invert_ ? static_cast<uint8_t>(255 - v) : v;
+    }
+
+private:
+    double center_;
+    double span_;
+    bool invert_;
+};
+
+// Box-filter `frame` by `scale`, calling emit(index, mean) once per output
+// sample in row-major, channel-interleaved order.
+template <typename Sample, typename Emit>
+void Reduce(const ProgressiveImage& frame, uint32_t channels, uint32_t scale,
+            uint32_t outWidth, uint32_t outHeight, const SampleDecoding& decoding,
+            Emit&& emit) {
+    const uint32_t width = frame.info.width;
+    const uint32_t height = frame.info.height;
+    const Sample* pixels = reinterpret_cast<const Sample*>(frame.pixels.data());
+    const size_t rowSamples = static_cast<size_t>(width) * channels;
+    const size_t outRowSamples = static_cast<size_t>(outWidth) * channels;
+
+    std::vector<int64_t> sums(outRowSamples);
+    for (uint32_t oy = 0; oy < outHeight; ++oy) {
+        const uint32_t y0 = oy * scale;
+        const uint32_t y1 = std::min(height, y0 + scale);
+        std::fill(sums.begin(), sums.end(), 0);
+        for (uint32_t y = y0; y < y1; ++y) {
+            const Sample* row = pixels + y * rowSamples;
+            for (uint32_t x = 0; x < width; ++x) {
+                int64_t* sum = &sums[(x / scale) * channels];
+                for (uint32_t c = 0; c < channels; ++c) {
+                    sum[c] += DecodeSample(row[x * channels + c], decoding);
+                }
+            }
+        }
+        const uint32_t rows = y1 - y0;
+        for (uint32_t ox = 0; ox < outWidth; ++ox) {
+            const uint32_t cols = std::min(width, (ox + 1) * scale) - ox * scale;
+            const double count = static_cast<double>(rows) * cols;
+            for (uint32_t c = 0; c < channels; ++c) {
+                const size_t i = static_cast<size_t>(ox) * channels + c;
+                emit(oy * outRowSamples + i, static_cast<double>(sums[i]) / count);
+            }
+        }
+    }
+}
+
+template <typename Sample>
+void RenderSamples(const ProgressiveImage& frame, const DicomImageInfo& info,
+                   uint32_t scale, const PreviewWindow& window, PreviewImage& out) {
+    const uint32_t containerBits = sizeof(Sample) * 8;
+    const uint32_t bits = std::min(std::max(frame.info.bitsPerSample, 1u), containerBits);
+    uint8_t* dst = out.pixels.data();
+
+    if (out.channels == 3) {
+        // Colour: no VOI, just rescale the (unsigned) samples to 8 bits.
+        const double toByte = 255.0 / static_cast<double>((1u << bits) - 1);
+        Reduce<Sample>(frame, 3, scale, out.width, out.height, SampleDecoding{},
+            [&](size_t i, double v) { dst[i] = static_cast<uint8_t>(v * toByte + 0.5); });
+        return;
+    }
+
+    SampleDecoding decoding;
+    if (info.isSigned) {
+        const uint32_t reduced = SignExtensionBits(true, bits, containerBits, info.highBit);
+        decoding.signBits = reduced ? reduced : containerBits;
+    }
+    const double slope = info.rescaleSlope;
+    const double intercept = info.rescaleIntercept;
+    const bool invert = info.photometricInterpretation == "MONOCHROME1";
+
+    if (window.width > 0.0) {
+        const LinearWindow voi(window.center, window.width, invert);
+        Reduce<Sample>(frame, 1, scale, out.width, out.height, decoding,
+            [&](size_t i, double v) { dst[i] = voi(v * slope + intercept); });
+        return;
+    }
+
+    // Automatic window: the reduced image's full range.
+    std::vector<double> values(static_cast<size_t>(out.width) * out.height);
+    double lo = std::numeric_limits<double>::max();
+    double hi = std::numeric_limits<double>::lowest();
+    Reduce<Sample>(frame, 1, scale, out.width, out.height, decoding,
+        [&](size_t i, double v) {
+            v = v * slope + intercept;
+            values[i] = v;
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        });
+    if (!(hi > lo)) {
+        // Flat frame (e.g. blank padding): render it dark, not thresholded.
+        std::fill(out.pixels.begin(), out.pixels.end(), invert ? 255 : 0);
+        return;
+    }
+    const LinearWindow voi((lo + hi) / 2.0, hi - lo + 1.0, invert);
+    for (size_t i = 0; i < values.size(); ++i) {
+        dst[i] = voi(values[i]);
+    }
+}
+
+}  // namespace
+
+PreviewImage RenderPreview(const ProgressiveImage& frame, const DicomImageInfo& info,
+                           uint32_t scale, const PreviewWindow& window) {
+    if (scale == 0 || scale > kMaxPreviewScale) {
+        throw JxlCodecError("Preview scale out of range");
+    }
+    const PixelFormat format = JxlCodec::FormatFromImageInfo(frame.info);
+    const size_t expected = static_cast<size_t>(frame.info.width) * frame.info.height *
+                            JxlCodec::BytesPerPixel(format);
+    if (frame.pixels.size() < expected) {
+        throw JxlCodecError("Preview source buffer too small");
+    }
+
+    PreviewImage out;
+    out.width = (frame.info.width + scale - 1) / scale;
+    out.height = (frame.info.height + scale - 1) / scale;
+    out.channels = static_cast<uint32_t>(JxlCodec::NumChannels(format));
+    out.downsampling = frame.downsampling;
+    out.bytesRead = frame.bytesRead;
+    out.pixels.resize(out.Stride() * out.height);
+
+    if (JxlCodec::BitsPerSample(format) == 16) {
+        RenderSamples<uint16_t>(frame, info, scale, window, out);
+    } else {
+        RenderSamples<uint8_t>(frame, info, scale, window, out);
+    }
+    return out;
+}
+
+PreviewImage DecodePreview(const uint8_t* jxl, size_t size, const DicomImageInfo& info,
+                           uint32_t scale, const PreviewWindow& window,
+                           int numWorkerThreads) {
+    // libjxl's coarsest pass is 1:8; beyond that the box filter does the rest.
+    const uint32_t detail = std::min<uint32_t>(scale, 8);
+    std::optional<StageSpan> decode;
+    decode.emplace(Stage::Decode);
+    const ProgressiveImage frame =
+        JxlCodec::DecodeProgressive(jxl, size, detail, numWorkerThreads);
+    decode.reset();
+    return RenderPreview(frame, info, scale, window);
+}
+
+}  // namespace orthanc_jxl
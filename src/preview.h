@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "dicom_handler.h"
+#include "jxl_codec.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace orthanc_jxl {
+
+// Largest preview downscale; accepted scales are powers of two up to this.
+constexpr uint32_t kMaxPreviewScale = 32;
+
+// VOI window in modality units (after Rescale Slope / Intercept). A width of
+// 0 uses the frame's own value range.
+struct PreviewWindow {
+    double center = 0.0;
+    double width = 0.0;
+};
+
+// 8-bit rendering of one frame, rows tightly packed.
+struct PreviewImage {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t channels = 1;       // 1 = grayscale, 3 = RGB
+    uint32_t downsampling = 1;   // detail of the progressive pass it came from
+    size_t bytesRead = 0;        // codestream bytes the decode consumed
+    std::vector<uint8_t> pixels;
+
+    size_t Stride() const { return static_cast<size_t>(width) * channels; }
+};
+
+/**
+ * Render a decoded frame at 1/scale of its size (rounded up).
+ *
+ * Box filtering, Modality LUT (rescale) and the linear VOI window are applied
+ * in the same pass over the source pixels; only an automatic window (width 0)
+ * needs a second pass, over the already reduced image. Grayscale is inverted
+ * for MONOCHROME1 and colour is reduced to 8 bits per sample. Signed samples
+ * of reduced-depth frames are sign-extended on the fly (see SignExtensionBits).
+ */
+PreviewImage RenderPreview(const ProgressiveImage& frame, const DicomImageInfo& info,
+                           uint32_t scale, const PreviewWindow& window);
+
+// Decode just enough of a JXL frame for a 1/scale preview (the coarsest
+// progressive pass with that detail) and render it.
+PreviewImage DecodePreview(const uint8_t* jxl, size_t size, const DicomImageInfo& info,
+                           uint32_t scale, const PreviewWindow& window,
+                           int numWorkerThreads = JxlCodec::kDefaultThreads);
+
+}  // namespace orthanc_jxl
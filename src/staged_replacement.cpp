@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "staged_replacement.h"
+
+#include <nlohmann/json.hpp>
+
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace orthanc_jxl {
+
+namespace {
+
+std::vector<uint8_t> ReadWholeFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)),
+                                std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+std::vector<uint8_t> InstanceExtras::ToCbor() const {
+    nlohmann::json doc;
+    doc["metadata"] = metadata;
+    doc["labels"] = labels;
+    doc["attachments"] = nlohmann::json::object();
+    for (const auto& [name, content] : attachments) {
+        doc["attachments"][name] = nlohmann::json::binary(
+            std::vector<uint8_t>(content.begin(), content.end()));
+    }
+    doc["parents"] = nlohmann::json::object();
+    for (const auto& [path, parent] : parents) {
+        doc["parents"][path] = {{"metadata", parent.metadata}, {"labels", parent.labels}};
+    }
+    return nlohmann::json::to_cbor(doc);
+}
+
+InstanceExtras InstanceExtras::FromCbor(const std::vector<uint8_t>& cbor) {
+    const nlohmann::json doc = nlohmann::json::from_cbor(cbor);
+    InstanceExtras extras;
+    extras.metadata = doc.at("metadata").get<std::map<std::string, std::string>>();
+    extras.labels = doc.at("labels").get<std::vector<std::string>>();
+    for (const auto& item : doc.at("attachments").items()) {
+        const auto& content = item.value().get_binary();
+        extras.attachments[item.key()].assign(content.begin(), content.end());
+    }
+    if (doc.contains("parents")) {   // absent when staged by older versions
+        for (const auto& item : doc["parents"].items()) {
+            ResourceExtras& parent = extras.parents[item.key()];
+            parent.metadata = item.value().at("metadata")
+                .get<std::map<std::string, std::string>>();
+            parent.labels = item.value().at("labels").get<std::vector<std::string>>();
+        }
+    }
+    return extras;
+}
+
+std::string StagedExtrasPath(const std::string& dicomPath) {
+    return dicomPath.substr(0, dicomPath.size() - 4) + ".extras";
+}
+
+void RecoverStagedReplacements(
+    const std::string& directory,
+    const std::function<void(const std::vector<uint8_t>& dicom)>& store,
+    const std::function<void(const std::string& instanceId, const InstanceExtras&)>& restore,
+    const std::function<void(const std::string& path, const std::string& error)>& warn) {
+    std::error_code error;
+    for (const auto& file : std::filesystem::directory_iterator(directory, error)) {
+        if (file.path().extension() != ".dcm") {
+            continue;
+        }
+        const std::string extrasPath = StagedExtrasPath(file.path().string());
+        try {
+            const std::vector<uint8_t> dicom = ReadWholeFile(file.path());
+            if (!dicom.empty()) {
+                store(dicom);
+            }
+            const std::vector<uint8_t> cbor = ReadWholeFile(extrasPath);
+            if (!cbor.empty()) {
+                restore(file.path().stem().string(), InstanceExtras::FromCbor(cbor));
+            }
+            std::filesystem::remove(file.path(), error);
+            std::filesystem::remove(extrasPath, error);
+        } catch (const std::exception& e) {
+            warn(file.path().string(), e.what());
+        }
+    }
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace orthanc_jxl {
+
+// What Orthanc keeps beside a stored resource rather than in its DICOM, and
+// drops when the resource is deleted: user metadata (the names declared in
+// Orthanc's configuration) and labels.
+struct ResourceExtras {
+    std::map<std::string, std::string> metadata;
+    std::vector<std::string> labels;
+};
+
+// What an instance carries besides that: user attachments (the types declared
+// in Orthanc's configuration), and the extras of its series, study and patient
+// by REST path, which Orthanc deletes with their last instance.
+struct InstanceExtras : ResourceExtras {
+    std::map<std::string, std::string> attachments;   // content, uncompressed
+    std::map<std::string, ResourceExtras> parents;
+
+    std::vector<uint8_t> ToCbor() const;
+    static InstanceExtras FromCbor(const std::vector<uint8_t>& cbor);
+};
+
+// Beside a staged replacement "<dir>/<instance ID>.dcm": what the replaced
+// instance carried, as InstanceExtras CBOR.
+std::string StagedExtrasPath(const std::string& dicomPath);
+
+/**
+ * Finish the replacements left staged in `directory` by a crash.
+ *
+ * A replacement is staged before the original is deleted and unstaged only
+ * once its extras are back, so for each staged instance the crash may have
+ * come before the delete, between the delete and the store, or between the
+ * store and the restore. Each is stored (`store` may find it already there)
+ * and then its extras are always re-applied: restoring only PUTs, so putting
+ * them back on an instance that still has them is harmless. The staged files
+ * are removed once both succeeded; on an error `warn` is told and they are
+ * kept for the next start.
+ */
+void RecoverStagedReplacements(
+    const std::string& directory,
+    const std::function<void(const std::vector<uint8_t>& dicom)>& store,
+    const std::function<void(const std::string& instanceId, const InstanceExtras&)>& restore,
+    const std::function<void(const std::string& path, const std::string& error)>& warn);
+
+}  // namespace orthanc_jxl
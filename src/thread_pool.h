@@ -18,44 +18,71 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <exception>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
 namespace orthanc_jxl {
 
 /**
- * Fixed-size worker pool reused for the lifetime of the plugin.
+ * A unit of pool work: a plain function pointer plus context, so submitting
+ * work never allocates. The context must outlive the task.
+ */
+struct PoolTask {
+    void (*fn)(void* ctx) = nullptr;
+    void* ctx = nullptr;
+};
+
+/**
+ * Fixed-size work-stealing pool reused for the lifetime of the plugin.
  *
- * Frame-level encode/decode work is dispatched here so that importing a study
- * does not pay the cost of spinning up and tearing down OS threads for every
- * instance. Tasks are independent and never block on each other, so a simple
- * queue is sufficient.
+ * Each worker owns a bounded deque: it pushes and pops its own work LIFO at
+ * the back, and idle workers steal FIFO from the front of the others. Work
+ * submitted from outside the pool is spread round-robin over the deques, and
+ * a shared overflow queue catches anything that does not fit. The deques are
+ * short and guarded by their own small locks, so a burst of submissions no
+ * longer serializes every worker on one global mutex.
+ *
+ * A thread blocked in ParallelFor keeps working on its own loop and hands
+ * back the helper tasks nobody started (Reclaim), so calling ParallelFor from
+ * a pool worker - nested parallelism - cannot deadlock.
  */
 class ThreadPool {
 public:
-    explicit ThreadPool(size_t numThreads) : stop_(false) {
+    explicit ThreadPool(size_t numThreads) {
         if (numThreads == 0) {
             numThreads = 1;
         }
+        queues_.reserve(numThreads);
+        for (size_t i = 0; i < numThreads; ++i) {
+            queues_.push_back(std::make_unique<WorkerQueue>());
+        }
         workers_.reserve(numThreads);
         for (size_t i = 0; i < numThreads; ++i) {
-            workers_.emplace_back([this] { WorkerLoop(); });
+            workers_.emplace_back([this, i] { WorkerLoop(i); });
         }
     }
 
     ~ThreadPool() {
         {
-            std::unique_lock<std::mutex> lock(mutex_);
+            std::lock_guard<std::mutex> lock(sleepMutex_);
             stop_ = true;
         }
-        cv_.notify_all();
+        wake_.notify_all();
         for (auto& w : workers_) {
             if (w.joinable()) {
                 w.join();
@@ -68,51 +95,289 @@ public:
 
     size_t Size() const { return workers_.size(); }
 
-    // Enqueue a task. Exceptions thrown by the task are swallowed by the worker;
-    // callers that need results/errors should capture them into shared state.
+    // Load figures for metrics, read without locking: tasks waiting to be
+    // picked up, workers running one right now, and the total time workers
+    // have spent in tasks (busy time / (Size() * elapsed) is utilisation).
+    size_t QueuedTasks() const { return queued_.load(std::memory_order_relaxed); }
+    size_t ActiveWorkers() const { return active_.load(std::memory_order_relaxed); }
+    uint64_t BusyMicros() const { return busyMicros_.load(std::memory_order_relaxed); }
+
+    // Submit a task without allocating (unless every deque is full). From a
+    // worker of this pool the task goes on that worker's own deque.
+    void Submit(PoolTask task) {
+        const size_t self = CurrentWorkerIndex();
+        const size_t target = (self != kNotAWorker)
+            ? self
+            : nextQueue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        queued_.fetch_add(1);
+        if (!queues_[target]->PushBack(task)) {
+            std::lock_guard<std::mutex> lock(overflowMutex_);
+            overflow_.push_back(task);
+        }
+        // Pairs with the sleeper count in WorkerLoop: either we see the
+        // sleeper, or it sees queued_ > 0 and does not sleep.
+        if (sleepers_.load() > 0) {
+            { std::lock_guard<std::mutex> lock(sleepMutex_); }
+            wake_.notify_one();
+        }
+    }
+
+    // Enqueue an owning closure (allocates). Exceptions thrown by the task are
+    // swallowed by the worker; callers that need results/errors should capture
+    // them into shared state.
     void Enqueue(std::function<void()> task) {
+        auto* owned = new std::function<void()>(std::move(task));
+        Submit(PoolTask{[](void* ctx) {
+            std::unique_ptr<std::function<void()>> fn(static_cast<std::function<void()>*>(ctx));
+            try {
+                (*fn)();
+            } catch (...) {
+            }
+        }, owned});
+    }
+
+    // Run one queued task on the calling thread, if any. Returns false if no
+    // work was found.
+    bool TryRunOne() {
+        PoolTask task;
+        if (!Acquire(CurrentWorkerIndex(), task)) {
+            return false;
+        }
+        task.fn(task.ctx);
+        return true;
+    }
+
+    // Withdraw every not-yet-started task whose context is `ctx`. Returns how
+    // many were withdrawn; they will never run.
+    size_t Reclaim(const void* ctx) {
+        size_t reclaimed = 0;
+        for (auto& q : queues_) {
+            reclaimed += q->Reclaim(ctx);
+        }
         {
-            std::unique_lock<std::mutex> lock(mutex_);
-            tasks_.push(std::move(task));
+            std::lock_guard<std::mutex> lock(overflowMutex_);
+            for (auto& t : overflow_) {
+                if (t.fn && t.ctx == ctx) {
+                    t.fn = nullptr;
+                    ++reclaimed;
+                }
+            }
         }
-        cv_.notify_one();
+        queued_.fetch_sub(reclaimed);
+        return reclaimed;
     }
 
 private:
-    void WorkerLoop() {
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(mutex_);
-                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
-                if (stop_ && tasks_.empty()) {
-                    return;
+    static constexpr size_t kNotAWorker = static_cast<size_t>(-1);
+
+    // Bounded ring deque; withdrawn tasks are left as tombstones (fn == null)
+    // and skipped when popped.
+    struct alignas(64) WorkerQueue {
+        static constexpr size_t kCapacity = 256;
+
+        bool PushBack(PoolTask t) {
+            std::lock_guard<std::mutex> lock(m);
+            if (back - front == kCapacity) {
+                return false;
+            }
+            ring[back++ % kCapacity] = t;
+            return true;
+        }
+
+        bool PopBack(PoolTask& t) {
+            std::lock_guard<std::mutex> lock(m);
+            while (back > front) {
+                t = ring[--back % kCapacity];
+                if (t.fn) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool StealFront(PoolTask& t) {
+            std::lock_guard<std::mutex> lock(m);
+            while (front < back) {
+                t = ring[front++ % kCapacity];
+                if (t.fn) {
+                    return true;
                 }
-                task = std::move(tasks_.front());
-                tasks_.pop();
             }
-            task();
+            return false;
+        }
+
+        size_t Reclaim(const void* ctx) {
+            std::lock_guard<std::mutex> lock(m);
+            size_t n = 0;
+            for (size_t i = front; i < back; ++i) {
+                PoolTask& t = ring[i % kCapacity];
+                if (t.fn && t.ctx == ctx) {
+                    t.fn = nullptr;
+                    ++n;
+                }
+            }
+            return n;
+        }
+
+        std::mutex m;
+        std::array<PoolTask, kCapacity> ring;
+        size_t front = 0;  // steal end
+        size_t back = 0;   // owner end
+    };
+
+    // Which worker of *this* pool the calling thread is, or kNotAWorker.
+    struct WorkerIdentity {
+        const ThreadPool* pool = nullptr;
+        size_t index = kNotAWorker;
+    };
+    static WorkerIdentity& CurrentWorker() {
+        thread_local WorkerIdentity identity;
+        return identity;
+    }
+    size_t CurrentWorkerIndex() const {
+        const WorkerIdentity& id = CurrentWorker();
+        return id.pool == this ? id.index : kNotAWorker;
+    }
+
+    // Own deque first (cache-warm, LIFO), then steal round-robin, then the
+    // overflow queue.
+    bool Acquire(size_t self, PoolTask& task) {
+        bool found = false;
+        if (self != kNotAWorker && queues_[self]->PopBack(task)) {
+            found = true;
+        }
+        const size_t n = queues_.size();
+        const size_t start = (self != kNotAWorker) ? self + 1 : 0;
+        for (size_t k = 0; !found && k < n; ++k) {
+            const size_t victim = (start + k) % n;
+            if (victim != self && queues_[victim]->StealFront(task)) {
+                found = true;
+            }
+        }
+        if (!found) {
+            std::lock_guard<std::mutex> lock(overflowMutex_);
+            while (!overflow_.empty() && !found) {
+                task = overflow_.front();
+                overflow_.pop_front();
+                found = (task.fn != nullptr);
+            }
+        }
+        if (found) {
+            queued_.fetch_sub(1);
         }
+        return found;
     }
 
+    void WorkerLoop(size_t index) {
+        CurrentWorker() = WorkerIdentity{this, index};
+        for (;;) {
+            PoolTask task;
+            if (Acquire(index, task)) {
+                active_.fetch_add(1, std::memory_order_relaxed);
+                const auto start = std::chrono::steady_clock::now();
+                task.fn(task.ctx);
+                busyMicros_.fetch_add(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count()),
+                    std::memory_order_relaxed);
+                active_.fetch_sub(1, std::memory_order_relaxed);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            sleepers_.fetch_add(1);
+            wake_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+            sleepers_.fetch_sub(1);
+            if (stop_ && queued_.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
     std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    std::mutex mutex_;
-    std::condition_variable cv_;
-    bool stop_;
+    std::atomic<size_t> nextQueue_{0};
+
+    std::mutex overflowMutex_;
+    std::deque<PoolTask> overflow_;
+
+    // queued_ counts submitted tasks not yet taken or reclaimed; idle workers
+    // sleep on wake_ until it becomes non-zero.
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<size_t> active_{0};
+    std::atomic<uint64_t> busyMicros_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+};
+
+namespace detail {
+
+// Shared state of one ParallelFor call; lives on the caller's stack. Indices
+// are handed out in chunks through an atomic cursor, so helpers and the caller
+// balance the load among themselves without one task per index.
+template <typename Fn>
+struct ParallelForState {
+    Fn* fn = nullptr;
+    size_t n = 0;
+    size_t grain = 1;
+    size_t chunkCount = 0;
+    std::atomic<size_t> nextChunk{0};
+    std::atomic<bool> failed{false};
+
+    std::mutex m;
+    std::condition_variable done;
+    size_t outstanding = 0;          // helper tasks submitted and not finished
+    std::exception_ptr firstError;
+
+    void RunChunks() {
+        for (;;) {
+            const size_t c = nextChunk.fetch_add(1, std::memory_order_relaxed);
+            if (c >= chunkCount || failed.load(std::memory_order_relaxed)) {
+                return;
+            }
+            const size_t begin = c * grain;
+            const size_t end = std::min(n, begin + grain);
+            try {
+                for (size_t i = begin; i < end; ++i) {
+                    (*fn)(i);
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(m);
+                if (!firstError) {
+                    firstError = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    }
+
+    static void Helper(void* ctx) {
+        auto* state = static_cast<ParallelForState*>(ctx);
+        state->RunChunks();
+        std::lock_guard<std::mutex> lock(state->m);
+        if (--state->outstanding == 0) {
+            state->done.notify_one();
+        }
+    }
 };
 
+}  // namespace detail
+
 /**
- * Run fn(0..n-1) across the pool and block until all complete. Each index is
- * processed exactly once; fn must be safe to invoke concurrently for distinct
- * indices (e.g. writing to its own result slot). The first exception thrown by
- * any task is rethrown to the caller after all tasks finish.
+ * Run fn(0..n-1) across the pool and block until all complete. fn must be safe
+ * to invoke concurrently for distinct indices (e.g. writing to its own result
+ * slot). Indices are processed in contiguous chunks of `grain` (0 = pick one
+ * so that each thread gets a few chunks); the calling thread works through
+ * chunks too. The first exception thrown is rethrown to the caller once every
+ * running chunk has finished; chunks not yet started when it was thrown are
+ * skipped.
  *
- * Falls back to sequential execution for trivial sizes. Must not be called from
- * a pool worker thread (would risk deadlock).
+ * Safe to call from a pool worker (nested parallelism): the caller never
+ * waits on work that nobody has started.
  */
 template <typename Fn>
-void ParallelFor(ThreadPool& pool, size_t n, Fn&& fn) {
+void ParallelFor(ThreadPool& pool, size_t n, Fn&& fn, size_t grain = 0) {
     if (n == 0) {
         return;
     }
@@ -123,33 +388,94 @@ void ParallelFor(ThreadPool& pool, size_t n, Fn&& fn) {
         return;
     }
 
-    std::mutex m;
-    std::condition_variable done;
-    size_t remaining = n;
-    std::exception_ptr firstError;
+    using State = detail::ParallelForState<std::remove_reference_t<Fn>>;
+    State state;
+    state.fn = &fn;
+    state.n = n;
+    if (grain == 0) {
+        constexpr size_t kChunksPerThread = 4;
+        const size_t targetChunks = (pool.Size() + 1) * kChunksPerThread;
+        grain = std::max<size_t>(1, (n + targetChunks - 1) / targetChunks);
+    }
+    state.grain = grain;
+    state.chunkCount = (n + grain - 1) / grain;
 
-    for (size_t i = 0; i < n; ++i) {
-        pool.Enqueue([&, i] {
-            try {
-                fn(i);
-            } catch (...) {
-                std::lock_guard<std::mutex> lock(m);
-                if (!firstError) {
-                    firstError = std::current_exception();
-                }
-            }
-            std::lock_guard<std::mutex> lock(m);
-            if (--remaining == 0) {
-                done.notify_one();
-            }
-        });
+    // One helper per worker at most; the caller covers the remaining chunk.
+    const size_t helpers = std::min(pool.Size(), state.chunkCount - 1);
+    state.outstanding = helpers;
+    for (size_t h = 0; h < helpers; ++h) {
+        pool.Submit(PoolTask{&State::Helper, &state});
     }
 
-    std::unique_lock<std::mutex> lock(m);
-    done.wait(lock, [&] { return remaining == 0; });
-    if (firstError) {
-        std::rethrow_exception(firstError);
+    state.RunChunks();
+
+    // Every chunk is claimed: helpers that have not started have nothing left
+    // to do, so take them back rather than waiting for a worker to free up.
+    const size_t reclaimed = pool.Reclaim(&state);
+
+    std::unique_lock<std::mutex> lock(state.m);
+    state.outstanding -= reclaimed;
+    state.done.wait(lock, [&] { return state.outstanding == 0; });
+    if (state.firstError) {
+        std::rethrow_exception(state.firstError);
     }
 }
 
+// Items an OrderedPipeline may run ahead of the next one to append: enough
+// to keep every pool thread, and the caller, busy while the oldest finishes.
+inline size_t PipelineWindow(const ThreadPool& pool) {
+    return 2 * (pool.Size() + 1);
+}
+
+/**
+ * Run produce(i) for items 0..count-1 across the pool, and pass each result
+ * to append(i, result) in item order once the items before it are appended.
+ * append runs under a lock on whichever thread finished the item, so it may
+ * touch state that is not thread-safe (e.g. a DicomHandler). No item starts
+ * more than `window` items ahead of the next to append, so at most `window`
+ * results are alive at once whatever the count. The first exception stops
+ * the pipeline and is rethrown, as by ParallelFor.
+ */
+template <typename Result, typename Produce, typename Append>
+void OrderedPipeline(ThreadPool& pool, size_t count, size_t window,
+                     Produce&& produce, Append&& append) {
+    std::vector<std::optional<Result>> slots(std::max<size_t>(1, std::min(window, count)));
+    window = slots.size();
+    std::mutex mutex;
+    std::condition_variable advanced;
+    size_t next = 0;      // next item to append
+    bool failed = false;
+
+    // Grain 1 hands items out in increasing order, so every item before a
+    // waiting one is already running and the oldest never waits.
+    ParallelFor(pool, count, [&](size_t i) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            advanced.wait(lock, [&] { return failed || i < next + window; });
+            if (failed) {
+                return;
+            }
+        }
+        try {
+            Result result = produce(i);
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[i % window].emplace(std::move(result));
+            const size_t before = next;
+            while (next < count && slots[next % window]) {
+                append(next, *slots[next % window]);
+                slots[next % window].reset();
+                ++next;
+            }
+            if (next != before) {
+                advanced.notify_all();
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = true;
+            advanced.notify_all();
+            throw;
+        }
+    }, 1);
+}
+
 }  // namespace orthanc_jxl
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "trace.h"
+
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+
+namespace orthanc_jxl {
+
+namespace {
+
+std::atomic<TraceRecorder*> g_sharedRecorder{nullptr};
+
+// Small, stable per-thread ids for the trace viewer's rows.
+uint32_t TraceThreadId() {
+    static std::atomic<uint32_t> next{1};
+    thread_local const uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+}  // namespace
+
+void StageBreakdown::Add(const StageBreakdown& other) {
+    for (size_t i = 0; i < stages.size(); ++i) {
+        stages[i].wallMs += other.stages[i].wallMs;
+        stages[i].cpuMs += other.stages[i].cpuMs;
+    }
+}
+
+std::string StageBreakdown::ToString() const {
+    std::string s;
+    char part[64];
+    for (size_t i = 0; i < stages.size(); ++i) {
+        const StageTime& t = stages[i];
+        const Stage stage = static_cast<Stage>(i);
+        if (t.wallMs == 0.0 && t.cpuMs == 0.0) {
+            continue;
+        }
+        if (stage == Stage::QueueWait) {
+            snprintf(part, sizeof(part), "%s%s %.1f", s.empty() ? "" : " ",
+                     StageName(stage), t.wallMs);
+        } else {
+            snprintf(part, sizeof(part), "%s%s %.1f/%.1f", s.empty() ? "" : " ",
+                     StageName(stage), t.wallMs, t.cpuMs);
+        }
+        s += part;
+    }
+    return s + " ms (wall/cpu)";
+}
+
+// ============================================================================
+// Trace recorder
+// ============================================================================
+
+TraceRecorder::TraceRecorder(size_t maxEvents) : capacity_(maxEvents) {
+    events_.reserve(std::min<size_t>(capacity_, 4096));
+}
+
+void TraceRecorder::Add(const char* name, int64_t startUs, int64_t durationUs, int64_t frame) {
+    if (capacity_ == 0) {
+        return;
+    }
+    const Event event{name, startUs, durationUs, frame, TraceThreadId()};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (events_.size() < capacity_) {
+        events_.push_back(event);
+    } else {
+        events_[next_] = event;
+        next_ = (next_ + 1) % capacity_;
+        ++overwritten_;
+    }
+}
+
+std::string TraceRecorder::ToJson() const {
+    nlohmann::json events = nlohmann::json::array();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < events_.size(); ++i) {
+            const Event& e = events_[(next_ + i) % events_.size()];
+            nlohmann::json event = {
+                {"name", e.name},
+                {"cat", "orthanc-jxl"},
+                {"ph", "X"},
+                {"ts", e.start},
+                {"dur", e.duration},
+                {"pid", 1},
+                {"tid", e.thread},
+            };
+            if (e.frame >= 0) {
+                event["args"] = {{"frame", e.frame}};
+            }
+            events.push_back(std::move(event));
+        }
+    }
+    return nlohmann::json{{"traceEvents", events}, {"displayTimeUnit", "ms"}}.dump();
+}
+
+void TraceRecorder::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.clear();
+    next_ = 0;
+}
+
+size_t TraceRecorder::Size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return events_.size();
+}
+
+uint64_t TraceRecorder::Overwritten() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return overwritten_;
+}
+
+int64_t TraceRecorder::NowMicros() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - epoch).count();
+}
+
+void TraceRecorder::SetShared(TraceRecorder* recorder) {
+    g_sharedRecorder.store(recorder, std::memory_order_release);
+}
+
+TraceRecorder* TraceRecorder::Shared() {
+    return g_sharedRecorder.load(std::memory_order_acquire);
+}
+
+// ============================================================================
+// Stage spans
+// ============================================================================
+
+StageSpan::StageSpan(StageBreakdown& into, Stage stage, int64_t frame)
+    : into_(&into), stage_(stage), frame_(frame),
+      startUs_(TraceRecorder::NowMicros()), startCpuNs_(WorkCpuNanos()) {}
+
+StageSpan::StageSpan(Stage stage, int64_t frame)
+    : into_(nullptr), stage_(stage), frame_(frame),
+      startUs_(TraceRecorder::NowMicros()), startCpuNs_(0) {}
+
+StageSpan::~StageSpan() {
+    const int64_t durationUs = TraceRecorder::NowMicros() - startUs_;
+    Metrics().RecordStage(stage_, static_cast<uint64_t>(durationUs));
+    if (into_) {
+        StageTime& t = (*into_)[stage_];
+        t.wallMs += durationUs / 1000.0;
+        t.cpuMs += (WorkCpuNanos() - startCpuNs_) / 1e6;
+    }
+    if (TraceRecorder* recorder = TraceRecorder::Shared()) {
+        recorder->Add(StageName(stage_), startUs_, durationUs, frame_);
+    }
+}
+
+}  // namespace orthanc_jxl
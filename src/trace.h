@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "cpu_time.h"
+#include "metrics.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace orthanc_jxl {
+
+struct StageTime {
+    double wallMs = 0.0;
+    double cpuMs = 0.0;   // WorkCpuNanos() of the thread that ran the stage
+};
+
+// Wall and CPU time per stage (metrics.h) of one call. Per-frame stages are summed over
+// frames, so with frames in parallel they can add up to more than the call's
+// wall time. Codec CPU includes the pool workers libjxl hands groups to.
+// Streaming encodes interleave inside the codec,
+// so their layout time is part of Encode.
+struct StageBreakdown {
+    std::array<StageTime, static_cast<size_t>(Stage::Count)> stages{};
+
+    StageTime& operator[](Stage stage) { return stages[static_cast<size_t>(stage)]; }
+    const StageTime& operator[](Stage stage) const {
+        return stages[static_cast<size_t>(stage)];
+    }
+
+    void Add(const StageBreakdown& other);
+
+    // "parse 1.2/1.1 extract ... ms (wall/cpu)", for log lines. Stages the
+    // call never entered are left out.
+    std::string ToString() const;
+};
+
+/**
+ * Bounded in-memory buffer of trace spans in Chrome trace / Perfetto JSON
+ * form ("X" complete events), for seeing where a transcode spends its time.
+ *
+ * Opt-in: spans are only recorded while a recorder is installed with
+ * SetShared(). The buffer is a ring that keeps the most recent `maxEvents`
+ * spans, so it can stay installed in production.
+ */
+class TraceRecorder {
+public:
+    explicit TraceRecorder(size_t maxEvents);
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // startUs / durationUs on the NowMicros() clock. frame < 0 for spans that
+    // are not about one frame.
+    void Add(const char* name, int64_t startUs, int64_t durationUs, int64_t frame = -1);
+
+    // {"traceEvents": [...]} in recording order, loadable by chrome://tracing
+    // and ui.perfetto.dev.
+    std::string ToJson() const;
+    void Clear();
+
+    size_t Size() const;
+    uint64_t Overwritten() const;
+
+    // Microseconds on a steady clock shared by every recorder.
+    static int64_t NowMicros();
+
+    // Process-wide recorder used by the transcode paths; nullptr (the
+    // default) disables tracing. Must outlive every call started while set.
+    static void SetShared(TraceRecorder* recorder);
+    static TraceRecorder* Shared();
+
+private:
+    struct Event {
+        const char* name;   // string literal
+        int64_t start;
+        int64_t duration;
+        int64_t frame;
+        uint32_t thread;
+    };
+
+    const size_t capacity_;
+    mutable std::mutex mutex_;
+    std::vector<Event> events_;
+    size_t next_ = 0;           // ring position once full
+    uint64_t overwritten_ = 0;
+};
+
+// Times one stage: into its metrics histogram, into `into` (wall and thread
+// CPU) when given, and, when a trace recorder is installed, as a span. The
+// only timer for stages, so a stage is counted once however it is reached.
+class StageSpan {
+public:
+    StageSpan(StageBreakdown& into, Stage stage, int64_t frame = -1);
+    explicit StageSpan(Stage stage, int64_t frame = -1);
+    ~StageSpan();
+
+    StageSpan(const StageSpan&) = delete;
+    StageSpan& operator=(const StageSpan&) = delete;
+
+private:
+    StageBreakdown* const into_;
+    const Stage stage_;
+    const int64_t frame_;
+    const int64_t startUs_;
+    const int64_t startCpuNs_;
+};
+
+// Records a trace span (only) for the lifetime of a scope, e.g. a whole call.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name_(name), startUs_(TraceRecorder::NowMicros()) {}
+    ~TraceSpan() {
+        if (TraceRecorder* recorder = TraceRecorder::Shared()) {
+            recorder->Add(name_, startUs_, TraceRecorder::NowMicros() - startUs_);
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name_;
+    const int64_t startUs_;
+};
+
+}  // namespace orthanc_jxl
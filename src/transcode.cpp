@@ -18,11 +18,20 @@
 
 #include "transcode.h"
 
+#include "buffer_pool.h"
 #include "dicom_handler.h"
+#include "effort_policy.h"
 #include "jxl_codec.h"
+#include "layout_kernels.h"
+#include "load_tracker.h"
+#include "output_sink.h"
 #include "pixel_layout.h"
+#include "trace.h"
 #include "transfer_syntax.h"
 
+#include <cstring>
+#include <optional>
+
 namespace orthanc_jxl {
 
 namespace {
@@ -35,13 +44,95 @@ PixelFormat PixelFormatFor(const DicomImageInfo& info) {
     return (info.bitsAllocated <= 8) ? PixelFormat::RGB24 : PixelFormat::RGB48;
 }
 
+// libjxl threads per frame. Frame-parallel work encodes each frame
+// single-threaded so the shared pool is the sole source of threads, and a
+// lone frame gets singleFrameThreads - unless the load tracker is adaptive,
+// in which case it hands out the current share of the pool.
+int ResolveFrameThreads(const std::optional<LoadTracker::Scope>& scope,
+                        uint32_t frameCount, int singleFrameThreads) {
+    const int fixed = (frameCount > 1) ? JxlCodec::kSingleThreaded : singleFrameThreads;
+    return scope ? scope->FrameThreads(fixed) : fixed;
+}
+
+// Write the transcoded instance to the caller's sink, or into result.dicom
+// when the caller did not supply one.
+size_t Serialize(const DicomHandler& handler, const std::string& ts,
+                 OutputSink* out, TranscodeResult& result) {
+    if (out) {
+        return handler.WriteTo(ts, *out);
+    }
+    VectorSink sink(result.dicom);
+    return handler.WriteTo(ts, sink);
+}
+
+// Per-frame stage times. Each frame task only touches its own entry; they are
+// merged into the call's breakdown once ParallelFor returns.
+class FrameStages {
+public:
+    explicit FrameStages(uint32_t frameCount)
+        : frames_(frameCount), queuedUs_(TraceRecorder::NowMicros()) {}
+
+    // First thing in frame f's task: records how long it waited for a worker.
+    StageBreakdown& Start(size_t f) {
+        const int64_t waitUs = TraceRecorder::NowMicros() - queuedUs_;
+        Metrics().RecordStage(Stage::QueueWait, static_cast<uint64_t>(waitUs));
+        frames_[f][Stage::QueueWait].wallMs = waitUs / 1000.0;
+        return frames_[f];
+    }
+
+    StageBreakdown& operator[](size_t f) { return frames_[f]; }
+
+    void MergeInto(StageBreakdown& total) const {
+        for (const StageBreakdown& frame : frames_) {
+            total.Add(frame);
+        }
+    }
+
+private:
+    std::vector<StageBreakdown> frames_;
+    const int64_t queuedUs_;
+};
+
+// Parse an instance for the buffer overloads, timing it as their Parse stage.
+DicomHandler ParseInstance(const void* dicom, size_t size, StageBreakdown& stages) {
+    StageSpan span(stages, Stage::Parse);
+    return DicomHandler(dicom, size);
+}
+
+// Locate one JPEG bitstream per frame. Modalities usually write one fragment
+// per frame, which is used in place; the handler joins frames split over
+// several fragments. Views stay valid until pixel data changes.
+std::vector<ByteView> CollectJpegFrames(const DicomHandler& handler, uint32_t frameCount) {
+    if (handler.GetEncapsulatedFrameCount() != frameCount) {
+        throw DicomHandlerError("JPEG fragments do not match NumberOfFrames");
+    }
+    std::vector<ByteView> frames;
+    frames.reserve(frameCount);
+    for (uint32_t f = 0; f < frameCount; ++f) {
+        frames.push_back(handler.GetEncapsulatedView(f));
+    }
+    return frames;
+}
+
 }  // namespace
 
 TranscodeResult TranscodeToJxl(const void* dicom, size_t size,
                                const PluginConfig& config, ThreadPool& pool,
                                int singleFrameThreads) {
-    DicomHandler handler(dicom, size);
+    StageBreakdown parse;
+    DicomHandler handler = ParseInstance(dicom, size, parse);
+    TranscodeResult result = TranscodeToJxl(handler, config, pool, singleFrameThreads);
+    result.stages.Add(parse);
+    return result;
+}
 
+TranscodeResult TranscodeToJxl(DicomHandler& handler, const PluginConfig& config,
+                               ThreadPool& pool, int singleFrameThreads,
+                               OutputSink* out, LoadTracker* load) {
+    TraceSpan trace("to_jxl");
+    TranscodeResult result;
+    std::optional<StageSpan> extract;
+    extract.emplace(result.stages, Stage::Extract);
     DicomImageInfo info = handler.GetImageInfo();
 
     const size_t frameSize = info.FrameSizeBytes();
@@ -51,10 +142,12 @@ TranscodeResult TranscodeToJxl(const void* dicom, size_t size,
     }
 
     // Validate the pixel buffer actually holds every frame before slicing it -
-    // guards against malformed/truncated instances.
-    std::vector<uint8_t> pixels = handler.GetPixelData();
+    // guards against malformed/truncated instances. Frames are encoded straight
+    // from DCMTK's copy; the view stays valid until CommitEncapsulatedFrames
+    // below.
+    const ByteView pixels = handler.GetPixelDataView();
     const size_t expected = static_cast<size_t>(frameCount) * frameSize;
-    if (pixels.size() < expected) {
+    if (pixels.size < expected) {
         throw DicomHandlerError("Pixel data smaller than declared geometry");
     }
 
@@ -64,91 +157,409 @@ TranscodeResult TranscodeToJxl(const void* dicom, size_t size,
     const bool planar = (info.planarConfiguration == 1 && info.samplesPerPixel > 1);
 
     EncodeOptions opts = config.GetEncodeOptions(info.width, info.height);
-    const bool lossy =
-        (opts.mode == EncodeMode::ProgressiveVarDCT && opts.distance > 0.0f);
-    const std::string outTs = lossy ? TS_JPEG_XL : TS_JPEG_XL_LOSSLESS;
+    const std::string outTs =
+        config.EncodesLossy() ? TS_JPEG_XL : config.losslessTransferSyntax;
 
-    // Frame-parallel: encode each frame single-threaded so the shared pool, not
-    // nested libjxl runners, is the sole source of threads. A lone frame falls
-    // back to libjxl's own threads (overridable for ingest-concurrency tuning).
-    const int frameThreads = (frameCount > 1)
-        ? JxlCodec::kSingleThreaded : singleFrameThreads;
+    std::optional<LoadTracker::Scope> scope;
+    if (load) {
+        scope.emplace(*load, frameCount);
+    }
+    const int frameThreads = ResolveFrameThreads(scope, frameCount, singleFrameThreads);
 
-    std::vector<std::vector<uint8_t>> encoded(frameCount);
-    ParallelFor(pool, frameCount, [&](size_t f) {
-        const uint8_t* src = pixels.data() + f * frameSize;
-        if (planar) {
-            std::vector<uint8_t> interleaved = PlanarToInterleaved(
-                src, static_cast<size_t>(info.width) * info.height,
-                channels, bytesPerSample);
-            encoded[f] = JxlCodec::Encode(interleaved.data(), info.width,
-                                          info.height, format, opts, frameThreads);
-        } else {
-            encoded[f] = JxlCodec::Encode(src, info.width, info.height,
-                                          format, opts, frameThreads);
+    // Very large frames stream through libjxl: regions are pulled straight
+    // from DCMTK's buffer (interleaved on the fly for planar input).
+    const bool streaming = config.UseStreamingEncode(info.width, info.height);
+    const size_t rowBytes = static_cast<size_t>(info.width) * JxlCodec::BytesPerPixel(format);
+
+    // Optionally signal BitsStored instead of the container depth; frames
+    // whose samples do not fit it (e.g. overlay bits) stay at full depth.
+    const uint32_t reducedBits = config.bitsStoredEncoding && JxlCodec::SupportsReducedBitDepth()
+        ? ReducedSampleDepth(JxlCodec::BitsPerSample(format), info.bitsStored, info.highBit)
+        : 0;
+    const size_t frameSamples = static_cast<size_t>(info.width) * info.height * channels;
+
+    // A latency or throughput target picks the effort from the instance's
+    // size and the current load instead (see EffortPolicy).
+    EffortPolicy* policy = EffortPolicy::Shared();
+    if (policy && policy->Enabled()) {
+        opts.effort = policy->Choose(frameSamples, bytesPerSample, frameCount, frameThreads,
+                                     opts.effort);
+    } else {
+        policy = nullptr;
+    }
+
+    // Frames are encoded in parallel and appended to the new pixel sequence
+    // in order as they finish, so only a pool-sized window of encoded frames
+    // is held at once, however many frames the instance has.
+    handler.BeginEncapsulatedFrames(outTs);
+    size_t encodedBytes = 0;
+    extract.reset();
+    FrameStages frameStages(frameCount);
+    auto encodeFrame = [&](size_t f) -> std::vector<uint8_t> {
+        StageBreakdown& stages = frameStages.Start(f);
+        const uint8_t* src = pixels.data + f * frameSize;
+        EncodeOptions frameOpts = opts;
+        bool truncateSigned = false;
+        std::optional<StageSpan> layout;
+        layout.emplace(stages, Stage::Layout, f);
+        if (reducedBits &&
+            SamplesFitDepth(src, frameSamples, bytesPerSample, reducedBits, info.isSigned)) {
+            frameOpts.bitsStored = reducedBits;
+            truncateSigned = info.isSigned;
         }
-    });
 
-    handler.SetEncapsulatedFrames(encoded, outTs);
+        if (streaming) {
+            StreamingSource source;
+            if (planar || truncateSigned) {
+                source.read = [&, src, truncateSigned](size_t x, size_t y, size_t xsize,
+                                                       size_t ysize, uint8_t* out) {
+                    if (planar) {
+                        InterleaveRegion(src, info.width, info.height, x, y,
+                                         xsize, ysize, channels, bytesPerSample, out);
+                    } else {
+                        const size_t pixelBytes = JxlCodec::BytesPerPixel(format);
+                        for (size_t row = 0; row < ysize; ++row) {
+                            std::memcpy(out + row * xsize * pixelBytes,
+                                        src + (y + row) * rowBytes + x * pixelBytes,
+                                        xsize * pixelBytes);
+                        }
+                    }
+                    if (truncateSigned) {
+                        TruncateSignedSamples(out, xsize * ysize * channels, bytesPerSample,
+                                              reducedBits, out);
+                    }
+                };
+            } else {
+                source.data = src;
+                source.stride = rowBytes;
+            }
+            layout.reset();
+            StageSpan codec(stages, Stage::Encode, f);
+            return JxlCodec::EncodeStreaming(source, info.width, info.height,
+                                             format, frameOpts, frameThreads);
+        }
+        if (planar || truncateSigned) {
+            std::vector<uint8_t> staged = AcquireBuffer(frameSize);
+            staged.resize(frameSize);
+            if (planar) {
+                InterleaveFrame(src, static_cast<size_t>(info.width) * info.height,
+                                channels, bytesPerSample, staged.data());
+                if (truncateSigned) {
+                    TruncateSignedSamples(staged.data(), frameSamples, bytesPerSample,
+                                          reducedBits, staged.data());
+                }
+            } else {
+                TruncateSignedSamples(src, frameSamples, bytesPerSample, reducedBits,
+                                      staged.data());
+            }
+            layout.reset();
+            StageSpan codec(stages, Stage::Encode, f);
+            std::vector<uint8_t> encoded = JxlCodec::Encode(staged.data(), info.width,
+                                                            info.height, format, frameOpts,
+                                                            frameThreads);
+            RecycleBuffer(std::move(staged));
+            return encoded;
+        }
+        layout.reset();
+        StageSpan codec(stages, Stage::Encode, f);
+        return JxlCodec::Encode(src, info.width, info.height, format, frameOpts, frameThreads);
+    };
+    OrderedPipeline<std::vector<uint8_t>>(pool, frameCount, PipelineWindow(pool), encodeFrame,
+        [&](size_t f, std::vector<uint8_t>& encoded) {
+            StageSpan append(frameStages[f], Stage::Serialize, f);
+            handler.AppendEncapsulatedFrame(encoded.data(), encoded.size());
+            encodedBytes += encoded.size();
+            RecycleBuffer(std::move(encoded));
+        });
+    if (policy) {
+        for (uint32_t f = 0; f < frameCount; ++f) {
+            policy->Record(opts.effort, frameSamples, frameStages[f][Stage::Encode].cpuMs);
+        }
+    }
+    frameStages.MergeInto(result.stages);
+
+    std::optional<StageSpan> serialize;
+    serialize.emplace(result.stages, Stage::Serialize);
+    handler.CommitEncapsulatedFrames();
     if (planar) {
         // Encapsulated pixel data is colour-by-pixel by definition.
         handler.SetUint16(0x0028, 0x0006, 0);  // PlanarConfiguration
     }
     handler.SetTransferSyntax(outTs);
 
-    TranscodeResult result;
-    result.dicom = handler.WriteToBuffer(outTs);
+    result.dicomBytes = Serialize(handler, outTs, out, result);
     result.frameCount = frameCount;
     result.nativeBytes = expected;
-    result.encodedBytes = 0;
-    for (const auto& e : encoded) {
-        result.encodedBytes += e.size();
-    }
+    result.encodedBytes = encodedBytes;
+    result.effort = opts.effort;
+    serialize.reset();
     return result;
 }
 
 TranscodeResult TranscodeFromJxl(const void* dicom, size_t size,
                                  const std::string& uncompressedTs, ThreadPool& pool) {
-    DicomHandler handler(dicom, size);
+    StageBreakdown parse;
+    DicomHandler handler = ParseInstance(dicom, size, parse);
+    TranscodeResult result = TranscodeFromJxl(handler, uncompressedTs, pool);
+    result.stages.Add(parse);
+    return result;
+}
 
+TranscodeResult TranscodeFromJxl(DicomHandler& handler, const std::string& uncompressedTs,
+                                 ThreadPool& pool, OutputSink* out, LoadTracker* load) {
+    TraceSpan trace("from_jxl");
+    TranscodeResult result;
+    std::optional<StageSpan> extract;
+    extract.emplace(result.stages, Stage::Extract);
     uint32_t frameCount = handler.GetEncapsulatedFrameCount();
     if (frameCount == 0) {
         throw DicomHandlerError("JXL pixel data has no frames");
     }
 
-    // Pull every encapsulated frame up front (DCMTK access is not thread-safe),
-    // then decode frames in parallel.
-    std::vector<std::vector<uint8_t>> jxlFrames(frameCount);
+    const DicomImageInfo info = handler.GetImageInfo();
+    const size_t frameSize = info.FrameSizeBytes();
+    if (frameSize == 0) {
+        throw DicomHandlerError("Invalid image geometry for decoding");
+    }
+    const std::string sourceTs = handler.GetTransferSyntax();
+
+    // Locate every encapsulated frame up front (DCMTK access is not
+    // thread-safe), then decode frames in parallel straight from the dataset.
+    std::vector<ByteView> jxlFrames(frameCount);
     for (uint32_t f = 0; f < frameCount; ++f) {
-        jxlFrames[f] = handler.GetEncapsulatedData(f);
+        jxlFrames[f] = handler.GetEncapsulatedView(f);
     }
 
-    std::vector<std::vector<uint8_t>> decoded(frameCount);
-    const int frameThreads = (frameCount > 1)
-        ? JxlCodec::kSingleThreaded : JxlCodec::kDefaultThreads;
+    // Each frame decodes directly at its offset in the new native Pixel Data
+    // element; the encapsulated fragments stay readable until it is committed.
+    const size_t totalSize = static_cast<size_t>(frameCount) * frameSize;
+    uint8_t* pixels = handler.PrepareNativePixelData(totalSize);
+
+    std::optional<LoadTracker::Scope> scope;
+    if (load) {
+        scope.emplace(*load, frameCount);
+    }
+    const int frameThreads =
+        ResolveFrameThreads(scope, frameCount, JxlCodec::kDefaultThreads);
+    extract.reset();
+    FrameStages frameStages(frameCount);
     ParallelFor(pool, frameCount, [&](size_t f) {
-        decoded[f] = JxlCodec::Decode(jxlFrames[f], frameThreads).first;
+        StageBreakdown& stages = frameStages.Start(f);
+        std::optional<StageSpan> codec;
+        codec.emplace(stages, Stage::Decode, f);
+        const ImageInfo frameInfo = JxlCodec::DecodeInto(jxlFrames[f].data, jxlFrames[f].size,
+            [&](const ImageInfo& decoded, PixelFormat format) {
+                const size_t rowBytes =
+                    static_cast<size_t>(decoded.width) * JxlCodec::BytesPerPixel(format);
+                if (rowBytes * decoded.height != frameSize) {
+                    throw DicomHandlerError("Decoded frame does not match DICOM geometry");
+                }
+                return DecodeTarget{pixels + f * frameSize, rowBytes};
+            },
+            frameThreads);
+        codec.reset();
+        StageSpan layout(stages, Stage::Layout, f);
+        const PixelFormat format = JxlCodec::FormatFromImageInfo(frameInfo);
+        SignExtendFrame(pixels + f * frameSize,
+                        static_cast<size_t>(frameInfo.width) * JxlCodec::BytesPerPixel(format),
+                        frameInfo.height,
+                        static_cast<size_t>(frameInfo.width) * JxlCodec::NumChannels(format),
+                        JxlCodec::BitsPerSample(format) / 8, frameInfo.bitsPerSample,
+                        info.highBit, info.isSigned);
     });
+    frameStages.MergeInto(result.stages);
+
+    std::optional<StageSpan> serialize;
+    serialize.emplace(result.stages, Stage::Serialize);
+    handler.CommitNativePixelData();
+    if (sourceTs == TS_JPEG_XL_JPEG_RECOMPRESSION &&
+        info.photometricInterpretation.compare(0, 3, "YBR") == 0) {
+        // libjxl hands back reconstructed JPEGs as RGB, with chroma upsampled.
+        handler.SetString(0x0028, 0x0004, "RGB");  // PhotometricInterpretation
+    }
+    handler.SetTransferSyntax(uncompressedTs);
 
-    // Concatenate frames into a single native pixel-data blob.
-    size_t totalSize = 0;
-    for (const auto& d : decoded) {
-        totalSize += d.size();
+    result.dicomBytes = Serialize(handler, uncompressedTs, out, result);
+    result.frameCount = frameCount;
+    result.nativeBytes = totalSize;
+    result.encodedBytes = 0;
+    serialize.reset();
+    return result;
+}
+
+TranscodeResult RecompressJpegToJxl(DicomHandler& handler, const PluginConfig& config,
+                                    ThreadPool& pool, OutputSink* out, LoadTracker* load) {
+    TraceSpan trace("recompress_jpeg");
+    TranscodeResult result;
+    std::optional<StageSpan> extract;
+    extract.emplace(result.stages, Stage::Extract);
+    const DicomImageInfo info = handler.GetImageInfo();
+    const uint32_t frameCount = info.numberOfFrames;
+    if (frameCount == 0) {
+        throw DicomHandlerError("JPEG pixel data has no frames");
     }
-    std::vector<uint8_t> pixels;
-    pixels.reserve(totalSize);
-    for (auto& d : decoded) {
-        pixels.insert(pixels.end(), d.begin(), d.end());
+
+    const std::vector<ByteView> jpegFrames = CollectJpegFrames(handler, frameCount);
+    const int effort = config.GetEncodeOptions(info.width, info.height).effort;
+    std::optional<LoadTracker::Scope> scope;
+    if (load) {
+        scope.emplace(*load, frameCount);
     }
+    const int frameThreads =
+        ResolveFrameThreads(scope, frameCount, JxlCodec::kDefaultThreads);
 
-    handler.SetNativePixelData(pixels);
-    handler.SetTransferSyntax(uncompressedTs);
+    // The JPEG keeps its own colour model, so PhotometricInterpretation (e.g.
+    // YBR_FULL_422) and the lossy-compression attributes carry over unchanged.
+    handler.BeginEncapsulatedFrames(TS_JPEG_XL_JPEG_RECOMPRESSION);
+    extract.reset();
+    FrameStages frameStages(frameCount);
+    OrderedPipeline<std::vector<uint8_t>>(pool, frameCount, PipelineWindow(pool),
+        [&](size_t f) {
+            StageSpan codec(frameStages.Start(f), Stage::Encode, f);
+            return JxlCodec::RecompressJpeg(jpegFrames[f].data, jpegFrames[f].size,
+                                            effort, frameThreads);
+        },
+        [&](size_t f, std::vector<uint8_t>& recompressed) {
+            StageSpan append(frameStages[f], Stage::Serialize, f);
+            handler.AppendEncapsulatedFrame(recompressed.data(), recompressed.size());
+            result.encodedBytes += recompressed.size();
+            RecycleBuffer(std::move(recompressed));
+        });
+    frameStages.MergeInto(result.stages);
 
+    std::optional<StageSpan> serialize;
+    serialize.emplace(result.stages, Stage::Serialize);
+    result.frameCount = frameCount;
+    for (const ByteView& j : jpegFrames) {
+        result.nativeBytes += j.size;
+    }
+    handler.CommitEncapsulatedFrames();
+    handler.SetTransferSyntax(TS_JPEG_XL_JPEG_RECOMPRESSION);
+
+    result.dicomBytes = Serialize(handler, TS_JPEG_XL_JPEG_RECOMPRESSION, out, result);
+    serialize.reset();
+    return result;
+}
+
+TranscodeResult ReconstructJpegFromJxl(DicomHandler& handler, ThreadPool& pool,
+                                       OutputSink* out) {
+    TraceSpan trace("reconstruct_jpeg");
     TranscodeResult result;
-    result.dicom = handler.WriteToBuffer(uncompressedTs);
+    std::optional<StageSpan> extract;
+    extract.emplace(result.stages, Stage::Extract);
+    const uint32_t frameCount = handler.GetEncapsulatedFrameCount();
+    if (frameCount == 0) {
+        throw DicomHandlerError("JXL pixel data has no frames");
+    }
+
+    std::vector<ByteView> jxlFrames(frameCount);
+    for (uint32_t f = 0; f < frameCount; ++f) {
+        jxlFrames[f] = handler.GetEncapsulatedView(f);
+    }
+
+    handler.BeginEncapsulatedFrames(TS_JPEG_BASELINE);
+    extract.reset();
+    FrameStages frameStages(frameCount);
+    OrderedPipeline<std::vector<uint8_t>>(pool, frameCount, PipelineWindow(pool),
+        [&](size_t f) {
+            StageSpan codec(frameStages.Start(f), Stage::Decode, f);
+            return JxlCodec::ReconstructJpeg(jxlFrames[f].data, jxlFrames[f].size);
+        },
+        [&](size_t f, std::vector<uint8_t>& jpeg) {
+            StageSpan append(frameStages[f], Stage::Serialize, f);
+            handler.AppendEncapsulatedFrame(jpeg.data(), jpeg.size());
+            result.nativeBytes += jpeg.size();
+            RecycleBuffer(std::move(jpeg));
+        });
+    frameStages.MergeInto(result.stages);
+
+    std::optional<StageSpan> serialize;
+    serialize.emplace(result.stages, Stage::Serialize);
     result.frameCount = frameCount;
-    result.nativeBytes = pixels.size();
-    result.encodedBytes = 0;
+    for (const auto& v : jxlFrames) {
+        result.encodedBytes += v.size;
+    }
+    handler.CommitEncapsulatedFrames();
+    handler.SetTransferSyntax(TS_JPEG_BASELINE);
+
+    result.dicomBytes = Serialize(handler, TS_JPEG_BASELINE, out, result);
+    serialize.reset();
+    return result;
+}
+
+TranscodeResult RecompressJxl(DicomHandler& handler, const PluginConfig& config, int effort,
+                              ThreadPool& pool, OutputSink* out) {
+    TraceSpan trace("recompress_jxl");
+    TranscodeResult result;
+    std::optional<StageSpan> extract;
+    extract.emplace(result.stages, Stage::Extract);
+    if (handler.GetTransferSyntax() != TS_JPEG_XL_LOSSLESS) {
+        throw DicomHandlerError("Only JPEG XL Lossless instances can be recompressed");
+    }
+    const uint32_t frameCount = handler.GetEncapsulatedFrameCount();
+    if (frameCount == 0) {
+        throw DicomHandlerError("JXL pixel data has no frames");
+    }
+    const DicomImageInfo info = handler.GetImageInfo();
+
+    std::vector<ByteView> jxlFrames(frameCount);
+    for (uint32_t f = 0; f < frameCount; ++f) {
+        jxlFrames[f] = handler.GetEncapsulatedView(f);
+        result.nativeBytes += jxlFrames[f].size;
+    }
+
+    EncodeOptions opts = config.GetEncodeOptions(info.width, info.height);
+    if (opts.mode == EncodeMode::ProgressiveVarDCT) {
+        opts = EncodeOptions::ProgressiveLossless(effort, opts.centerX, opts.centerY);
+    }
+    opts.effort = effort;
+    opts.distance = 0.0f;
+    // Background work: frames run in parallel, each single-threaded.
+    const int frameThreads = JxlCodec::kSingleThreaded;
+
+    handler.BeginEncapsulatedFrames(TS_JPEG_XL_LOSSLESS);
+    extract.reset();
+    FrameStages frameStages(frameCount);
+    auto recompressFrame = [&](size_t f) -> std::vector<uint8_t> {
+        StageBreakdown& stages = frameStages.Start(f);
+        std::optional<StageSpan> codec;
+        codec.emplace(stages, Stage::Decode, f);
+        const auto original = JxlCodec::Decode(jxlFrames[f].data, jxlFrames[f].size, frameThreads);
+        const ImageInfo& decoded = original.second;
+        const PixelFormat format = JxlCodec::FormatFromImageInfo(decoded);
+        EncodeOptions frameOpts = opts;
+        if (decoded.bitsPerSample < static_cast<uint32_t>(JxlCodec::BitsPerSample(format))) {
+            frameOpts.bitsStored = decoded.bitsPerSample;
+        }
+        codec.emplace(stages, Stage::Encode, f);
+        std::vector<uint8_t> recompressed = JxlCodec::Encode(
+            original.first.data(), decoded.width, decoded.height, format, frameOpts, frameThreads);
+
+        codec.emplace(stages, Stage::Decode, f);
+        const auto check = JxlCodec::Decode(recompressed, frameThreads);
+        codec.reset();
+        if (check.first != original.first ||
+            check.second.bitsPerSample != decoded.bitsPerSample) {
+            throw JxlCodecError("Recompressed frame " + std::to_string(f) + " is not bit-exact");
+        }
+        return recompressed;
+    };
+    OrderedPipeline<std::vector<uint8_t>>(pool, frameCount, PipelineWindow(pool), recompressFrame,
+        [&](size_t f, std::vector<uint8_t>& recompressed) {
+            StageSpan append(frameStages[f], Stage::Serialize, f);
+            handler.AppendEncapsulatedFrame(recompressed.data(), recompressed.size());
+            result.encodedBytes += recompressed.size();
+            RecycleBuffer(std::move(recompressed));
+        });
+    frameStages.MergeInto(result.stages);
+
+    std::optional<StageSpan> serialize;
+    serialize.emplace(result.stages, Stage::Serialize);
+    result.frameCount = frameCount;
+    handler.CommitEncapsulatedFrames();
+
+    result.dicomBytes = Serialize(handler, TS_JPEG_XL_LOSSLESS, out, result);
+    serialize.reset();
     return result;
 }
 
@@ -19,7 +19,10 @@
 #pragma once
 
 #include "config.h"
+#include "dicom_handler.h"
+#include "output_sink.h"
 #include "thread_pool.h"
+#include "trace.h"
 
 #include <cstdint>
 #include <string>
@@ -27,12 +30,19 @@
 
 namespace orthanc_jxl {
 
+class LoadTracker;
+
 // Result of a transcode: the serialized DICOM plus stats for logging.
 struct TranscodeResult {
-    std::vector<uint8_t> dicom;
+    std::vector<uint8_t> dicom;   // empty when the caller supplied an OutputSink
+    size_t dicomBytes = 0;        // serialized size, wherever it was written
     uint32_t frameCount = 0;
-    size_t nativeBytes = 0;    // total uncompressed pixel bytes
-    size_t encodedBytes = 0;   // total JXL pixel bytes (TO-JXL only)
+    size_t nativeBytes = 0;    // total uncompressed pixel bytes (JPEG bytes for .111)
+    size_t encodedBytes = 0;   // total JXL pixel bytes
+    int effort = 0;            // libjxl effort of a pixel encode (TranscodeToJxl)
+    // Wall / CPU time per stage. Parse is only filled in by the buffer
+    // overloads; callers that parse the instance themselves add their own.
+    StageBreakdown stages;
 };
 
 // Encode an uncompressed/legacy DICOM instance to JPEG-XL. Frames are encoded
@@ -52,4 +62,42 @@ TranscodeResult TranscodeToJxl(const void* dicom, size_t size,
 TranscodeResult TranscodeFromJxl(const void* dicom, size_t size,
                                  const std::string& uncompressedTs, ThreadPool& pool);
 
+// Overloads for an instance the caller has already parsed (e.g. to inspect
+// it), so each instance is parsed once per request. The handler is rewritten
+// in place - pixel data and transfer syntax are replaced - and should not be
+// reused afterwards.
+//
+// When `out` is given the serialized instance is written straight into the
+// sink's memory (e.g. an Orthanc-owned buffer) and result.dicom stays empty.
+// When `load` is given the call is counted as in flight for its duration, and
+// an adaptive tracker picks libjxl's per-frame thread count from current load
+// (overriding singleFrameThreads).
+TranscodeResult TranscodeToJxl(DicomHandler& handler, const PluginConfig& config,
+                               ThreadPool& pool, int singleFrameThreads = -1,
+                               OutputSink* out = nullptr, LoadTracker* load = nullptr);
+TranscodeResult TranscodeFromJxl(DicomHandler& handler, const std::string& uncompressedTs,
+                                 ThreadPool& pool, OutputSink* out = nullptr,
+                                 LoadTracker* load = nullptr);
+
+// Lossless JPEG recompression (JPEG XL JPEG Recompression, .111). A JPEG
+// Baseline (.50) instance is repacked frame by frame without decoding to
+// pixels, and a .111 instance is turned back into the byte-identical JPEG
+// Baseline original. Both rewrite the handler in place like the overloads above.
+TranscodeResult RecompressJpegToJxl(DicomHandler& handler, const PluginConfig& config,
+                                    ThreadPool& pool, OutputSink* out = nullptr,
+                                    LoadTracker* load = nullptr);
+TranscodeResult ReconstructJpegFromJxl(DicomHandler& handler, ThreadPool& pool,
+                                       OutputSink* out = nullptr);
+
+// Re-encode a lossless JPEG XL (.110) instance at `effort`, e.g. to shrink
+// instances ingested at a fast, low effort. Frames are re-encoded from their
+// coded samples (same depth, signed samples left as coded) with the
+// configured lossless mode (single-threaded, frames in parallel), then
+// decoded again and compared with the original; any difference throws
+// JxlCodecError, so the output is verified bit-exact. Rewrites the handler in
+// place like the overloads above. nativeBytes is the original JXL
+// size and encodedBytes the new one; callers keep whichever is smaller.
+TranscodeResult RecompressJxl(DicomHandler& handler, const PluginConfig& config, int effort,
+                              ThreadPool& pool, OutputSink* out = nullptr);
+
 }  // namespace orthanc_jxl
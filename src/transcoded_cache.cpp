@@ -0,0 +1,416 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include "transcoded_cache.h"
+#include "content_hash.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace orthanc_jxl {
+
+namespace {
+
+// First line of every disk entry, followed by the fingerprint; the key is on
+// the second line, the length and hash of the transcoded instance on the
+// third, and the instance follows.
+constexpr const char* kDiskMagic = "orthanc-jxl-transcoded/2";
+constexpr const char* kDiskSuffix = ".dcm";
+
+struct DiskHeader {
+    std::string magic;   // with the fingerprint
+    std::string key;
+    uint64_t length = 0;
+    uint64_t hash = 0;
+    size_t size = 0;     // of the header itself
+};
+
+std::string FormatDiskHeader(const std::string& fingerprint, const std::string& key,
+                             const void* data, size_t size) {
+    char payload[48];
+    snprintf(payload, sizeof(payload), "%zu %016llx\n", size,
+             static_cast<unsigned long long>(HashBytes(static_cast<const uint8_t*>(data), size)));
+    return std::string(kDiskMagic) + ' ' + fingerprint + '\n' + key + '\n' + payload;
+}
+
+bool ReadDiskHeader(std::istream& in, DiskHeader& header) {
+    std::string payload;
+    if (!std::getline(in, header.magic) || !std::getline(in, header.key) ||
+        !std::getline(in, payload)) {
+        return false;
+    }
+    unsigned long long length = 0, hash = 0;
+    char extra = 0;
+    if (sscanf(payload.c_str(), "%llu %16llx%c", &length, &hash, &extra) != 2) {
+        return false;
+    }
+    const std::streamoff size = in.tellg();
+    if (size < 0) {
+        return false;
+    }
+    header.length = length;
+    header.hash = hash;
+    header.size = static_cast<size_t>(size);
+    return true;
+}
+
+uint64_t HashString(const std::string& s) {
+    return HashBytes(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+}
+
+// SOP Instance UID (and variant) part of a key made by MakeKey().
+std::string UidOf(const std::string& key) {
+    return key.substr(0, key.find('|'));
+}
+
+}  // namespace
+
+TranscodedCache::TranscodedCache(const Options& options) : options_(options) {
+    if (options_.diskBytes > 0) {
+        std::error_code ec;
+        fs::create_directories(options_.directory, ec);
+        if (!fs::is_directory(options_.directory)) {
+            throw std::runtime_error("Cannot create transcoded cache directory: " +
+                                     options_.directory);
+        }
+        LoadDisk();
+    }
+}
+
+std::string TranscodedCache::MakeKey(const FileMetaInfo& meta, const void* data, size_t size,
+                                     const std::string& variant) {
+    if (meta.sopInstanceUid.empty() || !data) {
+        return std::string();
+    }
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), "|%zu|%016llx", size,
+             static_cast<unsigned long long>(
+                 HashBytes(static_cast<const uint8_t*>(data), size)));
+    // The variant goes in the UID part, so it is versioned on its own.
+    return variant.empty() ? meta.sopInstanceUid + suffix
+                           : meta.sopInstanceUid + '@' + variant + suffix;
+}
+
+// Two keys with the same name hash share a file; the key stored in it decides
+// which one hits, and the other reads as a miss.
+std::string TranscodedCache::PathFor(const std::string& key) const {
+    char name[24];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(HashString(key)));
+    return options_.directory + "/" + name + kDiskSuffix;
+}
+
+// Index the entries left by earlier runs, most recently used (written or
+// hit) first. Entries of other encode settings, unreadable files, interrupted
+// writes and files of the wrong length are deleted; of two versions of one
+// UID the older goes. Payload hashes are checked when an entry is read.
+void TranscodedCache::LoadDisk() {
+    struct Found {
+        DiskEntry entry;
+        fs::file_time_type time;
+    };
+    std::vector<Found> found;
+    std::error_code ec;
+    for (const fs::directory_entry& file : fs::directory_iterator(options_.directory, ec)) {
+        const std::string path = file.path().string();
+        if (!file.is_regular_file(ec) || file.path().extension() != kDiskSuffix) {
+            if (file.path().extension() == ".tmp") {
+                fs::remove(file.path(), ec);
+            }
+            continue;
+        }
+        std::ifstream in(path, std::ios::binary);
+        DiskHeader header;
+        const bool parsed = ReadDiskHeader(in, header);
+        const uintmax_t bytes = file.file_size(ec);
+        if (!parsed || ec || header.magic != std::string(kDiskMagic) + ' ' + options_.fingerprint ||
+            header.key.empty() || PathFor(header.key) != path ||
+            bytes != header.size + header.length) {
+            in.close();
+            fs::remove(file.path(), ec);
+            continue;
+        }
+        found.push_back({DiskEntry{header.key, path, static_cast<size_t>(bytes)},
+                         file.last_write_time(ec)});
+    }
+    std::sort(found.begin(), found.end(),
+              [](const Found& a, const Found& b) { return a.time > b.time; });
+
+    std::vector<std::string> removedFiles;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (Found& f : found) {
+        if (!versions_.emplace(UidOf(f.entry.key), f.entry.key).second) {
+            removedFiles.push_back(f.entry.path);
+            continue;
+        }
+        diskBytes_ += f.entry.bytes;
+        disk_.push_back(std::move(f.entry));
+        diskMap_.emplace(disk_.back().key, std::prev(disk_.end()));
+    }
+    EvictLocked(removedFiles);
+    for (const std::string& path : removedFiles) {
+        fs::remove(path, ec);
+    }
+}
+
+bool TranscodedCache::ReadDiskEntry(const std::string& path, const std::string& key,
+                                    std::vector<uint8_t>& out) const {
+    std::ifstream in(path, std::ios::binary);
+    DiskHeader header;
+    if (!ReadDiskHeader(in, header) || header.key != key) {
+        return false;
+    }
+    in.seekg(0, std::ios::end);
+    const std::streamoff end = in.tellg();
+    if (end < 0 || static_cast<uint64_t>(end) != header.size + header.length) {
+        return false;   // truncated, or extended by something else
+    }
+    out.resize(static_cast<size_t>(header.length));
+    in.seekg(static_cast<std::streamoff>(header.size));
+    in.read(reinterpret_cast<char*>(out.data()), static_cast<std::streamsize>(out.size()));
+    return in && HashBytes(out.data(), out.size()) == header.hash;
+}
+
+TranscodedCache::Result TranscodedCache::Find(const std::string& key) {
+    if (!Enabled() || key.empty()) {
+        return nullptr;
+    }
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto disk = diskMap_.find(key);
+        if (disk != diskMap_.end()) {
+            disk_.splice(disk_.begin(), disk_, disk->second);
+            path = disk->second->path;
+        }
+        auto it = memoryMap_.find(key);
+        if (it != memoryMap_.end()) {
+            ++hits_;
+            memory_.splice(memory_.begin(), memory_, it->second);
+            return it->second->data;
+        }
+        if (path.empty()) {
+            ++misses_;
+            return nullptr;
+        }
+    }
+
+    // Read outside the lock so one slow disk hit does not stall other lookups.
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    const bool read = ReadDiskEntry(path, key, *data);
+    std::error_code ec;
+    if (read) {
+        // Keeps the LRU order across restarts.
+        fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+    }
+
+    if (!read) {
+        bool dropped = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++misses_;
+            auto disk = diskMap_.find(key);
+            if (disk != diskMap_.end()) {
+                diskBytes_ -= disk->second->bytes;
+                disk_.erase(disk->second);
+                diskMap_.erase(disk);
+                if (!memoryMap_.count(key)) {
+                    versions_.erase(UidOf(key));
+                }
+                dropped = true;
+            }
+        }
+        // Else LoadDisk, which only checks the header and length, would index
+        // the damaged file again on the next start.
+        if (dropped) {
+            fs::remove(path, ec);
+        }
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++hits_;
+    ++diskHits_;
+    if (!memoryMap_.count(key) && diskMap_.count(key)) {
+        InsertMemoryLocked(key, data);
+        std::vector<std::string> removedFiles;  // stays empty: the disk tier did not grow
+        EvictLocked(removedFiles);
+    }
+    return data;
+}
+
+void TranscodedCache::Insert(const std::string& key, const void* data, size_t size) {
+    if (!Enabled() || key.empty() || !data) {
+        return;
+    }
+    const bool toMemory = size + key.size() + sizeof(MemoryEntry) <= options_.memoryBytes;
+    const std::string header = options_.diskBytes > 0
+        ? FormatDiskHeader(options_.fingerprint, key, data, size) : std::string();
+    const bool toDisk = !header.empty() && header.size() + size <= options_.diskBytes;
+    if (!toMemory && !toDisk) {
+        return;
+    }
+    const std::string path = PathFor(key);
+    std::vector<std::string> removedFiles;
+    std::string temp;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (memoryMap_.count(key) || diskMap_.count(key)) {
+            return;  // another thread transcoded the same instance concurrently
+        }
+        InvalidateOtherVersionsLocked(key, removedFiles);
+        versions_[UidOf(key)] = key;
+        if (toMemory) {
+            const uint8_t* bytes = static_cast<const uint8_t*>(data);
+            InsertMemoryLocked(key, std::make_shared<const std::vector<uint8_t>>(bytes,
+                                                                                  bytes + size));
+        }
+        temp = path + '.' + std::to_string(++tempCounter_) + ".tmp";
+        EvictLocked(removedFiles);
+    }
+
+    bool written = false;
+    if (toDisk) {
+        // Via a temporary file, and unsynced: what a crash leaves of an entry
+        // fails its length or hash check and reads as a miss.
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+        written = static_cast<bool>(out.flush());
+        out.close();
+        written = written && std::rename(temp.c_str(), path.c_str()) == 0;
+        if (!written) {
+            std::error_code ec;
+            fs::remove(temp, ec);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto version = versions_.find(UidOf(key));
+        if (written) {
+            if (version == versions_.end() || version->second != key) {
+                // Superseded by a newer version while writing.
+                removedFiles.push_back(path);
+            } else if (!diskMap_.count(key)) {
+                disk_.push_front(DiskEntry{key, path, header.size() + size});
+                diskMap_.emplace(key, disk_.begin());
+                diskBytes_ += header.size() + size;
+            }
+        }
+        if (version != versions_.end() && version->second == key &&
+            !memoryMap_.count(key) && !diskMap_.count(key)) {
+            versions_.erase(version);  // stored in neither tier after all
+        }
+        EvictLocked(removedFiles);
+    }
+    std::error_code ec;
+    for (const std::string& file : removedFiles) {
+        fs::remove(file, ec);
+    }
+}
+
+void TranscodedCache::InsertMemoryLocked(const std::string& key, Result data) {
+    const size_t bytes = data->size() + key.size() + sizeof(MemoryEntry);
+    if (bytes > options_.memoryBytes) {
+        return;
+    }
+    memory_.push_front(MemoryEntry{key, std::move(data), bytes});
+    memoryMap_.emplace(key, memory_.begin());
+    memoryBytes_ += bytes;
+}
+
+void TranscodedCache::InvalidateOtherVersionsLocked(const std::string& key,
+                                                    std::vector<std::string>& removedFiles) {
+    auto version = versions_.find(UidOf(key));
+    if (version == versions_.end() || version->second == key) {
+        return;
+    }
+    const std::string stale = version->second;
+    versions_.erase(version);
+    bool dropped = false;
+    auto it = memoryMap_.find(stale);
+    if (it != memoryMap_.end()) {
+        memoryBytes_ -= it->second->bytes;
+        memory_.erase(it->second);
+        memoryMap_.erase(it);
+        dropped = true;
+    }
+    auto disk = diskMap_.find(stale);
+    if (disk != diskMap_.end()) {
+        diskBytes_ -= disk->second->bytes;
+        removedFiles.push_back(disk->second->path);
+        disk_.erase(disk->second);
+        diskMap_.erase(disk);
+        dropped = true;
+    }
+    if (dropped) {
+        ++invalidations_;
+    }
+}
+
+void TranscodedCache::EvictLocked(std::vector<std::string>& removedFiles) {
+    auto forget = [this](const std::string& key) {
+        if (!memoryMap_.count(key) && !diskMap_.count(key)) {
+            auto version = versions_.find(UidOf(key));
+            if (version != versions_.end() && version->second == key) {
+                versions_.erase(version);
+            }
+        }
+    };
+    while (memoryBytes_ > options_.memoryBytes && !memory_.empty()) {
+        const std::string key = memory_.back().key;
+        memoryBytes_ -= memory_.back().bytes;
+        memoryMap_.erase(key);
+        memory_.pop_back();
+        ++evictions_;
+        forget(key);
+    }
+    while (diskBytes_ > options_.diskBytes && !disk_.empty()) {
+        const std::string key = disk_.back().key;
+        diskBytes_ -= disk_.back().bytes;
+        removedFiles.push_back(disk_.back().path);
+        diskMap_.erase(key);
+        disk_.pop_back();
+        ++evictions_;
+        forget(key);
+    }
+}
+
+TranscodedCache::Stats TranscodedCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s;
+    s.hits = hits_;
+    s.diskHits = diskHits_;
+    s.misses = misses_;
+    s.evictions = evictions_;
+    s.invalidations = invalidations_;
+    s.entries = memoryMap_.size();
+    s.bytes = memoryBytes_;
+    s.diskEntries = diskMap_.size();
+    s.diskBytes = diskBytes_;
+    return s;
+}
+
+}  // namespace orthanc_jxl
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2026 Ryan Walklin <ryan@kaitakeradiology.co.nz>
+ *
+ * This file is part of orthanc-jxl.
+ *
+ * orthanc-jxl is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or (at your option) any later
+ * version.
+ *
+ * orthanc-jxl is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * orthanc-jxl. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include "dicom_scan.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace orthanc_jxl {
+
+/**
+ * Bounded LRU cache of TO-JXL transcoded instances, in memory and optionally
+ * on disk.
+ *
+ * Uncompressed instances served to JPEG XL capable clients are otherwise
+ * re-encoded on every retrieval; a hit copies the stored result into
+ * Orthanc's buffer without parsing or encoding anything.
+ *
+ * - Keys: MakeKey() combines the SOP Instance UID with the size and a hash of
+ *   the whole source buffer, so a changed instance never hits a stale entry.
+ *   Inserting a new key for a UID already cached drops the old entry (an
+ *   instance modified in place, or stored again with its UID kept). A
+ *   `variant` (e.g. another target syntax) is cached beside the others.
+ * - Options: every entry belongs to `fingerprint` (the encode settings, see
+ *   PluginConfig::OutputFingerprint()). Disk entries written under another
+ *   fingerprint are deleted when the cache opens.
+ * - Tiers: up to `memoryBytes` of results are kept in memory, and up to
+ *   `diskBytes` in `directory`, each evicted least recently used first. The
+ *   disk tier survives restarts; a disk hit is promoted to memory. Disk
+ *   entries record their length and hash, and a file that fails either check
+ *   reads as a miss and is deleted.
+ *
+ * Results are shared immutable, so a hit stays valid while another thread
+ * evicts it.
+ */
+class TranscodedCache {
+public:
+    struct Options {
+        size_t memoryBytes = 0;   // 0 = no memory tier
+        size_t diskBytes = 0;     // 0 = no disk tier
+        std::string directory;    // disk tier, created if missing
+        std::string fingerprint;  // encode settings the entries were made with
+    };
+
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t diskHits = 0;         // of hits, those read from disk
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;    // entries replaced by a newer version
+        size_t entries = 0;
+        size_t bytes = 0;
+        size_t diskEntries = 0;
+        size_t diskBytes = 0;
+    };
+
+    using Result = std::shared_ptr<const std::vector<uint8_t>>;
+
+    // Opens (and indexes) the disk tier when diskBytes > 0; throws
+    // std::runtime_error if its directory cannot be created.
+    explicit TranscodedCache(const Options& options);
+
+    TranscodedCache(const TranscodedCache&) = delete;
+    TranscodedCache& operator=(const TranscodedCache&) = delete;
+
+    // Key for a raw source instance, transcoded as `variant` (empty for the
+    // default output); empty when it has no Media Storage SOP Instance UID to
+    // key on.
+    static std::string MakeKey(const FileMetaInfo& meta, const void* data, size_t size,
+                               const std::string& variant = std::string());
+
+    Result Find(const std::string& key);
+    void Insert(const std::string& key, const void* data, size_t size);
+
+    bool Enabled() const { return options_.memoryBytes > 0 || options_.diskBytes > 0; }
+    Stats GetStats() const;
+
+private:
+    struct MemoryEntry {
+        std::string key;
+        Result data;
+        size_t bytes;
+    };
+    struct DiskEntry {
+        std::string key;
+        std::string path;
+        size_t bytes;
+    };
+    using MemoryList = std::list<MemoryEntry>;
+    using DiskList = std::list<DiskEntry>;
+
+    void LoadDisk();
+    std::string PathFor(const std::string& key) const;
+    bool ReadDiskEntry(const std::string& path, const std::string& key,
+                       std::vector<uint8_t>& out) const;
+    void InsertMemoryLocked(const std::string& key, Result data);
+    // Drop entries for the UID of `key` that are not `key`.
+    void InvalidateOtherVersionsLocked(const std::string& key,
+                                       std::vector<std::string>& removedFiles);
+    void EvictLocked(std::vector<std::string>& removedFiles);
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    MemoryList memory_;  // front = most recently used
+    std::unordered_map<std::string, MemoryList::iterator> memoryMap_;
+    DiskList disk_;      // front = most recently used
+    std::unordered_map<std::string, DiskList::iterator> diskMap_;
+    std::unordered_map<std::string, std::string> versions_;  // SOP Instance UID -> key
+    size_t memoryBytes_ = 0;
+    size_t diskBytes_ = 0;
+    uint64_t tempCounter_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t diskHits_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t evictions_ = 0;
+    uint64_t invalidations_ = 0;
+};
+
+}  // namespace orthanc_jxl
@@ -27,6 +27,9 @@ constexpr const char* TS_JPEG_XL_LOSSLESS = "1.2.840.10008.1.2.4.110";
 constexpr const char* TS_JPEG_XL_JPEG_RECOMPRESSION = "1.2.840.10008.1.2.4.111";
 constexpr const char* TS_JPEG_XL = "1.2.840.10008.1.2.4.112";
 
+// JPEG Baseline (Process 1): the source/target of lossless JPEG recompression
+constexpr const char* TS_JPEG_BASELINE = "1.2.840.10008.1.2.4.50";
+
 // Uncompressed transfer syntaxes for transcoding FROM JXL
 constexpr const char* TS_LITTLE_ENDIAN_EXPLICIT = "1.2.840.10008.1.2.1";
 constexpr const char* TS_BIG_ENDIAN_EXPLICIT = "1.2.840.10008.1.2.2";
@@ -38,6 +41,11 @@ inline bool IsJxlTransferSyntax(std::string_view ts) {
            ts == TS_JPEG_XL;
 }
 
+// Syntaxes whose pixel data this plugin writes as encapsulated fragments.
+inline bool IsEncapsulatedTransferSyntax(std::string_view ts) {
+    return IsJxlTransferSyntax(ts) || ts == TS_JPEG_BASELINE;
+}
+
 inline bool IsUncompressedTransferSyntax(std::string_view ts) {
     return ts == TS_LITTLE_ENDIAN_EXPLICIT ||
            ts == TS_BIG_ENDIAN_EXPLICIT ||
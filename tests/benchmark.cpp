@@ -172,6 +172,15 @@ int main(int argc, char* argv[]) {
 
         PrintResults(results, info);
 
+        // Encoders/decoders are recycled across runs; the first run of each
+        // kind creates them and fills their arenas.
+        const CodecStats stats = JxlCodec::Stats();
+        printf("libjxl objects: %llu created, %llu reused; allocations: %llu (%llu reached malloc)\n\n",
+               (unsigned long long)(stats.encodersCreated + stats.decodersCreated),
+               (unsigned long long)stats.codecsReused,
+               (unsigned long long)stats.allocations,
+               (unsigned long long)stats.systemAllocations);
+
         // Summary - only check lossless modes
         bool allPassed = true;
         for (const auto& r : results) {
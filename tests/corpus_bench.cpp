@@ -0,0 +1,503 @@
+/*
+ * Corpus benchmark with JSON output and regression gating.
+ *
+ * Walks a directory of DICOM instances, groups them by modality and geometry
+ * (e.g. "CT 512x512x1 16-bit 1spp") and, for every group and threading
+ * strategy, times the operations the plugin performs in production:
+ *
+ *   to_jxl        TranscodeToJxl (or RecompressJpegToJxl for .50 inputs)
+ *   from_jxl      TranscodeFromJxl (or ReconstructJpegFromJxl)
+ *   frame_decode  one frame decoded into a caller buffer, as
+ *                 DecodeImageCallback does for the viewer
+ *
+ * Strategies are the plugin's thread sizing modes: "default" (libjxl may use
+ * the whole shared pool per frame), "single" (one thread per frame, the cores
+ * are filled by concurrent frames) and "adaptive" (LoadTracker).
+ *
+ * Each group reports p50/p95/p99 latency, MB/s of native pixel data,
+ * compression ratio and the peak RSS reached while it ran. With --json the
+ * results are written as JSON, including the mean per-stage wall / CPU time of
+ * to_jxl and from_jxl; --baseline compares the run against a stored result and
+ * exits non-zero on a regression, and --compare does the same for two result
+ * files without running anything. --trace writes every stage span as Chrome
+ * trace JSON for ui.perfetto.dev.
+ *
+ * JXL inputs are decoded to native once and benchmarked from there; other
+ * compressed transfer syntaxes are skipped.
+ *
+ * Usage: corpus_bench <corpus_dir> [--iterations N] [--json out.json]
+ *                     [--baseline baseline.json] [--tolerance 0.10]
+ *                     [--trace trace.json]
+ *        corpus_bench --compare current.json baseline.json [--tolerance 0.10]
+ */
+
+#include "../src/transcode.h"
+#include "../src/dicom_handler.h"
+#include "../src/jxl_codec.h"
+#include "../src/config.h"
+#include "../src/load_tracker.h"
+#include "../src/thread_pool.h"
+#include "../src/trace.h"
+#include "../src/buffer_pool.h"
+#include "../src/transfer_syntax.h"
+
+#include <jxl/version.h>
+#include <nlohmann/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace orthanc_jxl;
+using Clock = std::chrono::steady_clock;
+
+static std::vector<uint8_t> ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) throw std::runtime_error("Failed to open: " + path);
+    size_t size = file.tellg();
+    file.seekg(0);
+    std::vector<uint8_t> data(size);
+    file.read(reinterpret_cast<char*>(data.data()), size);
+    return data;
+}
+
+static double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// ============================================================================
+// Peak memory
+// ============================================================================
+
+// Reset the kernel's peak-RSS mark (Linux >= 4.0), so each group's peak is its
+// own; elsewhere the peak is simply monotonic over the run.
+static void ResetPeakRss() {
+    std::ofstream clear("/proc/self/clear_refs");
+    if (clear) clear << "5";
+}
+
+static double PeakRssMb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtod(line.c_str() + 6, nullptr) / 1024.0;  // kB
+        }
+    }
+    return 0.0;
+}
+
+// ============================================================================
+// Corpus
+// ============================================================================
+
+struct Instance {
+    std::string path;
+    std::vector<uint8_t> dicom;   // native, or JPEG Baseline for the .111 path
+    bool jpeg = false;
+    size_t nativeBytes = 0;       // uncompressed pixel bytes, all frames
+};
+
+struct Group {
+    std::string key;
+    std::vector<Instance> instances;
+};
+
+static std::string GroupKey(const DicomImageInfo& info, bool jpeg) {
+    char key[128];
+    snprintf(key, sizeof(key), "%s %ux%ux%u %u-bit %uspp%s",
+             info.modality.empty() ? "OT" : info.modality.c_str(),
+             info.width, info.height, info.numberOfFrames, info.bitsAllocated,
+             info.samplesPerPixel, jpeg ? " jpeg" : "");
+    return key;
+}
+
+static std::vector<Group> LoadCorpus(const std::string& dir, ThreadPool& pool) {
+    std::vector<std::string> paths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file()) paths.push_back(entry.path().string());
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::map<std::string, Group> groups;
+    for (const std::string& path : paths) {
+        try {
+            Instance instance;
+            instance.path = path;
+            instance.dicom = ReadFile(path);
+            DicomHandler handler(instance.dicom.data(), instance.dicom.size());
+            const std::string ts = handler.GetTransferSyntax();
+            DicomImageInfo info = handler.GetImageInfo();
+
+            if (IsJxlTransferSyntax(ts)) {
+                TranscodeResult native = TranscodeFromJxl(handler, TS_LITTLE_ENDIAN_EXPLICIT, pool);
+                instance.dicom = std::move(native.dicom);
+            } else if (ts == TS_JPEG_BASELINE) {
+                instance.jpeg = true;
+            } else if (!IsUncompressedTransferSyntax(ts)) {
+                printf("skip %s (transfer syntax %s)\n", path.c_str(), ts.c_str());
+                continue;
+            }
+            instance.nativeBytes = info.FrameSizeBytes() * info.numberOfFrames;
+
+            Group& group = groups[GroupKey(info, instance.jpeg)];
+            group.key = GroupKey(info, instance.jpeg);
+            group.instances.push_back(std::move(instance));
+        } catch (const std::exception& e) {
+            printf("skip %s (%s)\n", path.c_str(), e.what());
+        }
+    }
+
+    std::vector<Group> out;
+    for (auto& entry : groups) out.push_back(std::move(entry.second));
+    return out;
+}
+
+// ============================================================================
+// Measurement
+// ============================================================================
+
+struct Strategy {
+    const char* name;
+    int singleFrameThreads;          // for TranscodeToJxl without a tracker
+    std::unique_ptr<LoadTracker> load;
+};
+
+// Latency samples of one (group, strategy, operation).
+struct Samples {
+    std::vector<double> ms;
+    double nativeBytes = 0;    // uncompressed pixels, for MB/s
+    double sourceBytes = 0;    // what was compressed (pixels, or the JPEG)
+    double encodedBytes = 0;
+    StageBreakdown stages;     // summed over calls (to_jxl / from_jxl only)
+    size_t calls = 0;
+
+    double Percentile(double q) const {
+        if (ms.empty()) return 0.0;
+        std::vector<double> sorted = ms;
+        std::sort(sorted.begin(), sorted.end());
+        const size_t i = std::min(sorted.size() - 1,
+                                  static_cast<size_t>(q * (sorted.size() - 1) + 0.5));
+        return sorted[i];
+    }
+    double TotalMs() const {
+        double total = 0;
+        for (double v : ms) total += v;
+        return total;
+    }
+};
+
+// Encoded frames of one instance, for the per-frame decode.
+static std::vector<std::vector<uint8_t>> EncodedFrames(const std::vector<uint8_t>& dicom) {
+    DicomHandler handler(dicom.data(), dicom.size());
+    std::vector<std::vector<uint8_t>> frames(handler.GetEncapsulatedFrameCount());
+    for (uint32_t f = 0; f < frames.size(); ++f) {
+        frames[f] = handler.GetEncapsulatedData(f);
+    }
+    return frames;
+}
+
+static DicomHandler ParseTimed(const std::vector<uint8_t>& dicom, StageBreakdown& stages) {
+    StageSpan span(stages, Stage::Parse);
+    return DicomHandler(dicom.data(), dicom.size());
+}
+
+// One timed pass over an instance in `strategy`; `record` false warms up.
+static void RunInstance(const Instance& instance, const PluginConfig& config, ThreadPool& pool,
+                        Strategy& strategy, std::map<std::string, Samples>& ops, bool record) {
+    LoadTracker* load = strategy.load.get();
+
+    auto t0 = Clock::now();
+    TranscodeResult encoded;
+    {
+        StageBreakdown parse;
+        DicomHandler handler = ParseTimed(instance.dicom, parse);
+        encoded = instance.jpeg
+            ? RecompressJpegToJxl(handler, config, pool, nullptr, load)
+            : TranscodeToJxl(handler, config, pool, strategy.singleFrameThreads, nullptr, load);
+        encoded.stages.Add(parse);
+    }
+    const double encodeMs = MsSince(t0);
+
+    t0 = Clock::now();
+    TranscodeResult decoded;
+    {
+        StageBreakdown parse;
+        DicomHandler handler = ParseTimed(encoded.dicom, parse);
+        decoded = instance.jpeg
+            ? ReconstructJpegFromJxl(handler, pool)
+            : TranscodeFromJxl(handler, TS_LITTLE_ENDIAN_EXPLICIT, pool, nullptr, load);
+        decoded.stages.Add(parse);
+    }
+    decoded.dicom.clear();
+    const double decodeMs = MsSince(t0);
+
+    // Viewer-style decode: one frame at a time into a reused buffer.
+    std::vector<double> frameMs;
+    std::vector<uint8_t> pixels;
+    for (const auto& frame : EncodedFrames(encoded.dicom)) {
+        std::optional<LoadTracker::Scope> scope;
+        if (load) scope.emplace(*load, 1);
+        const int threads = scope ? scope->FrameThreads(JxlCodec::kDefaultThreads)
+                                  : strategy.singleFrameThreads;
+        t0 = Clock::now();
+        JxlCodec::DecodeInto(frame.data(), frame.size(),
+            [&](const ImageInfo& info, PixelFormat format) {
+                const size_t rowBytes = static_cast<size_t>(info.width) *
+                                        JxlCodec::BytesPerPixel(format);
+                pixels.resize(rowBytes * info.height);
+                return DecodeTarget{pixels.data(), rowBytes};
+            },
+            threads);
+        frameMs.push_back(MsSince(t0));
+    }
+
+    if (!record) return;
+    auto add = [&](const char* op, const double* ms, size_t count,
+                   const TranscodeResult* call) {
+        Samples& s = ops[op];
+        s.ms.insert(s.ms.end(), ms, ms + count);
+        s.nativeBytes += instance.nativeBytes;
+        s.sourceBytes += encoded.nativeBytes;
+        s.encodedBytes += encoded.encodedBytes;
+        if (call) {
+            s.stages.Add(call->stages);
+            ++s.calls;
+        }
+    };
+    add("to_jxl", &encodeMs, 1, &encoded);
+    add("from_jxl", &decodeMs, 1, &decoded);
+    add("frame_decode", frameMs.data(), frameMs.size(), nullptr);
+}
+
+static nlohmann::json Record(const std::string& group, const char* strategy,
+                             const std::string& op, const Samples& s, double peakRssMb) {
+    const double totalMs = s.TotalMs();
+    nlohmann::json record = {
+        {"group", group},
+        {"strategy", strategy},
+        {"op", op},
+        {"samples", s.ms.size()},
+        {"p50_ms", s.Percentile(0.50)},
+        {"p95_ms", s.Percentile(0.95)},
+        {"p99_ms", s.Percentile(0.99)},
+        {"mb_per_s", totalMs > 0 ? (s.nativeBytes / (1024.0 * 1024.0)) / (totalMs / 1000.0) : 0.0},
+        {"ratio", s.encodedBytes > 0 ? s.sourceBytes / s.encodedBytes : 0.0},
+        {"peak_rss_mb", peakRssMb},
+    };
+    if (s.calls > 0) {
+        nlohmann::json stages;
+        for (size_t i = 0; i < s.stages.stages.size(); ++i) {
+            const StageTime& t = s.stages.stages[i];
+            stages[StageName(static_cast<Stage>(i))] = {
+                {"wall_ms", t.wallMs / s.calls},
+                {"cpu_ms", t.cpuMs / s.calls},
+            };
+        }
+        record["stages"] = std::move(stages);
+    }
+    return record;
+}
+
+// ============================================================================
+// Regression gating
+// ============================================================================
+
+// Flag every record of `current` that is worse than its `baseline` match by
+// more than `tolerance` (relative). Compression ratio is deterministic for a
+// given libjxl, so it allows only a 0.5% drop. Returns the regression count.
+static int Compare(const nlohmann::json& current, const nlohmann::json& baseline,
+                   double tolerance) {
+    std::map<std::string, const nlohmann::json*> base;
+    for (const auto& r : baseline["results"]) {
+        base[r["group"].get<std::string>() + "|" + r["strategy"].get<std::string>() + "|" +
+             r["op"].get<std::string>()] = &r;
+    }
+
+    printf("\n%-44s %-9s %-13s %-12s %10s %10s %8s\n",
+           "Group", "Strategy", "Op", "Metric", "Baseline", "Current", "Change");
+    int regressions = 0;
+    int compared = 0;
+    for (const auto& r : current["results"]) {
+        const std::string key = r["group"].get<std::string>() + "|" +
+                                r["strategy"].get<std::string>() + "|" + r["op"].get<std::string>();
+        auto match = base.find(key);
+        if (match == base.end()) continue;
+        ++compared;
+        const nlohmann::json& b = *match->second;
+
+        struct Check { const char* metric; bool higherIsBetter; double tolerance; };
+        const Check checks[] = {
+            {"p50_ms", false, tolerance},
+            {"p95_ms", false, tolerance},
+            {"mb_per_s", true, tolerance},
+            {"ratio", true, 0.005},
+            {"peak_rss_mb", false, tolerance},
+        };
+        for (const Check& c : checks) {
+            const double was = b.value(c.metric, 0.0);
+            const double now = r.value(c.metric, 0.0);
+            if (was <= 0) continue;
+            const double change = (now - was) / was;
+            const bool worse = c.higherIsBetter ? change < -c.tolerance : change > c.tolerance;
+            if (worse) {
+                ++regressions;
+                printf("%-44s %-9s %-13s %-12s %10.2f %10.2f %+7.1f%%  REGRESSION\n",
+                       r["group"].get<std::string>().c_str(),
+                       r["strategy"].get<std::string>().c_str(),
+                       r["op"].get<std::string>().c_str(), c.metric, was, now, 100.0 * change);
+            }
+        }
+    }
+    printf("%d record%s compared, %d regression%s (tolerance %.0f%%)\n",
+           compared, compared == 1 ? "" : "s", regressions, regressions == 1 ? "" : "s",
+           100.0 * tolerance);
+    return regressions;
+}
+
+static nlohmann::json ReadJson(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) throw std::runtime_error("Failed to open: " + path);
+    return nlohmann::json::parse(file);
+}
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static int Usage(const char* argv0) {
+    fprintf(stderr,
+            "Usage: %s <corpus_dir> [--iterations N] [--json out.json]\n"
+            "          [--baseline baseline.json] [--tolerance 0.10] [--trace trace.json]\n"
+            "       %s --compare current.json baseline.json [--tolerance 0.10]\n",
+            argv0, argv0);
+    return 2;
+}
+
+int main(int argc, char* argv[]) {
+    std::string corpus, jsonPath, baselinePath, comparePath, tracePath;
+    int iterations = 5;
+    double tolerance = 0.10;
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!std::strcmp(argv[i], "--iterations") && hasValue) {
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if (!std::strcmp(argv[i], "--json") && hasValue) {
+            jsonPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--trace") && hasValue) {
+            tracePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--baseline") && hasValue) {
+            baselinePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--tolerance") && hasValue) {
+            tolerance = std::atof(argv[++i]);
+        } else if (!std::strcmp(argv[i], "--compare") && i + 2 < argc) {
+            comparePath = argv[++i];
+            baselinePath = argv[++i];
+        } else if (argv[i][0] != '-' && corpus.empty()) {
+            corpus = argv[i];
+        } else {
+            return Usage(argv[0]);
+        }
+    }
+
+    try {
+        if (!comparePath.empty()) {
+            return Compare(ReadJson(comparePath), ReadJson(baselinePath), tolerance) ? 1 : 0;
+        }
+        if (corpus.empty()) {
+            return Usage(argv[0]);
+        }
+
+        const unsigned hw = std::thread::hardware_concurrency();
+        ThreadPool pool(hw == 0 ? 1u : hw);
+        JxlCodec::SetSharedPool(&pool);  // as the plugin does
+        PluginConfig config = PluginConfig::Default();
+        BufferPool buffers(config.bufferPoolBytes);
+        BufferPool::SetShared(&buffers);
+        std::unique_ptr<TraceRecorder> trace;
+        if (!tracePath.empty()) {
+            trace = std::make_unique<TraceRecorder>(size_t{1} << 20);
+            TraceRecorder::SetShared(trace.get());
+        }
+
+        std::vector<Group> groups = LoadCorpus(corpus, pool);
+        if (groups.empty()) {
+            fprintf(stderr, "No usable DICOM instances under %s\n", corpus.c_str());
+            return 2;
+        }
+
+        // A one-thread tracker budget pins every frame to a single thread.
+        Strategy strategies[] = {
+            {"default", JxlCodec::kDefaultThreads, nullptr},
+            {"single", JxlCodec::kSingleThreaded, std::make_unique<LoadTracker>(1, true)},
+            {"adaptive", JxlCodec::kDefaultThreads,
+             std::make_unique<LoadTracker>(pool.Size() + 1, true)},
+        };
+
+        nlohmann::json doc;
+        doc["hardware_threads"] = hw;
+        doc["iterations"] = iterations;
+        doc["libjxl"] = std::to_string(JPEGXL_MAJOR_VERSION) + "." +
+                        std::to_string(JPEGXL_MINOR_VERSION) + "." +
+                        std::to_string(JPEGXL_PATCH_VERSION);
+        doc["results"] = nlohmann::json::array();
+
+        printf("%-44s %-9s %-13s %6s %9s %9s %9s %9s %7s %9s\n",
+               "Group", "Strategy", "Op", "N", "p50 ms", "p95 ms", "p99 ms", "MB/s",
+               "Ratio", "Peak MB");
+        for (const Group& group : groups) {
+            for (Strategy& strategy : strategies) {
+                ResetPeakRss();
+                std::map<std::string, Samples> ops;
+                for (const Instance& instance : group.instances) {
+                    RunInstance(instance, config, pool, strategy, ops, false);
+                    for (int it = 0; it < iterations; ++it) {
+                        RunInstance(instance, config, pool, strategy, ops, true);
+                    }
+                }
+                const double peak = PeakRssMb();
+                for (const auto& op : ops) {
+                    nlohmann::json r = Record(group.key, strategy.name, op.first, op.second, peak);
+                    printf("%-44s %-9s %-13s %6zu %9.2f %9.2f %9.2f %9.1f %6.2fx %9.1f\n",
+                           group.key.c_str(), strategy.name, op.first.c_str(),
+                           op.second.ms.size(), r["p50_ms"].get<double>(),
+                           r["p95_ms"].get<double>(), r["p99_ms"].get<double>(),
+                           r["mb_per_s"].get<double>(), r["ratio"].get<double>(), peak);
+                    doc["results"].push_back(std::move(r));
+                }
+            }
+        }
+
+        if (!jsonPath.empty()) {
+            std::ofstream out(jsonPath);
+            out << doc.dump(2) << "\n";
+            printf("\nResults written to %s\n", jsonPath.c_str());
+        }
+        if (trace) {
+            TraceRecorder::SetShared(nullptr);
+            std::ofstream out(tracePath);
+            out << trace->ToJson() << "\n";
+            printf("Trace (%zu spans) written to %s\n", trace->Size(), tracePath.c_str());
+        }
+        JxlCodec::SetSharedPool(nullptr);
+        BufferPool::SetShared(nullptr);
+        if (!baselinePath.empty()) {
+            return Compare(doc, ReadJson(baselinePath), tolerance) ? 1 : 0;
+        }
+        return 0;
+
+    } catch (const std::exception& e) {
+        fprintf(stderr, "ERROR: %s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,172 @@
+/*
+ * Microbenchmark for ThreadPool / ParallelFor.
+ *
+ * Runs the same loops on the work-stealing pool and on a replica of the
+ * previous design (one mutex-guarded std::queue<std::function>, one
+ * heap-allocated closure per index, caller asleep on a condition variable),
+ * across a sweep of pool sizes. Three workloads:
+ *
+ *   tiny   - many near-empty items (cine frames / WSI tiles bookkeeping),
+ *            where the lock and allocations dominate;
+ *   frames - a few hundred ~50 us items, roughly a small-frame decode;
+ *   nested - an outer ParallelFor whose body runs an inner one from the pool
+ *            worker (the old design deadlocks here, so it is not run on it).
+ *
+ * Usage: pool_bench [items]
+ */
+
+#include "../src/thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+using namespace orthanc_jxl;
+
+namespace {
+
+// The previous ThreadPool + ParallelFor, kept for comparison.
+class LegacyPool {
+public:
+    explicit LegacyPool(size_t numThreads) {
+        for (size_t i = 0; i < numThreads; ++i) {
+            workers_.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ~LegacyPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& w : workers_) {
+            w.join();
+        }
+    }
+
+    size_t Size() const { return workers_.size(); }
+
+    void Enqueue(std::function<void()> task) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            tasks_.push(std::move(task));
+        }
+        cv_.notify_one();
+    }
+
+private:
+    void WorkerLoop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+                if (stop_ && tasks_.empty()) {
+                    return;
+                }
+                task = std::move(tasks_.front());
+                tasks_.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
+
+template <typename Fn>
+void LegacyParallelFor(LegacyPool& pool, size_t n, Fn&& fn) {
+    std::mutex m;
+    std::condition_variable done;
+    size_t remaining = n;
+    for (size_t i = 0; i < n; ++i) {
+        pool.Enqueue([&, i] {
+            fn(i);
+            std::lock_guard<std::mutex> lock(m);
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        });
+    }
+    std::unique_lock<std::mutex> lock(m);
+    done.wait(lock, [&] { return remaining == 0; });
+}
+
+// Busy work the optimizer cannot remove.
+inline void Spin(unsigned iterations, std::atomic<uint64_t>& sink) {
+    uint64_t x = iterations;
+    for (unsigned k = 0; k < iterations; ++k) {
+        x = x * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    sink.fetch_add(x & 1, std::memory_order_relaxed);
+}
+
+template <typename Body>
+double TimeMs(int reps, Body&& body) {
+    auto t0 = std::chrono::steady_clock::now();
+    for (int r = 0; r < reps; ++r) {
+        body();
+    }
+    auto t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(t1 - t0).count() / reps;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    const size_t items = (argc >= 2) ? static_cast<size_t>(std::atoll(argv[1])) : 100000;
+    const size_t frames = 512;
+    const unsigned hw = std::thread::hardware_concurrency();
+
+    std::vector<unsigned> sweep = {1, 2, 4};
+    if (hw > 4) sweep.push_back(hw);
+
+    std::atomic<uint64_t> sink{0};
+    printf("tiny=%zu items, frames=%zu x ~50us, hw_threads=%u\n\n", items, frames, hw);
+    printf("%-8s %-8s %14s %14s %10s\n", "Threads", "Load", "Legacy (ms)", "Stealing (ms)", "Speed-up");
+
+    for (unsigned threads : sweep) {
+        LegacyPool legacy(threads);
+        ThreadPool pool(threads);
+
+        double legacyTiny = TimeMs(3, [&] {
+            LegacyParallelFor(legacy, items, [&](size_t) { Spin(16, sink); });
+        });
+        double poolTiny = TimeMs(3, [&] {
+            ParallelFor(pool, items, [&](size_t) { Spin(16, sink); });
+        });
+        printf("%-8u %-8s %14.2f %14.2f %9.1fx\n", threads, "tiny",
+               legacyTiny, poolTiny, legacyTiny / poolTiny);
+
+        double legacyFrames = TimeMs(3, [&] {
+            LegacyParallelFor(legacy, frames, [&](size_t) { Spin(100000, sink); });
+        });
+        double poolFrames = TimeMs(3, [&] {
+            ParallelFor(pool, frames, [&](size_t) { Spin(100000, sink); });
+        });
+        printf("%-8u %-8s %14.2f %14.2f %9.1fx\n", threads, "frames",
+               legacyFrames, poolFrames, legacyFrames / poolFrames);
+
+        double poolNested = TimeMs(3, [&] {
+            ParallelFor(pool, 64, [&](size_t) {
+                ParallelFor(pool, frames / 8, [&](size_t) { Spin(100000, sink); });
+            });
+        });
+        printf("%-8u %-8s %14s %14.2f %10s\n", threads, "nested", "deadlocks", poolNested, "-");
+    }
+
+    printf("\n(checksum %llu)\n", static_cast<unsigned long long>(sink.load()));
+    return 0;
+}
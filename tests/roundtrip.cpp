@@ -5,20 +5,54 @@
  * exact production transcode path (native -> JXL -> native) and verifies the
  * recovered pixel data is byte-identical to the input (after the planar ->
  * interleaved normalisation the encoder performs). It also checks the frame
- * count survives the roundtrip.
+ * count survives the roundtrip, that the File Meta sniffer agrees with DCMTK
+ * about every transfer syntax it reports, and that the raw-buffer fragment
+ * index points at exactly the bytes DCMTK returns for each frame, and that
+ * fragments group into frames through the Basic / Extended Offset Tables.
+ *
+ * Every pixel input is also encoded once more through the streaming (chunked)
+ * encoder to check it is just as lossless.
+ *
+ * JPEG Baseline (.50) inputs instead take the JPEG recompression path
+ * (.50 -> .111 -> .50) and must come back with identical JPEG fragments.
  *
  * Usage: roundtrip <dicom_file> [<dicom_file> ...]
  */
 
 #include "../src/transcode.h"
 #include "../src/dicom_handler.h"
+#include "../src/jxl_codec.h"
+#include "../src/dicom_scan.h"
 #include "../src/transfer_syntax.h"
 #include "../src/pixel_layout.h"
+#include "../src/preview.h"
+#include "../src/frame_cache.h"
+#include "../src/frame_prefetch.h"
+#include "../src/layout_kernels.h"
+#include "../src/metrics.h"
+#include "../src/trace.h"
+#include "../src/ingest_queue.h"
+#include "../src/batch_transcoder.h"
+#include "../src/transcoded_cache.h"
+#include "../src/staged_replacement.h"
+#include "../src/http_range.h"
+#include "../src/load_tracker.h"
+#include "../src/effort_policy.h"
 #include "../src/config.h"
 #include "../src/thread_pool.h"
+#include "../src/buffer_pool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <memory>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <thread>
 #include <vector>
@@ -59,15 +93,54 @@ static std::vector<uint8_t> ExpectedRecovered(const DicomImageInfo& info,
     return out;
 }
 
+// .50 -> .111 -> .50: every reconstructed JPEG fragment must match the
+// original bitstream byte for byte.
+static bool RunJpegOne(const char* path, const std::vector<uint8_t>& dicom, ThreadPool& pool) {
+    PluginConfig config = PluginConfig::Default();
+
+    DicomHandler source(dicom.data(), dicom.size());
+    const uint32_t frameCount = source.GetEncapsulatedFrameCount();
+    std::vector<std::vector<uint8_t>> origFrames(frameCount);
+    for (uint32_t f = 0; f < frameCount; ++f) {
+        origFrames[f] = source.GetEncapsulatedData(f);
+    }
+
+    TranscodeResult toJxl = RecompressJpegToJxl(source, config, pool);
+    DicomHandler jxlHandler(toJxl.dicom.data(), toJxl.dicom.size());
+    const bool tsOk = jxlHandler.GetTransferSyntax() == TS_JPEG_XL_JPEG_RECOMPRESSION;
+
+    TranscodeResult back = ReconstructJpegFromJxl(jxlHandler, pool);
+    DicomHandler jpegHandler(back.dicom.data(), back.dicom.size());
+    bool bytesOk = jpegHandler.GetTransferSyntax() == TS_JPEG_BASELINE &&
+                   jpegHandler.GetEncapsulatedFrameCount() == frameCount;
+    for (uint32_t f = 0; bytesOk && f < frameCount; ++f) {
+        bytesOk = jpegHandler.GetEncapsulatedData(f) == origFrames[f];
+    }
+
+    const bool pass = tsOk && bytesOk;
+    double ratio = toJxl.encodedBytes
+        ? static_cast<double>(toJxl.nativeBytes) / toJxl.encodedBytes : 0.0;
+    printf("%-40s JPEG f=%-3u recompression  %5.2fx  %s\n",
+           path, frameCount, ratio, pass ? "PASS" : "FAIL");
+    if (!tsOk)    printf("    -> recompressed instance is not .111\n");
+    if (!bytesOk) printf("    -> reconstructed JPEG differs from the original\n");
+    return pass;
+}
+
 static bool RunOne(const char* path, ThreadPool& pool) {
     auto dicom = ReadFile(path);
+    if (SniffTransferSyntax(dicom.data(), dicom.size()) == TS_JPEG_BASELINE) {
+        return RunJpegOne(path, dicom, pool);
+    }
 
     DicomImageInfo info;
     std::vector<uint8_t> origPixels;
+    std::string origTs;
     {
         DicomHandler handler(dicom.data(), dicom.size());
         info = handler.GetImageInfo();
         origPixels = handler.GetPixelData();
+        origTs = handler.GetTransferSyntax();
     }
 
     PluginConfig config = PluginConfig::Default();  // ProgressiveLossless
@@ -78,10 +151,25 @@ static bool RunOne(const char* path, ThreadPool& pool) {
     // number of frames we started with.
     std::string jxlTs;
     uint32_t encFrames = 0;
+    bool indexOk = false;
     {
         DicomHandler jxlHandler(toJxl.dicom.data(), toJxl.dicom.size());
         jxlTs = jxlHandler.GetTransferSyntax();
         encFrames = jxlHandler.GetEncapsulatedFrameCount();
+
+        FileMetaInfo meta;
+        FragmentIndex index;
+        indexOk = SniffFileMeta(toJxl.dicom.data(), toJxl.dicom.size(), meta) &&
+                  IndexEncapsulatedFrames(toJxl.dicom.data(), toJxl.dicom.size(),
+                                          meta, index) &&
+                  index.frames.size() == encFrames &&
+                  index.info.isSigned == info.isSigned;
+        for (uint32_t f = 0; indexOk && f < encFrames; ++f) {
+            const ByteRange& r = index.frames[f];
+            const uint8_t* p = toJxl.dicom.data() + r.offset;
+            indexOk = std::vector<uint8_t>(p, p + r.length)
+                      == jxlHandler.GetEncapsulatedData(f);
+        }
     }
 
     TranscodeResult fromJxl = TranscodeFromJxl(
@@ -95,12 +183,20 @@ static bool RunOne(const char* path, ThreadPool& pool) {
 
     std::vector<uint8_t> expected = ExpectedRecovered(info, origPixels);
 
+    // The sniffer may decline input it cannot read (e.g. no Part 10 header),
+    // but must never disagree with DCMTK. Our own output always has a header.
+    const std::string origSniff = SniffTransferSyntax(dicom.data(), dicom.size());
+    bool sniffOk = (origSniff.empty() || origSniff == origTs) &&
+                   SniffTransferSyntax(toJxl.dicom.data(), toJxl.dicom.size()) == jxlTs &&
+                   SniffTransferSyntax(fromJxl.dicom.data(), fromJxl.dicom.size())
+                       == TS_LITTLE_ENDIAN_EXPLICIT;
+
     bool tsOk = IsJxlTransferSyntax(jxlTs);
     bool framesOk = (encFrames == info.numberOfFrames) &&
                     (fromJxl.frameCount == info.numberOfFrames);
     bool sizeOk = (rtPixels.size() == expected.size());
     bool bytesOk = sizeOk && (rtPixels == expected);
-    bool pass = tsOk && framesOk && bytesOk;
+    bool pass = tsOk && framesOk && bytesOk && sniffOk && indexOk;
 
     double ratio = toJxl.encodedBytes
         ? static_cast<double>(toJxl.nativeBytes) / toJxl.encodedBytes : 0.0;
@@ -113,6 +209,8 @@ static bool RunOne(const char* path, ThreadPool& pool) {
 
     if (!pass) {
         if (!tsOk)     printf("    -> bad transfer syntax: %s\n", jxlTs.c_str());
+        if (!sniffOk)  printf("    -> File Meta sniffer disagrees with DCMTK\n");
+        if (!indexOk)  printf("    -> fragment index disagrees with DCMTK\n");
         if (!framesOk) printf("    -> frame count mismatch: enc=%u from=%u expected=%u\n",
                               encFrames, fromJxl.frameCount, info.numberOfFrames);
         if (!sizeOk)   printf("    -> size mismatch: got %zu expected %zu\n",
@@ -139,6 +237,1157 @@ static bool VerifyLossyLabeling(const char* path, ThreadPool& pool) {
     return ok;
 }
 
+// Force the streaming (chunked) encoder on every frame and check the result
+// still decodes to the original pixels.
+static bool VerifyStreamingEncode(const char* path, ThreadPool& pool) {
+    auto dicom = ReadFile(path);
+    if (SniffTransferSyntax(dicom.data(), dicom.size()) == TS_JPEG_BASELINE) {
+        return true;  // JPEG inputs are recompressed, not pixel-encoded
+    }
+
+    DicomImageInfo info;
+    std::vector<uint8_t> origPixels;
+    {
+        DicomHandler handler(dicom.data(), dicom.size());
+        info = handler.GetImageInfo();
+        origPixels = handler.GetPixelData();
+    }
+
+    PluginConfig config = PluginConfig::Default();
+    config.streamingEncodePixels = 1;
+
+    TranscodeResult toJxl = TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+    TranscodeResult fromJxl = TranscodeFromJxl(
+        toJxl.dicom.data(), toJxl.dicom.size(), TS_LITTLE_ENDIAN_EXPLICIT, pool);
+    DicomHandler rtHandler(fromJxl.dicom.data(), fromJxl.dicom.size());
+    bool ok = rtHandler.GetPixelData() == ExpectedRecovered(info, origPixels);
+    printf("%-40s streaming encode -> %s\n", path, ok ? "PASS" : "FAIL (pixels differ)");
+    return ok;
+}
+
+// Encode with BitsStoredEncoding on and check the pixels still come back
+// exactly, reporting the size against the default full-depth encode.
+static bool VerifyBitsStoredEncoding(const char* path, ThreadPool& pool) {
+    auto dicom = ReadFile(path);
+    if (SniffTransferSyntax(dicom.data(), dicom.size()) == TS_JPEG_BASELINE) {
+        return true;
+    }
+
+    DicomImageInfo info;
+    std::vector<uint8_t> origPixels;
+    {
+        DicomHandler handler(dicom.data(), dicom.size());
+        info = handler.GetImageInfo();
+        origPixels = handler.GetPixelData();
+    }
+
+    PluginConfig config = PluginConfig::Default();
+    const TranscodeResult full = TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+    config.bitsStoredEncoding = true;
+    const TranscodeResult reduced = TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+    TranscodeResult fromJxl = TranscodeFromJxl(
+        reduced.dicom.data(), reduced.dicom.size(), TS_LITTLE_ENDIAN_EXPLICIT, pool);
+    DicomHandler rtHandler(fromJxl.dicom.data(), fromJxl.dicom.size());
+    const bool pixelsOk = rtHandler.GetPixelData() == ExpectedRecovered(info, origPixels);
+
+    // Each codestream must signal BitsStored itself, not just decode back to
+    // the same samples, unless the frame's samples do not fit it.
+    const int bytesPerSample = (info.bitsAllocated + 7) / 8;
+    const uint32_t containerBits = 8 * bytesPerSample;
+    const uint32_t reducedBits = JxlCodec::SupportsReducedBitDepth()
+        ? ReducedSampleDepth(containerBits, info.bitsStored, info.highBit) : 0;
+    const size_t frameSize = info.FrameSizeBytes();
+    DicomHandler reducedHandler(reduced.dicom.data(), reduced.dicom.size());
+    bool depthOk = reducedHandler.GetEncapsulatedFrameCount() == info.numberOfFrames;
+    for (uint32_t f = 0; depthOk && f < info.numberOfFrames; ++f) {
+        const bool fits = reducedBits &&
+            SamplesFitDepth(origPixels.data() + f * frameSize, frameSize / bytesPerSample,
+                            bytesPerSample, reducedBits, info.isSigned);
+        const ImageInfo decoded = JxlCodec::DecodeInfo(reducedHandler.GetEncapsulatedData(f));
+        depthOk = decoded.bitsPerSample == (fits ? reducedBits : containerBits);
+    }
+
+    const bool ok = pixelsOk && depthOk;
+    printf("%-40s bits-stored %u/%u%s: %zu -> %zu bytes -> %s\n", path,
+           info.bitsStored, info.bitsAllocated, info.isSigned ? " signed" : "",
+           full.encodedBytes, reduced.encodedBytes,
+           ok ? "PASS" : !pixelsOk ? "FAIL (pixels differ)" : "FAIL (codestream depth)");
+    return ok;
+}
+
+// Encode fast (effort 1, BitsStoredEncoding on), recompress at effort 7 and
+// check the instance still decodes to the original pixels and is no larger.
+static bool VerifyRecompressJxl(const char* path, ThreadPool& pool) {
+    auto dicom = ReadFile(path);
+    if (SniffTransferSyntax(dicom.data(), dicom.size()) == TS_JPEG_BASELINE) {
+        return true;
+    }
+
+    DicomImageInfo info;
+    std::vector<uint8_t> origPixels;
+    {
+        DicomHandler handler(dicom.data(), dicom.size());
+        info = handler.GetImageInfo();
+        origPixels = handler.GetPixelData();
+    }
+
+    PluginConfig config = PluginConfig::Default();
+    config.encodeOptions.effort = 1;
+    config.bitsStoredEncoding = true;
+    const TranscodeResult fast = TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+    DicomHandler handler(fast.dicom.data(), fast.dicom.size());
+    const TranscodeResult slow = RecompressJxl(handler, config, 7, pool);
+    TranscodeResult fromJxl = TranscodeFromJxl(
+        slow.dicom.data(), slow.dicom.size(), TS_LITTLE_ENDIAN_EXPLICIT, pool);
+    DicomHandler rtHandler(fromJxl.dicom.data(), fromJxl.dicom.size());
+    bool ok = rtHandler.GetPixelData() == ExpectedRecovered(info, origPixels) &&
+              slow.nativeBytes == fast.encodedBytes && slow.encodedBytes <= slow.nativeBytes;
+    printf("%-40s recompress e1 -> e7: %zu -> %zu bytes -> %s\n", path,
+           slow.nativeBytes, slow.encodedBytes, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Signed 12-bit samples through the codec directly: truncate to 12-bit two's
+// complement, encode at 12 bits, decode unscaled into padded rows (as into an
+// Orthanc image) and sign-extend from HighBit. What any decoder returns must
+// already be the DICOM stored values, and signed frames whose HighBit does
+// not sit below the container are left alone.
+static bool VerifySignedReducedDepth() {
+    if (!JxlCodec::SupportsReducedBitDepth()) {
+        printf("%-40s signed 12-bit -> SKIP (libjxl < 0.8)\n", "synthetic");
+        return true;
+    }
+    const uint32_t width = 67, height = 41;
+    std::vector<uint16_t> samples(static_cast<size_t>(width) * height);
+    for (size_t i = 0; i < samples.size(); ++i) {
+        samples[i] = static_cast<uint16_t>(static_cast<int16_t>(((i * 97) % 4096) - 2048));
+    }
+    const size_t bytes = samples.size() * sizeof(uint16_t);
+    const auto* raw = reinterpret_cast<const uint8_t*>(samples.data());
+    bool ok = SamplesFitDepth(raw, samples.size(), 2, 12, true);
+
+    std::vector<uint8_t> truncated(bytes);
+    TruncateSignedSamples(raw, samples.size(), 2, 12, truncated.data());
+    EncodeOptions opts = EncodeOptions::Lossless(3);
+    opts.bitsStored = 12;
+    auto jxl = JxlCodec::Encode(truncated.data(), width, height, PixelFormat::Gray16, opts);
+    const size_t rowBytes = width * sizeof(uint16_t);
+    const size_t stride = rowBytes + 6;
+    std::vector<uint8_t> decoded(stride * height);
+    const ImageInfo decodedInfo = JxlCodec::DecodeInto(jxl.data(), jxl.size(),
+        [&](const ImageInfo&, PixelFormat) { return DecodeTarget{decoded.data(), stride}; });
+    ok &= decodedInfo.bitsPerSample == 12;
+    for (uint32_t y = 0; ok && y < height; ++y) {
+        ok &= std::memcmp(decoded.data() + y * stride, truncated.data() + y * rowBytes,
+                          rowBytes) == 0;
+    }
+    if (ok) {
+        SignExtendFrame(decoded.data(), stride, height, width, 2, decodedInfo.bitsPerSample,
+                        11, true);
+        for (uint32_t y = 0; y < height; ++y) {
+            ok &= std::memcmp(decoded.data() + y * stride, raw + y * rowBytes, rowBytes) == 0;
+        }
+    }
+    ok &= SignExtensionBits(true, 12, 16, 11) == 12 && SignExtensionBits(true, 12, 16, 15) == 0 &&
+          SignExtensionBits(true, 16, 16, 11) == 0 && SignExtensionBits(false, 12, 16, 11) == 0;
+    printf("%-40s signed 12-bit -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Previews of a lossless frame must render exactly as previews of the source
+// pixels, and a progressive encode should stop short of the whole codestream.
+static bool VerifyPreview(const char* path, ThreadPool& pool) {
+    auto dicom = ReadFile(path);
+    if (SniffTransferSyntax(dicom.data(), dicom.size()) == TS_JPEG_BASELINE) {
+        return true;
+    }
+
+    DicomImageInfo info;
+    ProgressiveImage source;
+    {
+        DicomHandler handler(dicom.data(), dicom.size());
+        info = handler.GetImageInfo();
+        source.pixels = ExpectedRecovered(info, handler.GetPixelData());
+        source.pixels.resize(info.FrameSizeBytes());
+    }
+    source.info.width = info.width;
+    source.info.height = info.height;
+    source.info.bitsPerSample = info.bitsAllocated;
+    source.info.numChannels = info.samplesPerPixel;
+    source.info.isGrayscale = (info.samplesPerPixel == 1);
+
+    TranscodeResult r = TranscodeToJxl(dicom.data(), dicom.size(),
+                                       PluginConfig::Default(), pool);
+    DicomHandler jxlHandler(r.dicom.data(), r.dicom.size());
+    const ByteView jxl = jxlHandler.GetEncapsulatedView(0);
+
+    PreviewWindow window{info.windowCenter, info.windowWidth};
+    const ProgressiveImage full = JxlCodec::DecodeProgressive(jxl.data, jxl.size, 1);
+    bool ok = full.downsampling == 1 && full.bytesRead == jxl.size;
+    for (uint32_t scale : {1u, 8u}) {
+        ok &= RenderPreview(full, info, scale, window).pixels ==
+              RenderPreview(source, info, scale, window).pixels;
+    }
+
+    const PreviewImage thumb = DecodePreview(jxl.data, jxl.size, info, 8, window);
+    ok &= thumb.width == (info.width + 7) / 8 && thumb.height == (info.height + 7) / 8 &&
+          thumb.downsampling <= 8 && thumb.bytesRead <= jxl.size;
+    printf("%-40s preview 1:8 -> read %zu of %zu bytes at 1:%u detail  %s\n", path,
+           thumb.bytesRead, jxl.size, thumb.downsampling, ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Box filter, rescale and window on a known 2x2 block: mean 150 through
+// center 150 / width 201 lands mid-scale, and MONOCHROME1 inverts it.
+static bool VerifyPreviewWindowing() {
+    ProgressiveImage frame;
+    frame.info.width = 2;
+    frame.info.height = 2;
+    frame.info.bitsPerSample = 16;
+    frame.info.numChannels = 1;
+    frame.info.isGrayscale = true;
+    const uint16_t samples[4] = {0, 100, 200, 300};
+    frame.pixels.assign(reinterpret_cast<const uint8_t*>(samples),
+                        reinterpret_cast<const uint8_t*>(samples) + sizeof(samples));
+
+    DicomImageInfo info;
+    info.photometricInterpretation = "MONOCHROME2";
+    const PreviewWindow window{150.0, 201.0};
+    PreviewImage mean = RenderPreview(frame, info, 2, window);
+    PreviewImage exact = RenderPreview(frame, info, 1, window);
+    info.photometricInterpretation = "MONOCHROME1";
+    PreviewImage inverted = RenderPreview(frame, info, 2, window);
+    info.photometricInterpretation = "MONOCHROME2";
+    PreviewImage autoWindow = RenderPreview(frame, info, 1, PreviewWindow{});
+
+    bool ok = mean.width == 1 && mean.height == 1 && mean.pixels[0] == 128 &&
+              inverted.pixels[0] == 127 &&
+              exact.pixels == std::vector<uint8_t>({0, 64, 192, 255}) &&
+              autoWindow.pixels.front() == 0 && autoWindow.pixels.back() == 255;
+    printf("%-40s preview windowing -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Fragment-to-frame grouping through the offset tables, and without them.
+static bool VerifyFragmentGrouping() {
+    using Bounds = std::vector<uint32_t>;
+    const std::vector<uint64_t> lengths = {100, 50, 200, 30};
+    const std::vector<bool> starts = {true, false, true, false};
+    const std::vector<bool> none(lengths.size(), false);
+
+    const bool ok =
+        // Basic Offset Table: frame 1 starts after two 8-byte item headers.
+        GroupFragmentsIntoFrames(lengths, {0, 166}, none, 2) == Bounds({0, 2, 4}) &&
+        // No table: frames start at a bitstream signature.
+        GroupFragmentsIntoFrames(lengths, {}, starts, 2) == Bounds({0, 2, 4}) &&
+        // A table that misses an item boundary falls back to signatures.
+        GroupFragmentsIntoFrames(lengths, {0, 7}, starts, 2) == Bounds({0, 2, 4}) &&
+        GroupFragmentsIntoFrames(lengths, {0, 7}, none, 2).empty() &&
+        GroupFragmentsIntoFrames(lengths, {}, none, 1) == Bounds({0, 4}) &&
+        GroupFragmentsIntoFrames(lengths, {}, none, 4) == Bounds({0, 1, 2, 3, 4}) &&
+        // Extended Offset Table offsets past 4 GiB.
+        GroupFragmentsIntoFrames({uint64_t{1} << 32, 10, 10}, {0, (uint64_t{1} << 32) + 8},
+                                 {false, false, false}, 2) == Bounds({0, 1, 3});
+    printf("%-40s fragment grouping -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Histogram buckets tile the value range, and percentiles of a uniform
+// 1..1000 us spread land within a bucket's width of the truth.
+static bool VerifyLatencyHistogram() {
+    bool ok = true;
+    for (size_t b = 0; b + 1 < HistogramSnapshot::kBuckets; ++b) {
+        ok &= HistogramSnapshot::BucketLow(b) < HistogramSnapshot::BucketLow(b + 1) &&
+              HistogramSnapshot::BucketOf(HistogramSnapshot::BucketLow(b)) == b &&
+              HistogramSnapshot::BucketOf(HistogramSnapshot::BucketLow(b + 1) - 1) == b;
+    }
+    LatencyHistogram histogram;
+    for (uint64_t us = 1; us <= 1000; ++us) {
+        histogram.Record(us);
+    }
+    const HistogramSnapshot h = histogram.Snapshot();
+    const double p50 = h.Percentile(0.50);
+    const double p99 = h.Percentile(0.99);
+    ok &= h.count == 1000 && h.sumMicros == 500500 &&
+          p50 > 400 && p50 < 625 && p99 > 800 && p99 <= 1024;
+    printf("%-40s latency histogram -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Stage spans accumulate into their breakdown and the stage histograms, and
+// the trace ring keeps the most recent spans once full.
+static bool VerifyTraceRecorder() {
+    const uint64_t encodesBefore = Metrics().StageSnapshot(Stage::Encode).count;
+    const uint64_t decodesBefore = Metrics().StageSnapshot(Stage::Decode).count;
+    TraceRecorder recorder(4);
+    TraceRecorder::SetShared(&recorder);
+    StageBreakdown stages;
+    for (int64_t f = 0; f < 6; ++f) {
+        StageSpan span(stages, Stage::Encode, f);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    {
+        StageSpan unattributed(Stage::Decode);
+    }
+    TraceRecorder::SetShared(nullptr);
+    const std::string json = recorder.ToJson();
+    bool ok = recorder.Size() == 4 && recorder.Overwritten() == 3 &&
+              stages[Stage::Encode].wallMs >= 6.0 &&
+              stages[Stage::Parse].wallMs == 0.0 &&
+              stages[Stage::Decode].wallMs == 0.0 &&
+              Metrics().StageSnapshot(Stage::Encode).count == encodesBefore + 6 &&
+              Metrics().StageSnapshot(Stage::Decode).count == decodesBefore + 1 &&
+              json.find("\"frame\":3") != std::string::npos &&
+              json.find("\"frame\":2") == std::string::npos &&
+              stages.ToString().find("decode") == std::string::npos;
+    recorder.Clear();
+    ok &= recorder.Size() == 0;
+    printf("%-40s trace recorder -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// The ingest queue refuses entries past its capacity, persists pending ones
+// across a restart, runs a viewed study's entries first, retries failures
+// with backoff and journals completions (dropped failures included) so they
+// do not run again.
+static bool VerifyIngestQueue() {
+    const std::string journal = "roundtrip_ingest.journal";
+    std::remove(journal.c_str());
+    LoadTracker load(4, false);
+    bool ok = true;
+    {
+        IngestQueue::Options options;
+        options.journalPath = journal;
+        options.capacity = 4;
+        IngestQueue queue(load, options,
+                          [](const IngestQueue::Entry&) { return IngestQueue::Outcome::Skipped; });
+        for (const char* id : {"a", "b", "c", "d"}) {
+            ok &= queue.Push({id, std::strcmp(id, "c") == 0 ? "1.2.3" : "1.2.4"});
+        }
+        ok &= !queue.Push({"e", "1.2.4"}) && !queue.Push({"a", "1.2.4"}) &&
+              queue.GetStats().rejected == 1;
+    }   // never started: everything stays pending
+
+    // b always fails and is dropped after its third attempt; d fails once and
+    // converts on its retry. Retries go to the back of the queue.
+    std::vector<std::string> order;
+    {
+        IngestQueue::Options options;
+        options.journalPath = journal;
+        options.retryDelay = std::chrono::milliseconds(1);
+        IngestQueue queue(load, options, [&](const IngestQueue::Entry& entry) {
+            order.push_back(entry.instanceId);
+            if (entry.instanceId == "b" ||
+                (entry.instanceId == "d" && std::count(order.begin(), order.end(), "d") == 1)) {
+                throw std::runtime_error("unreadable");
+            }
+            return IngestQueue::Outcome::Converted;
+        });
+        queue.MarkStudyViewed("1.2.3");
+        ok &= queue.GetStats().restored == 4 && queue.GetStats().prioritised == 1;
+        queue.Start();
+        for (int i = 0; i < 1000 && queue.GetStats().converted + queue.GetStats().failed < 4; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        const IngestQueue::Stats stats = queue.GetStats();
+        ok &= stats.converted == 3 && stats.failed == 1 && stats.retried == 3 &&
+              stats.pending == 0 && stats.retrying == 0;
+    }
+    ok &= order == std::vector<std::string>{"c", "a", "b", "d", "b", "d", "b"};
+
+    // An entry waiting out its retry delay at shutdown is still journaled.
+    {
+        IngestQueue::Options options;
+        options.journalPath = journal;
+        options.retryDelay = std::chrono::hours(1);
+        IngestQueue queue(load, options, [](const IngestQueue::Entry&) -> IngestQueue::Outcome {
+            throw std::runtime_error("unreadable");
+        });
+        queue.Push({"f", ""});
+        queue.Start();
+        for (int i = 0; i < 1000 && queue.GetStats().retrying == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        ok &= queue.GetStats().retrying == 1 && queue.GetStats().failed == 0;
+    }
+    {
+        IngestQueue::Options options;
+        options.journalPath = journal;
+        IngestQueue queue(load, options, [](const IngestQueue::Entry&) {
+            return IngestQueue::Outcome::Skipped;
+        });
+        ok &= queue.GetStats().restored == 1;
+        queue.Start();
+        for (int i = 0; i < 1000 && queue.GetStats().skipped == 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    {
+        IngestQueue::Options options;
+        options.journalPath = journal;
+        IngestQueue queue(load, options,
+                          [](const IngestQueue::Entry&) { return IngestQueue::Outcome::Skipped; });
+        ok &= queue.GetStats().restored == 0;
+    }
+    std::remove(journal.c_str());
+    printf("%-40s ingest queue -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Recovery after a crash between storing a replacement and restoring its
+// extras: the store finds the replacement already there, and the staged
+// extras, parents included, are put back all the same before the staged
+// files go. A failed restore keeps them for the next start.
+static bool VerifyStagedRecovery() {
+    const std::string directory = "roundtrip_staged";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    InstanceExtras extras;
+    extras.metadata["Note"] = "kept";
+    extras.labels = {"teaching"};
+    extras.attachments["1024"] = std::string("\0\1report", 8);
+    extras.parents["/series/s1"].labels = {"reviewed"};
+    const std::string dicomPath = directory + "/abc.dcm";
+    {
+        std::ofstream(dicomPath, std::ios::binary) << "DICM";
+        const std::vector<uint8_t> cbor = extras.ToCbor();
+        std::ofstream(StagedExtrasPath(dicomPath), std::ios::binary)
+            .write(reinterpret_cast<const char*>(cbor.data()), cbor.size());
+    }
+
+    int stores = 0, warnings = 0;
+    std::vector<std::pair<std::string, InstanceExtras>> restored;
+    auto store = [&](const std::vector<uint8_t>& dicom) {
+        ++stores;   // "AlreadyStored": the replacement made it before the crash
+        if (std::string(dicom.begin(), dicom.end()) != "DICM") {
+            throw std::runtime_error("wrong staged copy");
+        }
+    };
+    auto warn = [&](const std::string&, const std::string&) { ++warnings; };
+
+    RecoverStagedReplacements(directory, store,
+        [](const std::string&, const InstanceExtras&) { throw std::runtime_error("offline"); },
+        warn);
+    bool ok = stores == 1 && warnings == 1 && std::filesystem::exists(dicomPath) &&
+              std::filesystem::exists(StagedExtrasPath(dicomPath));
+
+    RecoverStagedReplacements(directory, store,
+        [&](const std::string& id, const InstanceExtras& e) { restored.emplace_back(id, e); },
+        warn);
+    ok &= stores == 2 && warnings == 1 && restored.size() == 1 && restored[0].first == "abc";
+    if (ok) {
+        const InstanceExtras& e = restored[0].second;
+        ok &= e.metadata == extras.metadata && e.labels == extras.labels &&
+              e.attachments == extras.attachments && e.parents.size() == 1 &&
+              e.parents.at("/series/s1").labels == extras.parents["/series/s1"].labels;
+    }
+    ok &= std::filesystem::is_empty(directory);
+    std::filesystem::remove_all(directory);
+    printf("%-40s staged recovery -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// The buffer pool rounds requests up to quarter-octave classes, files a
+// released buffer under the largest class it can serve, leaves small buffers
+// and anything past its capacity to the allocator, and predicts the next
+// output size with headroom from a bounded set of keys.
+static bool VerifyBufferPool() {
+    const size_t kMin = BufferPool::kMinPooledBytes;
+    BufferPool pool(3 * 81920);
+    bool ok = pool.Acquire(100).capacity() >= kMin;
+
+    // 65537 and 70000 both round up to 5 * 2^14; 90000 to 6 * 2^14.
+    std::vector<uint8_t> a = pool.Acquire(kMin + 1);
+    ok &= a.capacity() >= 81920;
+    pool.Release(std::move(a));
+    ok &= pool.GetStats().buffers == 1 && pool.GetStats().bytes == 81920;
+    std::vector<uint8_t> b = pool.Acquire(70000);
+    ok &= b.capacity() >= 81920 && pool.GetStats().hits == 1 && pool.GetStats().buffers == 0;
+    std::vector<uint8_t> c = pool.Acquire(90000);
+    ok &= c.capacity() >= 98304 && pool.GetStats().misses == 3;
+
+    // A 90000-byte buffer only serves the 81920 class.
+    std::vector<uint8_t> odd;
+    odd.reserve(90000);
+    pool.Release(std::move(odd));
+    ok &= pool.GetStats().bytes == 81920;
+    ok &= pool.Acquire(81920).capacity() >= 81920 && pool.GetStats().hits == 2;
+
+    // Below kMinPooledBytes: freed, not pooled and not a drop.
+    std::vector<uint8_t> small;
+    small.reserve(kMin - 1);
+    pool.Release(std::move(small));
+    ok &= pool.GetStats().buffers == 0 && pool.GetStats().drops == 0;
+
+    // Full: the third 81920-class buffer fits, a 98304 one does not.
+    for (int i = 0; i < 3; ++i) {
+        std::vector<uint8_t> buffer;
+        buffer.reserve(81920);
+        pool.Release(std::move(buffer));
+    }
+    pool.Release(std::move(c));
+    ok &= pool.GetStats().buffers == 3 && pool.GetStats().bytes == 3 * 81920 &&
+          pool.GetStats().drops == 1;
+
+    BufferPool disabled(0);
+    std::vector<uint8_t> plain = disabled.Acquire(kMin);
+    disabled.Release(std::move(plain));
+    ok &= disabled.GetStats().buffers == 0 && disabled.GetStats().misses == 0;
+
+    // Predictions: 1/8 + 4 KiB over the last size; the map is cleared when a
+    // new key would take it past 4096 entries.
+    ok &= pool.PredictSize(1, 777) == 777;
+    pool.RecordSize(1, 80000);
+    ok &= pool.PredictSize(1, 777) == 80000 + 10000 + 4096;
+    for (uint64_t key = 2; key <= 4096; ++key) {
+        pool.RecordSize(key, 1000);
+    }
+    pool.RecordSize(1, 8000);   // known key: no clear
+    ok &= pool.PredictSize(4096, 0) == 1000 + 125 + 4096 && pool.PredictSize(1, 0) == 13096;
+    pool.RecordSize(5000, 1000);
+    ok &= pool.PredictSize(1, 777) == 777 && pool.PredictSize(4096, 777) == 777 &&
+          pool.PredictSize(5000, 0) == 1000 + 125 + 4096;
+    printf("%-40s buffer pool -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// The transcoded cache evicts least recently used results from memory, keeps
+// its disk tier across a restart, drops an instance's old result when its
+// content changes, and discards disk entries of other encode settings.
+static bool VerifyTranscodedCache() {
+    const std::string directory = "roundtrip_transcoded_cache";
+    std::filesystem::remove_all(directory);
+    const std::vector<uint8_t> source(3000, 7), result(1000, 9);
+    auto keyFor = [](const char* uid, const std::vector<uint8_t>& data) {
+        FileMetaInfo meta;
+        meta.sopInstanceUid = uid;
+        return TranscodedCache::MakeKey(meta, data.data(), data.size());
+    };
+    std::vector<uint8_t> changed = source;
+    changed[1500] ^= 1;
+    const std::string a = keyFor("1.2.1", source), b = keyFor("1.2.2", source),
+                      c = keyFor("1.2.3", source), a2 = keyFor("1.2.1", changed);
+
+    TranscodedCache::Options options;
+    options.memoryBytes = 2500;   // two results
+    options.diskBytes = 100000;
+    options.directory = directory;
+    options.fingerprint = "effort=7";
+    bool ok = a != a2 && keyFor("", source).empty();
+    {
+        TranscodedCache cache(options);
+        cache.Insert(a, result.data(), result.size());
+        cache.Insert(b, result.data(), result.size());
+        ok &= cache.Find(a) != nullptr;       // b becomes least recently used
+        cache.Insert(c, result.data(), result.size());
+        const TranscodedCache::Stats stats = cache.GetStats();
+        ok &= stats.entries == 2 && stats.evictions == 1 && stats.diskEntries == 3;
+        TranscodedCache::Result fromDisk = cache.Find(b);
+        ok &= fromDisk && *fromDisk == result && cache.GetStats().diskHits == 1;
+        cache.Insert(a2, result.data(), result.size());
+        ok &= !cache.Find(a) && cache.GetStats().invalidations == 1 &&
+              cache.GetStats().diskEntries == 3;
+    }
+    {
+        TranscodedCache cache(options);
+        ok &= cache.GetStats().diskEntries == 3 && cache.Find(a2) && !cache.Find(a);
+    }
+    // A damaged payload misses and its file is deleted; a truncated file is
+    // deleted on open. b and c are only on disk by now.
+    auto pathOf = [&](const std::string& key) {
+        for (const auto& file : std::filesystem::directory_iterator(directory)) {
+            std::ifstream in(file.path(), std::ios::binary);
+            std::string magic, stored;
+            std::getline(in, magic);
+            std::getline(in, stored);
+            if (stored == key) {
+                return file.path().string();
+            }
+        }
+        return std::string();
+    };
+    const std::string pathB = pathOf(b), pathC = pathOf(c);
+    ok &= !pathB.empty() && !pathC.empty();
+    {
+        std::fstream damaged(pathB, std::ios::binary | std::ios::in | std::ios::out);
+        damaged.seekp(-10, std::ios::end);
+        damaged.put('\x42');
+    }
+    std::filesystem::resize_file(pathC, std::filesystem::file_size(pathC) - 1);
+    {
+        TranscodedCache cache(options);
+        ok &= cache.GetStats().diskEntries == 2 && !cache.Find(b) && !cache.Find(c) &&
+              cache.GetStats().diskEntries == 1 && cache.Find(a2);
+    }
+    ok &= !std::filesystem::exists(pathB) && !std::filesystem::exists(pathC);
+    options.fingerprint = "effort=9";
+    {
+        TranscodedCache cache(options);
+        ok &= cache.GetStats().diskEntries == 0 && !cache.Find(a2);
+    }
+    std::filesystem::remove_all(directory);
+    printf("%-40s transcoded cache -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Range headers of the raw frame route: closed, open and suffix ranges,
+// clamping, and the cases answered in full or with 416.
+static bool VerifyRangeHeader() {
+    struct Case {
+        const char* header;
+        RangeRequest kind;
+        size_t offset, length;
+    };
+    const Case cases[] = {
+        {"bytes=0-99", RangeRequest::Partial, 0, 100},
+        {"bytes=900-", RangeRequest::Partial, 900, 100},
+        {"bytes=-300", RangeRequest::Partial, 700, 300},
+        {"bytes=-5000", RangeRequest::Partial, 0, 1000},
+        {"bytes=990-2000", RangeRequest::Partial, 990, 10},
+        {"bytes=1000-", RangeRequest::Unsatisfiable, 0, 0},
+        {"bytes=-0", RangeRequest::Unsatisfiable, 0, 0},
+        {"bytes=5-2", RangeRequest::Full, 0, 0},
+        {"bytes=0-1,5-9", RangeRequest::Full, 0, 0},
+        {"items=0-1", RangeRequest::Full, 0, 0},
+        {"bytes=x-", RangeRequest::Full, 0, 0},
+    };
+    bool ok = true;
+    for (const Case& c : cases) {
+        ByteRange range;
+        const RangeRequest kind = ParseRangeHeader(c.header, 1000, range);
+        ok &= kind == c.kind && (kind != RangeRequest::Partial ||
+                                 (range.offset == c.offset && range.length == c.length));
+    }
+    printf("%-40s range header -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// With a window smaller than the item count, the ordered pipeline appends
+// every item in order, never has more than `window` results produced or in
+// production ahead of the next append, and stops on the first exception and
+// rethrows it.
+static bool VerifyOrderedPipeline() {
+    ThreadPool pool(4);
+    constexpr size_t kCount = 40, kWindow = 3;
+    std::vector<size_t> appended;
+    std::atomic<size_t> alive{0}, maxAlive{0};
+    std::atomic<bool> aheadOfWindow{false};
+    std::atomic<size_t> appendedCount{0};
+    auto produce = [&](size_t i) {
+        const size_t now = ++alive;
+        size_t seen = maxAlive.load();
+        while (now > seen && !maxAlive.compare_exchange_weak(seen, now)) {
+        }
+        if (i >= appendedCount.load() + kWindow) {
+            aheadOfWindow = true;
+        }
+        // Later items of each group of three finish first.
+        std::this_thread::sleep_for(std::chrono::milliseconds(3 - i % 3));
+        return i * 10;
+    };
+    auto append = [&](size_t i, size_t& result) {
+        appended.push_back(result == i * 10 ? i : kCount);
+        --alive;
+        ++appendedCount;
+    };
+    OrderedPipeline<size_t>(pool, kCount, kWindow, produce, append);
+    std::vector<size_t> expected(kCount);
+    for (size_t i = 0; i < kCount; ++i) {
+        expected[i] = i;
+    }
+    bool ok = appended == expected && maxAlive.load() <= kWindow && maxAlive.load() > 1 &&
+              !aheadOfWindow.load();
+
+    appended.clear();
+    std::atomic<size_t> produced{0};
+    bool threw = false;
+    try {
+        OrderedPipeline<size_t>(pool, kCount, kWindow,
+            [&](size_t i) -> size_t {
+                ++produced;
+                if (i == 7) {
+                    throw std::runtime_error("bad item");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                return i;
+            },
+            [&](size_t i, size_t&) { appended.push_back(i); });
+    } catch (const std::runtime_error& e) {
+        threw = std::string(e.what()) == "bad item";
+    }
+    // Nothing at or past the failed item is appended, the items before it
+    // are appended in order, and the window stops the rest from starting.
+    ok &= threw && produced.load() < kCount && appended.size() <= 7;
+    for (size_t i = 0; i < appended.size(); ++i) {
+        ok &= appended[i] == i;
+    }
+    printf("%-40s ordered pipeline -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// A batch converts every instance exactly once through the shared pipeline,
+// starts no more than a window of instances ahead of the reader without
+// parking pool workers while it waits for the reader, keeps the rest
+// flowing past a slow instance, reports any exception as a failed instance
+// and carries on, and resumes after a pause with only the instances it had
+// not started.
+static bool VerifyBatchTranscoder() {
+    ThreadPool pool(4);
+    std::vector<std::string> ids;
+    for (int i = 0; i < 200; ++i) {
+        ids.push_back(std::to_string(i));
+    }
+    std::atomic<int> runs{0};
+    std::promise<void> release;
+    const std::shared_future<void> released = release.get_future().share();
+    std::atomic<bool> slowReleased{false};
+    BatchTranscoder batch(pool, ids, [&](BatchTranscoder::Item& item) {
+        ++runs;
+        if (item.id == "13") {
+            throw std::runtime_error("unreadable");
+        }
+        if (item.id == "21") {
+            throw 21;
+        }
+        if (item.id == "100") {
+            // Released only once the others have moved well past it.
+            slowReleased = released.wait_for(std::chrono::seconds(5)) ==
+                           std::future_status::ready;
+        }
+        item.converted.assign(item.id.begin(), item.id.end());
+        return item.id == "7" ? BatchTranscoder::Outcome::Skipped
+                              : BatchTranscoder::Outcome::Converted;
+    });
+
+    std::multiset<std::string> seen;
+    size_t failed = 0, skipped = 0;
+    bool ok = true, paused = false, releaseSent = false;
+    batch.Start();
+    // Nothing taken yet: no more than a window of instances may start.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ok &= runs.load() > 0 && runs.load() <= static_cast<int>(PipelineWindow(pool));
+    // ...and waiting for the reader must not hold a pool worker.
+    ok &= pool.ActiveWorkers() == 0;
+    for (;;) {
+        std::vector<BatchTranscoder::Item> items;
+        const bool more = batch.Take(items, 16, std::chrono::milliseconds(100));
+        for (const BatchTranscoder::Item& item : items) {
+            seen.insert(item.id);
+            failed += item.outcome == BatchTranscoder::Outcome::Failed ? 1 : 0;
+            skipped += item.outcome == BatchTranscoder::Outcome::Skipped ? 1 : 0;
+            ok &= item.outcome != BatchTranscoder::Outcome::Converted ||
+                  std::string(item.converted.begin(), item.converted.end()) == item.id;
+        }
+        if (!paused && seen.size() >= 50) {
+            batch.Pause();
+            paused = true;
+            batch.Start();
+        }
+        if (!releaseSent && seen.size() >= 100 + 3 * PipelineWindow(pool)) {
+            release.set_value();
+            releaseSent = true;
+        }
+        if (!more && batch.Unstarted() == 0) {
+            break;
+        }
+        if (!more) {
+            batch.Start();
+        }
+    }
+    const std::set<std::string> unique(seen.begin(), seen.end());
+    ok &= seen.size() == ids.size() && unique.size() == ids.size() &&
+          failed == 2 && skipped == 1 && runs == static_cast<int>(ids.size()) &&
+          slowReleased;
+    printf("%-40s batch transcoder -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// The effort policy takes the highest effort whose predicted encode fits the
+// latency or throughput target, drops it while frames back up beyond the
+// thread budget, and follows measured encode rates.
+static bool VerifyEffortPolicy() {
+    LoadTracker tracker(4, false);
+    EffortPolicy::Options options;
+    options.minEffort = 1;
+    options.threadBudget = 4;
+    options.load = &tracker;
+    bool ok = true;
+
+    {
+        EffortPolicy off(options);
+        ok &= !off.Enabled() && off.Choose(20000000, 2, 1, 1, 7) == 7;
+    }
+
+    options.latencyMs = 150.0;
+    EffortPolicy latency(options);
+    const int small = latency.Choose(256 * 256, 2, 1, 1, 7);      // MR slice
+    const int medium = latency.Choose(512 * 512, 2, 1, 1, 7);     // CT slice
+    const int large = latency.Choose(4000 * 5000, 2, 1, 1, 7);    // mammogram
+    ok &= small == 7 && medium == 7 && large == 1;
+    {
+        // Sixteen frames in flight on four threads: each gets a quarter.
+        std::vector<std::unique_ptr<LoadTracker::Scope>> busy;
+        for (int i = 0; i < 4; ++i) {
+            busy.push_back(std::make_unique<LoadTracker::Scope>(tracker, 4));
+        }
+        const int loaded = latency.Choose(512 * 512, 2, 1, 1, 7);
+        ok &= loaded < medium && loaded >= 1;
+    }
+    ok &= latency.Choose(512 * 512, 2, 1, 1, 7) == medium;
+
+    // Encodes at effort 7 turn out 10x slower than expected: the estimate
+    // follows, unmeasured efforts are rescaled with it, and effort drops.
+    const double prior = latency.CostPerSample(7);
+    for (int i = 0; i < 50; ++i) {
+        latency.Record(7, 512 * 512, 10.0 * prior * 512 * 512 / 1e6);
+    }
+    ok &= latency.CostPerSample(7) > 9.0 * prior &&
+          latency.CostPerSample(6) > latency.CostPerSample(5) &&
+          latency.Choose(512 * 512, 2, 1, 1, 7) < medium;
+
+    // Load, then idle: effort 7 measured 10x slow drops it, the lower effort
+    // chosen instead measures at its usual cost, and once effort 7 has gone
+    // unmeasured for a few half-lives its estimate decays back and it is
+    // chosen again.
+    options.halfLife = std::chrono::milliseconds(50);
+    EffortPolicy recovering(options);
+    const double prior7 = recovering.CostPerSample(7);
+    const double prior5 = recovering.CostPerSample(5);
+    for (int i = 0; i < 50; ++i) {
+        recovering.Record(7, 512 * 512, 10.0 * prior7 * 512 * 512 / 1e6);
+    }
+    const int loadedEffort = recovering.Choose(512 * 512, 2, 1, 1, 7);
+    for (int i = 0; i < 50; ++i) {
+        recovering.Record(5, 512 * 512, prior5 * 512 * 512 / 1e6);
+    }
+    ok &= loadedEffort < medium && recovering.Choose(512 * 512, 2, 1, 1, 7) < medium;
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    ok &= recovering.CostPerSample(7) < 1.1 * prior7 &&
+          recovering.Choose(512 * 512, 2, 1, 1, 7) == medium;
+    options.halfLife = EffortPolicy::Options().halfLife;
+
+    options.latencyMs = 0.0;
+    options.throughputMBps = 100.0;
+    EffortPolicy throughput(options);
+    const int effort = throughput.Choose(512 * 512, 2, 1, 1, 7);
+    const double rate = 4.0 * 2.0 / throughput.CostPerSample(effort) * 1e3;
+    ok &= effort > 1 && effort < 7 && rate >= 100.0 &&
+          4.0 * 2.0 / throughput.CostPerSample(effort + 1) * 1e3 < 100.0;
+
+    printf("%-40s effort policy -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Profiles match on Modality, SOP Class and frame size in order, inherit the
+// top-level settings, and are encoded lossy only for requesters accepting
+// JPEG XL (.112); lossless output is labelled .112 when .110 is not accepted.
+static bool VerifyEncodeProfiles() {
+    const char* json = R"({"OrthancJxl": {
+        "Mode": "ProgressiveLossless", "Effort": 7,
+        "Profiles": [
+            {"Name": "wan-cr", "Modalities": ["CR", "DX"], "MinMegapixels": 4,
+             "Mode": "ProgressiveVarDCT", "Distance": 1.5, "Effort": 5},
+            {"Name": "sc", "SopClasses": ["1.2.840.10008.5.1.4.1.1.7"], "Effort": 3}
+        ]}})";
+    const PluginConfig config = PluginConfig::Parse(json);
+    bool ok = config.profiles.size() == 2;
+    if (!ok) {
+        printf("%-40s encode profiles -> FAIL\n", "synthetic");
+        return false;
+    }
+
+    const EncodeProfile* wan = config.MatchProfile("CR", "1.2.3", 3000, 2500);
+    const EncodeProfile* small = config.MatchProfile("CR", "1.2.3", 1000, 1000);
+    const EncodeProfile* sc = config.MatchProfile("OT", "1.2.840.10008.5.1.4.1.1.7", 640, 480);
+    ok &= wan == &config.profiles[0] && small == nullptr && sc == &config.profiles[1];
+    ok &= sc->encodeOptions.mode == EncodeMode::ProgressiveLossless &&
+          sc->encodeOptions.effort == 3;
+
+    const PluginConfig lossy = config.ForTarget(wan, true, true);
+    const PluginConfig lossless = config.ForTarget(wan, false, true);
+    const PluginConfig only112 = config.ForTarget(small, true, false);
+    ok &= lossy.EncodesLossy() && lossy.encodeOptions.distance == 1.5f &&
+          lossy.encodeOptions.effort == 5;
+    ok &= !lossless.EncodesLossy() &&
+          lossless.encodeOptions.mode == EncodeMode::ProgressiveLossless &&
+          lossless.encodeOptions.effort == 5 &&
+          lossless.losslessTransferSyntax == TS_JPEG_XL_LOSSLESS;
+    ok &= !only112.EncodesLossy() && only112.encodeOptions.effort == 7 &&
+          only112.losslessTransferSyntax == TS_JPEG_XL;
+
+    // Cached results are tied to the profiles too.
+    ok &= config.OutputFingerprint() != PluginConfig::Default().OutputFingerprint();
+    printf("%-40s encode profiles -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Orthanc's own settings are read whether or not the OrthancJxl section is
+// present: staged replacements go under its StorageDirectory and keep its
+// declared user metadata and attachments.
+static bool VerifyOrthancSettings() {
+    const char* json = R"({"StorageDirectory": "/var/lib/orthanc/db",
+        "HttpDescribeErrors": false,
+        "UserMetadata": {"Reviewed": 1024},
+        "UserContentType": {"Report": 1025}})";
+    const PluginConfig config = PluginConfig::Parse(json);
+    bool ok = config.backgroundDirectory == "/var/lib/orthanc/db/jxl-ingest" &&
+              config.transcodedCacheDirectory == "/var/lib/orthanc/db/jxl-cache" &&
+              !config.httpDescribeErrors;
+    ok &= config.userMetadata == std::vector<std::string>{"Reviewed"} &&
+          config.userAttachments == std::vector<std::string>{"Report"};
+    printf("%-40s orthanc settings -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// The decoded frame cache evicts least recently used frames to stay within
+// its byte bound, keys each frame by its own bitstream, and stays consistent
+// under concurrent lookups and inserts.
+static bool VerifyDecodedFrameCache() {
+    constexpr size_t kFrameBytes = 64 * 1024;
+    auto makeFrame = [](uint8_t fill) {
+        auto frame = std::make_shared<DecodedFrame>();
+        frame->info.width = 256;
+        frame->info.height = 256;
+        frame->pixels.assign(kFrameBytes, fill);
+        return std::shared_ptr<const DecodedFrame>(std::move(frame));
+    };
+    const uint8_t bits[4][8] = {{1}, {2}, {3}, {4}};
+    std::string keys[4];
+    for (uint32_t i = 0; i < 4; ++i) {
+        keys[i] = DecodedFrameCache::MakeKey("1.2.3|100|0", i, bits[i], sizeof(bits[i]));
+    }
+
+    // Room for three frames plus bookkeeping, not four.
+    DecodedFrameCache cache(kFrameBytes * 7 / 2);
+    for (int i = 0; i < 3; ++i) {
+        cache.Insert(keys[i], makeFrame(static_cast<uint8_t>(i)));
+    }
+    bool ok = cache.Find(keys[0]) != nullptr;     // 0 is now the most recent
+    cache.Insert(keys[3], makeFrame(3));          // evicts 1, the least recent
+    ok &= cache.Contains(keys[0]) && !cache.Contains(keys[1]) &&
+          cache.Contains(keys[2]) && cache.Contains(keys[3]);
+    DecodedFrameCache::Stats stats = cache.GetStats();
+    ok &= stats.entries == 3 && stats.evictions == 1 && stats.bytes <= cache.Capacity();
+    ok &= stats.hits == 1 && stats.misses == 0;
+
+    // A frame larger than the whole cache is not kept.
+    auto huge = std::make_shared<DecodedFrame>();
+    huge->pixels.resize(cache.Capacity());
+    const std::string hugeKey = DecodedFrameCache::MakeKey("1.2.3|100|0", 9, bits[0], 8);
+    cache.Insert(hugeKey, huge);
+    ok &= !cache.Contains(hugeKey) && cache.GetStats().entries == 3;
+
+    // Same instance key and frame, different bitstream: a different entry.
+    const uint8_t changed[8] = {1, 1};
+    ok &= DecodedFrameCache::MakeKey("1.2.3|100|0", 0, changed, sizeof(changed)) != keys[0];
+    ok &= DecodedFrameCache::MakeKey("", 0, bits[0], sizeof(bits[0])).empty();
+
+    // Concurrent scrolling over more frames than fit: hits must return the
+    // frame stored under that key, and the bound must hold throughout.
+    DecodedFrameCache shared(kFrameBytes * 5);
+    std::vector<std::string> sharedKeys;
+    uint8_t frameBits[16][4] = {};
+    for (uint32_t i = 0; i < 16; ++i) {
+        frameBits[i][0] = static_cast<uint8_t>(i);
+        sharedKeys.push_back(DecodedFrameCache::MakeKey("4.5.6|1|0", i, frameBits[i], 4));
+    }
+    std::atomic<bool> consistent{true};
+    std::atomic<uint64_t> finds{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t] {
+            for (int op = 0; op < 2000; ++op) {
+                const size_t i = static_cast<size_t>(op * 7 + t * 3) % sharedKeys.size();
+                if (auto frame = shared.Find(sharedKeys[i])) {
+                    if (frame->pixels.size() != kFrameBytes || frame->pixels[0] != i) {
+                        consistent = false;
+                    }
+                } else {
+                    shared.Insert(sharedKeys[i], makeFrame(static_cast<uint8_t>(i)));
+                }
+                finds.fetch_add(1, std::memory_order_relaxed);
+                if (shared.GetStats().bytes > shared.Capacity()) {
+                    consistent = false;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    stats = shared.GetStats();
+    ok &= consistent && stats.hits + stats.misses == finds && stats.entries <= 5;
+
+    printf("%-40s decoded frame cache -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Prefetch follows the scroll direction, stays within its in-flight bound,
+// queues nothing under foreground load, never leaks a reserved frame when
+// the frame source throws, and waits for queued decodes when destroyed.
+static bool VerifyFramePrefetcher() {
+    constexpr uint32_t kFrames = 10;
+    std::vector<std::vector<uint8_t>> bitstreams;
+    for (uint32_t f = 0; f < kFrames; ++f) {
+        const std::vector<uint8_t> pixels(16 * 16, static_cast<uint8_t>(f * 20));
+        bitstreams.push_back(JxlCodec::Encode(pixels.data(), 16, 16, PixelFormat::Gray8,
+                                              EncodeOptions::Lossless(1)));
+    }
+    const FramePrefetcher::FrameSource source = [&](uint32_t n) {
+        return ByteView{bitstreams[n].data(), bitstreams[n].size()};
+    };
+    auto cached = [&](const DecodedFrameCache& cache, const char* instance, uint32_t n) {
+        return cache.Contains(DecodedFrameCache::MakeKey(instance, n, bitstreams[n].data(),
+                                                         bitstreams[n].size()));
+    };
+    auto settle = [](const FramePrefetcher& prefetcher) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        FramePrefetcher::Stats stats = prefetcher.GetStats();
+        while (stats.completed + stats.dropped < stats.queued &&
+               std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            stats = prefetcher.GetStats();
+        }
+        return stats;
+    };
+
+    ThreadPool pool(2);
+    LoadTracker idle(8, true);
+    DecodedFrameCache cache(16u << 20);
+    bool ok = true;
+    {
+        FramePrefetcher prefetcher(pool, cache, idle, 3, 16);
+        prefetcher.OnFrameViewed("fwd", 2, kFrames, false, 0, source);   // first view: forward
+        prefetcher.OnFrameViewed("back", 6, kFrames, false, 0, source);
+        prefetcher.OnFrameViewed("back", 5, kFrames, false, 0, source);  // scrolled back
+        const FramePrefetcher::Stats stats = settle(prefetcher);
+        ok &= stats.queued == 9 && stats.completed == 9;
+        ok &= cached(cache, "fwd", 3) && cached(cache, "fwd", 5) &&
+              !cached(cache, "fwd", 1) && !cached(cache, "fwd", 6);
+        ok &= cached(cache, "back", 4) && cached(cache, "back", 2) &&
+              cached(cache, "back", 9) && !cached(cache, "back", 1);
+    }
+
+    // Foreground work filling half the budget: nothing is queued.
+    {
+        LoadTracker busy(4, true);
+        LoadTracker::Scope foreground(busy, 4);
+        FramePrefetcher prefetcher(pool, cache, busy, 3, 16);
+        prefetcher.OnFrameViewed("busy", 0, kFrames, false, 0, source);
+        ok &= prefetcher.GetStats().queued == 0 && !cached(cache, "busy", 1);
+    }
+
+    // A throwing source must not leave its frame reserved: with room for one
+    // decode in flight, the next view still queues one.
+    {
+        FramePrefetcher prefetcher(pool, cache, idle, 1, 1);
+        bool threw = false;
+        try {
+            prefetcher.OnFrameViewed("throws", 0, kFrames, false, 0,
+                                     [](uint32_t) -> ByteView { throw std::runtime_error("x"); });
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        prefetcher.OnFrameViewed("retry", 0, kFrames, false, 0, source);
+        ok &= threw && prefetcher.GetStats().queued == 1;
+    }
+
+    // maxInFlight bounds the queue, and destruction waits for it to drain.
+    {
+        ThreadPool single(1);
+        std::promise<void> started, release;
+        std::shared_future<void> gate = release.get_future().share();
+        single.Enqueue([&started, gate] {
+            started.set_value();
+            gate.wait();
+        });
+        started.get_future().wait();   // the only worker is now blocked
+        auto prefetcher = std::make_unique<FramePrefetcher>(single, cache, idle, 3, 1);
+        prefetcher->OnFrameViewed("drain", 0, kFrames, false, 0, source);
+        ok &= prefetcher->GetStats().queued == 1;
+        std::atomic<bool> destroyed{false};
+        std::thread closer([&] {
+            prefetcher.reset();
+            destroyed = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ok &= !destroyed;
+        release.set_value();
+        closer.join();
+        ok &= destroyed;
+    }
+
+    printf("%-40s frame prefetcher -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Adaptive sizing splits the thread budget over the frames in flight, its
+// own included, and gives the whole budget back once the load clears.
+static bool VerifyLoadTracker() {
+    LoadTracker tracker(16, true);
+    bool ok = LoadTracker::Scope(tracker, 1).FrameThreads(1) == 16;
+    {
+        LoadTracker::Scope multiFrame(tracker, 4);
+        ok &= multiFrame.FrameThreads(1) == 4;
+        ok &= LoadTracker::Scope(tracker, 1).FrameThreads(1) == 3;   // 16 / (4 + 1)
+        std::vector<std::unique_ptr<LoadTracker::Scope>> ingest;
+        for (int i = 0; i < 4; ++i) {
+            ingest.push_back(std::make_unique<LoadTracker::Scope>(tracker, 4));
+        }
+        ok &= tracker.InFlightFrames() == 20 && tracker.InFlightTranscodes() == 5;
+        ok &= LoadTracker::Scope(tracker, 1).FrameThreads(1) == 1;
+    }
+    ok &= tracker.InFlightFrames() == 0 && tracker.InFlightTranscodes() == 0;
+    // A call's weight is capped at the budget, so a huge instance cannot
+    // starve later calls below one thread per frame for longer than it runs.
+    {
+        LoadTracker::Scope huge(tracker, 1000);
+        ok &= huge.FrameThreads(1) == 1 && tracker.InFlightFrames() == 16;
+    }
+    ok &= LoadTracker::Scope(tracker, 1).FrameThreads(1) == 16;
+
+    LoadTracker fixed(16, false);
+    LoadTracker::Scope busy(fixed, 8);
+    ok &= fixed.InFlightFrames() == 8 && LoadTracker::Scope(fixed, 1).FrameThreads(5) == 5;
+
+    printf("%-40s load tracker -> %s\n", "synthetic", ok ? "PASS" : "FAIL");
+    return ok;
+}
+
+// Every layout kernel set the CPU supports must match the reference loops,
+// including lengths that leave a partial vector.
+static bool VerifyLayoutKernels() {
+    bool ok = true;
+    for (KernelIsa isa : {KernelIsa::Scalar, KernelIsa::Sse41, KernelIsa::Avx2, KernelIsa::Neon}) {
+        const LayoutKernels* k = KernelsFor(isa);
+        if (!k) {
+            continue;
+        }
+        bool isaOk = true;
+        // 3 channels take the vector paths; 6 is past the kernels' plane limit.
+        for (int channels : {3, 6}) {
+            for (int bytesPerSample : {1, 2}) {
+                for (size_t pixels : {size_t{1}, size_t{15}, size_t{33}, size_t{1027}}) {
+                    std::vector<uint8_t> planar(pixels * channels * bytesPerSample);
+                    for (size_t i = 0; i < planar.size(); ++i) {
+                        planar[i] = static_cast<uint8_t>(i * 131 + 7);
+                    }
+                    std::vector<const uint8_t*> planes(channels);
+                    for (int c = 0; c < channels; ++c) {
+                        planes[c] = planar.data() + c * pixels * bytesPerSample;
+                    }
+                    std::vector<uint8_t> out(planar.size());
+                    k->interleave(planes.data(), pixels, channels, bytesPerSample, out.data());
+                    isaOk &= (out == PlanarToInterleaved(planar.data(), pixels, channels, bytesPerSample));
+                }
+            }
+        }
+        printf("%-40s layout kernels -> %s\n", k->name, isaOk ? "PASS" : "FAIL");
+        ok &= isaOk;
+    }
+    return ok;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         fprintf(stderr, "Usage: %s <dicom_file> [<dicom_file> ...]\n", argv[0]);
@@ -147,6 +1396,9 @@ int main(int argc, char* argv[]) {
 
     unsigned hw = std::thread::hardware_concurrency();
     ThreadPool pool(hw == 0 ? 1u : hw);
+    JxlCodec::SetSharedPool(&pool);  // as the plugin does
+    BufferPool buffers(PluginConfig::Default().bufferPoolBytes);
+    BufferPool::SetShared(&buffers);
 
     int failures = 0;
     for (int i = 1; i < argc; ++i) {
@@ -160,6 +1412,18 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    printf("\n");
+    for (int i = 1; i < argc; ++i) {
+        try {
+            if (!VerifyStreamingEncode(argv[i], pool)) {
+                ++failures;
+            }
+        } catch (const std::exception& e) {
+            printf("%-40s  streaming ERROR: %s\n", argv[i], e.what());
+            ++failures;
+        }
+    }
+
     // Lossy transfer-syntax labelling check (uses the first input file).
     printf("\n");
     try {
@@ -171,6 +1435,109 @@ int main(int argc, char* argv[]) {
         ++failures;
     }
 
+    printf("\n");
+    for (int i = 1; i < argc; ++i) {
+        try {
+            if (!VerifyBitsStoredEncoding(argv[i], pool)) {
+                ++failures;
+            }
+        } catch (const std::exception& e) {
+            printf("%-40s  bits-stored ERROR: %s\n", argv[i], e.what());
+            ++failures;
+        }
+    }
+    for (int i = 1; i < argc; ++i) {
+        try {
+            if (!VerifyRecompressJxl(argv[i], pool)) {
+                ++failures;
+            }
+        } catch (const std::exception& e) {
+            printf("%-40s  recompress ERROR: %s\n", argv[i], e.what());
+            ++failures;
+        }
+    }
+    try {
+        if (!VerifySignedReducedDepth()) {
+            ++failures;
+        }
+    } catch (const std::exception& e) {
+        printf("signed-reduced-depth  ERROR: %s\n", e.what());
+        ++failures;
+    }
+
+    printf("\n");
+    for (int i = 1; i < argc; ++i) {
+        try {
+            if (!VerifyPreview(argv[i], pool)) {
+                ++failures;
+            }
+        } catch (const std::exception& e) {
+            printf("%-40s  preview ERROR: %s\n", argv[i], e.what());
+            ++failures;
+        }
+    }
+    try {
+        if (!VerifyPreviewWindowing()) {
+            ++failures;
+        }
+    } catch (const std::exception& e) {
+        printf("preview-windowing  ERROR: %s\n", e.what());
+        ++failures;
+    }
+
+    printf("\n");
+    if (!VerifyFragmentGrouping()) {
+        ++failures;
+    }
+    if (!VerifyLatencyHistogram()) {
+        ++failures;
+    }
+    if (!VerifyLoadTracker()) {
+        ++failures;
+    }
+    if (!VerifyDecodedFrameCache()) {
+        ++failures;
+    }
+    if (!VerifyFramePrefetcher()) {
+        ++failures;
+    }
+    if (!VerifyLayoutKernels()) {
+        ++failures;
+    }
+    if (!VerifyBufferPool()) {
+        ++failures;
+    }
+    if (!VerifyTraceRecorder()) {
+        ++failures;
+    }
+    if (!VerifyIngestQueue()) {
+        ++failures;
+    }
+    if (!VerifyStagedRecovery()) {
+        ++failures;
+    }
+    if (!VerifyTranscodedCache()) {
+        ++failures;
+    }
+    if (!VerifyRangeHeader()) {
+        ++failures;
+    }
+    if (!VerifyOrderedPipeline()) {
+        ++failures;
+    }
+    if (!VerifyBatchTranscoder()) {
+        ++failures;
+    }
+    if (!VerifyEffortPolicy()) {
+        ++failures;
+    }
+    if (!VerifyEncodeProfiles()) {
+        ++failures;
+    }
+    if (!VerifyOrthancSettings()) {
+        ++failures;
+    }
+
     printf("\n%s\n", failures == 0 ? "ALL PASSED" : "FAILURES PRESENT");
     return failures == 0 ? 0 : 1;
 }
@@ -6,13 +6,20 @@
  * real transcode path). Reports wall time and instances/sec so we can see how
  * import speed scales and pick an ingest concurrency.
  *
+ * A final section measures what the single-parse transcode API saves: the old
+ * plugin flow parsed each instance once to read its transfer syntax and again
+ * inside the transcode, the current one hands the parsed handler through.
+ *
  * Usage: throughput <dicom_file> [copies]
  */
 
 #include "../src/transcode.h"
 #include "../src/dicom_handler.h"
+#include "../src/jxl_codec.h"
 #include "../src/config.h"
 #include "../src/thread_pool.h"
+#include "../src/buffer_pool.h"
+#include "../src/transfer_syntax.h"
 
 #include <atomic>
 #include <chrono>
@@ -49,7 +56,10 @@ int main(int argc, char* argv[]) {
 
     const unsigned hw = std::thread::hardware_concurrency();
     ThreadPool pool(hw == 0 ? 1u : hw);
+    JxlCodec::SetSharedPool(&pool);  // as the plugin does
     PluginConfig config = PluginConfig::Default();
+    BufferPool buffers(config.bufferPoolBytes);
+    BufferPool::SetShared(&buffers);
 
     const double mbIn = (info.FrameSizeBytes() * (double)info.numberOfFrames) / (1024.0 * 1024.0);
     printf("Input: %ux%u f=%u spp=%u ba=%u  (%.2f MB native/instance)\n",
@@ -103,5 +113,68 @@ int main(int argc, char* argv[]) {
         }
         printf("\n");
     }
+
+    // Parse overhead: compare the double-parse flow with the single-parse
+    // overload, sequentially so the difference is not hidden by concurrency.
+    printf("== parse overhead (sequential, %d instances) ==\n", copies);
+    printf("%-28s %12s %14s\n", "Flow", "Wall (s)", "ms/instance");
+    auto timeFlow = [&](const char* name, auto&& fn) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < copies; ++i) {
+            fn();
+        }
+        auto t1 = std::chrono::high_resolution_clock::now();
+        double secs = std::chrono::duration<double>(t1 - t0).count();
+        printf("%-28s %12.3f %14.3f\n", name, secs, 1000.0 * secs / copies);
+        return secs;
+    };
+    double parseOnly = timeFlow("parse only", [&] {
+        DicomHandler h(dicom.data(), dicom.size());
+        (void)h.GetTransferSyntax();
+    });
+    double twoParse = timeFlow("parse + TranscodeToJxl(buf)", [&] {
+        DicomHandler h(dicom.data(), dicom.size());
+        (void)h.GetTransferSyntax();
+        (void)TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+    });
+    double oneParse = timeFlow("TranscodeToJxl(handler)", [&] {
+        DicomHandler h(dicom.data(), dicom.size());
+        (void)h.GetTransferSyntax();
+        (void)TranscodeToJxl(h, config, pool);
+    });
+    printf("single-parse saves %.3f ms/instance (%.1f%%); one parse costs %.3f ms\n\n",
+           1000.0 * (twoParse - oneParse) / copies,
+           twoParse > 0 ? 100.0 * (twoParse - oneParse) / twoParse : 0.0,
+           1000.0 * parseOnly / copies);
+
+    // Steady-state libjxl allocation behaviour: warm the per-thread
+    // encoders/decoders and their arenas, then count what a further
+    // encode + decode of every copy costs.
+    printf("== codec reuse (steady state, %d encode+decode) ==\n", copies);
+    auto roundtrip = [&] {
+        auto r = TranscodeToJxl(dicom.data(), dicom.size(), config, pool);
+        (void)TranscodeFromJxl(r.dicom.data(), r.dicom.size(), TS_LITTLE_ENDIAN_EXPLICIT, pool);
+    };
+    roundtrip();
+    const CodecStats before = JxlCodec::Stats();
+    const BufferPool::Stats buffersBefore = buffers.GetStats();
+    for (int i = 0; i < copies; ++i) {
+        roundtrip();
+    }
+    const CodecStats after = JxlCodec::Stats();
+    const BufferPool::Stats buffersAfter = buffers.GetStats();
+    const uint64_t created = (after.encodersCreated - before.encodersCreated) +
+                             (after.decodersCreated - before.decodersCreated);
+    const uint64_t allocs = after.allocations - before.allocations;
+    const uint64_t mallocs = after.systemAllocations - before.systemAllocations;
+    printf("codecs created %llu, reused %llu\n", (unsigned long long)created,
+           (unsigned long long)(after.codecsReused - before.codecsReused));
+    printf("libjxl allocations %.1f/instance, %.1f/instance reached malloc (%.1f%% arena hits)\n",
+           (double)allocs / copies, (double)mallocs / copies,
+           allocs ? 100.0 * (allocs - mallocs) / allocs : 0.0);
+    printf("frame buffers: %llu pooled, %llu allocated (%zu idle, %.1f MB)\n\n",
+           (unsigned long long)(buffersAfter.hits - buffersBefore.hits),
+           (unsigned long long)(buffersAfter.misses - buffersBefore.misses),
+           buffersAfter.buffers, buffersAfter.bytes / (1024.0 * 1024.0));
     return 0;
 }